@@ -20,7 +20,8 @@ static bool initializeDeviceRequired;
 static bool setPasskeyRequired;
 static bool changeBleAdvertisingModeRequired;
 static bool deleteAllBleBondsDeviceRequired;
-static int bleAdvertiseToAllTimerFd = -1;
+static void BleAdvertiseToAllTimeoutEventHandler(Timer *timer);
+static Timer bleAdvertiseToAllTimer = {.timerHandler = &BleAdvertiseToAllTimeoutEventHandler};
 
 static BleControlMessageProtocol_BleAdvertisingMode currentAdvertisingMode;
 static BleControlMessageProtocol_BleAdvertisingMode desiredAdvertisingMode;
@@ -245,8 +246,7 @@ static void BleDeviceUpEventHandler(MessageProtocol_CategoryId categoryId,
     setPasskeyRequired = false;
     changeBleAdvertisingModeRequired = false;
     deleteAllBleBondsDeviceRequired = false;
-    struct timespec disabled = {0, 0};
-    SetTimerFdToPeriod(bleAdvertiseToAllTimerFd, &disabled);
+    DisarmTimer(&bleAdvertiseToAllTimer);
 
     // Start to initialize nRF52.
     SendInitializeBleDeviceRequest();
@@ -261,8 +261,7 @@ static void BleDeviceConnectedEventHandler(MessageProtocol_CategoryId categoryId
         Log_Debug("INFO: Received BLE connection event.\n");
         if (currentAdvertisingMode == BleControlMessageProtocol_AdvertisingToAllMode) {
             Log_Debug("INFO: Disabling advertising to all.\n");
-            struct timespec disabled = {0, 0};
-            SetTimerFdToPeriod(bleAdvertiseToAllTimerFd, &disabled);
+            DisarmTimer(&bleAdvertiseToAllTimer);
             currentAdvertisingMode = BleControlMessageProtocol_AdvertisingToBondedDevicesMode;
         }
 
@@ -311,12 +310,8 @@ static void IdleHandler(void)
     }
 }
 
-static void BleAdvertiseToAllTimeoutEventHandler(EventData *eventData)
+static void BleAdvertiseToAllTimeoutEventHandler(Timer *timer)
 {
-    if (ConsumeTimerFdEvent(bleAdvertiseToAllTimerFd) != 0) {
-        return;
-    }
-
     Log_Debug("INFO: BLE device advertising to all timeout reached.\n");
     SendChangeBleAdvertisingModeRequest(BleControlMessageProtocol_AdvertisingToBondedDevicesMode);
 }
@@ -337,16 +332,6 @@ int BleControlMessageProtocol_Init(BleControlMessageProtocol_StateChangeHandlerT
     bleStateChangeHandler = handler;
     GenerateRandomBleDeviceName();
 
-    // Set up BLE advertising to all timer, for later use.
-    struct timespec disabled = {0, 0};
-    static EventData bleAdvertiseToAllTimeoutEventData = {
-        .eventHandler = &BleAdvertiseToAllTimeoutEventHandler};
-    bleAdvertiseToAllTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &disabled, &bleAdvertiseToAllTimeoutEventData, EPOLLIN);
-    if (bleAdvertiseToAllTimerFd < 0) {
-        return -1;
-    }
-
     MessageProtocol_RegisterEventHandler(MessageProtocol_BleControlCategoryId,
                                          BleControlMessageProtocol_BleDeviceUpEventId,
                                          BleDeviceUpEventHandler);
@@ -374,7 +359,7 @@ int BleControlMessageProtocol_Init(BleControlMessageProtocol_StateChangeHandlerT
 
 void BleControlMessageProtocol_Cleanup(void)
 {
-    CloseFdAndPrintError(bleAdvertiseToAllTimerFd, "BleAdvertiseToAllTimer");
+    DisarmTimer(&bleAdvertiseToAllTimer);
 }
 
 int BleControlMessageProtocol_AllowNewBleBond(struct timespec *timeout)
@@ -386,7 +371,7 @@ int BleControlMessageProtocol_AllowNewBleBond(struct timespec *timeout)
 
     // Start (or restart) timer, after which the BLE device will start advertising to bonded
     // devices.
-    SetTimerFdToSingleExpiry(bleAdvertiseToAllTimerFd, timeout);
+    SetTimerToSingleExpiry(&bleAdvertiseToAllTimer, timeout);
     SendChangeBleAdvertisingModeRequest(BleControlMessageProtocol_AdvertisingToAllMode);
     return 0;
 }
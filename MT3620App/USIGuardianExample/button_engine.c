@@ -0,0 +1,208 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "button_engine.h"
+
+// Buttons cannot interrupt the application, so they are polled. While every button is idle they
+// are polled slowly; a change of value switches to fast polling until it has been debounced, and
+// a pressed button is polled at an intermediate rate to catch its release.
+static const uint32_t idlePollPeriodMs = 100;
+static const uint32_t debouncePollPeriodMs = 5;
+static const uint32_t pressedPollPeriodMs = 20;
+
+// A sample must be stable for this long before it is reported.
+static const uint32_t debounceIntervalMs = 20;
+
+// A button which has been pressed for this long is reported as held.
+static const uint32_t heldThresholdMs = 3000;
+
+static void PollTimerEventHandler(Timer *timer);
+static Timer pollTimer = {.timerHandler = &PollTimerEventHandler};
+static uint32_t currentPollPeriodMs = 0;
+
+static Button *buttons = NULL;
+
+static uint64_t GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static int SetPollPeriod(uint32_t periodMs)
+{
+    if (periodMs == currentPollPeriodMs) {
+        return 0;
+    }
+
+    struct timespec period = {.tv_sec = periodMs / 1000, .tv_nsec = (periodMs % 1000) * 1000000};
+    if (SetTimerToPeriod(&pollTimer, &period) != 0) {
+        return -1;
+    }
+
+    currentPollPeriodMs = periodMs;
+    return 0;
+}
+
+/// <summary>
+///     Selects the poll period required by the button which needs the fastest polling.
+/// </summary>
+static void UpdatePollPeriod(void)
+{
+    uint32_t periodMs = idlePollPeriodMs;
+    for (Button *button = buttons; button != NULL; button = button->next) {
+        if (button->isDebouncing) {
+            periodMs = debouncePollPeriodMs;
+            break;
+        }
+        if (button->isPressed) {
+            periodMs = pressedPollPeriodMs;
+        }
+    }
+
+    if (buttons == NULL) {
+        DisarmTimer(&pollTimer);
+        currentPollPeriodMs = 0;
+        return;
+    }
+
+    SetPollPeriod(periodMs);
+}
+
+static void HoldTimerEventHandler(Timer *timer)
+{
+    Button *button = (Button *)((uint8_t *)timer - offsetof(Button, holdTimer));
+
+    // The button may have been released since it was last polled, in which case the release is
+    // reported by the next poll instead.
+    GPIO_Value_Type value;
+    if (GPIO_GetValue(button->fd, &value) != 0) {
+        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+        button->eventHandler(button, ButtonEvent_Error);
+        return;
+    }
+
+    if (button->isPressed && !button->isHeld && value == GPIO_Value_Low) {
+        button->isHeld = true;
+        button->eventHandler(button, ButtonEvent_Held);
+    }
+}
+
+/// <summary>
+///     Starts the hold deadline of a button which has just been sampled going down. It may have
+///     gone down up to one idle poll period earlier, so the deadline is that much shorter than
+///     the held threshold, and the held event is never later than the threshold after the press.
+/// </summary>
+static void ArmHoldTimer(Button *button)
+{
+    uint32_t delayMs = heldThresholdMs - idlePollPeriodMs;
+    struct timespec holdDelay = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000000};
+    SetTimerToSingleExpiry(&button->holdTimer, &holdDelay);
+}
+
+/// <summary>
+///     Reports the debounced value of a button.
+/// </summary>
+static void ReportStableValue(Button *button)
+{
+    if (button->stableValue == GPIO_Value_Low) {
+        button->isPressed = true;
+        button->isHeld = false;
+        button->eventHandler(button, ButtonEvent_Pressed);
+    } else if (button->isPressed) {
+        DisarmTimer(&button->holdTimer);
+        ButtonEvent event = button->isHeld ? ButtonEvent_ReleasedAfterHeld : ButtonEvent_Released;
+        button->isPressed = false;
+        button->isHeld = false;
+
+        button->eventHandler(button, event);
+    }
+}
+
+static void PollTimerEventHandler(Timer *timer)
+{
+    uint64_t nowMs = GetMonotonicMs();
+
+    Button *next;
+    for (Button *button = buttons; button != NULL; button = next) {
+        // The handler may unregister the button.
+        next = button->next;
+
+        GPIO_Value_Type value;
+        if (GPIO_GetValue(button->fd, &value) != 0) {
+            Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+            button->eventHandler(button, ButtonEvent_Error);
+            continue;
+        }
+
+        if (value != button->lastSample) {
+            button->lastSample = value;
+            button->lastChangeMs = nowMs;
+            button->isDebouncing = (value != button->stableValue);
+
+            // The hold deadline runs from the last time a released button was seen going down,
+            // so a glitch which does not become a press does not leave it running.
+            if (!button->isPressed) {
+                if (value == GPIO_Value_Low) {
+                    ArmHoldTimer(button);
+                } else {
+                    DisarmTimer(&button->holdTimer);
+                }
+            }
+        } else if (button->isDebouncing && nowMs - button->lastChangeMs >= debounceIntervalMs) {
+            button->isDebouncing = false;
+            button->stableValue = value;
+            ReportStableValue(button);
+        }
+    }
+
+    UpdatePollPeriod();
+}
+
+int ButtonEngine_Register(Button *button)
+{
+    if (button->fd < 0 || button->eventHandler == NULL) {
+        Log_Debug("ERROR: Could not register button: invalid fd or event handler.\n");
+        return -1;
+    }
+
+    // A button is released until it has been sampled otherwise.
+    button->holdTimer = (Timer){.timerHandler = &HoldTimerEventHandler};
+    button->lastChangeMs = GetMonotonicMs();
+    button->lastSample = GPIO_Value_High;
+    button->stableValue = GPIO_Value_High;
+    button->isDebouncing = false;
+    button->isPressed = false;
+    button->isHeld = false;
+
+    button->next = buttons;
+    buttons = button;
+
+    if (currentPollPeriodMs == 0 && SetPollPeriod(idlePollPeriodMs) != 0) {
+        buttons = button->next;
+        return -1;
+    }
+
+    return 0;
+}
+
+void ButtonEngine_Unregister(Button *button)
+{
+    for (Button **link = &buttons; *link != NULL; link = &(*link)->next) {
+        if (*link == button) {
+            *link = button->next;
+            button->next = NULL;
+            break;
+        }
+    }
+
+    DisarmTimer(&button->holdTimer);
+    UpdatePollPeriod();
+}
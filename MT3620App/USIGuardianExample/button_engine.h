@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "applibs_versions.h"
+#include <applibs/gpio.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+///     Button events.
+/// </summary>
+typedef enum {
+    /// <summary>The event when failing to get button state.</summary>
+    ButtonEvent_Error = -1,
+    /// <summary>No button event has occurred.</summary>
+    ButtonEvent_None = 0,
+    /// <summary>The event when button is pressed.</summary>
+    ButtonEvent_Pressed,
+    /// <summary>The event when button is released.</summary>
+    ButtonEvent_Released,
+    /// <summary>The event when button is being held.</summary>
+    ButtonEvent_Held,
+    /// <summary>The event when button is released after being held.</summary>
+    ButtonEvent_ReleasedAfterHeld
+} ButtonEvent;
+
+/// Forward declaration of the data type passed to the button handlers.
+struct Button;
+
+/// <summary>
+///     Function signature for button event handlers.
+/// </summary>
+/// <param name="button">The button which generated the event</param>
+/// <param name="event">The debounced event</param>
+typedef void (*ButtonEventHandler)(struct Button *button, ButtonEvent event);
+
+/// <summary>
+/// <para>A push button which is active low. Register it with <see cref="ButtonEngine_Register"
+/// />.</para>
+/// <para>Only the fd and eventHandler fields need to be populated; the remaining fields are
+/// managed by the button engine. The button must remain valid for as long as it is
+/// registered.</para>
+/// </summary>
+typedef struct Button {
+    /// <summary>GPIO file descriptor for the button, opened as an input.</summary>
+    int fd;
+    /// <summary>Function which is called when a debounced event occurs.</summary>
+    ButtonEventHandler eventHandler;
+    /// <summary>Next registered button.</summary>
+    struct Button *next;
+    /// <summary>Timer which detects that the button has been held.</summary>
+    Timer holdTimer;
+    /// <summary>Time in milliseconds when the last sample changed.</summary>
+    uint64_t lastChangeMs;
+    /// <summary>Value of the last sample.</summary>
+    GPIO_Value_Type lastSample;
+    /// <summary>Debounced value of the button.</summary>
+    GPIO_Value_Type stableValue;
+    /// <summary>Whether the last sample differs from the debounced value.</summary>
+    bool isDebouncing;
+    /// <summary>Whether the button is currently pressed.</summary>
+    bool isPressed;
+    /// <summary>Whether the button is currently held.</summary>
+    bool isHeld;
+} Button;
+
+/// <summary>
+/// <para>Adds a button to the button engine.</para>
+/// <para>The engine polls the buttons slowly while they are all idle and only polls quickly
+/// while a button is bouncing or pressed. Pressed and released events are reported after the
+/// button has been stable for the debounce interval. The held event is reported by a one-shot
+/// timer which starts when the button is first sampled down, no later than the held threshold
+/// after the press.</para>
+/// <para>The timer wheel must have been created with <see cref="CreateTimerWheelAndAddToEpoll"
+/// />.</para>
+/// </summary>
+/// <param name="button">The button; its fd and eventHandler must be populated</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ButtonEngine_Register(Button *button);
+
+/// <summary>
+///     Removes a button from the button engine. The button's fd is not closed.
+/// </summary>
+/// <param name="button">The button</param>
+void ButtonEngine_Unregister(Button *button);
@@ -32,4 +32,24 @@
 #define BUILD_USI_UART
 #define BUILD_USI_WIFISETUPBYBT
 #define BUILD_USI_PRIVATE_ETHERNET
-#define BUILD_USI_RS232_485
\ No newline at end of file
+#define BUILD_USI_RS232_485
+//#define BUILD_USI_MODBUS
+
+// The UART and RS232/485 ports are both driven by the serial port table in usi_serial.c.
+#if (defined(BUILD_USI_UART) || defined(BUILD_USI_RS232_485))
+#define BUILD_USI_SERIAL
+#endif
+
+// The Modbus RTU master polls the slaves in its table on the RS232/485 port and serves the
+// Modbus TCP gateway. It takes over the port, which then no longer carries lines to and from the
+// cloud, so it is only built when BUILD_USI_MODBUS is defined above, with BUILD_USI_RS232_485.
+// The gateway listens on TCP port 502, which must then be added to AllowedTcpServerPorts in
+// app_manifest.json; script/validate_manifest.ps1 checks this.
+#if (defined(BUILD_USI_MODBUS) && !defined(BUILD_USI_RS232_485))
+#error "BUILD_USI_MODBUS requires BUILD_USI_RS232_485"
+#endif
+
+// Each serial port can be bridged to a TCP client on the private Ethernet port.
+#if (defined(BUILD_USI_SERIAL) && defined(BUILD_USI_PRIVATE_ETHERNET))
+#define BUILD_USI_SERIAL_BRIDGE
+#endif
\ No newline at end of file
@@ -1,7 +1,7 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
-#define _GNU_SOURCE // required for asprintf
+#define _GNU_SOURCE // required for accept4
 #include <stdbool.h>
 #include <ctype.h>
 #include <string.h>
@@ -9,32 +9,38 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stddef.h>
+#include <time.h>
 
 #include <sys/socket.h>
 
 #include <applibs/log.h>
 
 #include "echo_tcp_server.h"
+#include "serial_framer.h"
+#include "modbus_rtu.h"
 
 EchoServer_ServerState *eth_ServerState = NULL;
 static char *sendToCloudPropertyName = "sendToCloud";
+static char *sendToBinaryPropertyName = "binary";
 
 // Support functions.
 static void HandleListenEvent(EventData *eventData);
-static void LaunchRead(EchoServer_ServerState *serverState);
-static void HandleClientReadEvent(EventData *eventData);
-static void LaunchWrite(EchoServer_ServerState *serverState);
-static void HandleClientWriteEvent(EventData *eventData);
+static void HandleClientEvent(EventData *eventData);
+static void HandleIdleTimerEvent(Timer *timer);
+static void CloseClient(EchoServer_Client *client);
+static int SendLineToClient(EchoServer_Client *client, const char *line);
 static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType);
 static void ReportError(const char *desc);
 static void StopServer(EchoServer_ServerState *serverState, EchoServer_StopReason reason);
 static EchoServer_ServerState *EventDataToServerState(EventData *eventData, size_t offset);
 
 EchoServer_ServerState *EchoServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
-                                         int backlogSize,
+                                         int backlogSize, size_t maxClients,
+                                         const struct timespec *idleTimeout,
                                          void (*shutdownCallback)(EchoServer_StopReason))
 {
-    EchoServer_ServerState *serverState = malloc(sizeof(*serverState));
+    EchoServer_ServerState *serverState =
+        calloc(1, sizeof(*serverState) + maxClients * sizeof(serverState->clients[0]));
     if (!serverState) {
         abort();
     }
@@ -43,14 +49,18 @@ EchoServer_ServerState *EchoServer_Start(int epollFd, in_addr_t ipAddr, uint16_t
     // subset of the resources are successfully allocated.
     serverState->epollFd = epollFd;
     serverState->listenFd = -1;
-    serverState->clientFd = -1;
     serverState->listenEvent.eventHandler = HandleListenEvent;
-    serverState->clientReadEvent.eventHandler = HandleClientReadEvent;
-    serverState->epollInEnabled = false;
-    serverState->clientWriteEvent.eventHandler = HandleClientWriteEvent;
-    serverState->epollOutEnabled = false;
-    serverState->txPayload = NULL;
+    serverState->idleTimeout = *idleTimeout;
+    serverState->nextClientId = 1;
     serverState->shutdownCallback = shutdownCallback;
+    serverState->maxClients = maxClients;
+    for (size_t i = 0; i < maxClients; ++i) {
+        EchoServer_Client *client = &serverState->clients[i];
+        client->server = serverState;
+        client->clientFd = -1;
+        client->clientEvent.eventHandler = HandleClientEvent;
+        client->idleTimer.timerHandler = HandleIdleTimerEvent;
+    }
 
     int sockType = SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
     serverState->listenFd = OpenIpV4Socket(ipAddr, port, sockType);
@@ -68,9 +78,10 @@ EchoServer_ServerState *EchoServer_Start(int epollFd, in_addr_t ipAddr, uint16_t
         goto fail;
     }
 
-    Log_Debug("INFO: TCP server: Listening for client connection (fd %d).\n",
-              serverState->listenFd);
+    Log_Debug("INFO: TCP server: Listening for client connections (fd %d, %zu clients).\n",
+              serverState->listenFd, maxClients);
 
+    eth_ServerState = serverState;
     return serverState;
 
 fail:
@@ -84,199 +95,400 @@ void EchoServer_ShutDown(EchoServer_ServerState *serverState)
         return;
     }
 
-    CloseFdAndPrintError(serverState->clientFd, "clientFd");
+    for (size_t i = 0; i < serverState->maxClients; ++i) {
+        CloseClient(&serverState->clients[i]);
+    }
     CloseFdAndPrintError(serverState->listenFd, "listenFd");
 
-    free(serverState->txPayload);
-
+    if (eth_ServerState == serverState) {
+        eth_ServerState = NULL;
+    }
     free(serverState);
 }
 
+static uint64_t GetNowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+/// <summary>
+///     Records activity on a connection and restarts its idle timer.
+/// </summary>
+static void TouchClient(EchoServer_Client *client)
+{
+    client->lastActivityMs = GetNowMs();
+    SetTimerToSingleExpiry(&client->idleTimer, &client->server->idleTimeout);
+}
+
 static void HandleListenEvent(EventData *eventData)
 {
     EchoServer_ServerState *serverState =
         EventDataToServerState(eventData, offsetof(EchoServer_ServerState, listenEvent));
-    int localFd = -1;
 
-    do {
-        // Create a new accepted socket to connect to the client.
-        // The newly-accepted sockets should be opened in non-blocking mode, and use
-        // EPOLLIN and EPOLLOUT to transfer data.
-        struct sockaddr in_addr;
-        socklen_t sockLen = sizeof(in_addr);
-        localFd = accept4(serverState->listenFd, &in_addr, &sockLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
-        if (localFd < 0) {
-            ReportError("accept");
+    // Create a new accepted socket to connect to the client.
+    // The newly-accepted sockets should be opened in non-blocking mode, and use
+    // EPOLLIN and EPOLLOUT to transfer data.
+    struct sockaddr in_addr;
+    socklen_t sockLen = sizeof(in_addr);
+    int localFd =
+        accept4(serverState->listenFd, &in_addr, &sockLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (localFd < 0) {
+        ReportError("accept");
+        // Only a listening socket which has failed stops the server; running out of
+        // descriptors or memory, or a client which gave up, costs one connection.
+        if (errno != EAGAIN && errno != ECONNABORTED && errno != EINTR && errno != EMFILE &&
+            errno != ENFILE && errno != ENOBUFS && errno != ENOMEM) {
+            StopServer(serverState, EchoServer_StopReason_Error);
+        }
+        return;
+    }
+
+    // Take a free slot. If the table is full, the least recently active client makes way.
+    EchoServer_Client *client = NULL;
+    for (size_t i = 0; i < serverState->maxClients; ++i) {
+        EchoServer_Client *candidate = &serverState->clients[i];
+        if (candidate->clientFd < 0) {
+            client = candidate;
             break;
         }
+        if (client == NULL || candidate->lastActivityMs < client->lastActivityMs) {
+            client = candidate;
+        }
+    }
+    if (client == NULL) {
+        close(localFd);
+        return;
+    }
+    if (client->clientFd >= 0) {
+        Log_Debug("INFO: TCP server: Too many clients, closing least recently active client %u.\n",
+                  client->id);
+        CloseClient(client);
+    }
 
-        Log_Debug("INFO: TCP server: Accepted client connection (fd %d).\n", localFd);
+    // Socket opened successfully, so transfer ownership to the slot.
+    client->clientFd = localFd;
+    client->id = serverState->nextClientId++;
+    client->epollOutEnabled = false;
+    client->inLineSize = 0;
+    client->isBinary = false;
+    client->framesReceived = 0;
+    client->framesDropped = 0;
+    TxQueue_Init(&client->txQueue, ECHO_SERVER_TX_QUEUE_LIMIT);
+    TxQueue_SetLowWatermark(&client->txQueue, ECHO_SERVER_TX_QUEUE_LOW_WATERMARK);
+    if (RegisterEventHandlerToEpoll(serverState->epollFd, client->clientFd, &client->clientEvent,
+                                    EPOLLIN) != 0) {
+        CloseClient(client);
+        return;
+    }
+    TouchClient(client);
 
-        if (serverState->clientFd >= 0) {
-			Log_Debug("INFO: TCP server: Get new connection, unregister old client.\n");
-			UnregisterEventHandlerFromEpoll(serverState->epollFd, serverState->clientFd);
-			serverState->epollInEnabled = false;
-        }
+    Log_Debug("INFO: TCP server: Accepted client %u (fd %d).\n", client->id, client->clientFd);
+}
 
-        // Socket opened successfully, so transfer ownership to EchoServer_ServerState object.
-        serverState->clientFd = localFd;
-        localFd = -1;
+/// <summary>
+///     Closes a client's socket, frees its slot and drops any data waiting to be sent to it.
+/// </summary>
+static void CloseClient(EchoServer_Client *client)
+{
+    if (client->clientFd < 0) {
+        return;
+    }
 
-        LaunchRead(serverState);
-		eth_ServerState = serverState;
-    } while (0);
+    const TxQueueStats *stats = &client->txQueue.stats;
+    Log_Debug("INFO: TCP server: Client %u sent %llu messages, dropped %llu.\n", client->id,
+              (unsigned long long)stats->messagesSent,
+              (unsigned long long)stats->messagesRejected);
+    if (client->isBinary) {
+        Log_Debug("INFO: TCP server: Client %u received %llu frames, dropped %llu.\n",
+                  client->id, (unsigned long long)client->framesReceived,
+                  (unsigned long long)client->framesDropped);
+    }
 
-    close(localFd);
+    UnregisterEventHandlerFromEpoll(client->server->epollFd, client->clientFd);
+    CloseFdAndPrintError(client->clientFd, "clientFd");
+    client->clientFd = -1;
+    DisarmTimer(&client->idleTimer);
+    TxQueue_Clear(&client->txQueue);
 }
 
-static void LaunchRead(EchoServer_ServerState *serverState)
+static void HandleIdleTimerEvent(Timer *timer)
 {
-    serverState->inLineSize = 0;
-    RegisterEventHandlerToEpoll(serverState->epollFd, serverState->clientFd,
-                                &serverState->clientReadEvent, EPOLLIN);
+    EchoServer_Client *client =
+        (EchoServer_Client *)((uint8_t *)timer - offsetof(EchoServer_Client, idleTimer));
+
+    Log_Debug("INFO: TCP server: Client %u has been idle, closing it.\n", client->id);
+    CloseClient(client);
 }
 
-static void HandleClientReadEvent(EventData *eventData)
+/// <summary>
+///     Drops unprintable characters, including NULs, from a line in place and terminates it.
+///     Lines are normally printable throughout, in which case nothing moves.
+/// </summary>
+/// <param name="line">Start of the line</param>
+/// <param name="lineEnd">End of the line, where its terminating NUL is written</param>
+/// <returns>Start of the printable line</returns>
+static char *RemoveUnprintable(char *line, char *lineEnd)
 {
-    EchoServer_ServerState *serverState =
-        EventDataToServerState(eventData, offsetof(EchoServer_ServerState, clientReadEvent));
-
-    if (serverState->epollInEnabled) {
-        UnregisterEventHandlerFromEpoll(serverState->epollFd, serverState->clientFd);
-        serverState->epollInEnabled = false;
-    }
-
-    // Continue until no immediately available input or until an error occurs.
-    size_t maxChars = sizeof(serverState->input) - 1;
-
-    while (true) {
-        // Read a single byte from the client and add it to the buffered line.
-        uint8_t b;
-        ssize_t bytesReadOneSysCall = recv(serverState->clientFd, &b, 1, /* flags */ 0);
-
-        // If successfully read a single byte then process it.
-        if (bytesReadOneSysCall == 1) {
-            // If received newline then print received line to debug log.
-            if (b == '\r') {
-                serverState->input[serverState->inLineSize] = '\0';
-                Log_Debug("INFO: TCP server: Received \"%s\"\n", serverState->input);
-                LaunchRead(serverState);
-
-				//When received newline will send message to Azure IoT
-				USIAzureIoT_SendStringToCloud(sendToCloudPropertyName, serverState->input);
-                break;
-            }
-
-            // If new character is not printable then discard.
-            else if (!isprint(b)) {
-                // Special case '\n' to avoid printing a message for every line of input.
-                if (b != '\n') {
-                    Log_Debug("INFO: TCP server: Discarding unprintable character 0x%02x\n", b);
-                }
-            }
-
-            // If new character would leave no space for NUL terminator then reset buffer.
-            else if (serverState->inLineSize == maxChars) {
-                Log_Debug("INFO: TCP server: Input data overflow. Discarding %zu characters.\n",
-                          maxChars);
-                serverState->input[0] = b;
-                serverState->inLineSize = 1;
-            }
-
-            // Else append character to buffer.
-            else {
-                serverState->input[serverState->inLineSize] = b;
-                ++serverState->inLineSize;
-            }
+    // Special case '\n' from "\r\n" line endings to avoid printing a message for every line.
+    while (line < lineEnd && *line == '\n') {
+        ++line;
+    }
+
+    char *write = line;
+    for (char *read = line; read < lineEnd; ++read) {
+        if (isprint((unsigned char)*read)) {
+            *write++ = *read;
+        } else if (*read != '\n') {
+            Log_Debug("INFO: TCP server: Discarding unprintable character 0x%02x\n",
+                      (uint8_t)*read);
         }
+    }
+    *write = '\0';
+    return line;
+}
+
+/// <summary>
+///     A line from a client, as a telemetry record.
+/// </summary>
+typedef struct {
+    uint32_t clientId;
+    const char *line;
+} ClientLineRecord;
+
+/// <summary>
+///     Writes the fields of a line's telemetry record, with the ID which addresses the client
+///     from the cloud: "client":id,"sendToCloud":line
+/// </summary>
+static void WriteClientLineRecord(JsonWriter *writer, const void *record)
+{
+    const ClientLineRecord *lineRecord = record;
+    JsonWriter_Key(writer, "client");
+    JsonWriter_Uint(writer, lineRecord->clientId);
+    JsonWriter_Key(writer, sendToCloudPropertyName);
+    JsonWriter_String(writer, lineRecord->line);
+}
 
-        // If client has shut down cleanly then terminate.
-        else if (bytesReadOneSysCall == 0) {
-            Log_Debug("INFO: TCP server: Client has closed connection, so terminating server.\n");
-            //StopServer(serverState, EchoServer_StopReason_ClientClosed);
+/// <summary>
+///     A binary frame's payload from a client, as a telemetry record.
+/// </summary>
+typedef struct {
+    uint32_t clientId;
+    const uint8_t *payload;
+    size_t length;
+} ClientFrameRecord;
+
+/// <summary>
+///     Writes the fields of a frame's telemetry record, with the payload in base64:
+///     "client":id,"binary":payload
+/// </summary>
+static void WriteClientFrameRecord(JsonWriter *writer, const void *record)
+{
+    const ClientFrameRecord *frameRecord = record;
+    JsonWriter_Key(writer, "client");
+    JsonWriter_Uint(writer, frameRecord->clientId);
+    JsonWriter_Key(writer, sendToBinaryPropertyName);
+    JsonWriter_Base64(writer, frameRecord->payload, frameRecord->length);
+}
+
+/// <summary>
+///     Splits off every complete line and passes it to the cloud. Each line is terminated in place
+///     by overwriting its '\r', and passed on from the buffer without being copied. The line
+///     <see cref="ECHO_SERVER_BINARY_COMMAND" /> switches the client to binary frames, and ends
+///     the lines.
+/// </summary>
+/// <param name="client">The client</param>
+/// <param name="start">Start of the first line</param>
+/// <param name="scanStart">Where to look for '\r'; bytes before it are known not to contain
+/// one</param>
+/// <param name="end">End of the received data</param>
+/// <returns>Start of the data which has not been handled</returns>
+static char *HandleLines(EchoServer_Client *client, char *start, char *scanStart, char *end)
+{
+    const uint8_t *lineEnd;
+    while ((lineEnd = SerialFramer_FindByte((const uint8_t *)scanStart, (const uint8_t *)end,
+                                            '\r')) != NULL) {
+        char *line = start;
+        start = (char *)lineEnd + 1;
+        scanStart = start;
+        line = RemoveUnprintable(line, (char *)lineEnd);
+        if (strcmp(line, ECHO_SERVER_BINARY_COMMAND) == 0) {
+            Log_Debug("INFO: TCP server: Client %u switched to binary frames.\n", client->id);
+            client->isBinary = true;
+            SendLineToClient(client, "+OK BINARY");
             break;
         }
 
-        // If receive buffer is empty then wait for EPOLLIN event.
-        else if (bytesReadOneSysCall == -1 && errno == EAGAIN) {
-            RegisterEventHandlerToEpoll(serverState->epollFd, serverState->clientFd,
-                                        &serverState->clientReadEvent, EPOLLIN);
-            serverState->epollInEnabled = true;
-			LaunchRead(serverState);
-            break;
+        Log_Debug("INFO: TCP server: Received \"%s\" from client %u\n", line, client->id);
+
+		//When received newline will send message to Azure IoT
+		ClientLineRecord record = {.clientId = client->id, .line = line};
+		USIAzureIoT_SendRecordToCloud(&WriteClientLineRecord, &record);
+    }
+    return start;
+}
+
+/// <summary>
+///     Passes every complete binary frame's payload to the cloud, in base64. Only the header and,
+///     if the frame has one, the CRC are examined. A frame with a wrong CRC is dropped; a header
+///     which is not valid closes the client, since the stream cannot be resynchronized.
+/// </summary>
+/// <param name="client">The client</param>
+/// <param name="start">Start of the first frame</param>
+/// <param name="end">End of the received data</param>
+/// <returns>Start of the data which has not been handled</returns>
+static char *HandleFrames(EchoServer_Client *client, char *start, char *end)
+{
+    while ((size_t)(end - start) >= ECHO_SERVER_FRAME_HEADER_SIZE) {
+        const uint8_t *frame = (const uint8_t *)start;
+        uint8_t flags = frame[1];
+        size_t payloadLength = ((size_t)frame[2] << 8) | frame[3];
+        if (frame[0] != ECHO_SERVER_FRAME_MAGIC || (flags & ~ECHO_SERVER_FRAME_FLAG_CRC) != 0 ||
+            payloadLength > ECHO_SERVER_MAX_FRAME_PAYLOAD) {
+            Log_Debug("INFO: TCP server: Invalid frame header from client %u, closing it.\n",
+                      client->id);
+            CloseClient(client);
+            return start;
         }
 
-        // Another error occured so abort the program.
-        else {
-            ReportError("recv");
-            StopServer(serverState, EchoServer_StopReason_Error);
+        bool hasCrc = (flags & ECHO_SERVER_FRAME_FLAG_CRC) != 0;
+        size_t frameSize = ECHO_SERVER_FRAME_HEADER_SIZE + payloadLength +
+                           (hasCrc ? ECHO_SERVER_FRAME_CRC_SIZE : 0);
+        if ((size_t)(end - start) < frameSize) {
             break;
         }
+        start += frameSize;
+
+        // The CRC-16/MODBUS of a frame followed by its CRC, least significant byte first, is 0.
+        if (hasCrc && ModbusRtu_Crc16(frame, frameSize) != 0) {
+            ++client->framesDropped;
+            Log_Debug("INFO: TCP server: Frame with wrong CRC from client %u dropped.\n",
+                      client->id);
+            continue;
+        }
+
+        ++client->framesReceived;
+        ClientFrameRecord record = {.clientId = client->id,
+                                    .payload = frame + ECHO_SERVER_FRAME_HEADER_SIZE,
+                                    .length = payloadLength};
+        USIAzureIoT_SendRecordToCloud(&WriteClientFrameRecord, &record);
     }
+    return start;
 }
 
-static void LaunchWrite(EchoServer_ServerState *serverState)
+static void HandleClientReadEvent(EchoServer_Client *client)
 {
-    // Allocate a client response on the heap.
-    char *str;
-    int result = asprintf(&str, "Received \"%s\"\r\n", serverState->input);
-    if (result == -1) {
-        ReportError("asprintf");
-        StopServer(serverState, EchoServer_StopReason_Error);
+    // Read everything that is available, up to the free space in the buffer, with a single call.
+    // The socket stays registered for EPOLLIN, so any remainder raises another event.
+    char *input = client->input;
+    size_t buffered = client->inLineSize;
+    ssize_t bytesReadOneSysCall =
+        recv(client->clientFd, input + buffered, sizeof(client->input) - buffered, /* flags */ 0);
+
+    // If client has shut down cleanly then free its slot.
+    if (bytesReadOneSysCall == 0) {
+        Log_Debug("INFO: TCP server: Client %u has closed connection.\n", client->id);
+        CloseClient(client);
         return;
     }
 
-    // Start to send the response.
-    serverState->txPayloadSize = (size_t)result;
-    serverState->txPayload = (uint8_t *)str;
-    serverState->txBytesSent = 0;
-    HandleClientWriteEvent(&serverState->clientWriteEvent);
-}
+    // If receive buffer is empty then wait for next EPOLLIN event.
+    if (bytesReadOneSysCall == -1 && errno == EAGAIN) {
+        return;
+    }
 
-static void HandleClientWriteEvent(EventData *eventData)
-{
-    EchoServer_ServerState *serverState =
-        EventDataToServerState(eventData, offsetof(EchoServer_ServerState, clientWriteEvent));
+    // Another error occured so drop the client.
+    if (bytesReadOneSysCall < 0) {
+        ReportError("recv");
+        CloseClient(client);
+        return;
+    }
+
+    TouchClient(client);
 
-    if (serverState->epollOutEnabled) {
-        UnregisterEventHandlerFromEpoll(serverState->epollFd, serverState->clientFd);
-        serverState->epollOutEnabled = false;
+    char *end = input + buffered + bytesReadOneSysCall;
+    char *start = input;
+    if (!client->isBinary) {
+        start = HandleLines(client, input, input + buffered, end);
+    }
+    if (client->isBinary && client->clientFd >= 0) {
+        start = HandleFrames(client, start, end);
+    }
+    if (client->clientFd < 0) {
+        return;
     }
 
-    // Continue until have written entire response, error occurs, or OS TX buffer is full.
-    while (serverState->txBytesSent < serverState->txPayloadSize) {
-        size_t remainingBytes = serverState->txPayloadSize - serverState->txBytesSent;
-        const uint8_t *data = &serverState->txPayload[serverState->txBytesSent];
-        ssize_t bytesSentOneSysCall =
-            send(serverState->clientFd, data, remainingBytes, /* flags */ 0);
+    // Keep the start of an incomplete line or frame for the next read. A frame always fits, but
+    // a line which fills the whole buffer cannot be completed, so discard it.
+    size_t remaining = (size_t)(end - start);
+    if (remaining == sizeof(client->input)) {
+        Log_Debug("INFO: TCP server: Input data overflow. Discarding %zu characters.\n",
+                  remaining);
+        remaining = 0;
+    } else if (start != input) {
+        memmove(input, start, remaining);
+    }
+    client->inLineSize = remaining;
+}
 
-        // If successfully sent data then stay in loop and try to send more data.
-        if (bytesSentOneSysCall > 0) {
-            serverState->txBytesSent += (size_t)bytesSentOneSysCall;
-        }
+/// <summary>
+///     Writes as much of a client's queued data as the socket accepts, and waits for EPOLLOUT
+///     only while some remains.
+/// </summary>
+/// <returns>0 on success, or -1 if the client was closed</returns>
+static int FlushClient(EchoServer_Client *client)
+{
+    uint64_t bytesSentBefore = client->txQueue.stats.bytesSent;
+    if (TxQueue_Drain(&client->txQueue, client->clientFd) != 0) {
+        ReportError("send");
+        CloseClient(client);
+        return -1;
+    }
 
-        // If OS TX buffer is full then wait for next EPOLLOUT.
-        else if (bytesSentOneSysCall < 0 && errno == EAGAIN) {
-            RegisterEventHandlerToEpoll(serverState->epollFd, serverState->clientFd,
-                                        &serverState->clientWriteEvent, EPOLLOUT);
-            serverState->epollOutEnabled = true;
-            return;
-        }
+    // A client which only receives messages from the cloud is still active.
+    if (client->txQueue.stats.bytesSent != bytesSentBefore) {
+        TouchClient(client);
+    }
 
-        // Another error occurred so terminate the program.
-        else {
-            ReportError("send");
-            StopServer(serverState, EchoServer_StopReason_Error);
-            return;
-        }
+    bool epollOutEnabled = !TxQueue_IsEmpty(&client->txQueue);
+    if (epollOutEnabled != client->epollOutEnabled) {
+        RegisterEventHandlerToEpoll(client->server->epollFd, client->clientFd,
+                                    &client->clientEvent,
+                                    EPOLLIN | (epollOutEnabled ? EPOLLOUT : 0));
+        client->epollOutEnabled = epollOutEnabled;
     }
+    return 0;
+}
 
-    // If reached here then successfully sent entire payload so clean up and read next line from
-    // client.
-    free(serverState->txPayload);
-    serverState->txPayload = NULL;
+static void HandleClientEvent(EventData *eventData)
+{
+    EchoServer_Client *client =
+        (EchoServer_Client *)((uint8_t *)eventData - offsetof(EchoServer_Client, clientEvent));
 
-    LaunchRead(serverState);
+    if ((eventData->events & EPOLLOUT) != 0 && FlushClient(client) != 0) {
+        return;
+    }
+    if ((eventData->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+        HandleClientReadEvent(client);
+    }
+}
+
+/// <summary>
+///     Queues a line and its terminator for a client and starts to send it. If the client's
+///     queue is full, the line is dropped and counted, and the client stays connected.
+/// </summary>
+/// <returns>0 on success, or -1 if the line was dropped or the client was closed</returns>
+static int SendLineToClient(EchoServer_Client *client, const char *line)
+{
+    struct iovec fragments[] = {{.iov_base = (void *)line, .iov_len = strlen(line)},
+                                {.iov_base = "\r", .iov_len = 1}};
+    if (TxQueue_EnqueueFragments(&client->txQueue, fragments, 2) != 0) {
+        Log_Debug("INFO: TCP server: Client %u is not reading its data, dropped %llu messages.\n",
+                  client->id, (unsigned long long)client->txQueue.stats.messagesRejected);
+        return -1;
+    }
+    return FlushClient(client);
 }
 
 static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType)
@@ -348,23 +560,38 @@ static EchoServer_ServerState *EventDataToServerState(EventData *eventData, size
 
 void USIPrivateEthernet_SendMsg(const char *dataToSend)
 {
-	// Allocate a client response on the heap.
-	char *str;
-	int result = asprintf(&str, "%s\r", dataToSend);
-	if (result == -1) {
-		ReportError("asprintf");
-		StopServer(eth_ServerState, EchoServer_StopReason_Error);
+	if (dataToSend == NULL) {
 		return;
 	}
 
-	if (eth_ServerState != NULL) {
-		// Start to send the response.
-		eth_ServerState->txPayloadSize = (size_t)result;
-		eth_ServerState->txPayload = (uint8_t *)str;
-		eth_ServerState->txBytesSent = 0;
-		HandleClientWriteEvent(&eth_ServerState->clientWriteEvent);
-	}
-	else {
+	if (eth_ServerState == NULL) {
 		Log_Debug("Could not found client\n");
+		return;
+	}
+
+	for (size_t i = 0; i < eth_ServerState->maxClients; ++i) {
+		EchoServer_Client *client = &eth_ServerState->clients[i];
+		if (client->clientFd >= 0) {
+			SendLineToClient(client, dataToSend);
+		}
+	}
+}
+
+int USIPrivateEthernet_SendMsgToClient(uint32_t clientId, const char *dataToSend)
+{
+	if (dataToSend == NULL) {
+		return -1;
+	}
+
+	if (eth_ServerState != NULL) {
+		for (size_t i = 0; i < eth_ServerState->maxClients; ++i) {
+			EchoServer_Client *client = &eth_ServerState->clients[i];
+			if (client->clientFd >= 0 && client->id == clientId) {
+				return SendLineToClient(client, dataToSend);
+			}
+		}
 	}
-}
\ No newline at end of file
+
+	Log_Debug("Could not found client %u\n", clientId);
+	return -1;
+}
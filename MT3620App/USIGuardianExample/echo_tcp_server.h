@@ -6,8 +6,41 @@
 #include "netinet/in.h"
 
 #include "epoll_timerfd_utilities.h"
+#include "tx_queue.h"
 #include "usi_azureiot.h"
 
+/// <summary>Size of each client's receive buffer, which is also the longest line.</summary>
+#define ECHO_SERVER_INPUT_SIZE 2048
+
+/// <summary>Largest number of bytes which may wait to be sent to one client. Messages for a
+/// client whose queue is full are dropped.</summary>
+#define ECHO_SERVER_TX_QUEUE_LIMIT 4096
+
+/// <summary>Number of waiting bytes to which a full queue must drain before it accepts messages
+/// again.</summary>
+#define ECHO_SERVER_TX_QUEUE_LOW_WATERMARK 1024
+
+/// <summary>Line which switches a client from text lines to binary frames for the rest of the
+/// connection. The server answers "+OK BINARY\r".</summary>
+#define ECHO_SERVER_BINARY_COMMAND "+BINARY"
+
+/// <summary>First byte of a binary frame.</summary>
+#define ECHO_SERVER_FRAME_MAGIC 0xA5
+
+/// <summary>Flag of a binary frame which is followed by a CRC-16/MODBUS of its header and
+/// payload, least significant byte first.</summary>
+#define ECHO_SERVER_FRAME_FLAG_CRC 0x01
+
+/// <summary>Size of a binary frame header: magic, flags and big endian payload length.</summary>
+#define ECHO_SERVER_FRAME_HEADER_SIZE 4
+
+/// <summary>Size of the optional CRC which follows a binary frame.</summary>
+#define ECHO_SERVER_FRAME_CRC_SIZE 2
+
+/// <summary>Largest payload of a binary frame.</summary>
+#define ECHO_SERVER_MAX_FRAME_PAYLOAD \
+    (ECHO_SERVER_INPUT_SIZE - ECHO_SERVER_FRAME_HEADER_SIZE - ECHO_SERVER_FRAME_CRC_SIZE)
+
 /// <summary>Reason why the TCP server stopped.</summary>
 typedef enum {
     /// <summary>The echo server stopped because the client closed the connection.</summary>
@@ -16,39 +49,61 @@ typedef enum {
     EchoServer_StopReason_Error
 } EchoServer_StopReason;
 
+struct EchoServer_ServerState;
+
+/// <summary>
+/// One slot of the server's connection table.
+/// </summary>
+typedef struct {
+    /// <summary>Server which owns the slot.</summary>
+    struct EchoServer_ServerState *server;
+    /// <summary>Accept socket, or -1 if the slot is free.</summary>
+    int clientFd;
+    /// <summary>Connection ID, which is unique for the life of the server and is used to
+    /// address the client from the cloud.</summary>
+    uint32_t id;
+    /// <summary>Callback which is invoked when the client's socket is readable or
+    /// writable.</summary>
+    EventData clientEvent;
+    /// <summary>Whether the socket is registered for EPOLLOUT.</summary>
+    bool epollOutEnabled;
+    /// <summary>Closes the connection after it has been idle for the server's idle
+    /// timeout.</summary>
+    Timer idleTimer;
+    /// <summary>Time of the last data from or to the client, in milliseconds.</summary>
+    uint64_t lastActivityMs;
+    /// <summary>Whether the client sends binary frames instead of text lines.</summary>
+    bool isBinary;
+    /// <summary>Number of binary frames which were passed to the cloud.</summary>
+    uint64_t framesReceived;
+    /// <summary>Number of binary frames which were dropped because their CRC was wrong.</summary>
+    uint64_t framesDropped;
+    /// <summary>Number of bytes of an incomplete line or frame at the start of input.</summary>
+    size_t inLineSize;
+    /// <summary>Data received from client. Each recv fills as much of it as is free, so a
+    /// burst of lines costs one system call.</summary>
+    char input[ECHO_SERVER_INPUT_SIZE];
+    /// <summary>Data waiting to be sent to the client.</summary>
+    TxQueue txQueue;
+} EchoServer_Client;
+
 /// <summary>
 /// Bundles together state about an active echo server.
 /// This should be allocated with <see cref="EchoServer_Start" /> and freed with
 /// <see cref="EchoServer_ShutDown" />. The client should not directly modify member variables.
 /// </summary>
-typedef struct {
+typedef struct EchoServer_ServerState {
     /// <summary>Epoll which is used to respond asynchronously to incoming connections.</summary>
     int epollFd;
     /// <summary>Socket which listens for incoming connections.</summary>
     int listenFd;
     /// <summary>Callback which is invoked when a new connection is received.</summary>
     EventData listenEvent;
-    /// <summary>Accept socket. Only one client socket supported at a time.</summary>
-    int clientFd;
-    /// <summary>Callback which is invoked when server receives data from client.</summary>
-    EventData clientReadEvent;
-    /// <summary>Whether currently waiting for input from client.</summary>
-    bool epollInEnabled;
-    /// <summary>Whether currently writing response to client.</summary>
-    bool epollOutEnabled;
-    /// <summary>Number of characters received from client.</summary>
-    size_t inLineSize;
-    /// <summary>Data received from client.</summary>
-    char input[256];
-    /// <summary>Callback which is invoked when have written data to client.</summary>
-    EventData clientWriteEvent;
-    /// <summary>Payload to write to client.</summary>
-    uint8_t *txPayload;
-    /// <summary>Number of bytes to write to client.</summary>
-    size_t txPayloadSize;
-    /// <summary>Number of characters from paylod which have been written to client so
-    /// far.</summary>
-    size_t txBytesSent;
+    /// <summary>How long a client may be idle before it is disconnected; zero for
+    /// ever.</summary>
+    struct timespec idleTimeout;
+    /// <summary>ID of the next accepted connection.</summary>
+    uint32_t nextClientId;
     /// <summary>
     /// <para>Callback to invoke when the server stops processing connections.</para>
     /// <para>When this callback is invoked, the owner should clean up the server with
@@ -56,6 +111,10 @@ typedef struct {
     /// <param name="reason">Why the server stopped.</param>
     /// </summary>
     void (*shutdownCallback)(EchoServer_StopReason reason);
+    /// <summary>Number of slots in the connection table.</summary>
+    size_t maxClients;
+    /// <summary>The connection table.</summary>
+    EchoServer_Client clients[];
 } EchoServer_ServerState;
 
 /// <summary>
@@ -64,11 +123,16 @@ typedef struct {
 /// <param name="ipAddr">IP address to which the listen socket is bound.</param>
 /// <param name="port">TCP port to which the socket is bound.</param>
 /// <param name="backlogSize">Listening socket queue length.</param>
+/// <param name="maxClients">Number of clients which may be connected at once. When the table is
+/// full, a new connection replaces the least recently active client.</param>
+/// <param name="idleTimeout">How long a client may neither send nor receive anything before
+/// it is disconnected; zero for ever.</param>
 /// <returns>Server state which is used to manage the server's resources, NULL on failure.
 /// Should be disposed with <see cref="EchoServer_ShutDown" />.</returns>
 /// </summary>
 EchoServer_ServerState *EchoServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
-                                         int backlogSize,
+                                         int backlogSize, size_t maxClients,
+                                         const struct timespec *idleTimeout,
                                          void (*shutdownCallback)(EchoServer_StopReason));
 
 /// <summary>
@@ -78,4 +142,16 @@ EchoServer_ServerState *EchoServer_Start(int epollFd, in_addr_t ipAddr, uint16_t
 /// </summary>
 void EchoServer_ShutDown(EchoServer_ServerState *serverState);
 
-void USIPrivateEthernet_SendMsg(const char *dataToSend);
\ No newline at end of file
+/// <summary>
+/// Sends a line, terminated by '\r', to every connected client.
+/// </summary>
+void USIPrivateEthernet_SendMsg(const char *dataToSend);
+
+/// <summary>
+/// Sends a line, terminated by '\r', to one client.
+/// </summary>
+/// <param name="clientId">Connection ID of the client</param>
+/// <param name="dataToSend">The line</param>
+/// <returns>0 on success, or -1 if the client is not connected or the line was dropped because
+/// the client's queue is full</returns>
+int USIPrivateEthernet_SendMsgToClient(uint32_t clientId, const char *dataToSend);
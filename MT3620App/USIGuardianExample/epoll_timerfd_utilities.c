@@ -8,6 +8,33 @@
 #include <applibs/log.h>
 #include "epoll_timerfd_utilities.h"
 
+// Events returned by the most recent epoll_wait which have not been dispatched yet. The file
+// descriptor of each event is captured before any handler runs, so that an event can be dropped
+// without touching its EventData if an earlier handler in the batch unregisters or closes it.
+static struct epoll_event pendingEvents[EPOLL_MAX_EVENTS_PER_WAIT];
+static int pendingFds[EPOLL_MAX_EVENTS_PER_WAIT];
+static int pendingCount = 0;
+static int pendingIndex = 0;
+
+static int dispatchBudget = EPOLL_MAX_EVENTS_PER_WAIT;
+static EpollDispatchStats dispatchStats;
+
+/// <summary>
+///     Drops not yet dispatched events for a file descriptor from the current batch.
+/// </summary>
+/// <param name="fd">File descriptor whose events should be dropped</param>
+/// <param name="keepEventData">Events for this EventData are kept; NULL drops all events</param>
+static void DropPendingEvents(int fd, const EventData *keepEventData)
+{
+    for (int i = pendingIndex; i < pendingCount; ++i) {
+        if (pendingFds[i] == fd && pendingEvents[i].data.ptr != NULL &&
+            pendingEvents[i].data.ptr != keepEventData) {
+            pendingEvents[i].data.ptr = NULL;
+            ++dispatchStats.eventsDropped;
+        }
+    }
+}
+
 int CreateEpollFd(void)
 {
     int epollFd = -1;
@@ -25,6 +52,7 @@ int RegisterEventHandlerToEpoll(int epollFd, int eventFd, EventData *persistentE
                                 const uint32_t epollEventMask)
 {
     persistentEventData->fd = eventFd;
+    DropPendingEvents(eventFd, persistentEventData);
     struct epoll_event eventToAddOrModify = {.data.ptr = persistentEventData,
                                              .events = epollEventMask};
 
@@ -46,6 +74,7 @@ int RegisterEventHandlerToEpoll(int epollFd, int eventFd, EventData *persistentE
 int UnregisterEventHandlerFromEpoll(int epollFd, int eventFd)
 {
     int res = 0;
+    DropPendingEvents(eventFd, NULL);
     // Unregister the eventFd on the epoll instance referred by epollFd.
     if ((res = epoll_ctl(epollFd, EPOLL_CTL_DEL, eventFd, NULL)) == -1) {
         if (res == -1 && errno != EBADF) { // Ignore EBADF errors
@@ -119,10 +148,360 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
     return timerFd;
 }
 
+// Timer wheel: four levels of 64 slots with a one millisecond tick, which covers delays of up to
+// 2^24 ms (about 4.6 hours) directly. Longer delays are parked in the last level and re-inserted
+// when their slot is cascaded.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK ((uint64_t)TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MAX_DELTA (1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS))
+#define TIMER_WHEEL_NO_TICK UINT64_MAX
+#define TIMER_WHEEL_EXPIRED_LEVEL 0xFF
+#define NANOSECONDS_PER_TICK 1000000ull
+
+static void TimerWheelEventHandler(EventData *eventData);
+
+static struct {
+    /// <summary>Timer file descriptor which is armed for the earliest deadline.</summary>
+    int timerFd;
+    /// <summary>Event data registered with epoll for the timerfd.</summary>
+    EventData eventData;
+    /// <summary>Monotonic time which corresponds to tick zero.</summary>
+    struct timespec epoch;
+    /// <summary>Next tick which has not yet been processed.</summary>
+    uint64_t currentTick;
+    /// <summary>Tick for which the timerfd is armed, or TIMER_WHEEL_NO_TICK.</summary>
+    uint64_t armedTick;
+    /// <summary>Whether the wheel is currently calling timer handlers.</summary>
+    bool inDispatch;
+    /// <summary>Tick which corresponds to the time at which the current dispatch started.</summary>
+    uint64_t dispatchTick;
+    /// <summary>Bitmap of non-empty slots for each level.</summary>
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    /// <summary>Lists of armed timers.</summary>
+    Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timerWheel = {.timerFd = -1,
+                .eventData = {.eventHandler = &TimerWheelEventHandler},
+                .armedTick = TIMER_WHEEL_NO_TICK};
+
+static uint64_t TimespecToNanoseconds(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
+
+/// <summary>
+///     Gets the number of nanoseconds which have elapsed since the wheel was created.
+/// </summary>
+static uint64_t GetTimerWheelElapsedNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return TimespecToNanoseconds(&now) - TimespecToNanoseconds(&timerWheel.epoch);
+}
+
+static void LinkTimer(Timer *timer)
+{
+    uint64_t currentTick = timerWheel.currentTick;
+    uint64_t placementTick = (timer->expiryTick < currentTick) ? currentTick : timer->expiryTick;
+    uint64_t delta = placementTick - currentTick;
+    if (delta >= TIMER_WHEEL_MAX_DELTA) {
+        delta = TIMER_WHEEL_MAX_DELTA - 1;
+        placementTick = currentTick + delta;
+    }
+
+    // Use the lowest level whose range covers the delay. The slot is the expiry's digit at that
+    // level, so a slot is cascaded to the level below at the start of its range.
+    unsigned int level = 0;
+    while (delta >= (1ull << ((level + 1) * TIMER_WHEEL_SLOT_BITS))) {
+        ++level;
+    }
+    unsigned int slot =
+        (unsigned int)((placementTick >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_SLOT_MASK);
+
+    Timer **head = &timerWheel.slots[level][slot];
+    timer->next = *head;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    timerWheel.occupied[level] |= 1ull << slot;
+}
+
+static void UnlinkTimer(Timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (timer->level != TIMER_WHEEL_EXPIRED_LEVEL &&
+        timerWheel.slots[timer->level][timer->slot] == NULL) {
+        timerWheel.occupied[timer->level] &= ~(1ull << timer->slot);
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/// <summary>
+///     Removes every timer from a slot and returns them as a list.
+/// </summary>
+static Timer *DetachSlot(unsigned int level, unsigned int slot, Timer **list)
+{
+    *list = timerWheel.slots[level][slot];
+    timerWheel.slots[level][slot] = NULL;
+    timerWheel.occupied[level] &= ~(1ull << slot);
+    for (Timer *timer = *list; timer != NULL; timer = timer->next) {
+        timer->level = TIMER_WHEEL_EXPIRED_LEVEL;
+    }
+    if (*list != NULL) {
+        (*list)->pprev = list;
+    }
+    return *list;
+}
+
+/// <summary>
+///     Finds the first non-empty slot of a level, searching from a slot index in rotation order.
+/// </summary>
+/// <returns>The number of slots after startSlot, or -1 if the level is empty</returns>
+static int FindNextOccupiedSlot(unsigned int level, unsigned int startSlot)
+{
+    uint64_t bits = timerWheel.occupied[level];
+    if (bits == 0) {
+        return -1;
+    }
+    uint64_t rotated = (startSlot == 0) ? bits : ((bits >> startSlot) | (bits << (64 - startSlot)));
+    return __builtin_ctzll(rotated);
+}
+
+/// <summary>
+///     Gets the first tick at or after the current tick at which a slot must be processed,
+///     either to call its timers (level 0) or to cascade them to a lower level.
+/// </summary>
+static uint64_t GetNextWorkTick(uint64_t *earliestExpiryTick)
+{
+    uint64_t nextTick = TIMER_WHEEL_NO_TICK;
+    uint64_t earliestExpiry = TIMER_WHEEL_NO_TICK;
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        unsigned int shift = level * TIMER_WHEEL_SLOT_BITS;
+        uint64_t slotSpan = 1ull << shift;
+        uint64_t boundary = (timerWheel.currentTick + slotSpan - 1) & ~(slotSpan - 1);
+        unsigned int startSlot = (unsigned int)((boundary >> shift) & TIMER_WHEEL_SLOT_MASK);
+        int offset = FindNextOccupiedSlot(level, startSlot);
+        if (offset < 0) {
+            continue;
+        }
+        uint64_t tick = boundary + (uint64_t)offset * slotSpan;
+        if (tick < nextTick) {
+            nextTick = tick;
+        }
+        if (earliestExpiryTick != NULL) {
+            // Slots of a level cover consecutive ranges, so the earliest expiry of the level is in
+            // its first occupied slot.
+            unsigned int slot = (startSlot + (unsigned int)offset) & TIMER_WHEEL_SLOT_MASK;
+            for (Timer *timer = timerWheel.slots[level][slot]; timer != NULL; timer = timer->next) {
+                uint64_t expiry = (timer->expiryTick < tick) ? tick : timer->expiryTick;
+                if (expiry < earliestExpiry) {
+                    earliestExpiry = expiry;
+                }
+            }
+        }
+    }
+    if (earliestExpiryTick != NULL) {
+        *earliestExpiryTick = earliestExpiry;
+    }
+    return nextTick;
+}
+
+/// <summary>
+///     Arms the timerfd to expire at a tick, or disarms it for TIMER_WHEEL_NO_TICK.
+/// </summary>
+static void ArmTimerWheelFd(uint64_t tick)
+{
+    if (tick == timerWheel.armedTick || timerWheel.timerFd < 0) {
+        return;
+    }
+
+    struct itimerspec newValue = {.it_value = {0, 0}, .it_interval = {0, 0}};
+    if (tick != TIMER_WHEEL_NO_TICK) {
+        uint64_t expiryNs = TimespecToNanoseconds(&timerWheel.epoch) + tick * NANOSECONDS_PER_TICK;
+        newValue.it_value.tv_sec = (time_t)(expiryNs / 1000000000ull);
+        newValue.it_value.tv_nsec = (long)(expiryNs % 1000000000ull);
+    }
+
+    if (timerfd_settime(timerWheel.timerFd, TFD_TIMER_ABSTIME, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not set timer wheel expiry: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    timerWheel.armedTick = tick;
+}
+
+/// <summary>
+///     Processes a single tick: cascades the slots which start at this tick and calls the
+///     handlers of the timers which expire.
+/// </summary>
+static void ProcessTimerWheelTick(uint64_t tick)
+{
+    timerWheel.currentTick = tick;
+
+    // Cascade from the highest level down, so that timers moved into a lower level slot which
+    // starts at this tick are cascaded again in the same pass.
+    for (unsigned int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+        unsigned int shift = level * TIMER_WHEEL_SLOT_BITS;
+        if ((tick & ((1ull << shift) - 1)) != 0) {
+            continue;
+        }
+        Timer *list;
+        DetachSlot(level, (unsigned int)((tick >> shift) & TIMER_WHEEL_SLOT_MASK), &list);
+        Timer *timer;
+        while ((timer = list) != NULL) {
+            UnlinkTimer(timer);
+            LinkTimer(timer);
+        }
+    }
+
+    Timer *expired;
+    DetachSlot(0, (unsigned int)(tick & TIMER_WHEEL_SLOT_MASK), &expired);
+
+    // Timers armed by the handlers below must not land in the slot which is being processed.
+    timerWheel.currentTick = tick + 1;
+
+    Timer *timer;
+    while ((timer = expired) != NULL) {
+        UnlinkTimer(timer);
+        if (timer->periodTicks != 0) {
+            // Keep periodic timers on their original schedule, but skip periods which were
+            // missed entirely rather than calling the handler repeatedly to catch up.
+            timer->expiryTick += timer->periodTicks;
+            if (timer->expiryTick <= timerWheel.dispatchTick) {
+                timer->expiryTick = timerWheel.dispatchTick + timer->periodTicks;
+            }
+            LinkTimer(timer);
+        }
+        timer->timerHandler(timer);
+    }
+}
+
+static void TimerWheelEventHandler(EventData *eventData)
+{
+    uint64_t timerData = 0;
+    if (read(timerWheel.timerFd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timer wheel timerfd %s (%d).\n", strerror(errno), errno);
+    }
+    timerWheel.armedTick = TIMER_WHEEL_NO_TICK;
+
+    uint64_t nowTick = GetTimerWheelElapsedNanoseconds() / NANOSECONDS_PER_TICK;
+    timerWheel.inDispatch = true;
+    timerWheel.dispatchTick = nowTick;
+    while (timerWheel.currentTick <= nowTick) {
+        uint64_t nextTick = GetNextWorkTick(NULL);
+        if (nextTick > nowTick) {
+            timerWheel.currentTick = nowTick + 1;
+            break;
+        }
+        ProcessTimerWheelTick(nextTick);
+    }
+    timerWheel.inDispatch = false;
+
+    uint64_t earliestExpiryTick;
+    GetNextWorkTick(&earliestExpiryTick);
+    ArmTimerWheelFd(earliestExpiryTick);
+}
+
+static int ArmTimer(Timer *timer, const struct timespec *delay, uint64_t periodTicks)
+{
+    DisarmTimer(timer);
+
+    uint64_t delayNs = TimespecToNanoseconds(delay);
+    if (delayNs == 0) {
+        return 0;
+    }
+    if (timerWheel.timerFd < 0) {
+        Log_Debug("ERROR: Could not arm timer: the timer wheel has not been created.\n");
+        return -1;
+    }
+
+    // Round up, so that the timer never expires early.
+    uint64_t expiryNs = GetTimerWheelElapsedNanoseconds() + delayNs;
+    timer->expiryTick = (expiryNs + NANOSECONDS_PER_TICK - 1) / NANOSECONDS_PER_TICK;
+    timer->periodTicks = periodTicks;
+    LinkTimer(timer);
+
+    // The timerfd is re-armed when the dispatch completes, or here only if this timer is now
+    // the earliest deadline.
+    if (!timerWheel.inDispatch && timer->expiryTick < timerWheel.armedTick) {
+        ArmTimerWheelFd((timer->expiryTick < timerWheel.currentTick) ? timerWheel.currentTick
+                                                                      : timer->expiryTick);
+    }
+
+    return 0;
+}
+
+int CreateTimerWheelAndAddToEpoll(int epollFd)
+{
+    timerWheel.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerWheel.timerFd < 0) {
+        Log_Debug("ERROR: Could not create timer wheel timerfd: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &timerWheel.epoch);
+    timerWheel.currentTick = 0;
+    timerWheel.armedTick = TIMER_WHEEL_NO_TICK;
+
+    if (RegisterEventHandlerToEpoll(epollFd, timerWheel.timerFd, &timerWheel.eventData,
+                                    EPOLLIN) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void CloseTimerWheel(void)
+{
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        for (unsigned int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+            while (timerWheel.slots[level][slot] != NULL) {
+                UnlinkTimer(timerWheel.slots[level][slot]);
+            }
+        }
+    }
+
+    CloseFdAndPrintError(timerWheel.timerFd, "TimerWheel");
+    timerWheel.timerFd = -1;
+    timerWheel.armedTick = TIMER_WHEEL_NO_TICK;
+}
+
+int SetTimerToPeriod(Timer *timer, const struct timespec *period)
+{
+    uint64_t periodNs = TimespecToNanoseconds(period);
+    uint64_t periodTicks = (periodNs + NANOSECONDS_PER_TICK - 1) / NANOSECONDS_PER_TICK;
+    return ArmTimer(timer, period, periodTicks);
+}
+
+int SetTimerToSingleExpiry(Timer *timer, const struct timespec *expiry)
+{
+    return ArmTimer(timer, expiry, 0);
+}
+
+void DisarmTimer(Timer *timer)
+{
+    if (timer->pprev != NULL) {
+        UnlinkTimer(timer);
+    }
+}
+
+bool IsTimerArmed(const Timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
 int WaitForEventAndCallHandler(int epollFd)
 {
-    struct epoll_event event;
-    int numEventsOccurred = epoll_wait(epollFd, &event, 1, -1);
+    int numEventsOccurred = epoll_wait(epollFd, pendingEvents, dispatchBudget, -1);
 
     if (numEventsOccurred == -1) {
         if (errno == EINTR) {
@@ -133,17 +512,63 @@ int WaitForEventAndCallHandler(int epollFd)
         return -1;
     }
 
-    if (numEventsOccurred == 1 && event.data.ptr != NULL) {
-        EventData *eventData = event.data.ptr;
-        eventData->eventHandler(eventData);
+    if (numEventsOccurred == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < numEventsOccurred; ++i) {
+        EventData *eventData = pendingEvents[i].data.ptr;
+        pendingFds[i] = (eventData != NULL) ? eventData->fd : -1;
+    }
+    pendingCount = numEventsOccurred;
+
+    uint32_t dispatched = 0;
+    for (pendingIndex = 0; pendingIndex < pendingCount;) {
+        // Advance the index before calling the handler, so that events it drops are only the ones
+        // which are still waiting to be dispatched.
+        const struct epoll_event *event = &pendingEvents[pendingIndex++];
+        EventData *eventData = event->data.ptr;
+        if (eventData != NULL) {
+            eventData->events = event->events;
+            eventData->eventHandler(eventData);
+            ++dispatched;
+        }
+    }
+    pendingCount = 0;
+    pendingIndex = 0;
+
+    ++dispatchStats.wakeups;
+    dispatchStats.eventsDispatched += dispatched;
+    ++dispatchStats.eventsPerWakeup[dispatched];
+    if (dispatched > dispatchStats.maxEventsPerWakeup) {
+        dispatchStats.maxEventsPerWakeup = dispatched;
+    }
+    if (numEventsOccurred == dispatchBudget) {
+        ++dispatchStats.budgetExhausted;
     }
 
     return 0;
 }
 
+void SetEpollDispatchBudget(int maxEvents)
+{
+    if (maxEvents < 1) {
+        maxEvents = 1;
+    } else if (maxEvents > EPOLL_MAX_EVENTS_PER_WAIT) {
+        maxEvents = EPOLL_MAX_EVENTS_PER_WAIT;
+    }
+    dispatchBudget = maxEvents;
+}
+
+void GetEpollDispatchStats(EpollDispatchStats *stats)
+{
+    *stats = dispatchStats;
+}
+
 void CloseFdAndPrintError(int fd, const char *fdName)
 {
     if (fd >= 0) {
+        DropPendingEvents(fd, NULL);
         int result = close(fd);
         if (result != 0) {
             Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
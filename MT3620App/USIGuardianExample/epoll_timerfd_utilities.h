@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/epoll.h>
 #include <unistd.h>
@@ -31,6 +33,11 @@ typedef struct EventData {
     /// The file descriptor that generated the event.
     /// </summary>
     int fd;
+    /// <summary>
+    /// The epoll events (EPOLLIN, EPOLLOUT, ...) which are being handled. This is set by
+    /// <see cref="WaitForEventAndCallHandler" /> before the handler is called.
+    /// </summary>
+    uint32_t events;
 } EventData;
 
 /// <summary>
@@ -96,8 +103,119 @@ int ConsumeTimerFdEvent(int timerFd);
 int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
                                EventData *persistentEventData, const uint32_t epollEventMask);
 
+/// Forward declaration of the data type passed to the timer handlers.
+struct Timer;
+
+/// <summary>
+///     Function signature for timer handlers.
+/// </summary>
+/// <param name="timer">The timer which expired</param>
+typedef void (*TimerHandler)(struct Timer *timer);
+
+/// <summary>
+/// <para>A timer which is multiplexed with every other timer onto the single timerfd owned by
+/// the timer wheel (see <see cref="CreateTimerWheelAndAddToEpoll" />).</para>
+/// <para>Only the timerHandler field needs to be populated; the remaining fields are managed by
+/// the timer wheel. The timer must remain valid for as long as it is armed.</para>
+/// </summary>
+typedef struct Timer {
+    /// <summary>
+    /// Function which is called when the timer expires.
+    /// </summary>
+    TimerHandler timerHandler;
+    /// <summary>Next timer in the same wheel slot.</summary>
+    struct Timer *next;
+    /// <summary>Link which points to this timer; NULL when the timer is not armed.</summary>
+    struct Timer **pprev;
+    /// <summary>Tick at which the timer expires.</summary>
+    uint64_t expiryTick;
+    /// <summary>Period in ticks for a periodic timer, or zero for a one-shot timer.</summary>
+    uint64_t periodTicks;
+    /// <summary>Wheel level and slot which currently hold the timer.</summary>
+    uint8_t level;
+    uint8_t slot;
+} Timer;
+
+/// <summary>
+/// <para>Creates the timer wheel and adds its timerfd to an epoll instance.</para>
+/// <para>The timer wheel is hierarchical, with a resolution of one millisecond. Arming,
+/// re-arming and disarming a timer are O(1) and only make a system call when the earliest
+/// deadline moves forward, so timers which are frequently re-armed or cancelled before they
+/// expire do not cost a timerfd each.</para>
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int CreateTimerWheelAndAddToEpoll(int epollFd);
+
+/// <summary>
+///     Disarms every timer and closes the timer wheel's timerfd.
+/// </summary>
+void CloseTimerWheel(void);
+
+/// <summary>
+///     Arms a timer to expire periodically. If the timer is already armed, it is re-armed.
+/// </summary>
+/// <param name="timer">The timer</param>
+/// <param name="period">The new period; a zero period disarms the timer</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetTimerToPeriod(Timer *timer, const struct timespec *period);
+
 /// <summary>
-///     Waits for an event on an epoll instance and triggers the handler.
+///     Arms a timer to expire once only. If the timer is already armed, it is re-armed.
+/// </summary>
+/// <param name="timer">The timer</param>
+/// <param name="expiry">The time elapsed before it expires once; zero disarms the timer</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetTimerToSingleExpiry(Timer *timer, const struct timespec *expiry);
+
+/// <summary>
+///     Disarms a timer. It is safe to call this function on a timer which is not armed.
+/// </summary>
+/// <param name="timer">The timer</param>
+void DisarmTimer(Timer *timer);
+
+/// <summary>
+///     Queries whether a timer is armed.
+/// </summary>
+/// <param name="timer">The timer</param>
+/// <returns>True if the timer is armed; false otherwise</returns>
+bool IsTimerArmed(const Timer *timer);
+
+/// <summary>
+///     Maximum number of events which can be drained from the epoll instance by a single call to
+///     <see cref="WaitForEventAndCallHandler" />.
+/// </summary>
+#define EPOLL_MAX_EVENTS_PER_WAIT 16
+
+/// <summary>
+/// <para>Counters describing how much work each wakeup of the event loop performed.</para>
+/// <para>Retrieve a snapshot with <see cref="GetEpollDispatchStats" />.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Number of times epoll_wait returned with at least one event.</summary>
+    uint64_t wakeups;
+    /// <summary>Total number of handlers which have been called.</summary>
+    uint64_t eventsDispatched;
+    /// <summary>Number of ready events which were dropped because their handler was
+    /// unregistered or closed by an earlier handler in the same batch.</summary>
+    uint64_t eventsDropped;
+    /// <summary>Number of wakeups which returned as many events as the budget allowed, so
+    /// further ready events were left for the next wakeup.</summary>
+    uint64_t budgetExhausted;
+    /// <summary>Largest number of events handled by a single wakeup.</summary>
+    uint32_t maxEventsPerWakeup;
+    /// <summary>Histogram of events handled per wakeup; index n counts wakeups which handled
+    /// n events.</summary>
+    uint64_t eventsPerWakeup[EPOLL_MAX_EVENTS_PER_WAIT + 1];
+} EpollDispatchStats;
+
+/// <summary>
+/// <para>Waits for events on an epoll instance and triggers their handlers.</para>
+/// <para>Up to the dispatch budget (see <see cref="SetEpollDispatchBudget" />) ready events are
+/// drained by one epoll_wait call. Each ready file descriptor is reported at most once per
+/// batch, and because epoll moves a level-triggered descriptor to the back of its ready list
+/// after reporting it, descriptors which stay readable are served in round-robin order across
+/// wakeups, so a busy descriptor cannot starve the others.</para>
 /// </summary>
 /// <param name="epollFd">
 ///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
@@ -105,6 +223,19 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
 /// <returns>0 on success, or -1 on failure</returns>
 int WaitForEventAndCallHandler(int epollFd);
 
+/// <summary>
+///     Sets the maximum number of events which are handled per wakeup of the event loop.
+/// </summary>
+/// <param name="maxEvents">Budget between 1 and EPOLL_MAX_EVENTS_PER_WAIT; out of range
+/// values are clamped.</param>
+void SetEpollDispatchBudget(int maxEvents);
+
+/// <summary>
+///     Gets a snapshot of the event loop dispatch counters.
+/// </summary>
+/// <param name="stats">Receives the counters.</param>
+void GetEpollDispatchStats(EpollDispatchStats *stats);
+
 /// <summary>
 ///     Closes a file descriptor and prints an error on failure.
 /// </summary>
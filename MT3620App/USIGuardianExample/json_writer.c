@@ -0,0 +1,342 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+static void Write(JsonWriter *writer, const char *data, size_t length)
+{
+    if (writer->failed) {
+        return;
+    }
+    if (length > writer->capacity - 1 - writer->length) {
+        writer->failed = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+static void WriteChar(JsonWriter *writer, char c)
+{
+    Write(writer, &c, 1);
+}
+
+/// <summary>
+///     Gets the length of the UTF-8 sequence at the start of a string, rejecting overlong
+///     forms, surrogates and code points above U+10FFFF.
+/// </summary>
+/// <returns>The length of the sequence, or 0 if it is not valid UTF-8</returns>
+static size_t GetUtf8SequenceLength(const unsigned char *s, size_t length)
+{
+    unsigned char lead = s[0];
+    size_t sequenceLength;
+    unsigned char min = 0x80;
+    unsigned char max = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        sequenceLength = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        sequenceLength = 3;
+        min = (lead == 0xe0) ? 0xa0 : 0x80;
+        max = (lead == 0xed) ? 0x9f : 0xbf;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        sequenceLength = 4;
+        min = (lead == 0xf0) ? 0x90 : 0x80;
+        max = (lead == 0xf4) ? 0x8f : 0xbf;
+    } else {
+        return 0;
+    }
+
+    if (sequenceLength > length || s[1] < min || s[1] > max) {
+        return 0;
+    }
+    for (size_t i = 2; i < sequenceLength; ++i) {
+        if (s[i] < 0x80 || s[i] > 0xbf) {
+            return 0;
+        }
+    }
+    return sequenceLength;
+}
+
+/// <summary>
+///     Writes a quoted, escaped string. Runs of characters which need no escape are copied at
+///     once.
+/// </summary>
+static void WriteEscaped(JsonWriter *writer, const char *value, size_t length)
+{
+    static const char HexDigits[] = "0123456789abcdef";
+    const unsigned char *s = (const unsigned char *)value;
+
+    WriteChar(writer, '"');
+    size_t runStart = 0;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        size_t sequenceLength = (c >= 0x80) ? GetUtf8SequenceLength(s + i, length - i) : 0;
+        if (sequenceLength != 0) {
+            i += sequenceLength - 1;
+            continue;
+        }
+
+        Write(writer, value + runStart, i - runStart);
+        runStart = i + 1;
+        char escape[6] = {'\\', (char)c};
+        size_t escapeLength = 2;
+        switch (c) {
+        case '"':
+        case '\\':
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            if (c < 0x20) {
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = HexDigits[c >> 4];
+                escape[5] = HexDigits[c & 0xf];
+                escapeLength = 6;
+            } else {
+                // Not UTF-8: take the byte as Latin-1 and encode it.
+                escape[0] = (char)(0xc0 | (c >> 6));
+                escape[1] = (char)(0x80 | (c & 0x3f));
+            }
+            break;
+        }
+        Write(writer, escape, escapeLength);
+    }
+    Write(writer, value + runStart, length - runStart);
+    WriteChar(writer, '"');
+}
+
+/// <summary>
+///     Writes the comma which separates a value from the previous element of its container,
+///     and checks that a value is allowed here.
+/// </summary>
+static void BeginValue(JsonWriter *writer)
+{
+    uint32_t bit = 1u << writer->depth;
+    if (writer->afterKey) {
+        writer->afterKey = false;
+        return;
+    }
+    if ((writer->isObject & bit) != 0 || (writer->depth == 0 && (writer->hasElement & bit))) {
+        // A member of an object needs a key, and the top level holds one value.
+        writer->failed = true;
+        return;
+    }
+    if (writer->hasElement & bit) {
+        WriteChar(writer, ',');
+    }
+    writer->hasElement |= bit;
+}
+
+static void BeginContainer(JsonWriter *writer, char open, bool isObject)
+{
+    BeginValue(writer);
+    if (writer->depth >= JSON_WRITER_MAX_DEPTH) {
+        writer->failed = true;
+        return;
+    }
+    WriteChar(writer, open);
+    uint32_t bit = 1u << ++writer->depth;
+    writer->hasElement &= ~bit;
+    writer->isObject = isObject ? (writer->isObject | bit) : (writer->isObject & ~bit);
+}
+
+static void EndContainer(JsonWriter *writer, char close, bool isObject)
+{
+    uint32_t bit = 1u << writer->depth;
+    if (writer->depth == 0 || writer->afterKey || ((writer->isObject & bit) != 0) != isObject) {
+        writer->failed = true;
+        return;
+    }
+    WriteChar(writer, close);
+    --writer->depth;
+}
+
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t capacity)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->failed = capacity == 0;
+}
+
+JsonWriterMark JsonWriter_GetMark(const JsonWriter *writer)
+{
+    return *writer;
+}
+
+void JsonWriter_Rewind(JsonWriter *writer, const JsonWriterMark *mark)
+{
+    *writer = *mark;
+}
+
+void JsonWriter_BeginObject(JsonWriter *writer)
+{
+    BeginContainer(writer, '{', true);
+}
+
+void JsonWriter_EndObject(JsonWriter *writer)
+{
+    EndContainer(writer, '}', true);
+}
+
+void JsonWriter_BeginArray(JsonWriter *writer)
+{
+    BeginContainer(writer, '[', false);
+}
+
+void JsonWriter_EndArray(JsonWriter *writer)
+{
+    EndContainer(writer, ']', false);
+}
+
+void JsonWriter_Key(JsonWriter *writer, const char *key)
+{
+    uint32_t bit = 1u << writer->depth;
+    if ((writer->isObject & bit) == 0 || writer->afterKey) {
+        writer->failed = true;
+        return;
+    }
+    if (writer->hasElement & bit) {
+        WriteChar(writer, ',');
+    }
+    writer->hasElement |= bit;
+    WriteEscaped(writer, key, strlen(key));
+    WriteChar(writer, ':');
+    writer->afterKey = true;
+}
+
+void JsonWriter_String(JsonWriter *writer, const char *value)
+{
+    JsonWriter_StringN(writer, value, strlen(value));
+}
+
+void JsonWriter_StringN(JsonWriter *writer, const char *value, size_t length)
+{
+    BeginValue(writer);
+    WriteEscaped(writer, value, length);
+}
+
+void JsonWriter_Base64(JsonWriter *writer, const void *data, size_t length)
+{
+    static const char Alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t *bytes = data;
+
+    BeginValue(writer);
+    WriteChar(writer, '"');
+    for (size_t i = 0; i < length; i += 3) {
+        size_t remaining = length - i;
+        uint32_t group = (uint32_t)bytes[i] << 16;
+        if (remaining > 1) {
+            group |= (uint32_t)bytes[i + 1] << 8;
+        }
+        if (remaining > 2) {
+            group |= bytes[i + 2];
+        }
+        char quad[4] = {Alphabet[(group >> 18) & 0x3f], Alphabet[(group >> 12) & 0x3f],
+                        remaining > 1 ? Alphabet[(group >> 6) & 0x3f] : '=',
+                        remaining > 2 ? Alphabet[group & 0x3f] : '='};
+        Write(writer, quad, sizeof(quad));
+    }
+    WriteChar(writer, '"');
+}
+
+/// <summary>
+///     Writes the decimal digits of an unsigned integer.
+/// </summary>
+static void WriteDigits(JsonWriter *writer, uint64_t value)
+{
+    char digits[20];
+    size_t pos = sizeof(digits);
+    do {
+        digits[--pos] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    Write(writer, digits + pos, sizeof(digits) - pos);
+}
+
+void JsonWriter_Uint(JsonWriter *writer, uint64_t value)
+{
+    BeginValue(writer);
+    WriteDigits(writer, value);
+}
+
+void JsonWriter_Int(JsonWriter *writer, int64_t value)
+{
+    BeginValue(writer);
+    if (value < 0) {
+        WriteChar(writer, '-');
+        WriteDigits(writer, 0 - (uint64_t)value);
+    } else {
+        WriteDigits(writer, (uint64_t)value);
+    }
+}
+
+void JsonWriter_Fixed(JsonWriter *writer, double value, unsigned int decimals)
+{
+    if (isnan(value) || isinf(value)) {
+        JsonWriter_Null(writer);
+        return;
+    }
+
+    BeginValue(writer);
+    char text[48];
+    int length = snprintf(text, sizeof(text), "%.*f", decimals > 9 ? 9 : (int)decimals, value);
+    if (length < 0 || (size_t)length >= sizeof(text)) {
+        // Too large for fixed point; write it with an exponent.
+        length = snprintf(text, sizeof(text), "%.17g", value);
+    }
+    Write(writer, text, (size_t)length);
+}
+
+void JsonWriter_Bool(JsonWriter *writer, bool value)
+{
+    BeginValue(writer);
+    if (value) {
+        Write(writer, "true", 4);
+    } else {
+        Write(writer, "false", 5);
+    }
+}
+
+void JsonWriter_Null(JsonWriter *writer)
+{
+    BeginValue(writer);
+    Write(writer, "null", 4);
+}
+
+int JsonWriter_Finish(JsonWriter *writer, size_t *length)
+{
+    if (writer->failed || writer->depth != 0 || writer->afterKey ||
+        (writer->hasElement & 1u) == 0) {
+        return -1;
+    }
+    writer->buffer[writer->length] = '\0';
+    if (length != NULL) {
+        *length = writer->length;
+    }
+    return 0;
+}
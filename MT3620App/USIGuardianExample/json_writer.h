@@ -0,0 +1,168 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Deepest nesting of objects and arrays which a <see cref="JsonWriter" />
+/// supports.</summary>
+#define JSON_WRITER_MAX_DEPTH 31
+
+/// <summary>
+/// <para>Writes a JSON document straight into a caller's buffer, without allocating. Strings
+/// are escaped: quotes, backslashes and control characters are escaped, and bytes which are not
+/// valid UTF-8 are written as the Latin-1 character with the same code, so any input yields a
+/// valid document.</para>
+/// <para>Commas and colons are inserted by the writer. Once the document does not fit in the
+/// buffer, the writer stops writing and <see cref="JsonWriter_Finish" /> fails, so a document
+/// is never silently truncated.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The buffer.</summary>
+    char *buffer;
+    /// <summary>Size of the buffer, including room for the terminating null.</summary>
+    size_t capacity;
+    /// <summary>Length of the document written so far.</summary>
+    size_t length;
+    /// <summary>Number of objects and arrays which are open.</summary>
+    uint32_t depth;
+    /// <summary>Bit n is set if the object or array at depth n holds an element, so the next
+    /// one needs a comma; bit 0 is for the top level, which holds one value.</summary>
+    uint32_t hasElement;
+    /// <summary>Bit n is set if the container at depth n is an object.</summary>
+    uint32_t isObject;
+    /// <summary>True if a key was written, so the next value belongs to it.</summary>
+    bool afterKey;
+    /// <summary>True if the document did not fit or was not well formed.</summary>
+    bool failed;
+} JsonWriter;
+
+/// <summary>
+///     State of a <see cref="JsonWriter" /> to which it can be rewound.
+/// </summary>
+typedef JsonWriter JsonWriterMark;
+
+/// <summary>
+///     Starts an empty document.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="buffer">Buffer which receives the document</param>
+/// <param name="capacity">Size of the buffer, including room for the terminating null</param>
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t capacity);
+
+/// <summary>
+///     Gets the state of the writer, so that a value which turns out not to fit can be removed
+///     with <see cref="JsonWriter_Rewind" />.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <returns>The state</returns>
+JsonWriterMark JsonWriter_GetMark(const JsonWriter *writer);
+
+/// <summary>
+///     Removes everything written since a mark was taken.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="mark">State from <see cref="JsonWriter_GetMark" /></param>
+void JsonWriter_Rewind(JsonWriter *writer, const JsonWriterMark *mark);
+
+/// <summary>
+///     Opens an object.
+/// </summary>
+/// <param name="writer">The writer</param>
+void JsonWriter_BeginObject(JsonWriter *writer);
+
+/// <summary>
+///     Closes the innermost object.
+/// </summary>
+/// <param name="writer">The writer</param>
+void JsonWriter_EndObject(JsonWriter *writer);
+
+/// <summary>
+///     Opens an array.
+/// </summary>
+/// <param name="writer">The writer</param>
+void JsonWriter_BeginArray(JsonWriter *writer);
+
+/// <summary>
+///     Closes the innermost array.
+/// </summary>
+/// <param name="writer">The writer</param>
+void JsonWriter_EndArray(JsonWriter *writer);
+
+/// <summary>
+///     Writes the key of the next member of an object. The key is escaped.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="key">The key</param>
+void JsonWriter_Key(JsonWriter *writer, const char *key);
+
+/// <summary>
+///     Writes a null terminated string value, escaped.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="value">The string</param>
+void JsonWriter_String(JsonWriter *writer, const char *value);
+
+/// <summary>
+///     Writes a string value of a given length, which may contain nulls, escaped.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="value">The string</param>
+/// <param name="length">Length of the string</param>
+void JsonWriter_StringN(JsonWriter *writer, const char *value, size_t length);
+
+/// <summary>
+///     Writes binary data as a base64 string value, with padding.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="data">The data</param>
+/// <param name="length">Length of the data</param>
+void JsonWriter_Base64(JsonWriter *writer, const void *data, size_t length);
+
+/// <summary>
+///     Writes an unsigned integer value.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="value">The value</param>
+void JsonWriter_Uint(JsonWriter *writer, uint64_t value);
+
+/// <summary>
+///     Writes a signed integer value.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="value">The value</param>
+void JsonWriter_Int(JsonWriter *writer, int64_t value);
+
+/// <summary>
+///     Writes a number with a fixed number of decimal places. NaN and infinities, which JSON
+///     cannot represent, are written as null.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="value">The value</param>
+/// <param name="decimals">Number of decimal places, at most 9</param>
+void JsonWriter_Fixed(JsonWriter *writer, double value, unsigned int decimals);
+
+/// <summary>
+///     Writes true or false.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="value">The value</param>
+void JsonWriter_Bool(JsonWriter *writer, bool value);
+
+/// <summary>
+///     Writes null.
+/// </summary>
+/// <param name="writer">The writer</param>
+void JsonWriter_Null(JsonWriter *writer);
+
+/// <summary>
+///     Null terminates the document and checks that it is complete.
+/// </summary>
+/// <param name="writer">The writer</param>
+/// <param name="length">Receives the length of the document, without the terminating null;
+/// may be NULL</param>
+/// <returns>0 on success, or -1 if the document did not fit, has open objects or arrays, or
+/// was not well formed</returns>
+int JsonWriter_Finish(JsonWriter *writer, size_t *length);
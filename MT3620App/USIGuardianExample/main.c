@@ -3,10 +3,10 @@
 
 #include "common.h"
 #include "wifisetupbybt.h"
-#include "usi_uart.h"
+#include "usi_serial.h"
+#include "usi_modbus.h"
 #include "usi_private_ethernet.h"
 #include "usi_azureiot.h"
-#include "usi_rs232_485.h"
 #include "nordic/dfu_uart_protocol.h"
 
 static int nrfUartFd = -1;
@@ -121,21 +121,26 @@ int main(int argc, char *argv[])
 		terminationRequired = true;
 	}
 
+	// All module timers are multiplexed onto the timer wheel, so create it before any module.
+	if (CreateTimerWheelAndAddToEpoll(epollFd) != 0) {
+		terminationRequired = true;
+	}
+
 	// Update BLE FW
 	InitDFUPeripheralsAndHandlers();
 	updateBleFw();
 
-#if (defined(BUILD_USI_UART) )
-	if (USIUart_Init(epollFd, terminationRequired) != 0) {
+#if (defined(BUILD_USI_SERIAL) )
+	if (USISerial_Init(epollFd, terminationRequired) != 0) {
 		terminationRequired = true;
-		Log_Debug("Init USI UART Fail\n");
+		Log_Debug("Init USI Serial Fail\n");
 	}
 #endif
 
-#if (defined(BUILD_USI_RS232_485) )
-	if (USIRs_Init(epollFd, terminationRequired) != 0) {
+#if (defined(BUILD_USI_MODBUS) )
+	if (USIModbus_Init(epollFd, terminationRequired) != 0) {
 		terminationRequired = true;
-		Log_Debug("Init USI RS232&485 Fail\n");
+		Log_Debug("Init USI Modbus Fail\n");
 	}
 #endif
 
@@ -169,16 +174,17 @@ int main(int argc, char *argv[])
 #if (defined(BUILD_USI_WIFISETUPBYBT) )
 	WiFiSetupByBT_Deinit();
 #endif
-#if (defined(BUILD_USI_UART) )
-	USIUart_Deinit();
+#if (defined(BUILD_USI_MODBUS) )
+	USIModbus_Deinit();
 #endif
-#if (defined(BUILD_USI_RS232_485) )
-	USIRs_Deinit();
+#if (defined(BUILD_USI_SERIAL) )
+	USISerial_Deinit();
 #endif
 #if (defined(BUILD_USI_PRIVATE_ETHERNET) )
 	USIPrivateEthernet_Deinit();
 #endif
 	USIAzureIoT_Deinit();
+	CloseTimerWheel();
     Log_Debug("INFO: Application exiting\n");
     return 0;
 }
\ No newline at end of file
@@ -19,7 +19,6 @@
 // File descriptors - initialized to invalid value.
 static int epollFdRef = -1;
 static int messageUartFd = -1;
-static int sendRequestMessageTimerFd = -1;
 
 // Buffer for data received via UART and index at which to write future data.
 static uint8_t receiveBuffer[UART_RECEIVED_BUFFER_SIZE];
@@ -43,6 +42,10 @@ typedef enum {
 // Current state of the message protocol.
 static MessageProtocolState protocolState;
 
+// Timer for the response to the outstanding request.
+static void RequestTimeoutEventHandler(Timer *timer);
+static Timer requestTimeoutTimer = {.timerHandler = &RequestTimeoutEventHandler};
+
 // True if the EPOLLOUT event is registered for the UART fd; false if not.
 static bool uartFdEpolloutEnabled = false;
 
@@ -180,8 +183,7 @@ static void CallResponseHandler(void)
         return;
     }
     protocolState = MessageProtocolState_Idle;
-    struct timespec disabled = {0, 0};
-    SetTimerFdToPeriod(sendRequestMessageTimerFd, &disabled);
+    DisarmTimer(&requestTimeoutTimer);
 
     MessageProtocol_ResponseHandlerType handler = currentResponseHandler;
     currentResponseHandler = NULL;
@@ -230,12 +232,8 @@ static void HandleReceivedMessage(EventData *eventData)
     }
 }
 
-static void RequestTimeoutEventHandler(EventData *eventData)
+static void RequestTimeoutEventHandler(Timer *timer)
 {
-    if (ConsumeTimerFdEvent(sendRequestMessageTimerFd) != 0) {
-        return;
-    }
-
     // Timed out waiting for response message: change back to Idle state and call the response
     // handler to inform it that the request has timed out.
     protocolState = MessageProtocolState_Idle;
@@ -253,7 +251,6 @@ static void RequestTimeoutEventHandler(EventData *eventData)
 }
 
 static void SendUartMessage(EventData *eventData);
-static EventData requestTimeoutEventData = {.eventHandler = &RequestTimeoutEventHandler};
 static EventData uartReceivedEventData = {.eventHandler = &HandleReceivedMessage};
 static EventData uartSendEventData = {.eventHandler = &SendUartMessage};
 
@@ -293,14 +290,6 @@ int MessageProtocol_Init(int epollFd, int uartFd)
         return -1;
     }
 
-    // Set up request timeout timer, for later use.
-    struct timespec disabled = {0, 0};
-    sendRequestMessageTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &disabled, &requestTimeoutEventData, EPOLLIN);
-    if (sendRequestMessageTimerFd < 0) {
-        return -1;
-    }
-
     protocolState = MessageProtocolState_Idle;
     currentResponseHandler = NULL;
     eventHandlerList = NULL;
@@ -310,7 +299,7 @@ int MessageProtocol_Init(int epollFd, int uartFd)
 
 void MessageProtocol_Cleanup(void)
 {
-    CloseFdAndPrintError(sendRequestMessageTimerFd, "SendRequestMessageTimer");
+    DisarmTimer(&requestTimeoutTimer);
     // Free all event handlers in the list.
     struct EventHandlerNode *currentEventHandler = NULL;
     while (eventHandlerList != NULL) {
@@ -388,7 +377,7 @@ void MessageProtocol_SendRequest(MessageProtocol_CategoryId categoryId,
 
     // Start timer for response to this request.
     const struct timespec sendRequestMessageCheckPeriod = {REQUEST_TIMEOUT, 0};
-    SetTimerFdToSingleExpiry(sendRequestMessageTimerFd, &sendRequestMessageCheckPeriod);
+    SetTimerToSingleExpiry(&requestTimeoutTimer, &sendRequestMessageCheckPeriod);
     protocolState = MessageProtocolState_RequestOutstanding;
 
     SendUartMessage(NULL);
@@ -0,0 +1,121 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Largest Modbus RTU frame, including the slave address and CRC.</summary>
+#define MODBUS_RTU_MAX_FRAME_SIZE 256
+
+/// <summary>Largest protocol data unit: a function code and its data.</summary>
+#define MODBUS_MAX_PDU_SIZE 253
+
+/// <summary>Length of a read request frame.</summary>
+#define MODBUS_RTU_READ_REQUEST_SIZE 8
+
+/// <summary>Largest number of registers which function 3 or 4 can read at once.</summary>
+#define MODBUS_MAX_READ_REGISTERS 125
+
+/// <summary>Largest number of bits which function 1 or 2 can read at once.</summary>
+#define MODBUS_MAX_READ_BITS 2000
+
+/// <summary>
+///     Modbus function codes which the master uses.
+/// </summary>
+typedef enum {
+    ModbusFunction_ReadCoils = 1,
+    ModbusFunction_ReadDiscreteInputs = 2,
+    ModbusFunction_ReadHoldingRegisters = 3,
+    ModbusFunction_ReadInputRegisters = 4
+} ModbusFunction;
+
+/// <summary>Exception code: the gateway cannot forward the request.</summary>
+#define MODBUS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE 0x0A
+
+/// <summary>Exception code: the device behind the gateway did not respond.</summary>
+#define MODBUS_EXCEPTION_GATEWAY_TARGET_FAILED 0x0B
+
+/// <summary>
+///     Result of parsing a response.
+/// </summary>
+typedef enum {
+    /// <summary>The response is valid.</summary>
+    ModbusRtuResult_Ok = 0,
+    /// <summary>The frame's CRC is wrong.</summary>
+    ModbusRtuResult_BadCrc,
+    /// <summary>The slave returned an exception response.</summary>
+    ModbusRtuResult_Exception,
+    /// <summary>The frame is not a response to the request.</summary>
+    ModbusRtuResult_Mismatch
+} ModbusRtuResult;
+
+/// <summary>
+///     Computes the Modbus CRC-16 of a buffer.
+/// </summary>
+/// <param name="data">The data</param>
+/// <param name="length">Length of the data in bytes</param>
+/// <returns>The CRC, which is transmitted low byte first</returns>
+uint16_t ModbusRtu_Crc16(const uint8_t *data, size_t length);
+
+/// <summary>
+///     Appends the CRC to a frame.
+/// </summary>
+/// <param name="frame">The frame, which must have room for two more bytes</param>
+/// <param name="length">Length of the frame without the CRC</param>
+/// <returns>Length of the frame with the CRC</returns>
+size_t ModbusRtu_AppendCrc(uint8_t *frame, size_t length);
+
+/// <summary>
+///     Checks the CRC at the end of a frame.
+/// </summary>
+/// <param name="frame">The frame, including the CRC</param>
+/// <param name="length">Length of the frame</param>
+/// <returns>True if the frame is long enough and its CRC is valid; false otherwise</returns>
+bool ModbusRtu_IsCrcValid(const uint8_t *frame, size_t length);
+
+/// <summary>
+///     Returns whether a function reads bits (coils or discrete inputs) rather than registers.
+/// </summary>
+bool ModbusRtu_IsBitFunction(uint8_t function);
+
+/// <summary>
+///     Builds a request for function 1, 2, 3 or 4.
+/// </summary>
+/// <param name="frame">Receives the request; it must hold MODBUS_RTU_READ_REQUEST_SIZE
+/// bytes</param>
+/// <param name="slaveId">Slave address</param>
+/// <param name="function">Function code</param>
+/// <param name="address">Address of the first register or bit</param>
+/// <param name="count">Number of registers or bits</param>
+/// <returns>Length of the request</returns>
+size_t ModbusRtu_BuildReadRequest(uint8_t *frame, uint8_t slaveId, uint8_t function,
+                                  uint16_t address, uint16_t count);
+
+/// <summary>
+///     Parses the response to a request built by <see cref="ModbusRtu_BuildReadRequest" />.
+/// </summary>
+/// <param name="frame">The response frame</param>
+/// <param name="length">Length of the frame</param>
+/// <param name="slaveId">Slave address of the request</param>
+/// <param name="function">Function code of the request</param>
+/// <param name="count">Number of registers or bits which were requested</param>
+/// <param name="data">Receives a pointer to the register data (big endian) or packed bits</param>
+/// <param name="exceptionCode">Receives the exception code of an exception response</param>
+/// <returns>The result</returns>
+ModbusRtuResult ModbusRtu_ParseReadResponse(const uint8_t *frame, size_t length, uint8_t slaveId,
+                                            uint8_t function, uint16_t count,
+                                            const uint8_t **data, uint8_t *exceptionCode);
+
+/// <summary>
+///     Checks that a frame is a response, normal or exception, to an arbitrary request. The
+///     response's PDU is the frame without its first byte and its CRC.
+/// </summary>
+/// <param name="frame">The response frame</param>
+/// <param name="length">Length of the frame</param>
+/// <param name="slaveId">Slave address of the request</param>
+/// <param name="function">Function code of the request</param>
+/// <returns>ModbusRtuResult_Ok, ModbusRtuResult_BadCrc or ModbusRtuResult_Mismatch</returns>
+ModbusRtuResult ModbusRtu_CheckResponse(const uint8_t *frame, size_t length, uint8_t slaveId,
+                                        uint8_t function);
@@ -0,0 +1,505 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for accept4
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "modbus_tcp_server.h"
+#include "usi_modbus.h"
+
+#if (defined(BUILD_USI_MODBUS))
+
+// Responses queued for one client; a client which does not read them is disconnected.
+#define CLIENT_TX_QUEUE_LIMIT 4096
+
+// Support functions.
+static void HandleListenEvent(EventData *eventData);
+static void HandleClientEvent(EventData *eventData);
+static void HandleResponse(const uint8_t *pdu, size_t pduLength, void *context);
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType);
+static void ReportError(const char *desc);
+static void CloseClient(ModbusTcpServer_Client *client);
+
+ModbusTcpServer_ServerState *ModbusTcpServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
+                                                   int backlogSize, uint32_t cacheTtlMs)
+{
+    ModbusTcpServer_ServerState *serverState = calloc(1, sizeof(*serverState));
+    if (!serverState) {
+        abort();
+    }
+
+    // Set the state to unused values so it can be safely cleaned up if only a subset of the
+    // resources are successfully allocated.
+    serverState->epollFd = epollFd;
+    serverState->listenFd = -1;
+    serverState->listenEvent.eventHandler = HandleListenEvent;
+    serverState->cacheTtlMs = cacheTtlMs;
+    for (size_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; ++i) {
+        serverState->clients[i].server = serverState;
+        serverState->clients[i].clientFd = -1;
+        serverState->clients[i].clientEvent.eventHandler = HandleClientEvent;
+    }
+
+    int sockType = SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
+    serverState->listenFd = OpenIpV4Socket(ipAddr, port, sockType);
+    if (serverState->listenFd < 0) {
+        ReportError("open socket");
+        goto fail;
+    }
+
+    // Be notified asynchronously when a client connects.
+    RegisterEventHandlerToEpoll(epollFd, serverState->listenFd, &serverState->listenEvent, EPOLLIN);
+
+    int result = listen(serverState->listenFd, backlogSize);
+    if (result != 0) {
+        ReportError("listen");
+        goto fail;
+    }
+
+    Log_Debug("INFO: Modbus TCP server: Listening on port %u (fd %d).\n", port,
+              serverState->listenFd);
+
+    return serverState;
+
+fail:
+    ModbusTcpServer_ShutDown(serverState);
+    return NULL;
+}
+
+void ModbusTcpServer_ShutDown(ModbusTcpServer_ServerState *serverState)
+{
+    if (!serverState) {
+        return;
+    }
+
+    for (size_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; ++i) {
+        CloseClient(&serverState->clients[i]);
+    }
+    CloseFdAndPrintError(serverState->listenFd, "modbusListenFd");
+
+    free(serverState);
+}
+
+static uint64_t GetNowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static void HandleListenEvent(EventData *eventData)
+{
+    ModbusTcpServer_ServerState *serverState =
+        (ModbusTcpServer_ServerState *)((uint8_t *)eventData -
+                                        offsetof(ModbusTcpServer_ServerState, listenEvent));
+
+    struct sockaddr in_addr;
+    socklen_t sockLen = sizeof(in_addr);
+    int localFd =
+        accept4(serverState->listenFd, &in_addr, &sockLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (localFd < 0) {
+        ReportError("accept");
+        return;
+    }
+
+    ModbusTcpServer_Client *client = NULL;
+    for (size_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; ++i) {
+        if (serverState->clients[i].clientFd < 0) {
+            client = &serverState->clients[i];
+            break;
+        }
+    }
+    if (client == NULL) {
+        Log_Debug("INFO: Modbus TCP server: Too many clients, refusing connection.\n");
+        close(localFd);
+        return;
+    }
+
+    Log_Debug("INFO: Modbus TCP server: Accepted client connection (fd %d).\n", localFd);
+
+    client->clientFd = localFd;
+    client->epollOutEnabled = false;
+    client->rxLength = 0;
+    client->pendingCount = 0;
+    TxQueue_Init(&client->txQueue, CLIENT_TX_QUEUE_LIMIT);
+    if (RegisterEventHandlerToEpoll(serverState->epollFd, client->clientFd, &client->clientEvent,
+                                    EPOLLIN) != 0) {
+        CloseClient(client);
+    }
+}
+
+/// <summary>
+///     Closes a client's socket and cancels its requests which wait for the bus.
+/// </summary>
+static void CloseClient(ModbusTcpServer_Client *client)
+{
+    if (client->clientFd < 0) {
+        return;
+    }
+
+    ModbusTcpServer_ServerState *serverState = client->server;
+    for (size_t i = 0; i < MODBUS_TCP_MAX_PENDING; ++i) {
+        ModbusTcpServer_Pending *pending = &serverState->pending[i];
+        if (pending->client == client) {
+            USIModbus_Cancel(pending);
+            pending->client = NULL;
+        }
+    }
+
+    UnregisterEventHandlerFromEpoll(serverState->epollFd, client->clientFd);
+    CloseFdAndPrintError(client->clientFd, "modbusClientFd");
+    client->clientFd = -1;
+    TxQueue_Clear(&client->txQueue);
+}
+
+/// <summary>
+///     Writes as much of a client's queued responses as the socket accepts, and waits for
+///     EPOLLOUT only while some remain.
+/// </summary>
+/// <returns>0 on success, or -1 if the client was closed</returns>
+static int FlushClient(ModbusTcpServer_Client *client)
+{
+    if (TxQueue_Drain(&client->txQueue, client->clientFd) != 0) {
+        ReportError("send");
+        CloseClient(client);
+        return -1;
+    }
+
+    bool epollOutEnabled = !TxQueue_IsEmpty(&client->txQueue);
+    if (epollOutEnabled != client->epollOutEnabled) {
+        RegisterEventHandlerToEpoll(client->server->epollFd, client->clientFd,
+                                    &client->clientEvent,
+                                    EPOLLIN | (epollOutEnabled ? EPOLLOUT : 0));
+        client->epollOutEnabled = epollOutEnabled;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Queues a response with its MBAP header for a client.
+/// </summary>
+static void SendResponse(ModbusTcpServer_Client *client, uint16_t transactionId, uint8_t unitId,
+                         const uint8_t *pdu, size_t pduLength)
+{
+    if (client->clientFd < 0) {
+        return;
+    }
+
+    uint8_t adu[MODBUS_TCP_MBAP_HEADER_SIZE + MODBUS_MAX_PDU_SIZE];
+    size_t length = 1 + pduLength;
+    adu[0] = (uint8_t)(transactionId >> 8);
+    adu[1] = (uint8_t)(transactionId & 0xFF);
+    adu[2] = 0;
+    adu[3] = 0;
+    adu[4] = (uint8_t)(length >> 8);
+    adu[5] = (uint8_t)(length & 0xFF);
+    adu[6] = unitId;
+    memcpy(adu + MODBUS_TCP_MBAP_HEADER_SIZE, pdu, pduLength);
+
+    if (TxQueue_Enqueue(&client->txQueue, adu, MODBUS_TCP_MBAP_HEADER_SIZE + pduLength) != 0) {
+        Log_Debug("INFO: Modbus TCP server: Client is not reading its responses, closing it.\n");
+        CloseClient(client);
+        return;
+    }
+    FlushClient(client);
+}
+
+static void SendException(ModbusTcpServer_Client *client, uint16_t transactionId, uint8_t unitId,
+                          uint8_t function, uint8_t exceptionCode)
+{
+    uint8_t pdu[2] = {(uint8_t)(function | 0x80), exceptionCode};
+    SendResponse(client, transactionId, unitId, pdu, sizeof(pdu));
+}
+
+static bool IsCacheableRead(const uint8_t *pdu, size_t pduLength)
+{
+    return pduLength == 5 && pdu[0] >= ModbusFunction_ReadCoils &&
+           pdu[0] <= ModbusFunction_ReadInputRegisters;
+}
+
+/// <summary>
+///     Returns the cached response to a read, or NULL if there is none which is fresh enough.
+/// </summary>
+static const ModbusTcpServer_CacheEntry *FindCachedResponse(
+    const ModbusTcpServer_ServerState *serverState, uint8_t unitId, const uint8_t *request)
+{
+    uint64_t nowMs = GetNowMs();
+    for (size_t i = 0; i < MODBUS_TCP_CACHE_SIZE; ++i) {
+        const ModbusTcpServer_CacheEntry *entry = &serverState->cache[i];
+        if (entry->unitId == unitId && memcmp(entry->request, request, 5) == 0 &&
+            nowMs - entry->receivedMs < serverState->cacheTtlMs) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Caches a read response, replacing the entry for the same read or else the oldest entry.
+/// </summary>
+static void CacheResponse(ModbusTcpServer_ServerState *serverState, uint8_t unitId,
+                          const uint8_t *request, const uint8_t *pdu, size_t pduLength)
+{
+    ModbusTcpServer_CacheEntry *entry = &serverState->cache[0];
+    for (size_t i = 0; i < MODBUS_TCP_CACHE_SIZE; ++i) {
+        ModbusTcpServer_CacheEntry *candidate = &serverState->cache[i];
+        if (candidate->unitId == unitId && memcmp(candidate->request, request, 5) == 0) {
+            entry = candidate;
+            break;
+        }
+        if (candidate->unitId == 0 ||
+            (entry->unitId != 0 && candidate->receivedMs < entry->receivedMs)) {
+            entry = candidate;
+        }
+    }
+
+    entry->unitId = unitId;
+    memcpy(entry->request, request, 5);
+    entry->receivedMs = GetNowMs();
+    entry->pduLength = pduLength;
+    memcpy(entry->pdu, pdu, pduLength);
+}
+
+/// <summary>
+///     Drops a slave's cached responses, so reads which follow a write see its effect, and
+///     starts a new generation, so reads which are already waiting for the bus are not cached.
+/// </summary>
+static void InvalidateCache(ModbusTcpServer_ServerState *serverState, uint8_t unitId)
+{
+    ++serverState->cacheGenerations[unitId];
+    for (size_t i = 0; i < MODBUS_TCP_CACHE_SIZE; ++i) {
+        if (serverState->cache[i].unitId == unitId) {
+            serverState->cache[i].unitId = 0;
+        }
+    }
+}
+
+/// <summary>
+///     Handles a complete request from a client: answers it from the cache, or forwards it to
+///     the bus.
+/// </summary>
+static void HandleRequest(ModbusTcpServer_Client *client, uint16_t transactionId, uint8_t unitId,
+                          const uint8_t *pdu, size_t pduLength)
+{
+    ModbusTcpServer_ServerState *serverState = client->server;
+    bool isCacheable = IsCacheableRead(pdu, pduLength);
+
+    if (isCacheable && serverState->cacheTtlMs > 0) {
+        const ModbusTcpServer_CacheEntry *entry = FindCachedResponse(serverState, unitId, pdu);
+        if (entry != NULL) {
+            SendResponse(client, transactionId, unitId, entry->pdu, entry->pduLength);
+            return;
+        }
+    }
+    else if (!isCacheable) {
+        InvalidateCache(serverState, unitId);
+    }
+
+    ModbusTcpServer_Pending *pending = NULL;
+    if (client->pendingCount < MODBUS_TCP_MAX_PENDING_PER_CLIENT) {
+        for (size_t i = 0; i < MODBUS_TCP_MAX_PENDING; ++i) {
+            if (serverState->pending[i].client == NULL) {
+                pending = &serverState->pending[i];
+                break;
+            }
+        }
+    }
+
+    if (pending == NULL) {
+        SendException(client, transactionId, unitId, pdu[0],
+                      MODBUS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+        return;
+    }
+
+    // The record is filled in before the request is submitted, because the Modbus master calls
+    // HandleResponse from within USIModbus_Submit when the request cannot be sent.
+    pending->client = client;
+    pending->transactionId = transactionId;
+    pending->unitId = unitId;
+    memset(pending->request, 0, sizeof(pending->request));
+    memcpy(pending->request, pdu, pduLength < sizeof(pending->request) ? pduLength
+                                                                       : sizeof(pending->request));
+    pending->isCacheable = isCacheable;
+    pending->cacheGeneration = serverState->cacheGenerations[unitId];
+    ++client->pendingCount;
+
+    // Unit IDs outside 1 to 247 would be broadcasts, which have no response to return.
+    if (USIModbus_Submit(unitId, pdu, pduLength, HandleResponse, pending) != 0) {
+        pending->client = NULL;
+        --client->pendingCount;
+        SendException(client, transactionId, unitId, pdu[0],
+                      MODBUS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+    }
+}
+
+/// <summary>
+///     Called by the Modbus master with the response to a forwarded request.
+/// </summary>
+static void HandleResponse(const uint8_t *pdu, size_t pduLength, void *context)
+{
+    ModbusTcpServer_Pending *pending = context;
+    ModbusTcpServer_Client *client = pending->client;
+    ModbusTcpServer_ServerState *serverState = client->server;
+    pending->client = NULL;
+    --client->pendingCount;
+
+    // A write may have run between a read which was waiting for the bus and the read's
+    // response, so the cache is invalidated again when the write completes.
+    if (!pending->isCacheable) {
+        InvalidateCache(serverState, pending->unitId);
+    }
+
+    if (pdu == NULL) {
+        SendException(client, pending->transactionId, pending->unitId, pending->request[0],
+                      MODBUS_EXCEPTION_GATEWAY_TARGET_FAILED);
+        return;
+    }
+
+    if (serverState->cacheTtlMs > 0 && pending->isCacheable && (pdu[0] & 0x80) == 0) {
+        if (pending->cacheGeneration == serverState->cacheGenerations[pending->unitId]) {
+            CacheResponse(serverState, pending->unitId, pending->request, pdu, pduLength);
+        }
+
+        // Identical reads which queued up behind this one, in the same generation, are
+        // answered with the same response instead of going to the bus.
+        for (size_t i = 0; i < MODBUS_TCP_MAX_PENDING; ++i) {
+            ModbusTcpServer_Pending *other = &serverState->pending[i];
+            if (other->client != NULL && other->isCacheable && other->unitId == pending->unitId &&
+                other->cacheGeneration == pending->cacheGeneration &&
+                memcmp(other->request, pending->request, sizeof(other->request)) == 0) {
+                ModbusTcpServer_Client *otherClient = other->client;
+                USIModbus_Cancel(other);
+                other->client = NULL;
+                --otherClient->pendingCount;
+                SendResponse(otherClient, other->transactionId, other->unitId, pdu, pduLength);
+            }
+        }
+    }
+    SendResponse(client, pending->transactionId, pending->unitId, pdu, pduLength);
+}
+
+/// <summary>
+///     Handles data from a client: splits it into MBAP frames and handles each request.
+/// </summary>
+/// <returns>0 on success, or -1 if the client was closed</returns>
+static int HandleClientData(ModbusTcpServer_Client *client)
+{
+    ssize_t bytesRead = recv(client->clientFd, client->rx + client->rxLength,
+                             sizeof(client->rx) - client->rxLength, /* flags */ 0);
+    if (bytesRead == 0) {
+        Log_Debug("INFO: Modbus TCP server: Client has closed connection.\n");
+        CloseClient(client);
+        return -1;
+    }
+    if (bytesRead < 0) {
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        ReportError("recv");
+        CloseClient(client);
+        return -1;
+    }
+    client->rxLength += (size_t)bytesRead;
+
+    size_t offset = 0;
+    while (client->rxLength - offset >= MODBUS_TCP_MBAP_HEADER_SIZE) {
+        const uint8_t *header = client->rx + offset;
+        uint16_t transactionId = (uint16_t)((header[0] << 8) | header[1]);
+        uint16_t protocolId = (uint16_t)((header[2] << 8) | header[3]);
+        size_t length = (size_t)((header[4] << 8) | header[5]);
+        if (protocolId != 0 || length < 2 || length > 1 + MODBUS_MAX_PDU_SIZE) {
+            Log_Debug("INFO: Modbus TCP server: Invalid MBAP header, closing client.\n");
+            CloseClient(client);
+            return -1;
+        }
+
+        size_t frameSize = MODBUS_TCP_MBAP_HEADER_SIZE - 1 + length;
+        if (client->rxLength - offset < frameSize) {
+            break;
+        }
+
+        HandleRequest(client, transactionId, header[6], header + MODBUS_TCP_MBAP_HEADER_SIZE,
+                      length - 1);
+        if (client->clientFd < 0) {
+            return -1;
+        }
+        offset += frameSize;
+    }
+
+    // Keep the start of a partly received request for the next read.
+    memmove(client->rx, client->rx + offset, client->rxLength - offset);
+    client->rxLength -= offset;
+    return 0;
+}
+
+static void HandleClientEvent(EventData *eventData)
+{
+    ModbusTcpServer_Client *client =
+        (ModbusTcpServer_Client *)((uint8_t *)eventData -
+                                   offsetof(ModbusTcpServer_Client, clientEvent));
+
+    if ((eventData->events & EPOLLOUT) != 0 && FlushClient(client) != 0) {
+        return;
+    }
+    if ((eventData->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+        HandleClientData(client);
+    }
+}
+
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType)
+{
+    int localFd = -1;
+    int retFd = -1;
+
+    do {
+        localFd = socket(AF_INET, sockType, /* protocol */ 0);
+        if (localFd < 0) {
+            ReportError("socket");
+            break;
+        }
+
+        // Enable rebinding soon after a socket has been closed.
+        int enableReuseAddr = 1;
+        int r = setsockopt(localFd, SOL_SOCKET, SO_REUSEADDR, &enableReuseAddr,
+                           sizeof(enableReuseAddr));
+        if (r != 0) {
+            ReportError("setsockopt/SO_REUSEADDR");
+            break;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ipAddr;
+        addr.sin_port = htons(port);
+
+        r = bind(localFd, (const struct sockaddr *)&addr, sizeof(addr));
+        if (r != 0) {
+            ReportError("bind");
+            break;
+        }
+
+        retFd = localFd;
+        localFd = -1;
+    } while (0);
+
+    close(localFd);
+
+    return retFd;
+}
+
+static void ReportError(const char *desc)
+{
+    Log_Debug("ERROR: Modbus TCP server: \"%s\", errno=%d (%s)\n", desc, errno, strerror(errno));
+}
+
+#endif
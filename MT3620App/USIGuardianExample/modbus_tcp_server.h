@@ -0,0 +1,136 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "netinet/in.h"
+
+#include "epoll_timerfd_utilities.h"
+#include "tx_queue.h"
+#include "modbus_rtu.h"
+
+/// <summary>Length of the MBAP header which precedes each PDU on Modbus TCP.</summary>
+#define MODBUS_TCP_MBAP_HEADER_SIZE 7
+
+/// <summary>Largest number of clients which may be connected at once.</summary>
+#define MODBUS_TCP_MAX_CLIENTS 4
+
+/// <summary>Largest number of requests which may wait for the bus, across all clients.</summary>
+#define MODBUS_TCP_MAX_PENDING 16
+
+/// <summary>Largest number of requests which one client may have waiting for the bus.</summary>
+#define MODBUS_TCP_MAX_PENDING_PER_CLIENT 8
+
+/// <summary>Number of read responses which are cached.</summary>
+#define MODBUS_TCP_CACHE_SIZE 16
+
+struct ModbusTcpServer_ServerState;
+
+/// <summary>
+/// A client connection of the Modbus TCP server.
+/// </summary>
+typedef struct {
+    /// <summary>Server which accepted the connection.</summary>
+    struct ModbusTcpServer_ServerState *server;
+    /// <summary>Accepted socket, or -1 if the slot is free.</summary>
+    int clientFd;
+    /// <summary>Callback which is invoked when the socket is readable or writable.</summary>
+    EventData clientEvent;
+    /// <summary>Whether the socket is registered for EPOLLOUT.</summary>
+    bool epollOutEnabled;
+    /// <summary>Number of bytes of a partly received request.</summary>
+    size_t rxLength;
+    /// <summary>Partly received request: MBAP header and PDU.</summary>
+    uint8_t rx[MODBUS_TCP_MBAP_HEADER_SIZE + MODBUS_MAX_PDU_SIZE];
+    /// <summary>Responses waiting to be sent.</summary>
+    TxQueue txQueue;
+    /// <summary>Number of the client's requests which wait for the bus.</summary>
+    size_t pendingCount;
+} ModbusTcpServer_Client;
+
+/// <summary>
+/// A request which waits for the bus. Its address is the context of the submitted request, so
+/// responses find their client and transaction ID.
+/// </summary>
+typedef struct {
+    /// <summary>Client which sent the request, or NULL if the record is free.</summary>
+    ModbusTcpServer_Client *client;
+    /// <summary>MBAP transaction ID, echoed in the response.</summary>
+    uint16_t transactionId;
+    /// <summary>Slave address.</summary>
+    uint8_t unitId;
+    /// <summary>First bytes of the request PDU: function, address and count of a read.</summary>
+    uint8_t request[5];
+    /// <summary>Whether the request is a read whose response can be cached.</summary>
+    bool isCacheable;
+    /// <summary>Cache generation of the slave when the request was received; a response to a
+    /// read which started before the slave's cache was last invalidated is not cached.</summary>
+    uint32_t cacheGeneration;
+} ModbusTcpServer_Pending;
+
+/// <summary>
+/// A cached response to a read of coils, discrete inputs, holding or input registers.
+/// </summary>
+typedef struct {
+    /// <summary>Slave address; 0 if the entry is unused.</summary>
+    uint8_t unitId;
+    /// <summary>Function, address and count of the request.</summary>
+    uint8_t request[5];
+    /// <summary>Time at which the response was received, in milliseconds.</summary>
+    uint64_t receivedMs;
+    /// <summary>Length of the response PDU.</summary>
+    size_t pduLength;
+    /// <summary>The response PDU.</summary>
+    uint8_t pdu[MODBUS_MAX_PDU_SIZE];
+} ModbusTcpServer_CacheEntry;
+
+/// <summary>
+/// <para>Bundles together state about an active Modbus TCP server.</para>
+/// <para>This should be allocated with <see cref="ModbusTcpServer_Start" /> and freed with
+/// <see cref="ModbusTcpServer_ShutDown" />. The client should not directly modify member
+/// variables.</para>
+/// </summary>
+typedef struct ModbusTcpServer_ServerState {
+    /// <summary>Epoll which is used to respond asynchronously to incoming connections.</summary>
+    int epollFd;
+    /// <summary>Socket which listens for incoming connections.</summary>
+    int listenFd;
+    /// <summary>Callback which is invoked when a new connection is received.</summary>
+    EventData listenEvent;
+    /// <summary>Connected clients.</summary>
+    ModbusTcpServer_Client clients[MODBUS_TCP_MAX_CLIENTS];
+    /// <summary>Requests which wait for the bus.</summary>
+    ModbusTcpServer_Pending pending[MODBUS_TCP_MAX_PENDING];
+    /// <summary>How long a read response is served from the cache, in milliseconds; zero
+    /// disables the cache.</summary>
+    uint32_t cacheTtlMs;
+    /// <summary>Cached read responses.</summary>
+    ModbusTcpServer_CacheEntry cache[MODBUS_TCP_CACHE_SIZE];
+    /// <summary>Number of times each slave's cached responses were invalidated, by slave
+    /// address.</summary>
+    uint32_t cacheGenerations[256];
+} ModbusTcpServer_ServerState;
+
+/// <summary>
+/// <para>Open a Modbus TCP server on the supplied IP address and port. Requests are forwarded
+/// to the slaves on the Modbus RTU bus, one at a time, and the responses are returned to the
+/// clients which sent them.</para>
+/// <param name="epollFd">Descriptor to epoll created with CreateEpollFd.</param>
+/// <param name="ipAddr">IP address to which the listen socket is bound.</param>
+/// <param name="port">TCP port to which the socket is bound.</param>
+/// <param name="backlogSize">Listening socket queue length.</param>
+/// <param name="cacheTtlMs">How long a read response is served from the cache to every client,
+/// in milliseconds; zero disables the cache.</param>
+/// <returns>Server state which is used to manage the server's resources, NULL on failure.
+/// Should be disposed with <see cref="ModbusTcpServer_ShutDown" />.</returns>
+/// </summary>
+ModbusTcpServer_ServerState *ModbusTcpServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
+                                                   int backlogSize, uint32_t cacheTtlMs);
+
+/// <summary>
+/// <para>Closes the listening and accepted sockets, cancels the requests which wait for the bus
+/// and frees the server.</para>
+/// <param name="serverState">Server state allocated with
+/// <see cref="ModbusTcpServer_Start" />.</param>
+/// </summary>
+void ModbusTcpServer_ShutDown(ModbusTcpServer_ServerState *serverState);
@@ -256,17 +256,15 @@ struct DeviceTransferState {
     DfuProtocolStates state;
 
     /// <summary>
-    /// Data structure for init timer which is started after MT3620 resets the bootloader.
-    /// If the file descriptor != -1, then the timer was also successfully
-    /// added to epoll.
+    /// Init timer which is started after MT3620 resets the bootloader.
     /// </summary>
-    EventData initTimerEventData;
+    Timer initTimer;
 
     /// <summary>
-    /// Data structure for post-validation timer which is started after
+    /// Post-validation timer which is started after
     /// a file has been written to the attached board.
     /// </summary>
-    EventData postValidateTimerEventData;
+    Timer postValidateTimer;
 
     /// <summary>
     /// Holds up to one MTU worth of SLIP-encoded data which will be written
@@ -359,9 +357,9 @@ struct DeviceTransferState {
     DfuProtocolStates fileTransferContinueState;
 
     /// <summary>
-    /// Object passed back to timeout event handler.
+    /// Timer which identifies timeout conditions while reading or writing.
     /// </summary>
-    EventData timeoutTimerEventData;
+    Timer timeoutTimer;
 
     /// <summary>
     /// Whether waiting for an asynchronous read to complete on the UART.
@@ -41,7 +41,7 @@ static void WriteData(EventData *eventData);
 
 static int StartTimeoutTimer(void);
 static void CancelTimeoutTimer(void);
-static void TimeoutTimerExpiredEvent(EventData *eventData);
+static void TimeoutTimerExpiredEvent(Timer *timer);
 
 static bool ValidateHeader(NrfDfuOpCode op);
 static bool ValidateAndRemoveHeader(NrfDfuOpCode op);
@@ -51,7 +51,7 @@ static void MoveToNextDfuState(void);
 static void CleanUpStateMachine(void);
 
 static StateTransition HandleStart(void);
-static void InitTimerExpiredEvent(EventData *eventData);
+static void InitTimerExpiredEvent(Timer *timer);
 static StateTransition HandleInitTimerExpired(void);
 static StateTransition HandlePingReceivedResponse(void);
 static StateTransition HandlePrnReceivedResponse(void);
@@ -78,11 +78,7 @@ static StateTransition HandleFileTransferReceivedWindowChecksumResponse(void);
 static StateTransition HandleFileTransferReceivedExecuteResponse(void);
 
 static StateTransition HandlePostValidateImage(void);
-static void PostValidateTimerExpiredEvent(EventData *eventData);
-
-static int CreateDisarmedTimer(EventData *eventData);
-static int LaunchOneShotTimer(int fd, const struct timespec *delay);
-static int CancelTimer(int fd);
+static void PostValidateTimerExpiredEvent(Timer *timer);
 
 // When the state machine completes successfully or otherwise,
 // it calls the termination handler which is provided to ProgramImages.
@@ -426,7 +422,7 @@ static void WriteData(EventData *eventData)
 static int StartTimeoutTimer(void)
 {
     static const struct timespec timeoutDuration = {.tv_sec = 5, .tv_nsec = 0};
-    if (LaunchOneShotTimer(dts.timeoutTimerEventData.fd, &timeoutDuration) == -1) {
+    if (SetTimerToSingleExpiry(&dts.timeoutTimer, &timeoutDuration) == -1) {
         return -1;
     }
 
@@ -436,13 +432,11 @@ static int StartTimeoutTimer(void)
 // Called when a read or write has occurred.
 static void CancelTimeoutTimer(void)
 {
-    CancelTimer(dts.timeoutTimerEventData.fd);
+    DisarmTimer(&dts.timeoutTimer);
 }
 
-static void TimeoutTimerExpiredEvent(EventData *eventData)
+static void TimeoutTimerExpiredEvent(Timer *timer)
 {
-    ConsumeTimerFdEvent(dts.timeoutTimerEventData.fd);
-
     // Don't get notified if pending read or write completes after
     // this timer has expired.
     if (dts.epollinEnabled || dts.epolloutEnabled) {
@@ -626,23 +620,9 @@ static void MoveToNextDfuState(void)
 /// </summary>
 static void CleanUpStateMachine(void)
 {
-    if (dts.initTimerEventData.fd != -1) {
-        UnregisterEventHandlerFromEpoll(epollFd, dts.initTimerEventData.fd);
-        CloseFdAndPrintError(dts.initTimerEventData.fd, "initTimer");
-        dts.initTimerEventData.fd = -1;
-    }
-
-    if (dts.postValidateTimerEventData.fd != -1) {
-        UnregisterEventHandlerFromEpoll(epollFd, dts.postValidateTimerEventData.fd);
-        CloseFdAndPrintError(dts.postValidateTimerEventData.fd, "postValidateTimer");
-        dts.postValidateTimerEventData.fd = -1;
-    }
-
-    if (dts.timeoutTimerEventData.fd != -1) {
-        UnregisterEventHandlerFromEpoll(epollFd, dts.timeoutTimerEventData.fd);
-        CloseFdAndPrintError(dts.timeoutTimerEventData.fd, "timeoutTimer");
-        dts.timeoutTimerEventData.fd = -1;
-    }
+    DisarmTimer(&dts.initTimer);
+    DisarmTimer(&dts.postValidateTimer);
+    DisarmTimer(&dts.timeoutTimer);
 
     CloseFileView(dts.fv);
     dts.fv = NULL;
@@ -666,14 +646,10 @@ static StateTransition HandleStart(void)
     dts.decodedRxBuf = NULL;
     dts.fv = NULL;
 
-    dts.initTimerEventData.eventHandler = &InitTimerExpiredEvent;
-    dts.initTimerEventData.fd = -1;
-
-    dts.postValidateTimerEventData.eventHandler = &PostValidateTimerExpiredEvent;
-    dts.postValidateTimerEventData.fd = -1;
-
-    dts.timeoutTimerEventData.eventHandler = &TimeoutTimerExpiredEvent;
-    dts.timeoutTimerEventData.fd = -1;
+    // The timers are disarmed until they are launched.
+    dts.initTimer = (Timer){.timerHandler = &InitTimerExpiredEvent};
+    dts.postValidateTimer = (Timer){.timerHandler = &PostValidateTimerExpiredEvent};
+    dts.timeoutTimer = (Timer){.timerHandler = &TimeoutTimerExpiredEvent};
 
     dts.epollinEnabled = false;
     dts.epolloutEnabled = false;
@@ -692,22 +668,6 @@ static StateTransition HandleStart(void)
         return StateTransition_Failed;
     }
 
-    // Create all of the required timers in disarmed state.
-    dts.initTimerEventData.fd = CreateDisarmedTimer(&dts.initTimerEventData);
-    if (dts.initTimerEventData.fd == -1) {
-        return StateTransition_Failed;
-    }
-
-    dts.postValidateTimerEventData.fd = CreateDisarmedTimer(&dts.postValidateTimerEventData);
-    if (dts.postValidateTimerEventData.fd == -1) {
-        return StateTransition_Failed;
-    }
-
-    dts.timeoutTimerEventData.fd = CreateDisarmedTimer(&dts.timeoutTimerEventData);
-    if (dts.timeoutTimerEventData.fd == -1) {
-        return StateTransition_Failed;
-    }
-
     dts.pingId = 1;
 
     // Put the nRF52 into DFU mode.
@@ -717,7 +677,7 @@ static StateTransition HandleStart(void)
  
     // Wait one second for nRF52 to go into DFU mode.
     static const struct timespec initTimerDuration = {.tv_sec = 1, .tv_nsec = 0};
-    if (LaunchOneShotTimer(dts.initTimerEventData.fd, &initTimerDuration) == -1) {
+    if (SetTimerToSingleExpiry(&dts.initTimer, &initTimerDuration) == -1) {
         return StateTransition_Failed;
     }
 
@@ -725,12 +685,10 @@ static StateTransition HandleStart(void)
     return StateTransition_WaitAsync;
 }
 
-// Called by epoll event handler when timer expires.
-// Consumes one-shot timer event but does not close the timer.
-static void InitTimerExpiredEvent(EventData *eventData)
+// Called by the timer wheel when the one-shot init timer expires.
+static void InitTimerExpiredEvent(Timer *timer)
 {
-    bool consumed = (ConsumeTimerFdEvent(dts.initTimerEventData.fd) == 0);
-    dts.state = consumed ? DfuState_InitTimerExpired : DfuState_Failed;
+    dts.state = DfuState_InitTimerExpired;
 
     MoveToNextDfuState();
 }
@@ -1199,7 +1157,7 @@ static StateTransition HandlePostValidateImage(void)
     }
 
     const struct timespec postValidateTimerDuration = {.tv_sec = waitTime, .tv_nsec = 0};
-    if (LaunchOneShotTimer(dts.postValidateTimerEventData.fd, &postValidateTimerDuration) == -1) {
+    if (SetTimerToSingleExpiry(&dts.postValidateTimer, &postValidateTimerDuration) == -1) {
         return StateTransition_Failed;
     }
 
@@ -1208,10 +1166,9 @@ static StateTransition HandlePostValidateImage(void)
     return StateTransition_WaitAsync;
 }
 
-static void PostValidateTimerExpiredEvent(EventData *eventData)
+static void PostValidateTimerExpiredEvent(Timer *timer)
 {
-    bool consumed = (ConsumeTimerFdEvent(dts.postValidateTimerEventData.fd) == 0);
-    dts.state = consumed ? DfuState_Success : DfuState_Failed;
+    dts.state = DfuState_Success;
 
     // check if there are images which have to be added or updated
     for (size_t i = nextImageIndex; i < numberOfImages && dts.state != DfuState_Failed; ++i) {
@@ -1225,22 +1182,3 @@ static void PostValidateTimerExpiredEvent(EventData *eventData)
     MoveToNextDfuState();
 }
 
-static int CreateDisarmedTimer(EventData *eventData)
-{
-    // Setting both fields to zero disarms the timer.
-    struct timespec ts = {.tv_sec = 0, .tv_nsec = 0};
-    int fd = CreateTimerFdAndAddToEpoll(epollFd, &ts, eventData, EPOLLIN);
-    return fd;
-}
-
-static int LaunchOneShotTimer(int fd, const struct timespec *delay)
-{
-    return SetTimerFdToSingleExpiry(fd, delay);
-}
-
-static int CancelTimer(int fd)
-{
-    // Setting both fields to zero disarms the timer.
-    struct timespec ts = {.tv_sec = 0, .tv_nsec = 0};
-    return LaunchOneShotTimer(fd, &ts);
-}
@@ -0,0 +1,295 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "reported_properties.h"
+#include "json_writer.h"
+
+static uint64_t GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+/// <summary>
+///     Arms the flush timer, unless it is armed already or a patch is being sent.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+/// <param name="delayMs">Time from now, in milliseconds, at which the flush is allowed</param>
+static void ScheduleFlush(ReportedProperties *properties, uint64_t delayMs)
+{
+    if (properties->isInFlight || IsTimerArmed(&properties->flushTimer)) {
+        return;
+    }
+
+    if (delayMs < properties->config.coalesceMs) {
+        delayMs = properties->config.coalesceMs;
+    }
+    struct timespec expiry = {.tv_sec = (time_t)(delayMs / 1000),
+                              .tv_nsec = (long)(delayMs % 1000) * 1000000};
+    if (SetTimerToSingleExpiry(&properties->flushTimer, &expiry) != 0) {
+        Log_Debug("ERROR: Could not schedule reported properties.\n");
+    }
+}
+
+/// <summary>
+///     Schedules the next patch, no sooner than the rate limit allows, if any property is
+///     pending.
+/// </summary>
+static void ScheduleNextPatch(ReportedProperties *properties)
+{
+    bool hasPending = false;
+    for (size_t i = 0; i < properties->count; ++i) {
+        hasPending |= properties->properties[i].isPending;
+    }
+    if (!hasPending) {
+        return;
+    }
+
+    uint64_t delayMs = 0;
+    if (properties->stats.patchesSent > 0) {
+        uint64_t allowedMs = properties->lastSendMs + properties->config.minIntervalMs;
+        uint64_t nowMs = GetMonotonicMs();
+        delayMs = allowedMs > nowMs ? allowedMs - nowMs : 0;
+    }
+    ScheduleFlush(properties, delayMs);
+}
+
+/// <summary>
+///     Returns the properties of a failed patch to the pending state, keeping any newer value
+///     which was set meanwhile, and schedules the retry.
+/// </summary>
+static void RetryPatch(ReportedProperties *properties)
+{
+    for (size_t i = 0; i < properties->count; ++i) {
+        ReportedProperty *property = &properties->properties[i];
+        if (property->isInFlight) {
+            property->isPending = true;
+            property->isInFlight = false;
+        }
+    }
+    ++properties->stats.patchesFailed;
+
+    uint32_t delayMs = properties->retryDelayMs;
+    properties->retryDelayMs = delayMs >= properties->config.maxRetryMs / 2
+                                   ? properties->config.maxRetryMs
+                                   : delayMs * 2;
+    Log_Debug("WARNING: Reported properties patch failed; retrying in %u ms.\n", delayMs);
+    ScheduleFlush(properties, delayMs);
+}
+
+/// <summary>
+///     Writes the value of a property.
+/// </summary>
+static void WriteValue(JsonWriter *writer, const ReportedProperty *property)
+{
+    switch (property->type) {
+    case ReportedProperties_Type_Bool:
+        JsonWriter_Bool(writer, property->boolValue);
+        break;
+    case ReportedProperties_Type_Uint:
+        JsonWriter_Uint(writer, property->uintValue);
+        break;
+    case ReportedProperties_Type_String:
+        JsonWriter_String(writer, property->stringValue);
+        break;
+    }
+}
+
+/// <summary>
+///     Sends every pending property, or as many as fit, in one patch.
+/// </summary>
+static void FlushTimerEventHandler(Timer *timer)
+{
+    ReportedProperties *properties =
+        (ReportedProperties *)((uint8_t *)timer - offsetof(ReportedProperties, flushTimer));
+    if (properties->isInFlight) {
+        return;
+    }
+
+    JsonWriter writer;
+    JsonWriter_Init(&writer, properties->patch, sizeof(properties->patch));
+    JsonWriter_BeginObject(&writer);
+    size_t included = 0;
+    for (size_t i = 0; i < properties->count; ++i) {
+        ReportedProperty *property = &properties->properties[i];
+        if (!property->isPending) {
+            continue;
+        }
+
+        // Leave room for the closing brace; a property which does not fit goes in the next
+        // patch.
+        JsonWriterMark mark = JsonWriter_GetMark(&writer);
+        JsonWriter_Key(&writer, property->name);
+        WriteValue(&writer, property);
+        if (writer.failed || writer.length + 2 > writer.capacity) {
+            JsonWriter_Rewind(&writer, &mark);
+            continue;
+        }
+        property->isInFlight = true;
+        ++included;
+    }
+    JsonWriter_EndObject(&writer);
+
+    size_t length;
+    if (included == 0) {
+        return;
+    }
+    if (JsonWriter_Finish(&writer, &length) != 0) {
+        for (size_t i = 0; i < properties->count; ++i) {
+            properties->properties[i].isInFlight = false;
+        }
+        Log_Debug("ERROR: Could not write reported properties patch.\n");
+        return;
+    }
+
+    // Clear the pending flags first, so a value which is set while the patch is being sent is
+    // sent again.
+    for (size_t i = 0; i < properties->count; ++i) {
+        if (properties->properties[i].isInFlight) {
+            properties->properties[i].isPending = false;
+        }
+    }
+    properties->isInFlight = true;
+    properties->lastSendMs = GetMonotonicMs();
+    if (properties->sendHandler(properties->patch, length, properties->context) != 0) {
+        properties->isInFlight = false;
+        RetryPatch(properties);
+        return;
+    }
+    ++properties->stats.patchesSent;
+}
+
+/// <summary>
+///     Finds a property, or adds it if there is room.
+/// </summary>
+/// <returns>The property, or NULL if the name is too long or the table is full</returns>
+static ReportedProperty *FindOrAddProperty(ReportedProperties *properties, const char *name)
+{
+    for (size_t i = 0; i < properties->count; ++i) {
+        if (strcmp(properties->properties[i].name, name) == 0) {
+            return &properties->properties[i];
+        }
+    }
+
+    if (strlen(name) > REPORTED_PROPERTIES_MAX_NAME ||
+        properties->count == REPORTED_PROPERTIES_MAX) {
+        return NULL;
+    }
+    ReportedProperty *property = &properties->properties[properties->count++];
+    memset(property, 0, sizeof(*property));
+    strcpy(property->name, name);
+    return property;
+}
+
+/// <summary>
+///     Finds the property to set, and counts the update.
+/// </summary>
+/// <returns>The property, or NULL if the update is refused</returns>
+static ReportedProperty *BeginUpdate(ReportedProperties *properties, const char *name)
+{
+    ++properties->stats.updates;
+    ReportedProperty *property = FindOrAddProperty(properties, name);
+    if (property == NULL) {
+        ++properties->stats.updatesRefused;
+        Log_Debug("ERROR: Cannot report property '%s'.\n", name);
+        return NULL;
+    }
+    if (property->isPending) {
+        ++properties->stats.updatesCoalesced;
+    }
+    return property;
+}
+
+/// <summary>
+///     Marks a property which has been set as pending and schedules a patch.
+/// </summary>
+static int EndUpdate(ReportedProperties *properties, ReportedProperty *property)
+{
+    property->isPending = true;
+    ScheduleNextPatch(properties);
+    return 0;
+}
+
+void ReportedProperties_Init(ReportedProperties *properties,
+                             const ReportedPropertiesConfig *config,
+                             ReportedProperties_SendHandler sendHandler, void *context)
+{
+    memset(properties, 0, sizeof(*properties));
+    properties->config = *config;
+    properties->sendHandler = sendHandler;
+    properties->context = context;
+    properties->flushTimer.timerHandler = &FlushTimerEventHandler;
+    properties->retryDelayMs = config->minIntervalMs;
+}
+
+int ReportedProperties_SetBool(ReportedProperties *properties, const char *name, bool value)
+{
+    ReportedProperty *property = BeginUpdate(properties, name);
+    if (property == NULL) {
+        return -1;
+    }
+    property->type = ReportedProperties_Type_Bool;
+    property->boolValue = value;
+    return EndUpdate(properties, property);
+}
+
+int ReportedProperties_SetUint(ReportedProperties *properties, const char *name, uint64_t value)
+{
+    ReportedProperty *property = BeginUpdate(properties, name);
+    if (property == NULL) {
+        return -1;
+    }
+    property->type = ReportedProperties_Type_Uint;
+    property->uintValue = value;
+    return EndUpdate(properties, property);
+}
+
+int ReportedProperties_SetString(ReportedProperties *properties, const char *name,
+                                 const char *value)
+{
+    size_t length = strlen(value);
+    if (length > REPORTED_PROPERTIES_MAX_STRING) {
+        ++properties->stats.updates;
+        ++properties->stats.updatesRefused;
+        Log_Debug("ERROR: Reported property '%s' is too long.\n", name);
+        return -1;
+    }
+
+    ReportedProperty *property = BeginUpdate(properties, name);
+    if (property == NULL) {
+        return -1;
+    }
+    property->type = ReportedProperties_Type_String;
+    memcpy(property->stringValue, value, length + 1);
+    return EndUpdate(properties, property);
+}
+
+void ReportedProperties_Complete(ReportedProperties *properties, bool succeeded)
+{
+    if (!properties->isInFlight) {
+        return;
+    }
+    properties->isInFlight = false;
+
+    if (!succeeded) {
+        RetryPatch(properties);
+        return;
+    }
+
+    for (size_t i = 0; i < properties->count; ++i) {
+        properties->properties[i].isInFlight = false;
+    }
+    properties->retryDelayMs = properties->config.minIntervalMs;
+    ScheduleNextPatch(properties);
+}
+
+void ReportedProperties_Stop(ReportedProperties *properties)
+{
+    DisarmTimer(&properties->flushTimer);
+}
@@ -0,0 +1,180 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Largest number of reported properties which are tracked.</summary>
+#define REPORTED_PROPERTIES_MAX 16
+
+/// <summary>Longest property name.</summary>
+#define REPORTED_PROPERTIES_MAX_NAME 31
+
+/// <summary>Longest string value.</summary>
+#define REPORTED_PROPERTIES_MAX_STRING 127
+
+/// <summary>Size of the buffer for one patch; properties which do not fit are sent in the
+/// next patch.</summary>
+#define REPORTED_PROPERTIES_PATCH_CAPACITY 1024
+
+/// <summary>
+///     Function signature for handlers which send a patch of reported properties.
+/// </summary>
+/// <param name="patch">The patch: a null terminated JSON object</param>
+/// <param name="length">Length of the patch, without the terminating null</param>
+/// <param name="context">Context which was passed to <see cref="ReportedProperties_Init" /></param>
+/// <returns>0 if the patch was accepted for delivery, in which case
+/// <see cref="ReportedProperties_Complete" /> must be called with its result; or -1
+/// otherwise</returns>
+typedef int (*ReportedProperties_SendHandler)(const char *patch, size_t length, void *context);
+
+/// <summary>
+///     How often patches are sent.
+/// </summary>
+typedef struct {
+    /// <summary>Time, in milliseconds, for which updates are collected before a patch is
+    /// sent, so a burst of updates becomes one patch.</summary>
+    uint32_t coalesceMs;
+    /// <summary>Shortest time, in milliseconds, between the starts of two patches.</summary>
+    uint32_t minIntervalMs;
+    /// <summary>Longest time, in milliseconds, before a failed patch is retried; the delay
+    /// starts at minIntervalMs and doubles after each failure.</summary>
+    uint32_t maxRetryMs;
+} ReportedPropertiesConfig;
+
+/// <summary>
+///     Type of a reported property's value.
+/// </summary>
+typedef enum {
+    ReportedProperties_Type_Bool,
+    ReportedProperties_Type_Uint,
+    ReportedProperties_Type_String
+} ReportedProperties_Type;
+
+/// <summary>
+///     The latest value of a reported property.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the property.</summary>
+    char name[REPORTED_PROPERTIES_MAX_NAME + 1];
+    /// <summary>Type of the value.</summary>
+    ReportedProperties_Type type;
+    /// <summary>The value, according to its type.</summary>
+    union {
+        bool boolValue;
+        uint64_t uintValue;
+        char stringValue[REPORTED_PROPERTIES_MAX_STRING + 1];
+    };
+    /// <summary>True if the value has not been sent since it was set.</summary>
+    bool isPending;
+    /// <summary>True if the value is in the patch which is being sent.</summary>
+    bool isInFlight;
+} ReportedProperty;
+
+/// <summary>
+///     Counters for a <see cref="ReportedProperties" />.
+/// </summary>
+typedef struct {
+    /// <summary>Number of values which were set.</summary>
+    uint64_t updates;
+    /// <summary>Number of values which replaced a value that had not been sent yet.</summary>
+    uint64_t updatesCoalesced;
+    /// <summary>Number of values which were refused because the table was full or the name or
+    /// string was too long.</summary>
+    uint64_t updatesRefused;
+    /// <summary>Number of patches which were accepted for delivery.</summary>
+    uint64_t patchesSent;
+    /// <summary>Number of patches which failed and were retried.</summary>
+    uint64_t patchesFailed;
+} ReportedPropertiesStats;
+
+/// <summary>
+/// <para>Collects reported properties and sends them as merged patches, at most one patch per
+/// minimum interval and one at a time, so a burst of state changes does not become a burst of
+/// twin updates which IoT Hub throttles.</para>
+/// <para>Only the latest value of each property is kept. A property which was in a failed patch
+/// is sent again in the next one, after a growing delay, unless a newer value replaced
+/// it.</para>
+/// </summary>
+typedef struct {
+    /// <summary>How often patches are sent.</summary>
+    ReportedPropertiesConfig config;
+    /// <summary>Function which sends a patch.</summary>
+    ReportedProperties_SendHandler sendHandler;
+    /// <summary>Context which is passed to the send handler.</summary>
+    void *context;
+    /// <summary>Sends the next patch.</summary>
+    Timer flushTimer;
+    /// <summary>Number of entries in properties.</summary>
+    size_t count;
+    /// <summary>The properties.</summary>
+    ReportedProperty properties[REPORTED_PROPERTIES_MAX];
+    /// <summary>True while a patch waits for <see cref="ReportedProperties_Complete" />.</summary>
+    bool isInFlight;
+    /// <summary>CLOCK_MONOTONIC time, in milliseconds, at which the last patch was
+    /// sent.</summary>
+    uint64_t lastSendMs;
+    /// <summary>Delay, in milliseconds, before the next retry of a failed patch.</summary>
+    uint32_t retryDelayMs;
+    /// <summary>Buffer for the patch.</summary>
+    char patch[REPORTED_PROPERTIES_PATCH_CAPACITY];
+    /// <summary>Counters.</summary>
+    ReportedPropertiesStats stats;
+} ReportedProperties;
+
+/// <summary>
+///     Initializes an empty set of reported properties.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+/// <param name="config">How often patches are sent</param>
+/// <param name="sendHandler">Function which sends a patch</param>
+/// <param name="context">Context which is passed to the send handler</param>
+void ReportedProperties_Init(ReportedProperties *properties,
+                             const ReportedPropertiesConfig *config,
+                             ReportedProperties_SendHandler sendHandler, void *context);
+
+/// <summary>
+///     Sets a boolean property, to be sent in the next patch.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+/// <param name="name">Name of the property</param>
+/// <param name="value">The value</param>
+/// <returns>0 on success, or -1 if the table is full or the name is too long</returns>
+int ReportedProperties_SetBool(ReportedProperties *properties, const char *name, bool value);
+
+/// <summary>
+///     Sets an unsigned integer property, to be sent in the next patch.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+/// <param name="name">Name of the property</param>
+/// <param name="value">The value</param>
+/// <returns>0 on success, or -1 if the table is full or the name is too long</returns>
+int ReportedProperties_SetUint(ReportedProperties *properties, const char *name, uint64_t value);
+
+/// <summary>
+///     Sets a string property, to be sent in the next patch.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+/// <param name="name">Name of the property</param>
+/// <param name="value">The value, at most REPORTED_PROPERTIES_MAX_STRING bytes</param>
+/// <returns>0 on success, or -1 if the table is full or the name or value is too long</returns>
+int ReportedProperties_SetString(ReportedProperties *properties, const char *name,
+                                 const char *value);
+
+/// <summary>
+///     Reports the result of the patch which is being sent. A failed patch is retried after a
+///     delay. It is safe to call this function when no patch is being sent.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+/// <param name="succeeded">True if IoT Hub accepted the patch</param>
+void ReportedProperties_Complete(ReportedProperties *properties, bool succeeded);
+
+/// <summary>
+///     Stops sending patches. Values which have not been sent are kept.
+/// </summary>
+/// <param name="properties">The reported properties</param>
+void ReportedProperties_Stop(ReportedProperties *properties);
@@ -0,0 +1,142 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "applibs_versions.h"
+#include <applibs/gpio.h>
+#include <applibs/log.h>
+
+#include "rs485_direction.h"
+
+static uint64_t GetMonotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int ArmReleaseTimer(Rs485Direction *direction, uint64_t delayNs)
+{
+    // A zero expiry would disarm the timer, so release as soon as possible instead.
+    if (delayNs == 0) {
+        delayNs = 1;
+    }
+
+    struct timespec delay = {.tv_sec = (time_t)(delayNs / 1000000000u),
+                             .tv_nsec = (long)(delayNs % 1000000000u)};
+    return SetTimerFdToSingleExpiry(direction->releaseTimerEventData.fd, &delay);
+}
+
+static int SetDirection(Rs485Direction *direction, bool transmit)
+{
+    if (direction->setDirection(direction->context, transmit) != 0) {
+        Log_Debug("ERROR: Could not set RS485 direction: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    direction->isTransmitting = transmit;
+    return 0;
+}
+
+/// <summary>
+///     Handle release timer event: release the driver, unless the UART still has data to send.
+/// </summary>
+static void ReleaseTimerEventHandler(EventData *eventData)
+{
+    Rs485Direction *direction =
+        (Rs485Direction *)((uint8_t *)eventData - offsetof(Rs485Direction, releaseTimerEventData));
+
+    if (ConsumeTimerFdEvent(direction->releaseTimerEventData.fd) != 0) {
+        return;
+    }
+
+    // Where the driver reports its output queue, trust it over the estimate: the UART may have
+    // started late, for example behind flow control.
+    int pending = 0;
+    if (ioctl(direction->uartFd, TIOCOUTQ, &pending) == 0 && pending > 0) {
+        ArmReleaseTimer(direction, (uint64_t)pending * direction->characterTimeNs +
+                                       direction->turnaroundNs);
+        return;
+    }
+
+    if (direction->isTransmitting) {
+        SetDirection(direction, false);
+    }
+}
+
+int Rs485Direction_Init(Rs485Direction *direction, int epollFd, int uartFd, uint32_t baudRate,
+                        uint32_t bitsPerCharacter, Rs485DirectionSetter setDirection,
+                        void *context)
+{
+    direction->uartFd = uartFd;
+    direction->characterTimeNs = (bitsPerCharacter * 1000000000ull + baudRate - 1) / baudRate;
+    // Release half a character after the last stop bit: long enough for the stop bit to be
+    // driven on the bus, and well inside the 3.5 characters which a slave waits before replying.
+    direction->turnaroundNs = direction->characterTimeNs / 2;
+    direction->setDirection = setDirection;
+    direction->context = context;
+    direction->releaseTimerEventData.eventHandler = &ReleaseTimerEventHandler;
+    direction->isTransmitting = true;
+    direction->transmitCompleteNs = 0;
+
+    struct timespec disabled = {0, 0};
+    direction->releaseTimerEventData.fd = CreateTimerFdAndAddToEpoll(
+        epollFd, &disabled, &direction->releaseTimerEventData, EPOLLIN);
+    if (direction->releaseTimerEventData.fd < 0) {
+        return -1;
+    }
+
+    return SetDirection(direction, false);
+}
+
+void Rs485Direction_Close(Rs485Direction *direction)
+{
+    CloseFdAndPrintError(direction->releaseTimerEventData.fd, "Rs485ReleaseTimer");
+    direction->releaseTimerEventData.fd = -1;
+}
+
+int Rs485Direction_BeginTransmit(Rs485Direction *direction)
+{
+    // Cancel a pending release; the transmissions will run back to back.
+    struct timespec disabled = {0, 0};
+    SetTimerFdToSingleExpiry(direction->releaseTimerEventData.fd, &disabled);
+
+    if (direction->isTransmitting) {
+        return 0;
+    }
+    return SetDirection(direction, true);
+}
+
+void Rs485Direction_BytesWritten(Rs485Direction *direction, size_t byteCount)
+{
+    // Bytes are shifted out back to back, starting now or when the previous bytes are done.
+    uint64_t nowNs = GetMonotonicNs();
+    uint64_t startNs =
+        direction->transmitCompleteNs > nowNs ? direction->transmitCompleteNs : nowNs;
+    direction->transmitCompleteNs = startNs + byteCount * direction->characterTimeNs;
+}
+
+int Rs485Direction_EndTransmit(Rs485Direction *direction)
+{
+    if (!direction->isTransmitting) {
+        return 0;
+    }
+
+    uint64_t nowNs = GetMonotonicNs();
+    uint64_t remainingNs =
+        direction->transmitCompleteNs > nowNs ? direction->transmitCompleteNs - nowNs : 0;
+    return ArmReleaseTimer(direction, remainingNs + direction->turnaroundNs);
+}
+
+int Rs485Direction_SetGpio(void *context, bool transmit)
+{
+    const Rs485DirectionGpio *gpio = context;
+    GPIO_Value_Type value =
+        (transmit == gpio->transmitIsHigh) ? GPIO_Value_High : GPIO_Value_Low;
+    return GPIO_SetValue(gpio->gpioFd, value);
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+///     Function signature for driving an RS485 transceiver's direction, normally its DE and /RE
+///     pins tied to one GPIO.
+/// </summary>
+/// <param name="context">The context which was supplied to <see cref="Rs485Direction_Init"
+/// /></param>
+/// <param name="transmit">True to enable the driver; false to enable the receiver</param>
+/// <returns>0 on success, or -1 on failure</returns>
+typedef int (*Rs485DirectionSetter)(void *context, bool transmit);
+
+/// <summary>
+/// <para>Drives the direction of a half-duplex RS485 transceiver around transmissions.</para>
+/// <para>The driver is enabled before the first byte is written. write() returns as soon as the
+/// data is buffered, so the time at which the last stop bit leaves the UART is tracked from the
+/// baud rate. Once the transmit queue is empty, a precise one-shot timer releases the driver a
+/// turnaround time after that point. Where the UART reports its output queue (TIOCOUTQ), the
+/// timer also waits for that queue to empty. The receiver is enabled at all other
+/// times.</para>
+/// </summary>
+typedef struct {
+    /// <summary>UART file descriptor, used to query the output queue.</summary>
+    int uartFd;
+    /// <summary>Time to transmit one character, in nanoseconds.</summary>
+    uint64_t characterTimeNs;
+    /// <summary>Time from the last stop bit until the driver is released, in
+    /// nanoseconds.</summary>
+    uint64_t turnaroundNs;
+    /// <summary>Function which drives the transceiver's direction.</summary>
+    Rs485DirectionSetter setDirection;
+    /// <summary>Context which is passed to setDirection.</summary>
+    void *context;
+    /// <summary>One-shot timer which releases the driver.</summary>
+    EventData releaseTimerEventData;
+    /// <summary>Whether the driver is enabled.</summary>
+    bool isTransmitting;
+    /// <summary>CLOCK_MONOTONIC time, in nanoseconds, when the last written byte is expected to
+    /// have left the UART.</summary>
+    uint64_t transmitCompleteNs;
+} Rs485Direction;
+
+/// <summary>
+///     Initializes direction control for a UART and enables the receiver.
+/// </summary>
+/// <param name="direction">The direction control</param>
+/// <param name="epollFd">Epoll file descriptor, used by the release timer</param>
+/// <param name="uartFd">UART file descriptor</param>
+/// <param name="baudRate">Baud rate of the UART</param>
+/// <param name="bitsPerCharacter">Bits per character, including start, parity and stop
+/// bits</param>
+/// <param name="setDirection">Function which drives the transceiver's direction</param>
+/// <param name="context">Context which is passed to setDirection</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Rs485Direction_Init(Rs485Direction *direction, int epollFd, int uartFd, uint32_t baudRate,
+                        uint32_t bitsPerCharacter, Rs485DirectionSetter setDirection,
+                        void *context);
+
+/// <summary>
+///     Closes the release timer. The receiver is left enabled.
+/// </summary>
+/// <param name="direction">The direction control</param>
+void Rs485Direction_Close(Rs485Direction *direction);
+
+/// <summary>
+///     Enables the driver, if it is not already enabled, before data is written.
+/// </summary>
+/// <param name="direction">The direction control</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Rs485Direction_BeginTransmit(Rs485Direction *direction);
+
+/// <summary>
+///     Records bytes which have been written to the UART, which extends the time at which the
+///     transmission will be complete.
+/// </summary>
+/// <param name="direction">The direction control</param>
+/// <param name="byteCount">Number of bytes which were written</param>
+void Rs485Direction_BytesWritten(Rs485Direction *direction, size_t byteCount);
+
+/// <summary>
+///     Arms the release timer once no more data is waiting to be written. The driver is released
+///     a turnaround time after the last byte has left the UART.
+/// </summary>
+/// <param name="direction">The direction control</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Rs485Direction_EndTransmit(Rs485Direction *direction);
+
+/// <summary>
+///     Context for <see cref="Rs485Direction_SetGpio" />.
+/// </summary>
+typedef struct {
+    /// <summary>GPIO file descriptor, opened as an output.</summary>
+    int gpioFd;
+    /// <summary>Whether the GPIO is high to enable the driver.</summary>
+    bool transmitIsHigh;
+} Rs485DirectionGpio;
+
+/// <summary>
+///     Drives a GPIO for <see cref="Rs485Direction_Init" />. The context points to a
+///     <see cref="Rs485DirectionGpio" />.
+/// </summary>
+int Rs485Direction_SetGpio(void *context, bool transmit);
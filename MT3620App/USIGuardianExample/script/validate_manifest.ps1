@@ -54,4 +54,20 @@ if ($ret -eq 0) {
     Write-Output "app_manifest.json IoT Hub/Central parameters exist."
 }
 
+# The Modbus TCP gateway is optional, so its port is only allowed when it is built.
+$commonFile = Join-Path $scriptPath "..\common.h" -Resolve -ErrorAction SilentlyContinue
+$modbusTcpPort = 502
+if ($commonFile -ne $null) {
+    $isModbusBuilt = Select-String -Path $commonFile -Pattern "^\s*#define\s+BUILD_USI_MODBUS\b" -Quiet
+    $isModbusPortAllowed = $jsonobj.Capabilities.AllowedTcpServerPorts -contains $modbusTcpPort
+    if ($isModbusBuilt -and -not $isModbusPortAllowed) {
+        Write-Output "BUILD_USI_MODBUS is defined in common.h, so the app_manifest.json"
+        Write-Output "'AllowedTcpServerPorts' needs to contain the Modbus TCP port $modbusTcpPort"
+        $ret=1
+    } elseif (-not $isModbusBuilt -and $isModbusPortAllowed) {
+        Write-Output "The app_manifest.json 'AllowedTcpServerPorts' contains the Modbus TCP port"
+        Write-Output "$modbusTcpPort, but BUILD_USI_MODBUS is not defined in common.h"
+    }
+}
+
 exit $ret
@@ -0,0 +1,40 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "sequence_window.h"
+
+void SequenceWindow_Reset(SequenceWindow *window)
+{
+    memset(window, 0, sizeof(*window));
+}
+
+SequenceWindowResult SequenceWindow_Accept(SequenceWindow *window, uint32_t sequence,
+                                           uint64_t nowMs)
+{
+    bool isSilent = nowMs - window->lastHeardMs >= SEQUENCE_WINDOW_RESTART_GAP_MS;
+    window->lastHeardMs = nowMs;
+
+    int32_t ahead = (int32_t)(sequence - window->highestSequence);
+    if (window->isStarted && ahead > 0) {
+        window->received = ahead < SEQUENCE_WINDOW_SIZE ? (window->received << ahead) | 1u : 1u;
+        window->highestSequence = sequence;
+        return SequenceWindow_New;
+    }
+    if (window->isStarted && !isSilent && ahead > -SEQUENCE_WINDOW_SIZE) {
+        uint64_t bit = (uint64_t)1u << -ahead;
+        if ((window->received & bit) != 0) {
+            return SequenceWindow_Duplicate;
+        }
+        window->received |= bit;
+        return SequenceWindow_New;
+    }
+
+    // The first number, or a sender which has restarted its numbering.
+    SequenceWindowResult result = window->isStarted ? SequenceWindow_Restarted : SequenceWindow_New;
+    window->isStarted = true;
+    window->highestSequence = sequence;
+    window->received = 1u;
+    return result;
+}
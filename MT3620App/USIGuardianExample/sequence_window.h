@@ -0,0 +1,61 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>Number of sequence numbers below the highest received one which are remembered, so
+/// a duplicate which arrives out of order is still recognized.</summary>
+#define SEQUENCE_WINDOW_SIZE 64
+
+/// <summary>Silence, in milliseconds, after which a sequence number which is not ahead of the
+/// highest one is taken as the sender restarting rather than as a duplicate. A sender which
+/// repeats a message must do so sooner; one which restarts is silent for longer.</summary>
+#define SEQUENCE_WINDOW_RESTART_GAP_MS 2000
+
+/// <summary>
+///     What <see cref="SequenceWindow_Accept" /> made of a sequence number.
+/// </summary>
+typedef enum {
+    /// <summary>The number is new.</summary>
+    SequenceWindow_New,
+    /// <summary>The number has already been received.</summary>
+    SequenceWindow_Duplicate,
+    /// <summary>The sender has restarted its numbering; the number is new.</summary>
+    SequenceWindow_Restarted
+} SequenceWindowResult;
+
+/// <summary>
+///     The sequence numbers received from one sender. Numbers wrap, so they are compared by
+///     their distance from the highest one.
+/// </summary>
+typedef struct {
+    /// <summary>Whether any number has been received.</summary>
+    bool isStarted;
+    /// <summary>Highest sequence number received.</summary>
+    uint32_t highestSequence;
+    /// <summary>Sequence numbers received at and below the highest one; bit n is set if
+    /// highestSequence - n has been received.</summary>
+    uint64_t received;
+    /// <summary>Time of the last number, in milliseconds.</summary>
+    uint64_t lastHeardMs;
+} SequenceWindow;
+
+/// <summary>
+///     Forgets every number received, so the next one starts the window.
+/// </summary>
+/// <param name="window">The window</param>
+void SequenceWindow_Reset(SequenceWindow *window);
+
+/// <summary>
+///     Records a sequence number. A number at least SEQUENCE_WINDOW_SIZE below the highest one,
+///     or one which is not ahead of it after SEQUENCE_WINDOW_RESTART_GAP_MS of silence, restarts
+///     the window.
+/// </summary>
+/// <param name="window">The window</param>
+/// <param name="sequence">The sequence number</param>
+/// <param name="nowMs">Current time in milliseconds, from a monotonic clock</param>
+/// <returns>Whether the number is new, a duplicate or the start of a new numbering</returns>
+SequenceWindowResult SequenceWindow_Accept(SequenceWindow *window, uint32_t sequence,
+                                           uint64_t nowMs);
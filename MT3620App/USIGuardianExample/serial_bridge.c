@@ -0,0 +1,710 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for accept4
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "serial_bridge.h"
+#include "serial_framer.h"
+#include "usi_serial.h"
+
+#if (defined(BUILD_USI_SERIAL_BRIDGE))
+
+// Telnet commands (RFC 854).
+#define TELNET_SE 240
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+
+// Telnet options which the bridge agrees to: binary transmission (RFC 856), suppress go ahead
+// (RFC 858) and the COM port control option (RFC 2217).
+#define TELNET_OPTION_BINARY 0
+#define TELNET_OPTION_SUPPRESS_GO_AHEAD 3
+#define TELNET_OPTION_COM_PORT 44
+
+// COM port control commands from the client; the bridge answers each with the command plus
+// COM_PORT_RESPONSE_OFFSET.
+#define COM_PORT_SIGNATURE 0
+#define COM_PORT_SET_BAUDRATE 1
+#define COM_PORT_SET_DATASIZE 2
+#define COM_PORT_SET_PARITY 3
+#define COM_PORT_SET_STOPSIZE 4
+#define COM_PORT_SET_CONTROL 5
+#define COM_PORT_SET_LINESTATE_MASK 10
+#define COM_PORT_SET_MODEMSTATE_MASK 11
+#define COM_PORT_PURGE_DATA 12
+#define COM_PORT_RESPONSE_OFFSET 100
+
+// Delay from the last request for new line settings until the UART is reopened with them.
+#define APPLY_SETTINGS_DELAY_NS (10 * 1000 * 1000)
+
+// Largest number of bytes which are read from the client at once.
+#define CLIENT_READ_SIZE 1024
+
+static const char BridgeSignature[] = "USI MT3620 serial bridge";
+
+// Baud rates which the MT3620 UARTs support.
+static const uint32_t supportedBaudRates[] = {1200,   2400,   4800,    9600,    19200,  38400,
+                                              57600,  115200, 230400,  460800,  500000, 576000,
+                                              921600, 1000000, 1152000, 1500000, 2000000};
+
+// Support functions.
+static void HandleListenEvent(EventData *eventData);
+static void HandleClientEvent(EventData *eventData);
+static void HandleSerialData(const uint8_t *data, size_t length, void *context);
+static void HandleSerialTxReady(void *context);
+static void HandleApplySettingsTimerEvent(Timer *timer);
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType);
+static void ReportError(const char *desc);
+static void CloseClient(SerialBridge_ServerState *serverState);
+
+SerialBridge_ServerState *SerialBridge_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
+                                             int backlogSize, const char *portName)
+{
+    SerialBridge_ServerState *serverState = calloc(1, sizeof(*serverState));
+    if (!serverState) {
+        abort();
+    }
+
+    // Set the state to unused values so it can be safely cleaned up if only a subset of the
+    // resources are successfully allocated.
+    serverState->epollFd = epollFd;
+    serverState->listenFd = -1;
+    serverState->listenEvent.eventHandler = HandleListenEvent;
+    serverState->portName = portName;
+    serverState->portIndex = -1;
+    serverState->clientFd = -1;
+    serverState->clientEvent.eventHandler = HandleClientEvent;
+    serverState->applySettingsTimer.timerHandler = HandleApplySettingsTimerEvent;
+
+    int sockType = SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
+    serverState->listenFd = OpenIpV4Socket(ipAddr, port, sockType);
+    if (serverState->listenFd < 0) {
+        ReportError("open socket");
+        goto fail;
+    }
+
+    // Be notified asynchronously when a client connects.
+    RegisterEventHandlerToEpoll(epollFd, serverState->listenFd, &serverState->listenEvent, EPOLLIN);
+
+    int result = listen(serverState->listenFd, backlogSize);
+    if (result != 0) {
+        ReportError("listen");
+        goto fail;
+    }
+
+    Log_Debug("INFO: Serial bridge: %s listening on port %u (fd %d).\n", portName, port,
+              serverState->listenFd);
+
+    return serverState;
+
+fail:
+    SerialBridge_ShutDown(serverState);
+    return NULL;
+}
+
+void SerialBridge_ShutDown(SerialBridge_ServerState *serverState)
+{
+    if (!serverState) {
+        return;
+    }
+
+    CloseClient(serverState);
+    CloseFdAndPrintError(serverState->listenFd, "serialBridgeListenFd");
+
+    free(serverState);
+}
+
+static void HandleListenEvent(EventData *eventData)
+{
+    SerialBridge_ServerState *serverState =
+        (SerialBridge_ServerState *)((uint8_t *)eventData -
+                                     offsetof(SerialBridge_ServerState, listenEvent));
+
+    struct sockaddr in_addr;
+    socklen_t sockLen = sizeof(in_addr);
+    int localFd =
+        accept4(serverState->listenFd, &in_addr, &sockLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (localFd < 0) {
+        ReportError("accept");
+        return;
+    }
+
+    // A serial port has one owner at a time.
+    if (serverState->clientFd >= 0) {
+        Log_Debug("INFO: Serial bridge: %s is in use, refusing connection.\n",
+                  serverState->portName);
+        close(localFd);
+        return;
+    }
+
+    int portIndex = USISerial_OpenBridge(serverState->portName, &HandleSerialData,
+                                         &HandleSerialTxReady, serverState);
+    if (portIndex < 0) {
+        close(localFd);
+        return;
+    }
+
+    Log_Debug("INFO: Serial bridge: Accepted client connection to %s (fd %d).\n",
+              serverState->portName, localFd);
+
+    USISerialLineSettings settings;
+    USISerial_GetLineSettings(portIndex, &settings);
+    serverState->baudRate = settings.baudRate;
+    serverState->dataBits = settings.dataBits;
+    serverState->parity = settings.parity;
+    serverState->stopBits = settings.stopBits;
+    serverState->flowControl = settings.flowControl;
+
+    serverState->portIndex = portIndex;
+    serverState->clientFd = localFd;
+    serverState->epollOutEnabled = false;
+    serverState->isReadPaused = false;
+    serverState->telnetState = SerialBridge_TelnetState_Data;
+    serverState->remoteOptions = 0;
+    serverState->localOptions = 0;
+    TxQueue_Init(&serverState->txQueue, SERIAL_BRIDGE_TX_QUEUE_LIMIT);
+    TxQueue_SetLowWatermark(&serverState->txQueue, SERIAL_BRIDGE_TX_QUEUE_LOW_WATERMARK);
+    if (RegisterEventHandlerToEpoll(serverState->epollFd, serverState->clientFd,
+                                    &serverState->clientEvent, EPOLLIN) != 0) {
+        CloseClient(serverState);
+    }
+}
+
+/// <summary>
+///     Closes the client's socket and returns the serial port to its routes.
+/// </summary>
+static void CloseClient(SerialBridge_ServerState *serverState)
+{
+    if (serverState->clientFd < 0) {
+        return;
+    }
+
+    const TxQueueStats *stats = &serverState->txQueue.stats;
+    Log_Debug("INFO: Serial bridge: Client of %s closed; %llu bytes to the client, %llu reads "
+              "dropped.\n",
+              serverState->portName, (unsigned long long)stats->bytesSent,
+              (unsigned long long)stats->messagesRejected);
+
+    DisarmTimer(&serverState->applySettingsTimer);
+    USISerial_CloseBridge(serverState->portIndex);
+    serverState->portIndex = -1;
+
+    UnregisterEventHandlerFromEpoll(serverState->epollFd, serverState->clientFd);
+    CloseFdAndPrintError(serverState->clientFd, "serialBridgeClientFd");
+    serverState->clientFd = -1;
+    TxQueue_Clear(&serverState->txQueue);
+}
+
+/// <summary>
+///     Registers the client's socket for the events which the bridge is waiting for.
+/// </summary>
+static void UpdateClientEvents(SerialBridge_ServerState *serverState)
+{
+    uint32_t events = (serverState->isReadPaused ? 0 : EPOLLIN) |
+                      (serverState->epollOutEnabled ? EPOLLOUT : 0);
+    RegisterEventHandlerToEpoll(serverState->epollFd, serverState->clientFd,
+                                &serverState->clientEvent, events);
+}
+
+/// <summary>
+///     Writes as much of the queued data as the socket accepts, and waits for EPOLLOUT only
+///     while some remains.
+/// </summary>
+/// <returns>0 on success, or -1 if the client was closed</returns>
+static int FlushClient(SerialBridge_ServerState *serverState)
+{
+    if (TxQueue_Drain(&serverState->txQueue, serverState->clientFd) != 0) {
+        ReportError("send");
+        CloseClient(serverState);
+        return -1;
+    }
+
+    bool epollOutEnabled = !TxQueue_IsEmpty(&serverState->txQueue);
+    if (epollOutEnabled != serverState->epollOutEnabled) {
+        serverState->epollOutEnabled = epollOutEnabled;
+        UpdateClientEvents(serverState);
+    }
+    return 0;
+}
+
+/// <summary>
+///     Queues Telnet protocol bytes for the client. These are small and are not subject to the
+///     watermarks' hysteresis in practice; if the queue is full they are dropped.
+/// </summary>
+static void SendTelnet(SerialBridge_ServerState *serverState, const uint8_t *data, size_t length)
+{
+    if (serverState->clientFd < 0) {
+        return;
+    }
+    TxQueue_Enqueue(&serverState->txQueue, data, length);
+    FlushClient(serverState);
+}
+
+/// <summary>
+///     Sends bytes from the serial port to the client, doubling each 0xFF so it is not taken for
+///     a Telnet command. Bytes which do not fit in the queue are dropped.
+/// </summary>
+static void HandleSerialData(const uint8_t *data, size_t length, void *context)
+{
+    SerialBridge_ServerState *serverState = context;
+    if (serverState->clientFd < 0) {
+        return;
+    }
+
+    static const uint8_t escapedIac[2] = {TELNET_IAC, TELNET_IAC};
+    const uint8_t *start = data;
+    const uint8_t *end = data + length;
+    while (start < end) {
+        // Gather the spans between 0xFF bytes, and their escapes, into one queued message.
+        struct iovec fragments[16];
+        int fragmentCount = 0;
+        while (start < end && fragmentCount < 15) {
+            const uint8_t *iac = SerialFramer_FindByte(start, end, TELNET_IAC);
+            const uint8_t *spanEnd = (iac != NULL) ? iac : end;
+            if (spanEnd > start) {
+                fragments[fragmentCount].iov_base = (void *)start;
+                fragments[fragmentCount].iov_len = (size_t)(spanEnd - start);
+                ++fragmentCount;
+            }
+            if (iac == NULL) {
+                start = end;
+                break;
+            }
+            fragments[fragmentCount].iov_base = (void *)escapedIac;
+            fragments[fragmentCount].iov_len = sizeof(escapedIac);
+            ++fragmentCount;
+            start = iac + 1;
+        }
+
+        bool wasThrottled = TxQueue_IsThrottled(&serverState->txQueue);
+        if (TxQueue_EnqueueFragments(&serverState->txQueue, fragments, fragmentCount) != 0) {
+            if (!wasThrottled) {
+                Log_Debug("INFO: Serial bridge: Client of %s is not keeping up, dropping data.\n",
+                          serverState->portName);
+            }
+            break;
+        }
+    }
+
+    FlushClient(serverState);
+}
+
+/// <summary>
+///     Resumes reading from the client once the serial port accepts data again.
+/// </summary>
+static void HandleSerialTxReady(void *context)
+{
+    SerialBridge_ServerState *serverState = context;
+    if (serverState->clientFd >= 0 && serverState->isReadPaused) {
+        serverState->isReadPaused = false;
+        UpdateClientEvents(serverState);
+    }
+}
+
+static void HandleApplySettingsTimerEvent(Timer *timer)
+{
+    SerialBridge_ServerState *serverState =
+        (SerialBridge_ServerState *)((uint8_t *)timer -
+                                     offsetof(SerialBridge_ServerState, applySettingsTimer));
+
+    USISerialLineSettings settings = {.baudRate = serverState->baudRate,
+                                      .dataBits = serverState->dataBits,
+                                      .parity = serverState->parity,
+                                      .stopBits = serverState->stopBits,
+                                      .flowControl = serverState->flowControl};
+    if (USISerial_SetLineSettings(serverState->portIndex, &settings) != 0) {
+        Log_Debug("ERROR: Serial bridge: Could not apply the client's settings to %s.\n",
+                  serverState->portName);
+    }
+}
+
+static bool IsBaudRateSupported(uint32_t baudRate)
+{
+    for (size_t i = 0; i < sizeof(supportedBaudRates) / sizeof(supportedBaudRates[0]); ++i) {
+        if (supportedBaudRates[i] == baudRate) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Sends a COM port control response. 0xFF bytes in the value are doubled.
+/// </summary>
+static void SendComPortResponse(SerialBridge_ServerState *serverState, uint8_t command,
+                                const uint8_t *value, size_t valueLength)
+{
+    uint8_t response[6 + 2 * sizeof(BridgeSignature)];
+    size_t length = 0;
+    response[length++] = TELNET_IAC;
+    response[length++] = TELNET_SB;
+    response[length++] = TELNET_OPTION_COM_PORT;
+    response[length++] = (uint8_t)(command + COM_PORT_RESPONSE_OFFSET);
+    for (size_t i = 0; i < valueLength; ++i) {
+        response[length++] = value[i];
+        if (value[i] == TELNET_IAC) {
+            response[length++] = TELNET_IAC;
+        }
+    }
+    response[length++] = TELNET_IAC;
+    response[length++] = TELNET_SE;
+    SendTelnet(serverState, response, length);
+}
+
+/// <summary>
+///     Handles a COM port control request. Requested line settings are answered at once and
+///     applied together shortly after the last of them.
+/// </summary>
+static void HandleComPortCommand(SerialBridge_ServerState *serverState, uint8_t command,
+                                 const uint8_t *value, size_t valueLength)
+{
+    uint8_t request = (valueLength > 0) ? value[0] : 0;
+    bool isSettingChanged = false;
+    uint8_t reply;
+
+    switch (command) {
+    case COM_PORT_SIGNATURE:
+        // A signature from the client is informational; an empty one asks for ours.
+        if (valueLength == 0) {
+            SendComPortResponse(serverState, command, (const uint8_t *)BridgeSignature,
+                                sizeof(BridgeSignature) - 1);
+        }
+        return;
+
+    case COM_PORT_SET_BAUDRATE: {
+        if (valueLength < 4) {
+            return;
+        }
+        uint32_t baudRate = ((uint32_t)value[0] << 24) | ((uint32_t)value[1] << 16) |
+                            ((uint32_t)value[2] << 8) | value[3];
+        if (baudRate != 0 && baudRate != serverState->baudRate) {
+            if (IsBaudRateSupported(baudRate)) {
+                serverState->baudRate = baudRate;
+                isSettingChanged = true;
+            } else {
+                Log_Debug("INFO: Serial bridge: %u baud is not supported.\n", baudRate);
+            }
+        }
+        uint8_t current[4] = {(uint8_t)(serverState->baudRate >> 24),
+                              (uint8_t)(serverState->baudRate >> 16),
+                              (uint8_t)(serverState->baudRate >> 8),
+                              (uint8_t)serverState->baudRate};
+        SendComPortResponse(serverState, command, current, sizeof(current));
+        break;
+    }
+
+    case COM_PORT_SET_DATASIZE:
+        if (request >= 5 && request <= 8 && request != serverState->dataBits) {
+            serverState->dataBits = request;
+            isSettingChanged = true;
+        }
+        reply = serverState->dataBits;
+        SendComPortResponse(serverState, command, &reply, 1);
+        break;
+
+    case COM_PORT_SET_PARITY: {
+        // 1 is none, 2 odd and 3 even; mark and space are not supported.
+        static const UART_Parity_Type parities[] = {UART_Parity_None, UART_Parity_Odd,
+                                                    UART_Parity_Even};
+        if (request >= 1 && request <= 3 && parities[request - 1] != serverState->parity) {
+            serverState->parity = parities[request - 1];
+            isSettingChanged = true;
+        }
+        reply = (serverState->parity == UART_Parity_Odd)
+                    ? 2
+                    : (serverState->parity == UART_Parity_Even) ? 3 : 1;
+        SendComPortResponse(serverState, command, &reply, 1);
+        break;
+    }
+
+    case COM_PORT_SET_STOPSIZE:
+        // 1 is one stop bit and 2 two; one and a half is not supported.
+        if ((request == 1 || request == 2) && request != serverState->stopBits) {
+            serverState->stopBits = (request == 1) ? UART_StopBits_One : UART_StopBits_Two;
+            isSettingChanged = true;
+        }
+        reply = (serverState->stopBits == UART_StopBits_Two) ? 2 : 1;
+        SendComPortResponse(serverState, command, &reply, 1);
+        break;
+
+    case COM_PORT_SET_CONTROL:
+        if (request <= 3) {
+            // 1 is no flow control, 2 XON/XOFF and 3 RTS/CTS.
+            static const UART_FlowControl_Type flowControls[] = {
+                UART_FlowControl_None, UART_FlowControl_XONXOFF, UART_FlowControl_RTSCTS};
+            if (request >= 1 && flowControls[request - 1] != serverState->flowControl) {
+                serverState->flowControl = flowControls[request - 1];
+                isSettingChanged = true;
+            }
+            reply = (serverState->flowControl == UART_FlowControl_XONXOFF)
+                        ? 2
+                        : (serverState->flowControl == UART_FlowControl_RTSCTS) ? 3 : 1;
+        } else {
+            // BREAK, DTR and RTS are not brought out on these UARTs. Acknowledge the request as
+            // made so that clients which wait for the answer carry on.
+            reply = request;
+        }
+        SendComPortResponse(serverState, command, &reply, 1);
+        break;
+
+    case COM_PORT_PURGE_DATA:
+        // 1 purges the bytes from the serial port which wait for the client; 3 also asks for the
+        // transmit side, whose bytes have already been handed to the UART.
+        if (request == 1 || request == 3) {
+            TxQueue_Clear(&serverState->txQueue);
+        }
+        SendComPortResponse(serverState, command, value, valueLength > 0 ? 1 : 0);
+        break;
+
+    case COM_PORT_SET_LINESTATE_MASK:
+    case COM_PORT_SET_MODEMSTATE_MASK:
+        // No state notifications are sent, so any mask is accepted as it is.
+        SendComPortResponse(serverState, command, value, valueLength > 0 ? 1 : 0);
+        break;
+
+    default:
+        break;
+    }
+
+    if (isSettingChanged) {
+        struct timespec delay = {0, APPLY_SETTINGS_DELAY_NS};
+        SetTimerToSingleExpiry(&serverState->applySettingsTimer, &delay);
+    }
+}
+
+static bool IsOptionSupported(uint8_t option)
+{
+    switch (option) {
+    case TELNET_OPTION_BINARY:
+    case TELNET_OPTION_SUPPRESS_GO_AHEAD:
+    case TELNET_OPTION_COM_PORT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+///     Answers a Telnet option negotiation. An option is only acknowledged when its state
+///     changes, so negotiations cannot loop (RFC 854).
+/// </summary>
+static void HandleOptionCommand(SerialBridge_ServerState *serverState, uint8_t command,
+                                uint8_t option)
+{
+    uint64_t bit = (option < 64) ? (1ull << option) : 0;
+    bool isWill = (command == TELNET_WILL || command == TELNET_WONT);
+    uint64_t *options = isWill ? &serverState->remoteOptions : &serverState->localOptions;
+    bool isRequested = (command == TELNET_WILL || command == TELNET_DO);
+    bool isEnabled = (*options & bit) != 0;
+
+    uint8_t reply[3] = {TELNET_IAC, 0, option};
+    if (isRequested && IsOptionSupported(option)) {
+        if (isEnabled) {
+            return;
+        }
+        *options |= bit;
+        reply[1] = isWill ? TELNET_DO : TELNET_WILL;
+    } else if (isRequested || isEnabled) {
+        *options &= ~bit;
+        reply[1] = isWill ? TELNET_DONT : TELNET_WONT;
+    } else {
+        return;
+    }
+    SendTelnet(serverState, reply, sizeof(reply));
+}
+
+/// <summary>
+///     Removes Telnet commands from data received from the client, in place, and handles them.
+/// </summary>
+/// <returns>Number of data bytes which remain at the start of data</returns>
+static size_t ParseTelnet(SerialBridge_ServerState *serverState, uint8_t *data, size_t length)
+{
+    size_t dataLength = 0;
+    for (size_t i = 0; i < length && serverState->clientFd >= 0; ++i) {
+        uint8_t byte = data[i];
+        switch (serverState->telnetState) {
+        case SerialBridge_TelnetState_Data:
+            if (byte == TELNET_IAC) {
+                serverState->telnetState = SerialBridge_TelnetState_Iac;
+            } else {
+                data[dataLength++] = byte;
+            }
+            break;
+
+        case SerialBridge_TelnetState_Iac:
+            serverState->telnetState = SerialBridge_TelnetState_Data;
+            if (byte == TELNET_IAC) {
+                data[dataLength++] = byte;
+            } else if (byte >= TELNET_WILL) {
+                serverState->telnetCommand = byte;
+                serverState->telnetState = SerialBridge_TelnetState_Option;
+            } else if (byte == TELNET_SB) {
+                serverState->subnegotiationLength = 0;
+                serverState->telnetState = SerialBridge_TelnetState_Subnegotiation;
+            }
+            // Other commands, such as NOP and AYT, have no meaning for a serial port.
+            break;
+
+        case SerialBridge_TelnetState_Option:
+            serverState->telnetState = SerialBridge_TelnetState_Data;
+            HandleOptionCommand(serverState, serverState->telnetCommand, byte);
+            break;
+
+        case SerialBridge_TelnetState_Subnegotiation:
+            if (byte == TELNET_IAC) {
+                serverState->telnetState = SerialBridge_TelnetState_SubnegotiationIac;
+            } else if (serverState->subnegotiationLength < SERIAL_BRIDGE_SUBNEGOTIATION_SIZE) {
+                serverState->subnegotiation[serverState->subnegotiationLength++] = byte;
+            }
+            break;
+
+        case SerialBridge_TelnetState_SubnegotiationIac:
+            if (byte == TELNET_IAC) {
+                serverState->telnetState = SerialBridge_TelnetState_Subnegotiation;
+                if (serverState->subnegotiationLength < SERIAL_BRIDGE_SUBNEGOTIATION_SIZE) {
+                    serverState->subnegotiation[serverState->subnegotiationLength++] = byte;
+                }
+                break;
+            }
+
+            serverState->telnetState = SerialBridge_TelnetState_Data;
+            const uint8_t *subnegotiation = serverState->subnegotiation;
+            size_t subnegotiationLength = serverState->subnegotiationLength;
+            if (byte == TELNET_SE && subnegotiationLength >= 2 &&
+                subnegotiationLength < SERIAL_BRIDGE_SUBNEGOTIATION_SIZE &&
+                subnegotiation[0] == TELNET_OPTION_COM_PORT) {
+                HandleComPortCommand(serverState, subnegotiation[1], subnegotiation + 2,
+                                     subnegotiationLength - 2);
+            }
+            break;
+        }
+    }
+    return dataLength;
+}
+
+/// <summary>
+///     Reads from the client no more than the serial port accepts, and passes the data on. While
+///     the serial port's queue is full, the client is not read, so TCP flow control holds the
+///     sender back instead of bytes being dropped.
+/// </summary>
+static void HandleClientData(SerialBridge_ServerState *serverState)
+{
+    size_t freeBytes = USISerial_GetTxFreeBytes(serverState->portIndex);
+    if (freeBytes == 0) {
+        serverState->isReadPaused = true;
+        UpdateClientEvents(serverState);
+        return;
+    }
+
+    uint8_t data[CLIENT_READ_SIZE];
+    size_t readSize = (freeBytes < sizeof(data)) ? freeBytes : sizeof(data);
+    ssize_t bytesRead = recv(serverState->clientFd, data, readSize, /* flags */ 0);
+    if (bytesRead == 0) {
+        Log_Debug("INFO: Serial bridge: Client has closed connection.\n");
+        CloseClient(serverState);
+        return;
+    }
+    if (bytesRead < 0) {
+        if (errno == EAGAIN) {
+            return;
+        }
+        ReportError("recv");
+        CloseClient(serverState);
+        return;
+    }
+
+    // Telnet escapes only shrink the data, so it still fits in the serial port's queue.
+    size_t dataLength = ParseTelnet(serverState, data, (size_t)bytesRead);
+    if (serverState->clientFd >= 0 && dataLength > 0 &&
+        USISerial_BridgeSend(serverState->portIndex, data, dataLength) != 0) {
+        Log_Debug("ERROR: Serial bridge: Could not write %zu bytes to %s.\n", dataLength,
+                  serverState->portName);
+    }
+}
+
+static void HandleClientEvent(EventData *eventData)
+{
+    SerialBridge_ServerState *serverState =
+        (SerialBridge_ServerState *)((uint8_t *)eventData -
+                                     offsetof(SerialBridge_ServerState, clientEvent));
+
+    if ((eventData->events & EPOLLOUT) != 0 && FlushClient(serverState) != 0) {
+        return;
+    }
+
+    // A paused client is not read; if it has gone away meanwhile, close it rather than be woken
+    // for the hang-up again and again.
+    if (serverState->isReadPaused) {
+        if ((eventData->events & (EPOLLHUP | EPOLLERR)) != 0) {
+            CloseClient(serverState);
+        }
+        return;
+    }
+    if ((eventData->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+        HandleClientData(serverState);
+    }
+}
+
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType)
+{
+    int localFd = -1;
+    int retFd = -1;
+
+    do {
+        // Create a TCP / IPv4 socket. This will form the listen socket.
+        localFd = socket(AF_INET, sockType, /* protocol */ 0);
+        if (localFd < 0) {
+            ReportError("socket");
+            break;
+        }
+
+        // Enable rebinding soon after a socket has been closed.
+        int enableReuseAddr = 1;
+        int r = setsockopt(localFd, SOL_SOCKET, SO_REUSEADDR, &enableReuseAddr,
+                           sizeof(enableReuseAddr));
+        if (r != 0) {
+            ReportError("setsockopt/SO_REUSEADDR");
+            break;
+        }
+
+        // Bind to a well-known IP address.
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ipAddr;
+        addr.sin_port = htons(port);
+
+        r = bind(localFd, (const struct sockaddr *)&addr, sizeof(addr));
+        if (r != 0) {
+            ReportError("bind");
+            break;
+        }
+
+        // Port opened successfully.
+        retFd = localFd;
+        localFd = -1;
+    } while (0);
+
+    close(localFd);
+
+    return retFd;
+}
+
+static void ReportError(const char *desc)
+{
+    Log_Debug("ERROR: Serial bridge: \"%s\", errno=%d (%s)\n", desc, errno, strerror(errno));
+}
+
+#endif
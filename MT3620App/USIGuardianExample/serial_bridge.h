@@ -0,0 +1,117 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "netinet/in.h"
+#include <applibs/uart.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "tx_queue.h"
+
+/// <summary>Largest number of bytes from the serial port which may wait to be sent to the
+/// client. Bytes which arrive while the queue is full are dropped.</summary>
+#define SERIAL_BRIDGE_TX_QUEUE_LIMIT 8192
+
+/// <summary>Number of waiting bytes to which a full queue must drain before it accepts bytes
+/// again.</summary>
+#define SERIAL_BRIDGE_TX_QUEUE_LOW_WATERMARK 2048
+
+/// <summary>Longest Telnet subnegotiation which is understood; longer ones are ignored.</summary>
+#define SERIAL_BRIDGE_SUBNEGOTIATION_SIZE 32
+
+/// <summary>
+/// State of the Telnet parser for data received from the client.
+/// </summary>
+typedef enum {
+    /// <summary>Data bytes.</summary>
+    SerialBridge_TelnetState_Data,
+    /// <summary>After IAC.</summary>
+    SerialBridge_TelnetState_Iac,
+    /// <summary>After IAC WILL, IAC WONT, IAC DO or IAC DONT; the option follows.</summary>
+    SerialBridge_TelnetState_Option,
+    /// <summary>In a subnegotiation.</summary>
+    SerialBridge_TelnetState_Subnegotiation,
+    /// <summary>After IAC in a subnegotiation.</summary>
+    SerialBridge_TelnetState_SubnegotiationIac
+} SerialBridge_TelnetState;
+
+/// <summary>
+/// <para>Bundles together state about a bridge between a serial port and one TCP client.</para>
+/// <para>This should be allocated with <see cref="SerialBridge_Start" /> and freed with
+/// <see cref="SerialBridge_ShutDown" />. The client should not directly modify member
+/// variables.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Epoll which is used to respond asynchronously to incoming connections.</summary>
+    int epollFd;
+    /// <summary>Socket which listens for incoming connections.</summary>
+    int listenFd;
+    /// <summary>Callback which is invoked when a new connection is received.</summary>
+    EventData listenEvent;
+    /// <summary>Name of the serial port in the port table of usi_serial.c.</summary>
+    const char *portName;
+    /// <summary>Index of the bridged serial port, or -1 if no client is connected.</summary>
+    int portIndex;
+    /// <summary>Accepted socket, or -1 if no client is connected.</summary>
+    int clientFd;
+    /// <summary>Callback which is invoked when the socket is readable or writable.</summary>
+    EventData clientEvent;
+    /// <summary>Whether the socket is registered for EPOLLOUT.</summary>
+    bool epollOutEnabled;
+    /// <summary>Whether reading from the client waits for the serial port to accept
+    /// data.</summary>
+    bool isReadPaused;
+    /// <summary>Bytes from the serial port which wait to be sent to the client.</summary>
+    TxQueue txQueue;
+    /// <summary>Telnet parser state.</summary>
+    SerialBridge_TelnetState telnetState;
+    /// <summary>Command (WILL, WONT, DO or DONT) whose option is awaited.</summary>
+    uint8_t telnetCommand;
+    /// <summary>Options which the client has agreed to use, one bit per option below 64.</summary>
+    uint64_t remoteOptions;
+    /// <summary>Options which the bridge has agreed to use, one bit per option below 64.</summary>
+    uint64_t localOptions;
+    /// <summary>Number of bytes in subnegotiation.</summary>
+    size_t subnegotiationLength;
+    /// <summary>Subnegotiation which is being received, from its option byte.</summary>
+    uint8_t subnegotiation[SERIAL_BRIDGE_SUBNEGOTIATION_SIZE];
+    /// <summary>Baud rate requested by the client.</summary>
+    UART_BaudRate_Type baudRate;
+    /// <summary>Data bits requested by the client.</summary>
+    UART_DataBits_Type dataBits;
+    /// <summary>Parity requested by the client.</summary>
+    UART_Parity_Type parity;
+    /// <summary>Stop bits requested by the client.</summary>
+    UART_StopBits_Type stopBits;
+    /// <summary>Flow control requested by the client.</summary>
+    UART_FlowControl_Type flowControl;
+    /// <summary>Applies the requested line settings shortly after the last request, so a burst
+    /// of requests reopens the UART once.</summary>
+    Timer applySettingsTimer;
+} SerialBridge_ServerState;
+
+/// <summary>
+/// <para>Open a TCP server which bridges one client at a time to a serial port. Bytes are
+/// passed through in both directions without framing. The client speaks Telnet in binary mode,
+/// so a 0xFF data byte is sent as two; the COM-PORT-OPTION of RFC 2217 sets the baud rate, data
+/// bits, parity, stop bits and flow control.</para>
+/// <para>While a client is connected, the port's routes to and from the cloud and any frame
+/// handler, such as the Modbus master, are suspended.</para>
+/// <param name="epollFd">Descriptor to epoll created with CreateEpollFd.</param>
+/// <param name="ipAddr">IP address to which the listen socket is bound.</param>
+/// <param name="port">TCP port to which the socket is bound.</param>
+/// <param name="backlogSize">Listening socket queue length.</param>
+/// <param name="portName">Name of the serial port in the port table of usi_serial.c.</param>
+/// <returns>Server state which is used to manage the server's resources, NULL on failure.
+/// Should be disposed with <see cref="SerialBridge_ShutDown" />.</returns>
+/// </summary>
+SerialBridge_ServerState *SerialBridge_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
+                                             int backlogSize, const char *portName);
+
+/// <summary>
+/// <para>Closes the listening and accepted sockets, returns the serial port to its routes and
+/// frees the server.</para>
+/// <param name="serverState">Server state allocated with <see cref="SerialBridge_Start" />.</param>
+/// </summary>
+void SerialBridge_ShutDown(SerialBridge_ServerState *serverState);
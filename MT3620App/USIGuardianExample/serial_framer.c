@@ -0,0 +1,323 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "serial_framer.h"
+
+#define BUFFER_MASK (SERIAL_FRAMER_BUFFER_SIZE - 1)
+
+_Static_assert((SERIAL_FRAMER_BUFFER_SIZE & BUFFER_MASK) == 0,
+               "SERIAL_FRAMER_BUFFER_SIZE must be a power of two");
+
+// Constants for scanning eight bytes at a time.
+static const uint64_t ONES = 0x0101010101010101ull;
+static const uint64_t HIGH_BITS = 0x8080808080808080ull;
+
+// Whole words are compared at once, and a word which contains the byte is found by testing for a
+// zero byte in (word ^ pattern).
+const uint8_t *SerialFramer_FindByte(const uint8_t *data, const uint8_t *end,
+                                     uint8_t delimiter)
+{
+    while (data < end && ((uintptr_t)data & (sizeof(uint64_t) - 1)) != 0) {
+        if (*data == delimiter) {
+            return data;
+        }
+        ++data;
+    }
+
+    const uint64_t pattern = ONES * delimiter;
+    while (end - data >= (ptrdiff_t)sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= pattern;
+        // The lowest set bit marks the first zero byte; higher bits may be false positives.
+        uint64_t zeroBytes = (word - ONES) & ~word & HIGH_BITS;
+        if (zeroBytes != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return data + (__builtin_ctzll(zeroBytes) >> 3);
+#else
+            return data + (__builtin_clzll(zeroBytes) >> 3);
+#endif
+        }
+        data += sizeof(uint64_t);
+    }
+
+    while (data < end) {
+        if (*data == delimiter) {
+            return data;
+        }
+        ++data;
+    }
+
+    return NULL;
+}
+
+/// <summary>
+///     Passes the bytes from the head up to an end index to the frame handler as one frame.
+/// </summary>
+static void EmitFrame(SerialFramer *framer, uint32_t end)
+{
+    struct iovec spans[2];
+    int spanCount = 1;
+    size_t start = framer->head & BUFFER_MASK;
+    size_t length = end - framer->head;
+
+    spans[0].iov_base = framer->buffer + start;
+    if (start + length > SERIAL_FRAMER_BUFFER_SIZE) {
+        spans[0].iov_len = SERIAL_FRAMER_BUFFER_SIZE - start;
+        spans[1].iov_base = framer->buffer;
+        spans[1].iov_len = length - spans[0].iov_len;
+        spanCount = 2;
+    } else {
+        spans[0].iov_len = length;
+    }
+
+    framer->head = end;
+    framer->frameHandler(spans, spanCount, framer->context);
+}
+
+static uint64_t GetMonotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int ArmIdleTimer(SerialFramer *framer, uint64_t delayNs)
+{
+    struct timespec delay = {.tv_sec = (time_t)(delayNs / 1000000000u),
+                             .tv_nsec = (long)(delayNs % 1000000000u)};
+    if (SetTimerFdToSingleExpiry(framer->idleTimerEventData.fd, &delay) != 0) {
+        return -1;
+    }
+
+    framer->isIdleTimerArmed = true;
+    return 0;
+}
+
+/// <summary>
+///     Handle idle timer event: emit the pending data as a frame if the line has been idle for
+///     the whole gap, or wait for the rest of the gap if data arrived while the timer was armed.
+/// </summary>
+static void IdleTimerEventHandler(EventData *eventData)
+{
+    SerialFramer *framer =
+        (SerialFramer *)((uint8_t *)eventData - offsetof(SerialFramer, idleTimerEventData));
+
+    if (ConsumeTimerFdEvent(framer->idleTimerEventData.fd) != 0) {
+        return;
+    }
+
+    framer->isIdleTimerArmed = false;
+
+    uint64_t gapNs = (uint64_t)framer->config.idleGapMicroseconds * 1000u;
+    uint64_t idleNs = GetMonotonicNs() - framer->lastReceiveNs;
+    if (idleNs < gapNs) {
+        ArmIdleTimer(framer, gapNs - idleNs);
+        return;
+    }
+
+    if (framer->tail != framer->head) {
+        EmitFrame(framer, framer->tail);
+    }
+}
+
+/// <summary>
+///     Reads the length field of a length-prefixed frame, which may wrap around the end of the
+///     ring buffer.
+/// </summary>
+static uint32_t ReadLengthField(const SerialFramer *framer)
+{
+    uint32_t fieldStart = framer->head + framer->config.lengthFieldOffset;
+    uint32_t first = framer->buffer[fieldStart & BUFFER_MASK];
+    if (framer->config.lengthFieldSize == 1) {
+        return first;
+    }
+
+    uint32_t second = framer->buffer[(fieldStart + 1) & BUFFER_MASK];
+    return framer->config.lengthFieldBigEndian ? (first << 8) | second : (second << 8) | first;
+}
+
+static void FrameByDelimiter(SerialFramer *framer)
+{
+    while (framer->scanned != framer->tail) {
+        // Scan up to the tail or the end of the ring buffer, whichever comes first.
+        size_t start = framer->scanned & BUFFER_MASK;
+        size_t runLength = framer->tail - framer->scanned;
+        if (runLength > SERIAL_FRAMER_BUFFER_SIZE - start) {
+            runLength = SERIAL_FRAMER_BUFFER_SIZE - start;
+        }
+
+        const uint8_t *run = framer->buffer + start;
+        const uint8_t *found =
+            SerialFramer_FindByte(run, run + runLength, framer->config.delimiter);
+        if (found == NULL) {
+            framer->scanned += (uint32_t)runLength;
+            continue;
+        }
+
+        framer->scanned += (uint32_t)(found - run) + 1;
+        EmitFrame(framer, framer->scanned);
+    }
+}
+
+static void FrameByFixedLength(SerialFramer *framer)
+{
+    while (framer->tail - framer->head >= framer->config.frameLength) {
+        EmitFrame(framer, framer->head + framer->config.frameLength);
+    }
+}
+
+static void FrameByLengthPrefix(SerialFramer *framer)
+{
+    uint32_t headerLength =
+        (uint32_t)framer->config.lengthFieldOffset + framer->config.lengthFieldSize;
+
+    while (framer->tail - framer->head >= headerLength) {
+        int32_t frameLength =
+            (int32_t)(headerLength + ReadLengthField(framer)) + framer->config.lengthAdjustment;
+        if (frameLength < (int32_t)headerLength || frameLength > SERIAL_FRAMER_BUFFER_SIZE) {
+            // Not a valid header, so resynchronize on the next byte.
+            ++framer->head;
+            continue;
+        }
+
+        if (framer->tail - framer->head < (uint32_t)frameLength) {
+            break;
+        }
+        EmitFrame(framer, framer->head + (uint32_t)frameLength);
+    }
+}
+
+int SerialFramer_Init(SerialFramer *framer, const SerialFramerConfig *config,
+                      SerialFrameHandler frameHandler, void *context, int epollFd)
+{
+    framer->head = 0;
+    framer->scanned = 0;
+    framer->tail = 0;
+    framer->config = *config;
+    framer->frameHandler = frameHandler;
+    framer->context = context;
+    framer->idleTimerEventData.eventHandler = &IdleTimerEventHandler;
+    framer->idleTimerEventData.fd = -1;
+    framer->isIdleTimerArmed = false;
+    framer->lastReceiveNs = 0;
+
+    switch (config->mode) {
+    case SerialFramingMode_Delimiter:
+        return 0;
+
+    case SerialFramingMode_FixedLength:
+        if (config->frameLength == 0 || config->frameLength > SERIAL_FRAMER_BUFFER_SIZE) {
+            Log_Debug("ERROR: Invalid serial frame length %u.\n", config->frameLength);
+            return -1;
+        }
+        return 0;
+
+    case SerialFramingMode_LengthPrefix:
+        if (config->lengthFieldSize != 1 && config->lengthFieldSize != 2) {
+            Log_Debug("ERROR: Invalid serial length field size %u.\n", config->lengthFieldSize);
+            return -1;
+        }
+        return 0;
+
+    case SerialFramingMode_IdleGap: {
+        // The gap is often shorter than the timer wheel's tick, so the framer has its own timer.
+        struct timespec disabled = {0, 0};
+        framer->idleTimerEventData.fd =
+            CreateTimerFdAndAddToEpoll(epollFd, &disabled, &framer->idleTimerEventData, EPOLLIN);
+        return framer->idleTimerEventData.fd < 0 ? -1 : 0;
+    }
+
+    default:
+        Log_Debug("ERROR: Invalid serial framing mode %d.\n", config->mode);
+        return -1;
+    }
+}
+
+void SerialFramer_Close(SerialFramer *framer)
+{
+    if (framer->idleTimerEventData.fd >= 0) {
+        CloseFdAndPrintError(framer->idleTimerEventData.fd, "SerialFramerIdleTimer");
+        framer->idleTimerEventData.fd = -1;
+    }
+    framer->isIdleTimerArmed = false;
+    framer->head = framer->scanned = framer->tail = 0;
+}
+
+uint32_t SerialFramer_GetIdleGapForBaudRate(uint32_t baudRate)
+{
+    if (baudRate == 0 || baudRate > 19200) {
+        return 1750;
+    }
+
+    // 3.5 characters of 11 bits each, in microseconds, rounded up.
+    return (38500000u + baudRate - 1) / baudRate;
+}
+
+uint8_t *SerialFramer_GetWriteSpace(SerialFramer *framer, size_t *length)
+{
+    size_t start = framer->tail & BUFFER_MASK;
+    size_t free = SERIAL_FRAMER_BUFFER_SIZE - (framer->tail - framer->head);
+    size_t untilEnd = SERIAL_FRAMER_BUFFER_SIZE - start;
+    *length = free < untilEnd ? free : untilEnd;
+    return framer->buffer + start;
+}
+
+void SerialFramer_Commit(SerialFramer *framer, size_t length)
+{
+    framer->tail += (uint32_t)length;
+
+    switch (framer->config.mode) {
+    case SerialFramingMode_Delimiter:
+        FrameByDelimiter(framer);
+        break;
+    case SerialFramingMode_FixedLength:
+        FrameByFixedLength(framer);
+        break;
+    case SerialFramingMode_LengthPrefix:
+        FrameByLengthPrefix(framer);
+        break;
+    case SerialFramingMode_IdleGap:
+        // The timer is only armed when it is idle; if it expires early because more data has
+        // arrived since, its handler re-arms it for the rest of the gap. This saves a system
+        // call for every read while a frame is arriving.
+        framer->lastReceiveNs = GetMonotonicNs();
+        if (!framer->isIdleTimerArmed && framer->tail != framer->head) {
+            ArmIdleTimer(framer, (uint64_t)framer->config.idleGapMicroseconds * 1000u);
+        }
+        break;
+    }
+
+    // A full ring buffer is passed on rather than discarded. This cannot happen with fixed-length
+    // or length-prefixed frames, which are never longer than the ring buffer.
+    if (framer->tail - framer->head == SERIAL_FRAMER_BUFFER_SIZE) {
+        EmitFrame(framer, framer->tail);
+        framer->scanned = framer->tail;
+    }
+}
+
+size_t SerialFramer_CopyFrame(const struct iovec *spans, int spanCount, char *dest,
+                              size_t destSize)
+{
+    size_t copied = 0;
+    for (int i = 0; i < spanCount && copied + 1 < destSize; ++i) {
+        size_t length = spans[i].iov_len;
+        if (length > destSize - 1 - copied) {
+            length = destSize - 1 - copied;
+        }
+        memcpy(dest + copied, spans[i].iov_base, length);
+        copied += length;
+    }
+
+    if (destSize > 0) {
+        dest[copied] = '\0';
+    }
+    return copied;
+}
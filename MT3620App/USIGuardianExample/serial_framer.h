@@ -0,0 +1,164 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+///     Size of the framer's ring buffer in bytes, which is also the longest frame. This must be
+///     a power of two, and is large enough for a 256-byte Modbus RTU frame.
+/// </summary>
+#define SERIAL_FRAMER_BUFFER_SIZE 512
+
+/// <summary>
+///     How a framer finds the end of a frame.
+/// </summary>
+typedef enum {
+    /// <summary>A frame ends with a delimiter byte, which is included in the frame.</summary>
+    SerialFramingMode_Delimiter,
+    /// <summary>Every frame has the same length.</summary>
+    SerialFramingMode_FixedLength,
+    /// <summary>A frame starts with a header which contains the length of the rest of the
+    /// frame.</summary>
+    SerialFramingMode_LengthPrefix,
+    /// <summary>A frame ends when the line has been idle for a gap, as in Modbus RTU.</summary>
+    SerialFramingMode_IdleGap
+} SerialFramingMode;
+
+/// <summary>
+///     Describes how a framer splits a byte stream into frames. Only the fields for the selected
+///     mode are used.
+/// </summary>
+typedef struct {
+    /// <summary>How the end of a frame is found.</summary>
+    SerialFramingMode mode;
+    /// <summary>Delimiter: the byte which ends a frame.</summary>
+    uint8_t delimiter;
+    /// <summary>FixedLength: the length of every frame.</summary>
+    uint16_t frameLength;
+    /// <summary>LengthPrefix: offset of the length field from the start of the frame.</summary>
+    uint8_t lengthFieldOffset;
+    /// <summary>LengthPrefix: size of the length field, 1 or 2 bytes.</summary>
+    uint8_t lengthFieldSize;
+    /// <summary>LengthPrefix: whether a 2-byte length field is big endian.</summary>
+    bool lengthFieldBigEndian;
+    /// <summary>LengthPrefix: added to the length field to give the number of bytes which follow
+    /// it, for example to account for a trailing checksum.</summary>
+    int16_t lengthAdjustment;
+    /// <summary>IdleGap: the silence, in microseconds, which ends a frame.</summary>
+    uint32_t idleGapMicroseconds;
+} SerialFramerConfig;
+
+/// <summary>
+///     Function signature for frame handlers.
+/// </summary>
+/// <param name="spans">The frame, which is one span or, if it wraps around the end of the ring
+/// buffer, two spans. The spans point into the ring buffer and are only valid during the
+/// call.</param>
+/// <param name="spanCount">The number of spans, 1 or 2</param>
+/// <param name="context">The context which was supplied to <see cref="SerialFramer_Init"
+/// /></param>
+typedef void (*SerialFrameHandler)(const struct iovec *spans, int spanCount, void *context);
+
+/// <summary>
+/// <para>Splits a byte stream, such as the data read from a UART, into frames.</para>
+/// <para>Data is read directly into a ring buffer (see <see cref="SerialFramer_GetWriteSpace"
+/// />), so frames may be split across any number of reads. In delimiter and idle-gap modes, a
+/// frame which fills the whole ring buffer is emitted as it is. In length-prefix mode, a header
+/// which announces a frame longer than the ring buffer is skipped one byte at a time until a
+/// valid header is found.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Ring buffer which holds the frame being received.</summary>
+    uint8_t buffer[SERIAL_FRAMER_BUFFER_SIZE];
+    /// <summary>Free-running index of the first byte of the frame being received.</summary>
+    uint32_t head;
+    /// <summary>Free-running index of the first byte which has not been scanned.</summary>
+    uint32_t scanned;
+    /// <summary>Free-running index one past the last byte which has been received.</summary>
+    uint32_t tail;
+    /// <summary>How the stream is split into frames.</summary>
+    SerialFramerConfig config;
+    /// <summary>Function which is called for each frame.</summary>
+    SerialFrameHandler frameHandler;
+    /// <summary>Context which is passed to the frame handler.</summary>
+    void *context;
+    /// <summary>IdleGap: one-shot timer which expires when the line may have gone idle. Its fd
+    /// is -1 in the other modes.</summary>
+    EventData idleTimerEventData;
+    /// <summary>IdleGap: whether the idle timer is armed.</summary>
+    bool isIdleTimerArmed;
+    /// <summary>IdleGap: CLOCK_MONOTONIC time, in nanoseconds, when data was last
+    /// received.</summary>
+    uint64_t lastReceiveNs;
+} SerialFramer;
+
+/// <summary>
+///     Initializes a framer. In idle-gap mode, this creates the framer's idle timer.
+/// </summary>
+/// <param name="framer">The framer</param>
+/// <param name="config">How the stream is split into frames; it is copied</param>
+/// <param name="frameHandler">Function which is called for each frame</param>
+/// <param name="context">Context which is passed to the frame handler</param>
+/// <param name="epollFd">Epoll file descriptor, used by the idle timer</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SerialFramer_Init(SerialFramer *framer, const SerialFramerConfig *config,
+                      SerialFrameHandler frameHandler, void *context, int epollFd);
+
+/// <summary>
+///     Releases a framer's resources. Data which has not formed a frame is discarded.
+/// </summary>
+/// <param name="framer">The framer</param>
+void SerialFramer_Close(SerialFramer *framer);
+
+/// <summary>
+///     Gets the idle gap for Modbus RTU at a baud rate: 3.5 characters of 11 bits, but at least
+///     1750 microseconds above 19200 baud.
+/// </summary>
+/// <param name="baudRate">The baud rate</param>
+/// <returns>The idle gap in microseconds</returns>
+uint32_t SerialFramer_GetIdleGapForBaudRate(uint32_t baudRate);
+
+/// <summary>
+///     Gets the contiguous free space in the ring buffer, which received data should be read
+///     into before calling <see cref="SerialFramer_Commit" />.
+/// </summary>
+/// <param name="framer">The framer</param>
+/// <param name="length">Receives the number of bytes which can be written</param>
+/// <returns>Pointer to the free space</returns>
+uint8_t *SerialFramer_GetWriteSpace(SerialFramer *framer, size_t *length);
+
+/// <summary>
+///     Appends the bytes which have been written to the free space and calls the frame handler
+///     for every frame which they complete.
+/// </summary>
+/// <param name="framer">The framer</param>
+/// <param name="length">The number of bytes which have been written</param>
+void SerialFramer_Commit(SerialFramer *framer, size_t length);
+
+/// <summary>
+///     Finds the first occurrence of a byte in a range, eight bytes at a time.
+/// </summary>
+/// <param name="data">Start of the range</param>
+/// <param name="end">End of the range</param>
+/// <param name="delimiter">The byte to find</param>
+/// <returns>Pointer to the byte, or NULL if it was not found</returns>
+const uint8_t *SerialFramer_FindByte(const uint8_t *data, const uint8_t *end,
+                                     uint8_t delimiter);
+
+/// <summary>
+///     Copies a frame into a buffer and terminates it with a NUL byte. A frame which is too long
+///     for the buffer is truncated.
+/// </summary>
+/// <param name="spans">The frame's spans</param>
+/// <param name="spanCount">The number of spans</param>
+/// <param name="dest">The buffer</param>
+/// <param name="destSize">The size of the buffer in bytes, including the NUL byte</param>
+/// <returns>The number of bytes copied, excluding the NUL byte</returns>
+size_t SerialFramer_CopyFrame(const struct iovec *spans, int spanCount, char *dest,
+                              size_t destSize);
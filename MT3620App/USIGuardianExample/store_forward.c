@@ -0,0 +1,523 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "store_forward.h"
+#include "nordic/crc.h"
+
+// Marks a valid segment header or checkpoint.
+#define SEGMENT_MAGIC 0x53464753u
+#define CHECKPOINT_MAGIC 0x53464350u
+
+// Each of the two checkpoint slots takes this many bytes of the header area.
+#define CHECKPOINT_SLOT_SIZE 32
+
+// The write budget is a number of bytes per this many milliseconds.
+#define BUDGET_PERIOD_MS 86400000u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t firstSequence;
+    uint32_t crc;
+} SegmentHeader;
+
+typedef struct {
+    uint32_t crc;
+    uint32_t sequence;
+    uint16_t length;
+    uint16_t reserved;
+} RecordHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t sequence;
+    uint32_t crc;
+} Checkpoint;
+
+static uint64_t GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static off_t SegmentOffset(uint32_t segment)
+{
+    return (off_t)STORE_FORWARD_HEADER_SIZE + (off_t)segment * STORE_FORWARD_SEGMENT_SIZE;
+}
+
+/// <summary>
+///     Compares two sequence numbers, which wrap.
+/// </summary>
+/// <returns>True if a comes before b; false otherwise</returns>
+static bool IsBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/// <summary>
+///     Finds the bit of a record in the masks of records past the read pointer.
+/// </summary>
+/// <returns>True if the record is in the window; false otherwise</returns>
+static bool GetWindowBit(const StoreForward *store, uint32_t sequence, uint32_t *bit)
+{
+    uint32_t index = sequence - store->readPosition.sequence;
+    if (IsBefore(sequence, store->readPosition.sequence) || index >= STORE_FORWARD_READ_WINDOW) {
+        return false;
+    }
+    *bit = 1u << index;
+    return true;
+}
+
+/// <summary>
+///     Shifts the masks of records past the read pointer after it advanced.
+/// </summary>
+static void ShiftWindow(StoreForward *store, uint32_t count)
+{
+    if (count >= STORE_FORWARD_READ_WINDOW) {
+        store->inFlightMask = 0;
+        store->acknowledgedMask = 0;
+        return;
+    }
+    store->inFlightMask >>= count;
+    store->acknowledgedMask >>= count;
+}
+
+static int ReadAt(int fd, off_t offset, void *buffer, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        return -1;
+    }
+    ssize_t bytesRead = read(fd, buffer, length);
+    return bytesRead == (ssize_t)length ? 0 : -1;
+}
+
+/// <summary>
+///     Charges bytes which are about to be written to the daily budget.
+/// </summary>
+/// <returns>True if the budget allows the write; false otherwise</returns>
+static bool ChargeBudget(StoreForward *store, size_t length)
+{
+    uint64_t now = GetMonotonicMs();
+    if (now - store->budgetStartMs >= BUDGET_PERIOD_MS) {
+        store->budgetStartMs = now;
+        store->budgetBytesUsed = 0;
+    }
+    if (length > store->writeBudgetBytes - store->budgetBytesUsed) {
+        return false;
+    }
+    store->budgetBytesUsed += (uint32_t)length;
+    return true;
+}
+
+static int WriteAt(StoreForward *store, off_t offset, const struct iovec *fragments,
+                   int fragmentCount)
+{
+    size_t length = 0;
+    for (int i = 0; i < fragmentCount; ++i) {
+        length += fragments[i].iov_len;
+    }
+    if (lseek(store->fd, offset, SEEK_SET) == -1) {
+        return -1;
+    }
+    ssize_t bytesWritten = writev(store->fd, fragments, fragmentCount);
+    if (bytesWritten > 0) {
+        store->stats.bytesWritten += (uint64_t)bytesWritten;
+    }
+    return bytesWritten == (ssize_t)length ? 0 : -1;
+}
+
+static uint32_t RecordCrc(const RecordHeader *header, const void *data)
+{
+    uint32_t crc = CalcCrc32((const uint8_t *)&header->sequence,
+                             sizeof(*header) - offsetof(RecordHeader, sequence));
+    return CalcCrc32WithSeed(data, header->length, crc);
+}
+
+/// <summary>
+///     Reads the header of the record at a position and checks that it follows the previous
+///     record and fits in its segment.
+/// </summary>
+/// <returns>0 on success, or -1 if there is no valid record at the position</returns>
+static int ReadRecordHeader(const StoreForward *store, const StoreForwardPosition *position,
+                            RecordHeader *header)
+{
+    if (position->offset + sizeof(*header) > STORE_FORWARD_SEGMENT_SIZE ||
+        ReadAt(store->fd, SegmentOffset(position->segment) + position->offset, header,
+               sizeof(*header)) != 0) {
+        return -1;
+    }
+    if (header->sequence != position->sequence ||
+        header->length > STORE_FORWARD_SEGMENT_SIZE - position->offset - sizeof(*header)) {
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Finds the segment which was opened after a segment.
+/// </summary>
+/// <returns>The index of the segment, or the write segment if there is none</returns>
+static uint32_t NextSegment(const StoreForward *store, uint32_t segment)
+{
+    uint32_t next = store->writeSegment;
+    for (uint32_t i = 0; i < STORE_FORWARD_SEGMENT_COUNT; ++i) {
+        if (store->generations[i] > store->generations[segment] &&
+            store->generations[i] < store->generations[next]) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+/// <summary>
+///     Moves a position which is at the end of its segment to the first record of the next
+///     segment. A position at the end of the write segment is not moved.
+/// </summary>
+static void SkipSegmentEnd(const StoreForward *store, StoreForwardPosition *position)
+{
+    while (position->offset >= store->usedBytes[position->segment] &&
+           position->segment != store->writeSegment) {
+        position->segment = NextSegment(store, position->segment);
+        position->offset = STORE_FORWARD_SEGMENT_HEADER_SIZE;
+        position->sequence = store->firstSequences[position->segment];
+    }
+}
+
+static int WriteSegmentHeader(StoreForward *store, uint32_t segment, uint32_t generation)
+{
+    SegmentHeader header = {.magic = SEGMENT_MAGIC,
+                            .generation = generation,
+                            .firstSequence = store->nextSequence};
+    header.crc = CalcCrc32((const uint8_t *)&header, offsetof(SegmentHeader, crc));
+    struct iovec fragment = {.iov_base = &header, .iov_len = sizeof(header)};
+    if (WriteAt(store, SegmentOffset(segment), &fragment, 1) != 0) {
+        return -1;
+    }
+
+    store->generations[segment] = generation;
+    store->firstSequences[segment] = store->nextSequence;
+    store->usedBytes[segment] = STORE_FORWARD_SEGMENT_HEADER_SIZE;
+    store->writeSegment = segment;
+    return 0;
+}
+
+/// <summary>
+///     Writes the read pointer to the checkpoint slot which does not hold the last checkpoint.
+/// </summary>
+static void WriteCheckpoint(StoreForward *store)
+{
+    if (store->readPosition.sequence == store->checkpointSequence ||
+        !ChargeBudget(store, sizeof(Checkpoint))) {
+        return;
+    }
+
+    Checkpoint checkpoint = {.magic = CHECKPOINT_MAGIC,
+                             .generation = store->checkpointGeneration + 1,
+                             .sequence = store->readPosition.sequence};
+    checkpoint.crc = CalcCrc32((const uint8_t *)&checkpoint, offsetof(Checkpoint, crc));
+    struct iovec fragment = {.iov_base = &checkpoint, .iov_len = sizeof(checkpoint)};
+    if (WriteAt(store, (off_t)(checkpoint.generation % 2) * CHECKPOINT_SLOT_SIZE, &fragment, 1) !=
+        0) {
+        return;
+    }
+
+    store->checkpointGeneration = checkpoint.generation;
+    store->checkpointSequence = checkpoint.sequence;
+    ++store->stats.checkpointsWritten;
+}
+
+/// <summary>
+///     Reads a segment's header and finds the end of its valid records.
+/// </summary>
+/// <param name="scratch">Buffer of STORE_FORWARD_MAX_RECORD bytes for the records</param>
+static void RecoverSegment(StoreForward *store, uint32_t segment, uint8_t *scratch)
+{
+    SegmentHeader header;
+    if (ReadAt(store->fd, SegmentOffset(segment), &header, sizeof(header)) != 0 ||
+        header.magic != SEGMENT_MAGIC || header.generation == 0 ||
+        header.crc != CalcCrc32((const uint8_t *)&header, offsetof(SegmentHeader, crc))) {
+        return;
+    }
+
+    StoreForwardPosition position = {.segment = segment,
+                                     .offset = STORE_FORWARD_SEGMENT_HEADER_SIZE,
+                                     .sequence = header.firstSequence};
+    RecordHeader record;
+    while (ReadRecordHeader(store, &position, &record) == 0 &&
+           ReadAt(store->fd, SegmentOffset(segment) + position.offset + sizeof(record), scratch,
+                  record.length) == 0 &&
+           RecordCrc(&record, scratch) == record.crc) {
+        position.offset += (uint32_t)sizeof(record) + record.length;
+        ++position.sequence;
+    }
+
+    store->generations[segment] = header.generation;
+    store->firstSequences[segment] = header.firstSequence;
+    store->usedBytes[segment] = position.offset;
+}
+
+int StoreForward_Open(StoreForward *store, int fd, uint32_t writeBudgetBytes)
+{
+    memset(store, 0, sizeof(*store));
+    store->fd = fd;
+    store->writeBudgetBytes = writeBudgetBytes;
+    store->budgetStartMs = GetMonotonicMs();
+
+    uint8_t *scratch = malloc(STORE_FORWARD_MAX_RECORD);
+    if (!scratch) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < STORE_FORWARD_SEGMENT_COUNT; ++i) {
+        RecoverSegment(store, i, scratch);
+        if (store->generations[i] > store->generations[store->writeSegment]) {
+            store->writeSegment = i;
+        }
+    }
+    free(scratch);
+
+    // Records are appended to the newest segment; an empty file starts with segment 0.
+    uint32_t writeSegment = store->writeSegment;
+    if (store->generations[writeSegment] == 0) {
+        store->nextSequence = 1;
+        if (!ChargeBudget(store, sizeof(SegmentHeader)) ||
+            WriteSegmentHeader(store, 0, 1) != 0) {
+            return -1;
+        }
+    } else {
+        StoreForwardPosition end = {.segment = writeSegment,
+                                    .offset = STORE_FORWARD_SEGMENT_HEADER_SIZE,
+                                    .sequence = store->firstSequences[writeSegment]};
+        RecordHeader record;
+        while (end.offset < store->usedBytes[writeSegment] &&
+               ReadRecordHeader(store, &end, &record) == 0) {
+            end.offset += (uint32_t)sizeof(record) + record.length;
+            ++end.sequence;
+        }
+        store->nextSequence = end.sequence;
+    }
+
+    // Start reading at the oldest record.
+    uint32_t oldest = store->writeSegment;
+    for (uint32_t i = 0; i < STORE_FORWARD_SEGMENT_COUNT; ++i) {
+        if (store->generations[i] != 0 &&
+            store->generations[i] < store->generations[oldest]) {
+            oldest = i;
+        }
+    }
+    store->readPosition.segment = oldest;
+    store->readPosition.offset = STORE_FORWARD_SEGMENT_HEADER_SIZE;
+    store->readPosition.sequence = store->firstSequences[oldest];
+
+    // Skip the records which were delivered before the latest valid checkpoint.
+    bool hasCheckpoint = false;
+    uint32_t checkpointSequence = 0;
+    for (int slot = 0; slot < 2; ++slot) {
+        Checkpoint checkpoint;
+        if (ReadAt(fd, (off_t)slot * CHECKPOINT_SLOT_SIZE, &checkpoint, sizeof(checkpoint)) == 0 &&
+            checkpoint.magic == CHECKPOINT_MAGIC &&
+            checkpoint.crc == CalcCrc32((const uint8_t *)&checkpoint, offsetof(Checkpoint, crc)) &&
+            (!hasCheckpoint || checkpoint.generation > store->checkpointGeneration)) {
+            hasCheckpoint = true;
+            store->checkpointGeneration = checkpoint.generation;
+            checkpointSequence = checkpoint.sequence;
+        }
+    }
+    if (hasCheckpoint) {
+        while (IsBefore(store->readPosition.sequence, checkpointSequence) &&
+               store->readPosition.sequence != store->nextSequence) {
+            SkipSegmentEnd(store, &store->readPosition);
+            RecordHeader record;
+            if (ReadRecordHeader(store, &store->readPosition, &record) != 0) {
+                break;
+            }
+            store->readPosition.offset += (uint32_t)sizeof(record) + record.length;
+            ++store->readPosition.sequence;
+        }
+    }
+    store->checkpointSequence = store->readPosition.sequence;
+    store->peekPosition = store->readPosition;
+    return 0;
+}
+
+void StoreForward_Close(StoreForward *store)
+{
+    if (store->fd < 0) {
+        return;
+    }
+    WriteCheckpoint(store);
+    close(store->fd);
+    store->fd = -1;
+}
+
+int StoreForward_Append(StoreForward *store, const void *data, size_t length)
+{
+    size_t recordSize = sizeof(RecordHeader) + length;
+    bool isRollover =
+        store->usedBytes[store->writeSegment] + recordSize > STORE_FORWARD_SEGMENT_SIZE;
+    if (length > STORE_FORWARD_MAX_RECORD ||
+        !ChargeBudget(store, recordSize + (isRollover ? sizeof(SegmentHeader) : 0))) {
+        ++store->stats.recordsRefused;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (isRollover) {
+        // The segment after the write segment is the oldest. Its undelivered records are lost,
+        // and reading continues with the segment after it.
+        uint32_t segment = (store->writeSegment + 1) % STORE_FORWARD_SEGMENT_COUNT;
+        if (store->generations[segment] != 0) {
+            uint32_t next = NextSegment(store, segment);
+            StoreForwardPosition nextStart = {.segment = next,
+                                              .offset = STORE_FORWARD_SEGMENT_HEADER_SIZE,
+                                              .sequence = store->firstSequences[next]};
+            if (store->readPosition.segment == segment && !StoreForward_IsEmpty(store)) {
+                uint32_t lost = nextStart.sequence - store->readPosition.sequence;
+                store->stats.recordsLost += lost;
+                ShiftWindow(store, lost);
+                store->readPosition = nextStart;
+            }
+            if (store->peekPosition.segment == segment) {
+                store->peekPosition = nextStart;
+            }
+        }
+        if (WriteSegmentHeader(store, segment, store->generations[store->writeSegment] + 1) !=
+            0) {
+            return -1;
+        }
+    }
+
+    RecordHeader header = {.sequence = store->nextSequence, .length = (uint16_t)length};
+    header.crc = RecordCrc(&header, data);
+    struct iovec fragments[] = {{.iov_base = &header, .iov_len = sizeof(header)},
+                                {.iov_base = (void *)data, .iov_len = length}};
+    if (WriteAt(store,
+                SegmentOffset(store->writeSegment) + store->usedBytes[store->writeSegment],
+                fragments, 2) != 0) {
+        return -1;
+    }
+
+    store->usedBytes[store->writeSegment] += (uint32_t)recordSize;
+    ++store->nextSequence;
+    ++store->stats.recordsAppended;
+    return 0;
+}
+
+bool StoreForward_IsEmpty(const StoreForward *store)
+{
+    return store->readPosition.sequence == store->nextSequence;
+}
+
+/// <summary>
+///     Advances the read pointer past the run of acknowledged records at its start, and past
+///     records which were cut off from the end of their segment.
+/// </summary>
+static void AdvanceReadPosition(StoreForward *store)
+{
+    StoreForwardPosition *position = &store->readPosition;
+    while (position->sequence != store->nextSequence) {
+        uint32_t sequence = position->sequence;
+        SkipSegmentEnd(store, position);
+        if (position->sequence != sequence) {
+            store->stats.recordsLost += position->sequence - sequence;
+            ShiftWindow(store, position->sequence - sequence);
+            continue;
+        }
+        if ((store->acknowledgedMask & 1u) == 0) {
+            break;
+        }
+
+        RecordHeader header;
+        if (ReadRecordHeader(store, position, &header) != 0) {
+            if (position->segment == store->writeSegment) {
+                break;
+            }
+            store->usedBytes[position->segment] = position->offset;
+            continue;
+        }
+        position->offset += (uint32_t)sizeof(header) + header.length;
+        ++position->sequence;
+        ShiftWindow(store, 1);
+        ++store->stats.recordsDelivered;
+    }
+}
+
+int StoreForward_ReadNext(StoreForward *store, void *buffer, size_t capacity, size_t *length,
+                          uint32_t *sequence)
+{
+    while (store->peekPosition.sequence != store->nextSequence) {
+        SkipSegmentEnd(store, &store->peekPosition);
+
+        RecordHeader header;
+        StoreForwardPosition *position = &store->peekPosition;
+        uint32_t bit;
+        if (!GetWindowBit(store, position->sequence, &bit)) {
+            return -1;
+        }
+        bool hasHeader = ReadRecordHeader(store, position, &header) == 0;
+        if (hasHeader && ((store->inFlightMask | store->acknowledgedMask) & bit) != 0) {
+            position->offset += (uint32_t)sizeof(header) + header.length;
+            ++position->sequence;
+            continue;
+        }
+        if (!hasHeader || header.length > capacity ||
+            ReadAt(store->fd, SegmentOffset(position->segment) + position->offset + sizeof(header),
+                   buffer, header.length) != 0 ||
+            RecordCrc(&header, buffer) != header.crc) {
+            // The rest of the segment cannot be read. It is cut off, as recovery would, so the
+            // read pointer passes it too.
+            if (position->segment == store->writeSegment) {
+                return -1;
+            }
+            store->usedBytes[position->segment] = position->offset;
+            AdvanceReadPosition(store);
+            continue;
+        }
+
+        *length = header.length;
+        *sequence = header.sequence;
+        position->offset += (uint32_t)sizeof(header) + header.length;
+        ++position->sequence;
+        store->inFlightMask |= bit;
+        return 0;
+    }
+    return -1;
+}
+
+void StoreForward_Acknowledge(StoreForward *store, uint32_t sequence)
+{
+    uint32_t bit;
+    if (!GetWindowBit(store, sequence, &bit)) {
+        return;
+    }
+    store->inFlightMask &= ~bit;
+    store->acknowledgedMask |= bit;
+
+    StoreForwardPosition *position = &store->readPosition;
+    AdvanceReadPosition(store);
+    if (IsBefore(store->peekPosition.sequence, position->sequence)) {
+        store->peekPosition = *position;
+    }
+
+    if (StoreForward_IsEmpty(store) ||
+        position->sequence - store->checkpointSequence >= STORE_FORWARD_CHECKPOINT_INTERVAL) {
+        WriteCheckpoint(store);
+    }
+}
+
+void StoreForward_Rewind(StoreForward *store, uint32_t sequence)
+{
+    uint32_t bit;
+    if (GetWindowBit(store, sequence, &bit)) {
+        store->inFlightMask &= ~bit;
+    }
+    store->peekPosition = store->readPosition;
+}
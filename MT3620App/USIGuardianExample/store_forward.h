@@ -0,0 +1,190 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Size of the area at the start of the file which holds the two checkpoint
+/// slots.</summary>
+#define STORE_FORWARD_HEADER_SIZE 256
+
+/// <summary>Size of one segment of the ring.</summary>
+#define STORE_FORWARD_SEGMENT_SIZE 8192
+
+/// <summary>Number of segments in the ring. When every segment is in use, the oldest is
+/// overwritten and its undelivered records are lost.</summary>
+#define STORE_FORWARD_SEGMENT_COUNT 7
+
+/// <summary>Size of the file: the checkpoint area and the segments. The app's mutable storage
+/// must be at least this large.</summary>
+#define STORE_FORWARD_FILE_SIZE \
+    (STORE_FORWARD_HEADER_SIZE + STORE_FORWARD_SEGMENT_COUNT * STORE_FORWARD_SEGMENT_SIZE)
+
+/// <summary>Size of the header which starts each segment.</summary>
+#define STORE_FORWARD_SEGMENT_HEADER_SIZE 16
+
+/// <summary>Size of the header which precedes each record.</summary>
+#define STORE_FORWARD_RECORD_HEADER_SIZE 12
+
+/// <summary>Largest record, which fills a segment on its own.</summary>
+#define STORE_FORWARD_MAX_RECORD \
+    (STORE_FORWARD_SEGMENT_SIZE - STORE_FORWARD_SEGMENT_HEADER_SIZE - \
+     STORE_FORWARD_RECORD_HEADER_SIZE)
+
+/// <summary>Largest number of records past the read pointer which may be read before the
+/// record at the read pointer is acknowledged.</summary>
+#define STORE_FORWARD_READ_WINDOW 32
+
+/// <summary>Number of delivered records after which the read pointer is checkpointed.</summary>
+#define STORE_FORWARD_CHECKPOINT_INTERVAL 16
+
+/// <summary>
+///     A position in the ring: the offset of a record in a segment, and its sequence number.
+/// </summary>
+typedef struct {
+    /// <summary>Index of the segment.</summary>
+    uint32_t segment;
+    /// <summary>Offset of the record from the start of the segment.</summary>
+    uint32_t offset;
+    /// <summary>Sequence number of the record.</summary>
+    uint32_t sequence;
+} StoreForwardPosition;
+
+/// <summary>
+///     Counters for a <see cref="StoreForward" />.
+/// </summary>
+typedef struct {
+    /// <summary>Number of records which were stored.</summary>
+    uint64_t recordsAppended;
+    /// <summary>Number of records which were acknowledged as delivered.</summary>
+    uint64_t recordsDelivered;
+    /// <summary>Number of records which were refused because they were too long or the write
+    /// budget was spent.</summary>
+    uint64_t recordsRefused;
+    /// <summary>Number of undelivered records which were lost when their segment was
+    /// overwritten.</summary>
+    uint64_t recordsLost;
+    /// <summary>Number of checkpoints which were written.</summary>
+    uint64_t checkpointsWritten;
+    /// <summary>Number of bytes which were written to the file.</summary>
+    uint64_t bytesWritten;
+} StoreForwardStats;
+
+/// <summary>
+/// <para>A bounded log of records which survives reboots and power loss, for messages which
+/// cannot be sent while the device is offline.</para>
+/// <para>The file is a ring of segments. Records are only appended, each with a sequence
+/// number and a CRC-32, so a record which was torn by power loss ends the log when it is
+/// recovered. The sequence number of the next record to deliver is checkpointed in one of two
+/// slots in turn, so a torn checkpoint leaves the other one valid.</para>
+/// <para>Records are read in order ahead of the read pointer, and each is acknowledged or
+/// rewound on its own. The read pointer only advances over a run of acknowledged records, so a
+/// record which was never acknowledged is read again after <see cref="StoreForward_Rewind" />
+/// or a reboot, even if records after it were acknowledged, and a delivered one is not.</para>
+/// <para>Appends and checkpoints are charged to a daily budget of bytes written, which bounds
+/// the flash wear; when it is spent, records are refused and checkpoints are delayed.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The file, which the store owns.</summary>
+    int fd;
+    /// <summary>Generation of each segment: the number of segments opened before it, plus 1;
+    /// 0 if the segment has never been used.</summary>
+    uint32_t generations[STORE_FORWARD_SEGMENT_COUNT];
+    /// <summary>Sequence number of the first record of each segment.</summary>
+    uint32_t firstSequences[STORE_FORWARD_SEGMENT_COUNT];
+    /// <summary>Number of bytes used in each segment, including its header.</summary>
+    uint32_t usedBytes[STORE_FORWARD_SEGMENT_COUNT];
+    /// <summary>Segment which records are appended to.</summary>
+    uint32_t writeSegment;
+    /// <summary>Sequence number of the next record to be appended.</summary>
+    uint32_t nextSequence;
+    /// <summary>Next record to be acknowledged.</summary>
+    StoreForwardPosition readPosition;
+    /// <summary>Next record to be read.</summary>
+    StoreForwardPosition peekPosition;
+    /// <summary>Records which were read and wait to be acknowledged or rewound: bit i is the
+    /// record with sequence number readPosition.sequence + i.</summary>
+    uint32_t inFlightMask;
+    /// <summary>Records which were acknowledged behind a record which was not, numbered like
+    /// inFlightMask.</summary>
+    uint32_t acknowledgedMask;
+    /// <summary>Generation of the last checkpoint which was written.</summary>
+    uint32_t checkpointGeneration;
+    /// <summary>Sequence number in the last checkpoint which was written.</summary>
+    uint32_t checkpointSequence;
+    /// <summary>Largest number of bytes which may be written per day.</summary>
+    uint32_t writeBudgetBytes;
+    /// <summary>Number of bytes written in the current day.</summary>
+    uint32_t budgetBytesUsed;
+    /// <summary>CLOCK_MONOTONIC time, in milliseconds, at which the current day
+    /// started.</summary>
+    uint64_t budgetStartMs;
+    /// <summary>Counters.</summary>
+    StoreForwardStats stats;
+} StoreForward;
+
+/// <summary>
+///     Recovers the log from a file, which may be empty.
+/// </summary>
+/// <param name="store">The store</param>
+/// <param name="fd">The file, opened for reading and writing; the store closes it</param>
+/// <param name="writeBudgetBytes">Largest number of bytes which may be written per day</param>
+/// <returns>0 on success, or -1 if the file could not be read or initialized</returns>
+int StoreForward_Open(StoreForward *store, int fd, uint32_t writeBudgetBytes);
+
+/// <summary>
+///     Checkpoints the read pointer, if the budget allows, and closes the file.
+/// </summary>
+/// <param name="store">The store</param>
+void StoreForward_Close(StoreForward *store);
+
+/// <summary>
+///     Appends a record to the log. If every segment is in use, the oldest is overwritten.
+/// </summary>
+/// <param name="store">The store</param>
+/// <param name="data">The record</param>
+/// <param name="length">Length of the record; at most STORE_FORWARD_MAX_RECORD</param>
+/// <returns>0 on success, or -1 if the record was refused or could not be written</returns>
+int StoreForward_Append(StoreForward *store, const void *data, size_t length);
+
+/// <summary>
+///     Queries whether every record has been acknowledged.
+/// </summary>
+/// <param name="store">The store</param>
+/// <returns>True if no record waits for delivery; false otherwise</returns>
+bool StoreForward_IsEmpty(const StoreForward *store);
+
+/// <summary>
+///     Reads the oldest record which is neither acknowledged nor waiting to be, at most
+///     STORE_FORWARD_READ_WINDOW records past the read pointer.
+/// </summary>
+/// <param name="store">The store</param>
+/// <param name="buffer">Receives the record</param>
+/// <param name="capacity">Size of the buffer</param>
+/// <param name="length">Receives the length of the record</param>
+/// <param name="sequence">Receives the sequence number of the record, for
+/// <see cref="StoreForward_Acknowledge" /></param>
+/// <returns>0 on success, or -1 if there is no record to read, the window is full or the record
+/// could not be read</returns>
+int StoreForward_ReadNext(StoreForward *store, void *buffer, size_t capacity, size_t *length,
+                          uint32_t *sequence);
+
+/// <summary>
+///     Marks a record which was read as delivered, advances the read pointer past every
+///     delivered record at its start, and checkpoints it every STORE_FORWARD_CHECKPOINT_INTERVAL
+///     records and when the log is empty. A record which is before the read pointer, because
+///     it was lost, is ignored.
+/// </summary>
+/// <param name="store">The store</param>
+/// <param name="sequence">Sequence number of the delivered record</param>
+void StoreForward_Acknowledge(StoreForward *store, uint32_t sequence);
+
+/// <summary>
+///     Makes a record which was read but not delivered the next to be read again, ahead of the
+///     records after it.
+/// </summary>
+/// <param name="store">The store</param>
+/// <param name="sequence">Sequence number of the record</param>
+void StoreForward_Rewind(StoreForward *store, uint32_t sequence);
@@ -0,0 +1,177 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "telemetry_batcher.h"
+
+static void HandleAgeTimerEvent(Timer *timer);
+
+static uint64_t GetRealtimeMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+/// <summary>
+///     Appends a record to the batch if it fits, leaving room to close the array and the
+///     object.
+/// </summary>
+/// <returns>True if the record was appended; false if the batch is unchanged</returns>
+static bool AppendRecord(TelemetryBatcher *batcher, TelemetryBatcher_RecordWriter writeRecord,
+                         const void *record)
+{
+    JsonWriter *writer = &batcher->writer;
+    if (batcher->recordCount == 0) {
+        JsonWriter_Init(writer, batcher->buffer, sizeof(batcher->buffer));
+        JsonWriter_BeginObject(writer);
+        JsonWriter_Key(writer, "records");
+        JsonWriter_BeginArray(writer);
+    }
+
+    JsonWriterMark mark = JsonWriter_GetMark(writer);
+    JsonWriter_BeginObject(writer);
+    JsonWriter_Key(writer, "ts");
+    JsonWriter_Uint(writer, GetRealtimeMs());
+    writeRecord(writer, record);
+    JsonWriter_EndObject(writer);
+    // The closing "]}" must still fit.
+    if (writer->failed || writer->length + 2 > batcher->config.maxBytes) {
+        JsonWriter_Rewind(writer, &mark);
+        return false;
+    }
+
+    ++batcher->recordCount;
+    return true;
+}
+
+void TelemetryBatcher_Init(TelemetryBatcher *batcher, const TelemetryBatcherConfig *config,
+                           TelemetryBatcher_FlushHandler flushHandler, void *context)
+{
+    memset(batcher, 0, sizeof(*batcher));
+    batcher->flushHandler = flushHandler;
+    batcher->context = context;
+    batcher->ageTimer.timerHandler = HandleAgeTimerEvent;
+    TelemetryBatcher_SetConfig(batcher, config);
+}
+
+void TelemetryBatcher_SetConfig(TelemetryBatcher *batcher, const TelemetryBatcherConfig *config)
+{
+    batcher->config = *config;
+    if (batcher->config.maxBytes > TELEMETRY_BATCHER_CAPACITY - 1) {
+        batcher->config.maxBytes = TELEMETRY_BATCHER_CAPACITY - 1;
+    }
+    if (batcher->recordCount > 0 && batcher->recordCount >= batcher->config.maxRecords) {
+        ++batcher->stats.fullFlushes;
+        TelemetryBatcher_Flush(batcher);
+    }
+}
+
+/// <summary>
+///     A record which is one named string.
+/// </summary>
+typedef struct {
+    const char *name;
+    const char *value;
+    size_t length;
+} StringRecord;
+
+static void WriteStringRecord(JsonWriter *writer, const void *record)
+{
+    const StringRecord *stringRecord = record;
+    JsonWriter_Key(writer, stringRecord->name);
+    JsonWriter_StringN(writer, stringRecord->value, stringRecord->length);
+}
+
+int TelemetryBatcher_AddString(TelemetryBatcher *batcher, const char *name, const char *value)
+{
+    return TelemetryBatcher_AddStringN(batcher, name, value, strlen(value));
+}
+
+int TelemetryBatcher_AddStringN(TelemetryBatcher *batcher, const char *name, const char *value,
+                                size_t length)
+{
+    StringRecord record = {.name = name, .value = value, .length = length};
+    return TelemetryBatcher_AddRecord(batcher, WriteStringRecord, &record);
+}
+
+int TelemetryBatcher_AddRecord(TelemetryBatcher *batcher, TelemetryBatcher_RecordWriter writeRecord,
+                               const void *record)
+{
+    // Keep the first of every sampleInterval records.
+    if (batcher->config.sampleInterval > 1) {
+        uint32_t position = batcher->sampleCounter++;
+        if (batcher->sampleCounter >= batcher->config.sampleInterval) {
+            batcher->sampleCounter = 0;
+        }
+        if (position != 0) {
+            ++batcher->stats.recordsSampledOut;
+            return 0;
+        }
+    }
+
+    if (!AppendRecord(batcher, writeRecord, record)) {
+        // Send the full batch, and start the next one with this record.
+        if (batcher->recordCount > 0) {
+            ++batcher->stats.fullFlushes;
+            TelemetryBatcher_Flush(batcher);
+        }
+        if (!AppendRecord(batcher, writeRecord, record)) {
+            ++batcher->stats.recordsDropped;
+            return -1;
+        }
+    }
+    ++batcher->stats.recordsAdded;
+
+    if (batcher->recordCount == 1) {
+        struct timespec maxAge = {(time_t)(batcher->config.maxAgeMs / 1000u),
+                                  (long)(batcher->config.maxAgeMs % 1000u) * 1000000L};
+        SetTimerToSingleExpiry(&batcher->ageTimer, &maxAge);
+    }
+    if (batcher->recordCount >= batcher->config.maxRecords) {
+        ++batcher->stats.fullFlushes;
+        TelemetryBatcher_Flush(batcher);
+    }
+    return 0;
+}
+
+int TelemetryBatcher_Flush(TelemetryBatcher *batcher)
+{
+    if (batcher->recordCount == 0) {
+        return 0;
+    }
+
+    // AppendRecord left room to close the batch.
+    size_t length = 0;
+    JsonWriter_EndArray(&batcher->writer);
+    JsonWriter_EndObject(&batcher->writer);
+    JsonWriter_Finish(&batcher->writer, &length);
+    size_t recordCount = batcher->recordCount;
+    TelemetryBatcher_Clear(batcher);
+
+    if (batcher->flushHandler(batcher->buffer, length, recordCount, batcher->context) != 0) {
+        ++batcher->stats.messagesFailed;
+        return -1;
+    }
+    ++batcher->stats.messagesSent;
+    batcher->stats.bytesSent += length;
+    return 0;
+}
+
+void TelemetryBatcher_Clear(TelemetryBatcher *batcher)
+{
+    DisarmTimer(&batcher->ageTimer);
+    batcher->recordCount = 0;
+}
+
+static void HandleAgeTimerEvent(Timer *timer)
+{
+    TelemetryBatcher *batcher =
+        (TelemetryBatcher *)((uint8_t *)timer - offsetof(TelemetryBatcher, ageTimer));
+
+    ++batcher->stats.ageFlushes;
+    TelemetryBatcher_Flush(batcher);
+}
@@ -0,0 +1,175 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "json_writer.h"
+
+/// <summary>Size of a batch's buffer: the largest message, with its terminating null.</summary>
+#define TELEMETRY_BATCHER_CAPACITY 4097
+
+/// <summary>
+///     Function signature for handlers which send a finished batch.
+/// </summary>
+/// <param name="message">The batch: a null terminated JSON object</param>
+/// <param name="length">Length of the message, without the terminating null</param>
+/// <param name="recordCount">Number of records in the message</param>
+/// <param name="context">Context which was passed to <see cref="TelemetryBatcher_Init" /></param>
+/// <returns>0 if the message was accepted for delivery, or -1 otherwise</returns>
+typedef int (*TelemetryBatcher_FlushHandler)(const char *message, size_t length,
+                                             size_t recordCount, void *context);
+
+/// <summary>
+///     Function signature for functions which write the fields of a record.
+/// </summary>
+/// <param name="writer">Writer inside the record's object, after its timestamp</param>
+/// <param name="record">Record which was passed to <see cref="TelemetryBatcher_AddRecord"
+/// /></param>
+typedef void (*TelemetryBatcher_RecordWriter)(JsonWriter *writer, const void *record);
+
+/// <summary>
+///     When a batch is sent.
+/// </summary>
+typedef struct {
+    /// <summary>Largest message in bytes, at most TELEMETRY_BATCHER_CAPACITY - 1. A record which
+    /// does not fit in the current batch starts the next one.</summary>
+    size_t maxBytes;
+    /// <summary>Number of records after which the batch is sent.</summary>
+    size_t maxRecords;
+    /// <summary>Longest time, in milliseconds, which the first record of a batch waits before
+    /// the batch is sent.</summary>
+    uint32_t maxAgeMs;
+    /// <summary>Only one of every sampleInterval records is kept; 0 or 1 keeps every
+    /// record.</summary>
+    uint32_t sampleInterval;
+} TelemetryBatcherConfig;
+
+/// <summary>
+///     Counters for a <see cref="TelemetryBatcher" />.
+/// </summary>
+typedef struct {
+    /// <summary>Number of records which were added to a batch.</summary>
+    uint64_t recordsAdded;
+    /// <summary>Number of records which were dropped because they do not fit in an empty
+    /// batch.</summary>
+    uint64_t recordsDropped;
+    /// <summary>Number of records which were skipped by sampling.</summary>
+    uint64_t recordsSampledOut;
+    /// <summary>Number of batches which were accepted by the flush handler.</summary>
+    uint64_t messagesSent;
+    /// <summary>Number of batches which the flush handler failed to send.</summary>
+    uint64_t messagesFailed;
+    /// <summary>Number of bytes in the batches which were accepted.</summary>
+    uint64_t bytesSent;
+    /// <summary>Number of batches which were sent because they were full, by size or by
+    /// count.</summary>
+    uint64_t fullFlushes;
+    /// <summary>Number of batches which were sent because their first record reached the
+    /// maximum age.</summary>
+    uint64_t ageFlushes;
+} TelemetryBatcherStats;
+
+/// <summary>
+/// <para>Packs many telemetry records into one device-to-cloud message, so a burst of lines
+/// costs one message instead of one each. A record is an object with the time at which it was
+/// added and its fields, usually one named string. The batch is a JSON object:</para>
+/// <para>{"records":[{"ts":1571234567890,"name":"value"},...]}</para>
+/// <para>where ts is the UTC time in milliseconds since 1970. The batch is sent when the next
+/// record would not fit, when it holds maxRecords records, or maxAgeMs after its first record
+/// was added, whichever comes first.</para>
+/// </summary>
+typedef struct {
+    /// <summary>When a batch is sent.</summary>
+    TelemetryBatcherConfig config;
+    /// <summary>Function which sends a finished batch.</summary>
+    TelemetryBatcher_FlushHandler flushHandler;
+    /// <summary>Context which is passed to the flush handler.</summary>
+    void *context;
+    /// <summary>Sends the batch when its first record reaches the maximum age.</summary>
+    Timer ageTimer;
+    /// <summary>Number of records in the batch.</summary>
+    size_t recordCount;
+    /// <summary>Writes the batch into the buffer; the array and the object are closed when it
+    /// is sent.</summary>
+    JsonWriter writer;
+    /// <summary>Number of records which have been offered since the last one which was kept by
+    /// sampling.</summary>
+    uint32_t sampleCounter;
+    /// <summary>The batch.</summary>
+    char buffer[TELEMETRY_BATCHER_CAPACITY];
+    /// <summary>Counters.</summary>
+    TelemetryBatcherStats stats;
+} TelemetryBatcher;
+
+/// <summary>
+///     Initializes an empty batcher.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+/// <param name="config">When a batch is sent</param>
+/// <param name="flushHandler">Function which sends a finished batch</param>
+/// <param name="context">Context which is passed to the flush handler</param>
+void TelemetryBatcher_Init(TelemetryBatcher *batcher, const TelemetryBatcherConfig *config,
+                           TelemetryBatcher_FlushHandler flushHandler, void *context);
+
+/// <summary>
+///     Changes when batches are sent. A batch which holds the new maximum number of records is
+///     sent now; the age of a batch which has already started is not changed.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+/// <param name="config">When a batch is sent</param>
+void TelemetryBatcher_SetConfig(TelemetryBatcher *batcher, const TelemetryBatcherConfig *config);
+
+/// <summary>
+///     Adds a record to the batch, unless sampling skips it, and sends the batch if it is full.
+///     The name and value are escaped for JSON.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+/// <param name="name">Name of the record</param>
+/// <param name="value">The value</param>
+/// <returns>0 on success or if the record was skipped by sampling, or -1 if the record does not
+/// fit in an empty batch and was dropped</returns>
+int TelemetryBatcher_AddString(TelemetryBatcher *batcher, const char *name, const char *value);
+
+/// <summary>
+///     Adds a record with a string of a given length, which may contain nulls, like
+///     <see cref="TelemetryBatcher_AddString" />.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+/// <param name="name">Name of the string</param>
+/// <param name="value">The string</param>
+/// <param name="length">Length of the string</param>
+/// <returns>0 on success or if the record was skipped by sampling, or -1 if the record does not
+/// fit in an empty batch and was dropped</returns>
+int TelemetryBatcher_AddStringN(TelemetryBatcher *batcher, const char *name, const char *value,
+                                size_t length);
+
+/// <summary>
+///     Adds a record with any fields to the batch, unless sampling skips it, and sends the batch
+///     if it is full. The fields are written when the record is added; they may be written
+///     twice if the record starts a new batch.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+/// <param name="writeRecord">Function which writes the record's keys and values</param>
+/// <param name="record">Record which is passed to writeRecord</param>
+/// <returns>0 on success or if the record was skipped by sampling, or -1 if the record does not
+/// fit in an empty batch and was dropped</returns>
+int TelemetryBatcher_AddRecord(TelemetryBatcher *batcher, TelemetryBatcher_RecordWriter writeRecord,
+                               const void *record);
+
+/// <summary>
+///     Sends the batch now, if it holds any records.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+/// <returns>0 on success or if the batch was empty, or -1 if the flush handler failed; the
+/// batch is discarded either way</returns>
+int TelemetryBatcher_Flush(TelemetryBatcher *batcher);
+
+/// <summary>
+///     Discards the batch and stops its timer. The counters are kept.
+/// </summary>
+/// <param name="batcher">The batcher</param>
+void TelemetryBatcher_Clear(TelemetryBatcher *batcher);
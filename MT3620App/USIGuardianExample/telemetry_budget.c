@@ -0,0 +1,94 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <time.h>
+
+#include "telemetry_budget.h"
+
+// Milliseconds in the day over which the daily units are spread.
+#define MS_PER_DAY 86400000u
+
+static uint64_t GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+/// <summary>
+///     Adds the units earned since the last refill, up to the capacity.
+/// </summary>
+static void Refill(TelemetryBudget *budget)
+{
+    uint64_t now = GetMonotonicMs();
+    uint64_t elapsedMs = now - budget->lastRefillMs;
+    budget->lastRefillMs = now;
+    if (budget->tokensMilli >= budget->capacityMilli) {
+        budget->refillRemainder = 0;
+        return;
+    }
+
+    // A day refills a bucket which holds no more than the daily units, and capping the time
+    // at a day keeps the product below overflow.
+    if (elapsedMs > MS_PER_DAY) {
+        elapsedMs = MS_PER_DAY;
+    }
+    uint64_t earned = elapsedMs * budget->dailyUnits * 1000u + budget->refillRemainder;
+    budget->tokensMilli += earned / MS_PER_DAY;
+    budget->refillRemainder = earned % MS_PER_DAY;
+    if (budget->tokensMilli >= budget->capacityMilli) {
+        budget->tokensMilli = budget->capacityMilli;
+        budget->refillRemainder = 0;
+    }
+}
+
+void TelemetryBudget_Init(TelemetryBudget *budget, uint32_t dailyUnits, uint32_t burstUnits)
+{
+    memset(budget, 0, sizeof(*budget));
+    budget->dailyUnits = dailyUnits;
+    budget->capacityMilli = (uint64_t)burstUnits * 1000u;
+    budget->tokensMilli = budget->capacityMilli;
+    budget->lastRefillMs = GetMonotonicMs();
+}
+
+uint32_t TelemetryBudget_GetUnits(size_t length)
+{
+    return length == 0 ? 1u
+                       : (uint32_t)((length + TELEMETRY_BUDGET_UNIT_BYTES - 1) /
+                                    TELEMETRY_BUDGET_UNIT_BYTES);
+}
+
+bool TelemetryBudget_TryConsume(TelemetryBudget *budget, size_t length)
+{
+    Refill(budget);
+
+    uint32_t units = TelemetryBudget_GetUnits(length);
+    uint64_t costMilli = (uint64_t)units * 1000u;
+    if (budget->tokensMilli < costMilli) {
+        ++budget->stats.messagesRefused;
+        return false;
+    }
+
+    budget->tokensMilli -= costMilli;
+    ++budget->stats.messages;
+    budget->stats.bytes += length;
+    budget->stats.units += units;
+    return true;
+}
+
+TelemetryBudget_Level TelemetryBudget_GetLevel(TelemetryBudget *budget)
+{
+    Refill(budget);
+
+    if (budget->tokensMilli < 1000u) {
+        return TelemetryBudget_Level_Exhausted;
+    }
+    if (budget->tokensMilli * 5u < budget->capacityMilli) {
+        return TelemetryBudget_Level_Critical;
+    }
+    if (budget->tokensMilli * 2u < budget->capacityMilli) {
+        return TelemetryBudget_Level_Low;
+    }
+    return TelemetryBudget_Level_Normal;
+}
@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Size of the message unit in which IoT Hub counts device-to-cloud messages against
+/// the daily quota. A message of up to this many bytes uses one unit.</summary>
+#define TELEMETRY_BUDGET_UNIT_BYTES 4096
+
+/// <summary>
+///     How much of its budget a <see cref="TelemetryBudget" /> has left, from which the sender
+///     decides how hard to pack or sample its telemetry.
+/// </summary>
+typedef enum {
+    /// <summary>At least half the bucket is left.</summary>
+    TelemetryBudget_Level_Normal,
+    /// <summary>Less than half the bucket is left.</summary>
+    TelemetryBudget_Level_Low,
+    /// <summary>Less than a fifth of the bucket is left.</summary>
+    TelemetryBudget_Level_Critical,
+    /// <summary>Less than one unit is left, so no message can be sent until the bucket has
+    /// refilled.</summary>
+    TelemetryBudget_Level_Exhausted
+} TelemetryBudget_Level;
+
+/// <summary>
+///     Counters for a <see cref="TelemetryBudget" />.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages which were charged to the budget.</summary>
+    uint64_t messages;
+    /// <summary>Number of bytes in the messages which were charged.</summary>
+    uint64_t bytes;
+    /// <summary>Number of message units which were charged.</summary>
+    uint64_t units;
+    /// <summary>Number of messages which were refused because the budget was
+    /// exhausted.</summary>
+    uint64_t messagesRefused;
+} TelemetryBudgetStats;
+
+/// <summary>
+/// <para>A token bucket of IoT Hub message units, which keeps a device within its share of the
+/// hub's daily message quota. The bucket refills evenly over the day at the daily quota, and
+/// holds at most a burst of units, so a device which has been quiet can send a burst but
+/// cannot spend a day's quota in an hour.</para>
+/// <para>Each message costs one unit for every 4 KB or part of 4 KB, as IoT Hub counts
+/// them.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Units which the bucket gains per day.</summary>
+    uint32_t dailyUnits;
+    /// <summary>Largest number of units which the bucket holds, in thousandths of a
+    /// unit.</summary>
+    uint64_t capacityMilli;
+    /// <summary>Units in the bucket, in thousandths of a unit.</summary>
+    uint64_t tokensMilli;
+    /// <summary>Part of a thousandth of a unit which was earned but not yet added, in units of
+    /// 1/86400000.</summary>
+    uint64_t refillRemainder;
+    /// <summary>CLOCK_MONOTONIC time, in milliseconds, at which the bucket was last
+    /// refilled.</summary>
+    uint64_t lastRefillMs;
+    /// <summary>Counters.</summary>
+    TelemetryBudgetStats stats;
+} TelemetryBudget;
+
+/// <summary>
+///     Initializes a full bucket.
+/// </summary>
+/// <param name="budget">The budget</param>
+/// <param name="dailyUnits">Units which the device may use per day</param>
+/// <param name="burstUnits">Largest number of units which the bucket holds; at most
+/// dailyUnits</param>
+void TelemetryBudget_Init(TelemetryBudget *budget, uint32_t dailyUnits, uint32_t burstUnits);
+
+/// <summary>
+///     Gets the number of units which a message uses.
+/// </summary>
+/// <param name="length">Length of the message in bytes</param>
+/// <returns>The number of units; at least 1</returns>
+uint32_t TelemetryBudget_GetUnits(size_t length);
+
+/// <summary>
+///     Charges a message to the budget if enough units are left.
+/// </summary>
+/// <param name="budget">The budget</param>
+/// <param name="length">Length of the message in bytes</param>
+/// <returns>True if the message was charged and may be sent; false if it must not be
+/// sent</returns>
+bool TelemetryBudget_TryConsume(TelemetryBudget *budget, size_t length);
+
+/// <summary>
+///     Gets how much of its budget is left.
+/// </summary>
+/// <param name="budget">The budget</param>
+/// <returns>The level</returns>
+TelemetryBudget_Level TelemetryBudget_GetLevel(TelemetryBudget *budget);
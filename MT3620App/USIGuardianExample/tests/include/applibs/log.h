@@ -0,0 +1,9 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Stands in for the Azure Sphere log in the host tests.
+
+#pragma once
+#include <stdio.h>
+
+#define Log_Debug(...) fprintf(stderr, __VA_ARGS__)
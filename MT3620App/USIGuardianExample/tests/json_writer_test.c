@@ -0,0 +1,225 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "twin_parser.h"
+#include "test.h"
+
+static char document[1024];
+
+/// <summary>
+///     Writes a string as the only value of a document and checks the document's text.
+/// </summary>
+static void CheckString(const char *value, size_t length, const char *expected)
+{
+    JsonWriter writer;
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_StringN(&writer, value, length);
+    size_t documentLength;
+    CHECK(JsonWriter_Finish(&writer, &documentLength) == 0);
+    CHECK(documentLength == strlen(expected));
+    CHECK(strcmp(document, expected) == 0);
+}
+
+static void CollectValue(const TwinParserValue *value, void *context)
+{
+    *(TwinParserValue *)context = *value;
+}
+
+/// <summary>
+///     Writes a string under a key, parses the document back and checks that the string which
+///     is read is the expected one.
+/// </summary>
+static void CheckRoundTrip(const char *value, size_t length, const char *expected,
+                           size_t expectedLength)
+{
+    JsonWriter writer;
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_Key(&writer, "s");
+    JsonWriter_StringN(&writer, value, length);
+    JsonWriter_EndObject(&writer);
+    size_t documentLength;
+    CHECK(JsonWriter_Finish(&writer, &documentLength) == 0);
+
+    TwinParserValue parsed = {.text = NULL};
+    TwinParserPath path = {.path = "s", .handler = CollectValue, .context = &parsed};
+    CHECK(TwinParser_Parse(document, documentLength, NULL, &path, 1) == 0);
+    CHECK(parsed.text != NULL);
+    char copy[256];
+    int copyLength = TwinParser_CopyString(&parsed, copy, sizeof(copy));
+    CHECK(copyLength == (int)expectedLength);
+    CHECK(memcmp(copy, expected, expectedLength) == 0);
+}
+
+static void TestStringsAreEscaped(void)
+{
+    CheckString("plain text", 10, "\"plain text\"");
+    CheckString("say \"hi\"", 8, "\"say \\\"hi\\\"\"");
+    CheckString("C:\\dir", 6, "\"C:\\\\dir\"");
+    CheckString("\b\f\n\r\t", 5, "\"\\b\\f\\n\\r\\t\"");
+    CheckString("\x01\x1f", 2, "\"\\u0001\\u001f\"");
+    CheckString("a\0b", 3, "\"a\\u0000b\"");
+    CheckString("", 0, "\"\"");
+}
+
+static void TestUtf8IsKeptAndOtherBytesAreLatin1(void)
+{
+    CheckString("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80", 14,
+                "\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\"");
+    CheckString("\xff", 1, "\"\xc3\xbf\"");
+    // A truncated sequence, an overlong form and a surrogate are not valid UTF-8.
+    CheckString("\xe2\x82", 2, "\"\xc3\xa2\xc2\x82\"");
+    CheckString("\xc0\xaf", 2, "\"\xc3\x80\xc2\xaf\"");
+    CheckString("\xed\xa0\x80", 3, "\"\xc3\xad\xc2\xa0\xc2\x80\"");
+}
+
+static void TestStringsRoundTrip(void)
+{
+    static const char Text[] = "quote \" backslash \\ tab \t crlf \r\n slash /";
+    CheckRoundTrip(Text, sizeof(Text) - 1, Text, sizeof(Text) - 1);
+    CheckRoundTrip("a\0b\x7f", 4, "a\0b\x7f", 4);
+    CheckRoundTrip("\xe2\x82\xac", 3, "\xe2\x82\xac", 3);
+    CheckRoundTrip("\xff\x80", 2, "\xc3\xbf\xc2\x80", 4);
+}
+
+static void TestValues(void)
+{
+    JsonWriter writer;
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_BeginArray(&writer);
+    JsonWriter_Uint(&writer, 0);
+    JsonWriter_Uint(&writer, UINT64_MAX);
+    JsonWriter_Int(&writer, INT64_MIN);
+    JsonWriter_Fixed(&writer, -2.5, 2);
+    JsonWriter_Fixed(&writer, NAN, 2);
+    JsonWriter_Bool(&writer, true);
+    JsonWriter_Bool(&writer, false);
+    JsonWriter_Null(&writer);
+    JsonWriter_Base64(&writer, "foobar", 6);
+    JsonWriter_Base64(&writer, "\0\xff\x10\x80", 4);
+    JsonWriter_EndArray(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == 0);
+    CHECK(strcmp(document, "[0,18446744073709551615,-9223372036854775808,-2.50,null,true,false,"
+                           "null,\"Zm9vYmFy\",\"AP8QgA==\"]") == 0);
+}
+
+static void TestBase64Padding(void)
+{
+    static const char *const Encoded[] = {"\"\"",         "\"Zg==\"",     "\"Zm8=\"",
+                                          "\"Zm9v\"",     "\"Zm9vYg==\"", "\"Zm9vYmE=\"",
+                                          "\"Zm9vYmFy\""};
+    for (size_t length = 0; length <= 6; ++length) {
+        JsonWriter writer;
+        JsonWriter_Init(&writer, document, sizeof(document));
+        JsonWriter_Base64(&writer, "foobar", length);
+        CHECK(JsonWriter_Finish(&writer, NULL) == 0);
+        CHECK(strcmp(document, Encoded[length]) == 0);
+    }
+}
+
+static void TestNesting(void)
+{
+    JsonWriter writer;
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_Key(&writer, "records");
+    JsonWriter_BeginArray(&writer);
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_Key(&writer, "a\"b");
+    JsonWriter_Uint(&writer, 1);
+    JsonWriter_EndObject(&writer);
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_EndObject(&writer);
+    JsonWriter_EndArray(&writer);
+    JsonWriter_Key(&writer, "empty");
+    JsonWriter_BeginArray(&writer);
+    JsonWriter_EndArray(&writer);
+    JsonWriter_EndObject(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == 0);
+    CHECK(strcmp(document, "{\"records\":[{\"a\\\"b\":1},{}],\"empty\":[]}") == 0);
+}
+
+static void TestMalformedDocumentsFail(void)
+{
+    JsonWriter writer;
+
+    // A member without a key.
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_Uint(&writer, 1);
+    JsonWriter_EndObject(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+
+    // A key without a value.
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_Key(&writer, "k");
+    JsonWriter_EndObject(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+
+    // A container which is not closed, or closed with the wrong bracket.
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_BeginArray(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+    JsonWriter_EndObject(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+
+    // Two values at the top level, and none.
+    JsonWriter_Init(&writer, document, sizeof(document));
+    JsonWriter_Uint(&writer, 1);
+    JsonWriter_Uint(&writer, 2);
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+    JsonWriter_Init(&writer, document, sizeof(document));
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+}
+
+static void TestDocumentWhichDoesNotFitFails(void)
+{
+    char small[8];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, small, sizeof(small));
+    JsonWriter_String(&writer, "1234567");
+    CHECK(JsonWriter_Finish(&writer, NULL) == -1);
+
+    // The terminating null needs a byte too.
+    JsonWriter_Init(&writer, small, sizeof(small));
+    JsonWriter_String(&writer, "12345");
+    size_t length;
+    CHECK(JsonWriter_Finish(&writer, &length) == 0);
+    CHECK(length == 7);
+}
+
+static void TestRewindRemovesAValueWhichDoesNotFit(void)
+{
+    char buffer[24];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, buffer, sizeof(buffer));
+    JsonWriter_BeginArray(&writer);
+    JsonWriter_Uint(&writer, 1);
+    JsonWriterMark mark = JsonWriter_GetMark(&writer);
+    JsonWriter_String(&writer, "much too long for the buffer");
+    CHECK(writer.failed);
+    JsonWriter_Rewind(&writer, &mark);
+    JsonWriter_Uint(&writer, 2);
+    JsonWriter_EndArray(&writer);
+    CHECK(JsonWriter_Finish(&writer, NULL) == 0);
+    CHECK(strcmp(buffer, "[1,2]") == 0);
+}
+
+int main(void)
+{
+    RUN_TEST(TestStringsAreEscaped);
+    RUN_TEST(TestUtf8IsKeptAndOtherBytesAreLatin1);
+    RUN_TEST(TestStringsRoundTrip);
+    RUN_TEST(TestValues);
+    RUN_TEST(TestBase64Padding);
+    RUN_TEST(TestNesting);
+    RUN_TEST(TestMalformedDocumentsFail);
+    RUN_TEST(TestDocumentWhichDoesNotFitFails);
+    RUN_TEST(TestRewindRemovesAValueWhichDoesNotFit);
+    return 0;
+}
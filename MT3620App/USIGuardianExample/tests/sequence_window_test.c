@@ -0,0 +1,72 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "sequence_window.h"
+#include "test.h"
+
+static void TestDuplicatesAreDropped(void)
+{
+    SequenceWindow window;
+    SequenceWindow_Reset(&window);
+    CHECK(SequenceWindow_Accept(&window, 10, 1000) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 12, 1010) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 10, 1020) == SequenceWindow_Duplicate);
+    CHECK(SequenceWindow_Accept(&window, 11, 1030) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 11, 1040) == SequenceWindow_Duplicate);
+    CHECK(SequenceWindow_Accept(&window, 12, 1050) == SequenceWindow_Duplicate);
+}
+
+static void TestNumbersWrap(void)
+{
+    SequenceWindow window;
+    SequenceWindow_Reset(&window);
+    CHECK(SequenceWindow_Accept(&window, UINT32_MAX, 1000) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 0, 1010) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, UINT32_MAX, 1020) == SequenceWindow_Duplicate);
+}
+
+static void TestFarBelowIsARestart(void)
+{
+    SequenceWindow window;
+    SequenceWindow_Reset(&window);
+    CHECK(SequenceWindow_Accept(&window, 1000, 1000) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 1, 1010) == SequenceWindow_Restarted);
+    CHECK(SequenceWindow_Accept(&window, 2, 1020) == SequenceWindow_New);
+}
+
+static void TestSensorWhichRebootsEarlyIsARestart(void)
+{
+    SequenceWindow window;
+    SequenceWindow_Reset(&window);
+    for (uint32_t sequence = 1; sequence <= 10; ++sequence) {
+        CHECK(SequenceWindow_Accept(&window, sequence, 1000 + sequence) == SequenceWindow_New);
+    }
+
+    // Numbered from 1 again after a reboot, and silent while rebooting.
+    uint64_t nowMs = 1010 + SEQUENCE_WINDOW_RESTART_GAP_MS;
+    CHECK(SequenceWindow_Accept(&window, 1, nowMs) == SequenceWindow_Restarted);
+    CHECK(SequenceWindow_Accept(&window, 2, nowMs + 1) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 1, nowMs + 2) == SequenceWindow_Duplicate);
+    CHECK(SequenceWindow_Accept(&window, 3, nowMs + 3) == SequenceWindow_New);
+}
+
+static void TestNextNumberAfterSilenceIsNew(void)
+{
+    SequenceWindow window;
+    SequenceWindow_Reset(&window);
+    CHECK(SequenceWindow_Accept(&window, 5, 1000) == SequenceWindow_New);
+    CHECK(SequenceWindow_Accept(&window, 6, 1000 + 10 * SEQUENCE_WINDOW_RESTART_GAP_MS) ==
+          SequenceWindow_New);
+    CHECK(window.highestSequence == 6);
+    CHECK(window.received == 3u);
+}
+
+int main(void)
+{
+    RUN_TEST(TestDuplicatesAreDropped);
+    RUN_TEST(TestNumbersWrap);
+    RUN_TEST(TestFarBelowIsARestart);
+    RUN_TEST(TestSensorWhichRebootsEarlyIsARestart);
+    RUN_TEST(TestNextNumberAfterSilenceIsNew);
+    return 0;
+}
@@ -0,0 +1,326 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "store_forward.h"
+#include "test.h"
+
+#define UNLIMITED_BUDGET (1u << 30)
+
+static char path[] = "/tmp/store_forward_test_XXXXXX";
+static char buffer[STORE_FORWARD_MAX_RECORD];
+
+/// <summary>
+///     Truncates the test file, so the next store starts empty.
+/// </summary>
+static void ResetFile(void)
+{
+    int fd = open(path, O_RDWR | O_TRUNC);
+    CHECK(fd >= 0);
+    close(fd);
+}
+
+static void OpenStore(StoreForward *store, uint32_t writeBudgetBytes)
+{
+    int fd = open(path, O_RDWR);
+    CHECK(fd >= 0);
+    CHECK(StoreForward_Open(store, fd, writeBudgetBytes) == 0);
+}
+
+static void AppendText(StoreForward *store, const char *text)
+{
+    CHECK(StoreForward_Append(store, text, strlen(text)) == 0);
+}
+
+/// <summary>
+///     Reads the next record, checks its sequence number and returns it as a string.
+/// </summary>
+static const char *ReadExpecting(StoreForward *store, uint32_t expectedSequence)
+{
+    size_t length;
+    uint32_t sequence;
+    CHECK(StoreForward_ReadNext(store, buffer, sizeof(buffer) - 1, &length, &sequence) == 0);
+    CHECK(sequence == expectedSequence);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static bool HasNext(StoreForward *store)
+{
+    size_t length;
+    uint32_t sequence;
+    return StoreForward_ReadNext(store, buffer, sizeof(buffer), &length, &sequence) == 0;
+}
+
+static void TestAcknowledgedRecordsAreNotReadAfterReopen(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    CHECK(StoreForward_IsEmpty(&store));
+    for (int i = 1; i <= 20; ++i) {
+        char text[16];
+        snprintf(text, sizeof(text), "record %d", i);
+        AppendText(&store, text);
+    }
+    for (uint32_t sequence = 1; sequence <= 10; ++sequence) {
+        ReadExpecting(&store, sequence);
+        StoreForward_Acknowledge(&store, sequence);
+    }
+    StoreForward_Close(&store);
+
+    OpenStore(&store, UNLIMITED_BUDGET);
+    CHECK(strcmp(ReadExpecting(&store, 11), "record 11") == 0);
+    CHECK(store.nextSequence == 21);
+    StoreForward_Close(&store);
+}
+
+static void TestPowerLossResumesFromLastCheckpoint(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    for (int i = 0; i < 30; ++i) {
+        AppendText(&store, "x");
+    }
+    for (uint32_t sequence = 1; sequence <= 20; ++sequence) {
+        ReadExpecting(&store, sequence);
+        StoreForward_Acknowledge(&store, sequence);
+    }
+
+    // The file is not closed, so the last checkpoint, after 16 records, is all that remains.
+    int fd = store.fd;
+    StoreForward recovered;
+    OpenStore(&recovered, UNLIMITED_BUDGET);
+    close(fd);
+    ReadExpecting(&recovered, 1 + STORE_FORWARD_CHECKPOINT_INTERVAL);
+    StoreForward_Close(&recovered);
+}
+
+static void TestTornRecordEndsTheLog(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    AppendText(&store, "complete");
+    AppendText(&store, "torn record");
+    off_t end = STORE_FORWARD_HEADER_SIZE +
+                (off_t)store.writeSegment * STORE_FORWARD_SEGMENT_SIZE +
+                store.usedBytes[store.writeSegment];
+    CHECK(pwrite(store.fd, "?", 1, end - 1) == 1);
+    close(store.fd);
+
+    OpenStore(&store, UNLIMITED_BUDGET);
+    CHECK(store.nextSequence == 2);
+    CHECK(strcmp(ReadExpecting(&store, 1), "complete") == 0);
+    CHECK(!HasNext(&store));
+
+    // The next record takes the torn record's place.
+    AppendText(&store, "replacement");
+    CHECK(strcmp(ReadExpecting(&store, 2), "replacement") == 0);
+    StoreForward_Close(&store);
+}
+
+static void TestRolloverLosesTheOldestRecords(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    memset(buffer, 'r', 1000);
+    for (int i = 0; i < 100; ++i) {
+        CHECK(StoreForward_Append(&store, buffer, 1000) == 0);
+    }
+    CHECK(store.stats.recordsLost > 0);
+    CHECK(store.readPosition.sequence == 1 + store.stats.recordsLost);
+
+    uint32_t expected = store.readPosition.sequence;
+    while (!StoreForward_IsEmpty(&store)) {
+        ReadExpecting(&store, expected);
+        StoreForward_Acknowledge(&store, expected);
+        ++expected;
+    }
+    CHECK(expected == 101);
+    StoreForward_Close(&store);
+}
+
+static void TestFailedRecordIsReadAgainAheadOfLaterOnes(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    for (int i = 1; i <= 6; ++i) {
+        char text[16];
+        snprintf(text, sizeof(text), "batch %d", i);
+        AppendText(&store, text);
+    }
+    for (uint32_t sequence = 1; sequence <= 4; ++sequence) {
+        ReadExpecting(&store, sequence);
+    }
+
+    // Later records which are confirmed do not move the read pointer past a failed one.
+    StoreForward_Acknowledge(&store, 2);
+    StoreForward_Acknowledge(&store, 3);
+    CHECK(store.readPosition.sequence == 1);
+    StoreForward_Rewind(&store, 1);
+    CHECK(strcmp(ReadExpecting(&store, 1), "batch 1") == 0);
+    ReadExpecting(&store, 5);
+
+    StoreForward_Acknowledge(&store, 1);
+    CHECK(store.readPosition.sequence == 4);
+    StoreForward_Acknowledge(&store, 5);
+    CHECK(store.readPosition.sequence == 4);
+    StoreForward_Rewind(&store, 4);
+    ReadExpecting(&store, 4);
+    ReadExpecting(&store, 6);
+    StoreForward_Acknowledge(&store, 4);
+    CHECK(store.readPosition.sequence == 6);
+
+    // Records before the read pointer are ignored.
+    StoreForward_Acknowledge(&store, 2);
+    StoreForward_Rewind(&store, 3);
+    CHECK(store.readPosition.sequence == 6);
+    StoreForward_Acknowledge(&store, 6);
+    CHECK(StoreForward_IsEmpty(&store));
+    CHECK(store.stats.recordsDelivered == 6);
+    StoreForward_Close(&store);
+}
+
+static void TestUnacknowledgedRecordIsReadAgainAfterReopen(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    for (int i = 0; i < 3; ++i) {
+        AppendText(&store, "x");
+    }
+    for (uint32_t sequence = 1; sequence <= 3; ++sequence) {
+        ReadExpecting(&store, sequence);
+    }
+    StoreForward_Acknowledge(&store, 2);
+    StoreForward_Acknowledge(&store, 3);
+    StoreForward_Close(&store);
+
+    OpenStore(&store, UNLIMITED_BUDGET);
+    ReadExpecting(&store, 1);
+    StoreForward_Close(&store);
+}
+
+static void TestReadsStopAtTheWindow(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    for (int i = 0; i < STORE_FORWARD_READ_WINDOW + 8; ++i) {
+        AppendText(&store, "w");
+    }
+    for (uint32_t sequence = 1; sequence <= STORE_FORWARD_READ_WINDOW; ++sequence) {
+        ReadExpecting(&store, sequence);
+    }
+    CHECK(!HasNext(&store));
+    StoreForward_Acknowledge(&store, 1);
+    ReadExpecting(&store, STORE_FORWARD_READ_WINDOW + 1);
+    CHECK(!HasNext(&store));
+    StoreForward_Close(&store);
+}
+
+static void TestRolloverWithRecordsInFlight(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    memset(buffer, 'z', 4000);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(StoreForward_Append(&store, buffer, 4000) == 0);
+    }
+    for (uint32_t sequence = 1; sequence <= 3; ++sequence) {
+        ReadExpecting(&store, sequence);
+    }
+    StoreForward_Acknowledge(&store, 2);
+    for (int i = 0; i < 14; ++i) {
+        CHECK(StoreForward_Append(&store, buffer, 4000) == 0);
+    }
+    CHECK(store.stats.recordsLost > 0);
+
+    // Confirmations of lost records are ignored, and the rest are read in order.
+    StoreForward_Acknowledge(&store, 1);
+    StoreForward_Acknowledge(&store, 3);
+    uint32_t expected = store.readPosition.sequence;
+    while (HasNext(&store)) {
+        CHECK(buffer[0] == 'z');
+        StoreForward_Acknowledge(&store, expected);
+        ++expected;
+    }
+    CHECK(StoreForward_IsEmpty(&store));
+    CHECK(expected == store.nextSequence);
+    StoreForward_Close(&store);
+}
+
+static void TestCorruptRecordIsSkippedWithTheRestOfItsSegment(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, UNLIMITED_BUDGET);
+    memset(buffer, 'c', 3000);
+    // Two records fit in a segment, so the six records fill three segments.
+    for (int i = 0; i < 6; ++i) {
+        CHECK(StoreForward_Append(&store, buffer, 3000) == 0);
+    }
+    off_t secondRecordData = STORE_FORWARD_HEADER_SIZE + STORE_FORWARD_SEGMENT_HEADER_SIZE +
+                             STORE_FORWARD_RECORD_HEADER_SIZE + 3000 +
+                             STORE_FORWARD_RECORD_HEADER_SIZE;
+    CHECK(pwrite(store.fd, "?", 1, secondRecordData + 5) == 1);
+
+    int read = 0;
+    size_t length;
+    uint32_t sequence;
+    while (StoreForward_ReadNext(&store, buffer, sizeof(buffer), &length, &sequence) == 0) {
+        CHECK(sequence != 2);
+        StoreForward_Acknowledge(&store, sequence);
+        ++read;
+    }
+    CHECK(read == 5);
+    CHECK(store.stats.recordsLost == 1);
+    CHECK(StoreForward_IsEmpty(&store));
+    StoreForward_Close(&store);
+}
+
+static void TestWriteBudgetRefusesRecords(void)
+{
+    ResetFile();
+    StoreForward store;
+    OpenStore(&store, 1000);
+    int accepted = 0;
+    while (StoreForward_Append(&store, buffer, 100) == 0) {
+        ++accepted;
+    }
+    // The segment header took 16 bytes of the budget, and each record takes 112.
+    CHECK(accepted == 8);
+    CHECK(store.stats.recordsRefused == 1);
+    CHECK(StoreForward_Append(&store, buffer, STORE_FORWARD_MAX_RECORD + 1) == -1);
+    StoreForward_Close(&store);
+}
+
+int main(void)
+{
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    RUN_TEST(TestAcknowledgedRecordsAreNotReadAfterReopen);
+    RUN_TEST(TestPowerLossResumesFromLastCheckpoint);
+    RUN_TEST(TestTornRecordEndsTheLog);
+    RUN_TEST(TestRolloverLosesTheOldestRecords);
+    RUN_TEST(TestFailedRecordIsReadAgainAheadOfLaterOnes);
+    RUN_TEST(TestUnacknowledgedRecordIsReadAgainAfterReopen);
+    RUN_TEST(TestReadsStopAtTheWindow);
+    RUN_TEST(TestRolloverWithRecordsInFlight);
+    RUN_TEST(TestCorruptRecordIsSkippedWithTheRestOfItsSegment);
+    RUN_TEST(TestWriteBudgetRefusesRecords);
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "serial_framer.h"
+#include "telemetry_batcher.h"
+#include "test.h"
+
+static char sentMessage[TELEMETRY_BATCHER_CAPACITY];
+static size_t sentRecordCount;
+
+static int CaptureBatch(const char *message, size_t length, size_t recordCount, void *context)
+{
+    memcpy(sentMessage, message, length + 1);
+    sentRecordCount = recordCount;
+    return 0;
+}
+
+/// <summary>
+///     Passes a frame to the batcher with its length, as the serial port's cloud route does.
+/// </summary>
+static void AddFrame(const struct iovec *spans, int spanCount, void *context)
+{
+    char frame[SERIAL_FRAMER_BUFFER_SIZE + 1];
+    size_t length = SerialFramer_CopyFrame(spans, spanCount, frame, sizeof(frame));
+    CHECK(TelemetryBatcher_AddStringN(context, "serial", frame, length) == 0);
+}
+
+static void Receive(SerialFramer *framer, const char *data, size_t length)
+{
+    size_t space;
+    uint8_t *writeSpace = SerialFramer_GetWriteSpace(framer, &space);
+    CHECK(space >= length);
+    memcpy(writeSpace, data, length);
+    SerialFramer_Commit(framer, length);
+}
+
+static void TestFrameWithNullIsSentWhole(void)
+{
+    int epollFd = CreateEpollFd();
+    CHECK(epollFd >= 0);
+    CHECK(CreateTimerWheelAndAddToEpoll(epollFd) == 0);
+
+    TelemetryBatcher batcher;
+    TelemetryBatcherConfig batcherConfig = {.maxBytes = 4096, .maxRecords = 8, .maxAgeMs = 1000};
+    TelemetryBatcher_Init(&batcher, &batcherConfig, CaptureBatch, NULL);
+    SerialFramer framer;
+    SerialFramerConfig framerConfig = {.mode = SerialFramingMode_Delimiter, .delimiter = '\n'};
+    CHECK(SerialFramer_Init(&framer, &framerConfig, AddFrame, &batcher, epollFd) == 0);
+
+    static const char Frame[] = "id\0\x01" "after\n";
+    Receive(&framer, Frame, sizeof(Frame) - 1);
+    CHECK(TelemetryBatcher_Flush(&batcher) == 0);
+    CHECK(sentRecordCount == 1);
+    CHECK(strstr(sentMessage, "\"serial\":\"id\\u0000\\u0001after\\n\"}]}") != NULL);
+
+    SerialFramer_Close(&framer);
+    CloseTimerWheel();
+    close(epollFd);
+}
+
+static void TestStringStopsAtItsNull(void)
+{
+    int epollFd = CreateEpollFd();
+    CHECK(epollFd >= 0);
+    CHECK(CreateTimerWheelAndAddToEpoll(epollFd) == 0);
+
+    TelemetryBatcher batcher;
+    TelemetryBatcherConfig batcherConfig = {.maxBytes = 4096, .maxRecords = 8, .maxAgeMs = 1000};
+    TelemetryBatcher_Init(&batcher, &batcherConfig, CaptureBatch, NULL);
+    CHECK(TelemetryBatcher_AddString(&batcher, "line", "one\0two") == 0);
+    CHECK(TelemetryBatcher_Flush(&batcher) == 0);
+    CHECK(strstr(sentMessage, "\"line\":\"one\"}]}") != NULL);
+
+    CloseTimerWheel();
+    close(epollFd);
+}
+
+int main(void)
+{
+    RUN_TEST(TestFrameWithNullIsSentWhole);
+    RUN_TEST(TestStringStopsAtItsNull);
+    return 0;
+}
@@ -0,0 +1,26 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+/// <summary>
+///     Ends the test with a message naming the check if a condition is false.
+/// </summary>
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);  \
+            exit(1);                                                                       \
+        }                                                                                  \
+    } while (0)
+
+/// <summary>
+///     Runs a test function and reports it.
+/// </summary>
+#define RUN_TEST(test)              \
+    do {                            \
+        test();                     \
+        printf("PASS %s\n", #test); \
+    } while (0)
@@ -0,0 +1,453 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "twin_parser.h"
+
+/// <summary>
+///     State of one call to TwinParser_Parse.
+/// </summary>
+typedef struct {
+    const char *pos;
+    const char *end;
+    const char *prefix;
+    const TwinParserPath *paths;
+    size_t pathCount;
+    /// <summary>Keys of the objects which enclose the current value.</summary>
+    struct {
+        const char *text;
+        size_t length;
+    } keys[TWIN_PARSER_MAX_DEPTH];
+    /// <summary>Number of keys in keys.</summary>
+    size_t keyCount;
+    /// <summary>Number of arrays which enclose the current value; values in arrays are not
+    /// matched.</summary>
+    size_t arrayDepth;
+} Parser;
+
+static int ParseValue(Parser *parser, size_t depth, TwinParserValue *value);
+
+static void SkipWhitespace(Parser *parser)
+{
+    while (parser->pos < parser->end && (*parser->pos == ' ' || *parser->pos == '\t' ||
+                                         *parser->pos == '\n' || *parser->pos == '\r')) {
+        ++parser->pos;
+    }
+}
+
+static bool IsHexDigit(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/// <summary>
+///     Scans a string, which starts at the opening quote, and checks its escapes.
+/// </summary>
+static int ParseString(Parser *parser, TwinParserValue *value)
+{
+    const char *start = ++parser->pos;
+    while (parser->pos < parser->end && *parser->pos != '"') {
+        unsigned char c = (unsigned char)*parser->pos;
+        if (c < 0x20) {
+            return -1;
+        }
+        if (c != '\\') {
+            ++parser->pos;
+            continue;
+        }
+        if (parser->end - parser->pos < 2) {
+            return -1;
+        }
+        switch (parser->pos[1]) {
+        case '"':
+        case '\\':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+            parser->pos += 2;
+            break;
+        case 'u':
+            if (parser->end - parser->pos < 6 || !IsHexDigit(parser->pos[2]) ||
+                !IsHexDigit(parser->pos[3]) || !IsHexDigit(parser->pos[4]) ||
+                !IsHexDigit(parser->pos[5])) {
+                return -1;
+            }
+            parser->pos += 6;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (parser->pos == parser->end) {
+        return -1;
+    }
+
+    value->type = TwinParser_Type_String;
+    value->text = start;
+    value->length = (size_t)(parser->pos - start);
+    ++parser->pos;
+    return 0;
+}
+
+static int ParseNumber(Parser *parser, TwinParserValue *value)
+{
+    const char *start = parser->pos;
+    if (parser->pos < parser->end && *parser->pos == '-') {
+        ++parser->pos;
+    }
+    if (parser->pos == parser->end || !IsDigit(*parser->pos)) {
+        return -1;
+    }
+    if (*parser->pos == '0') {
+        ++parser->pos;
+    } else {
+        while (parser->pos < parser->end && IsDigit(*parser->pos)) {
+            ++parser->pos;
+        }
+    }
+    if (parser->pos < parser->end && *parser->pos == '.') {
+        ++parser->pos;
+        if (parser->pos == parser->end || !IsDigit(*parser->pos)) {
+            return -1;
+        }
+        while (parser->pos < parser->end && IsDigit(*parser->pos)) {
+            ++parser->pos;
+        }
+    }
+    if (parser->pos < parser->end && (*parser->pos == 'e' || *parser->pos == 'E')) {
+        ++parser->pos;
+        if (parser->pos < parser->end && (*parser->pos == '+' || *parser->pos == '-')) {
+            ++parser->pos;
+        }
+        if (parser->pos == parser->end || !IsDigit(*parser->pos)) {
+            return -1;
+        }
+        while (parser->pos < parser->end && IsDigit(*parser->pos)) {
+            ++parser->pos;
+        }
+    }
+
+    value->type = TwinParser_Type_Number;
+    value->text = start;
+    value->length = (size_t)(parser->pos - start);
+    return 0;
+}
+
+static int ParseLiteral(Parser *parser, const char *literal, TwinParser_Type type,
+                        TwinParserValue *value)
+{
+    size_t length = strlen(literal);
+    if ((size_t)(parser->end - parser->pos) < length ||
+        memcmp(parser->pos, literal, length) != 0) {
+        return -1;
+    }
+    value->type = type;
+    value->text = parser->pos;
+    value->length = length;
+    parser->pos += length;
+    return 0;
+}
+
+/// <summary>
+///     Compares the next dot-separated key of a path with a key of the document, and moves
+///     the path past it.
+/// </summary>
+static bool MatchKey(const char **path, const char *key, size_t keyLength)
+{
+    const char *dot = strchr(*path, '.');
+    size_t length = dot ? (size_t)(dot - *path) : strlen(*path);
+    if (length != keyLength || memcmp(*path, key, length) != 0) {
+        return false;
+    }
+    *path += dot ? length + 1 : length;
+    return true;
+}
+
+/// <summary>
+///     Checks whether the keys which lead to the current value are the prefix followed by a
+///     path.
+/// </summary>
+static bool MatchPath(const Parser *parser, const char *path)
+{
+    const char *prefix = parser->prefix ? parser->prefix : "";
+    size_t i = 0;
+    for (; *prefix != '\0'; ++i) {
+        if (i == parser->keyCount ||
+            !MatchKey(&prefix, parser->keys[i].text, parser->keys[i].length)) {
+            return false;
+        }
+    }
+    for (; *path != '\0'; ++i) {
+        if (i == parser->keyCount || !MatchKey(&path, parser->keys[i].text, parser->keys[i].length)) {
+            return false;
+        }
+    }
+    return i == parser->keyCount;
+}
+
+/// <summary>
+///     Calls the handler of every subscription to the current value.
+/// </summary>
+static void Dispatch(const Parser *parser, const TwinParserValue *value)
+{
+    if (parser->arrayDepth != 0) {
+        return;
+    }
+    for (size_t i = 0; i < parser->pathCount; ++i) {
+        if (MatchPath(parser, parser->paths[i].path)) {
+            parser->paths[i].handler(value, parser->paths[i].context);
+        }
+    }
+}
+
+static int ParseObject(Parser *parser, size_t depth)
+{
+    ++parser->pos;
+    SkipWhitespace(parser);
+    if (parser->pos < parser->end && *parser->pos == '}') {
+        ++parser->pos;
+        return 0;
+    }
+
+    while (true) {
+        TwinParserValue key;
+        SkipWhitespace(parser);
+        if (parser->pos == parser->end || *parser->pos != '"' || ParseString(parser, &key) != 0) {
+            return -1;
+        }
+        SkipWhitespace(parser);
+        if (parser->pos == parser->end || *parser->pos != ':') {
+            return -1;
+        }
+        ++parser->pos;
+
+        // Keys inside arrays are not matched, so they need not be kept.
+        bool isKept = parser->arrayDepth == 0;
+        if (isKept) {
+            parser->keys[parser->keyCount].text = key.text;
+            parser->keys[parser->keyCount].length = key.length;
+            ++parser->keyCount;
+        }
+        TwinParserValue member;
+        int result = ParseValue(parser, depth, &member);
+        if (result == 0) {
+            Dispatch(parser, &member);
+        }
+        if (isKept) {
+            --parser->keyCount;
+        }
+        if (result != 0) {
+            return -1;
+        }
+
+        SkipWhitespace(parser);
+        if (parser->pos == parser->end) {
+            return -1;
+        }
+        if (*parser->pos == '}') {
+            ++parser->pos;
+            return 0;
+        }
+        if (*parser->pos != ',') {
+            return -1;
+        }
+        ++parser->pos;
+    }
+}
+
+static int ParseArray(Parser *parser, size_t depth)
+{
+    ++parser->pos;
+    SkipWhitespace(parser);
+    if (parser->pos < parser->end && *parser->pos == ']') {
+        ++parser->pos;
+        return 0;
+    }
+
+    ++parser->arrayDepth;
+    while (true) {
+        TwinParserValue element;
+        if (ParseValue(parser, depth, &element) != 0) {
+            return -1;
+        }
+        SkipWhitespace(parser);
+        if (parser->pos == parser->end) {
+            return -1;
+        }
+        if (*parser->pos == ']') {
+            ++parser->pos;
+            --parser->arrayDepth;
+            return 0;
+        }
+        if (*parser->pos != ',') {
+            return -1;
+        }
+        ++parser->pos;
+    }
+}
+
+/// <summary>
+///     Parses a value of any type.
+/// </summary>
+/// <param name="depth">Number of objects and arrays which enclose the value</param>
+static int ParseValue(Parser *parser, size_t depth, TwinParserValue *value)
+{
+    SkipWhitespace(parser);
+    if (parser->pos == parser->end) {
+        return -1;
+    }
+
+    const char *start = parser->pos;
+    switch (*parser->pos) {
+    case '{':
+    case '[':
+        if (depth == TWIN_PARSER_MAX_DEPTH) {
+            return -1;
+        }
+        bool isObject = *parser->pos == '{';
+        if ((isObject ? ParseObject(parser, depth + 1) : ParseArray(parser, depth + 1)) != 0) {
+            return -1;
+        }
+        value->type = isObject ? TwinParser_Type_Object : TwinParser_Type_Array;
+        value->text = start;
+        value->length = (size_t)(parser->pos - start);
+        return 0;
+    case '"':
+        return ParseString(parser, value);
+    case 't':
+        return ParseLiteral(parser, "true", TwinParser_Type_Bool, value);
+    case 'f':
+        return ParseLiteral(parser, "false", TwinParser_Type_Bool, value);
+    case 'n':
+        return ParseLiteral(parser, "null", TwinParser_Type_Null, value);
+    default:
+        return ParseNumber(parser, value);
+    }
+}
+
+int TwinParser_Parse(const char *json, size_t length, const char *prefix,
+                     const TwinParserPath *paths, size_t pathCount)
+{
+    Parser parser = {.pos = json,
+                     .end = json + length,
+                     .prefix = prefix,
+                     .paths = paths,
+                     .pathCount = pathCount};
+    TwinParserValue root;
+    if (ParseValue(&parser, 0, &root) != 0) {
+        return -1;
+    }
+    Dispatch(&parser, &root);
+
+    SkipWhitespace(&parser);
+    return parser.pos == parser.end ? 0 : -1;
+}
+
+int TwinParser_GetBool(const TwinParserValue *value, bool *result)
+{
+    if (value->type != TwinParser_Type_Bool) {
+        return -1;
+    }
+    *result = value->text[0] == 't';
+    return 0;
+}
+
+int TwinParser_GetUint(const TwinParserValue *value, uint64_t *result)
+{
+    if (value->type != TwinParser_Type_Number) {
+        return -1;
+    }
+    uint64_t number = 0;
+    for (size_t i = 0; i < value->length; ++i) {
+        char c = value->text[i];
+        if (!IsDigit(c) || number > (UINT64_MAX - (uint64_t)(c - '0')) / 10) {
+            return -1;
+        }
+        number = number * 10 + (uint64_t)(c - '0');
+    }
+    *result = number;
+    return 0;
+}
+
+static unsigned int ParseHex4(const char *text)
+{
+    unsigned int code = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = text[i];
+        code = code * 16 + (unsigned int)(IsDigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return code;
+}
+
+int TwinParser_CopyString(const TwinParserValue *value, char *buffer, size_t capacity)
+{
+    if (value->type != TwinParser_Type_String || capacity == 0) {
+        return -1;
+    }
+
+    size_t length = 0;
+    const char *text = value->text;
+    const char *end = text + value->length;
+    while (text < end) {
+        char utf8[4];
+        size_t utf8Length = 1;
+        if (*text != '\\') {
+            utf8[0] = *text++;
+        } else if (text[1] != 'u') {
+            static const char Escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+            utf8[0] = strchr(Escapes, text[1])[1];
+            text += 2;
+        } else {
+            // The parser checked that the escape has four hex digits.
+            unsigned int code = ParseHex4(text + 2);
+            text += 6;
+            if (code >= 0xd800 && code <= 0xdbff && end - text >= 6 && text[0] == '\\' &&
+                text[1] == 'u') {
+                unsigned int low = ParseHex4(text + 2);
+                if (low >= 0xdc00 && low <= 0xdfff) {
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    text += 6;
+                }
+            }
+            if (code >= 0xd800 && code <= 0xdfff) {
+                // A lone surrogate cannot be encoded.
+                code = 0xfffd;
+            }
+            if (code < 0x80) {
+                utf8[0] = (char)code;
+            } else if (code < 0x800) {
+                utf8[0] = (char)(0xc0 | (code >> 6));
+                utf8[1] = (char)(0x80 | (code & 0x3f));
+                utf8Length = 2;
+            } else if (code < 0x10000) {
+                utf8[0] = (char)(0xe0 | (code >> 12));
+                utf8[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+                utf8[2] = (char)(0x80 | (code & 0x3f));
+                utf8Length = 3;
+            } else {
+                utf8[0] = (char)(0xf0 | (code >> 18));
+                utf8[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+                utf8[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+                utf8[3] = (char)(0x80 | (code & 0x3f));
+                utf8Length = 4;
+            }
+        }
+
+        if (utf8Length > capacity - 1 - length) {
+            return -1;
+        }
+        memcpy(buffer + length, utf8, utf8Length);
+        length += utf8Length;
+    }
+    buffer[length] = '\0';
+    return (int)length;
+}
@@ -0,0 +1,105 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Deepest nesting of objects and arrays which <see cref="TwinParser_Parse" />
+/// accepts.</summary>
+#define TWIN_PARSER_MAX_DEPTH 16
+
+/// <summary>
+///     Type of a JSON value.
+/// </summary>
+typedef enum {
+    TwinParser_Type_String,
+    TwinParser_Type_Number,
+    TwinParser_Type_Bool,
+    TwinParser_Type_Null,
+    TwinParser_Type_Object,
+    TwinParser_Type_Array
+} TwinParser_Type;
+
+/// <summary>
+///     A value in a JSON document. The value points into the document, which is not copied or
+///     modified.
+/// </summary>
+typedef struct {
+    /// <summary>Type of the value.</summary>
+    TwinParser_Type type;
+    /// <summary>Text of the value: for a string, its contents between the quotes, still
+    /// escaped; for an object or array, the whole object or array, which can be parsed again
+    /// with <see cref="TwinParser_Parse" />.</summary>
+    const char *text;
+    /// <summary>Length of the text.</summary>
+    size_t length;
+} TwinParserValue;
+
+/// <summary>
+///     Function signature for handlers of a subscribed value.
+/// </summary>
+/// <param name="value">The value</param>
+/// <param name="context">Context of the subscription</param>
+typedef void (*TwinParser_ValueHandler)(const TwinParserValue *value, void *context);
+
+/// <summary>
+///     A subscription to the value at a path of object keys.
+/// </summary>
+typedef struct {
+    /// <summary>Keys from the top level down, separated by dots, such as "StatusLED.value".
+    /// Keys which contain a dot or an escape cannot be matched, and values inside arrays are
+    /// not matched.</summary>
+    const char *path;
+    /// <summary>Function which is called with the value.</summary>
+    TwinParser_ValueHandler handler;
+    /// <summary>Context which is passed to the handler.</summary>
+    void *context;
+} TwinParserPath;
+
+/// <summary>
+/// <para>Parses a JSON document in place and calls the handler of each subscribed path which is
+/// present, in the order in which the values appear. Nothing is copied and nothing is
+/// allocated, and values which are not subscribed are only scanned, so a large twin document
+/// costs one pass over its bytes.</para>
+/// <para>Handlers are called as their values are parsed, so if the document turns out to be
+/// malformed, handlers for the values before the error have already been called.</para>
+/// </summary>
+/// <param name="json">The document, which need not be null terminated</param>
+/// <param name="length">Length of the document</param>
+/// <param name="prefix">Keys, separated by dots, which precede every path, such as "desired";
+/// may be NULL</param>
+/// <param name="paths">The subscriptions</param>
+/// <param name="pathCount">Number of subscriptions</param>
+/// <returns>0 on success, or -1 if the document is not valid JSON or is nested too
+/// deeply</returns>
+int TwinParser_Parse(const char *json, size_t length, const char *prefix,
+                     const TwinParserPath *paths, size_t pathCount);
+
+/// <summary>
+///     Gets the value of a boolean.
+/// </summary>
+/// <param name="value">The value</param>
+/// <param name="result">Receives the boolean</param>
+/// <returns>0 on success, or -1 if the value is not a boolean</returns>
+int TwinParser_GetBool(const TwinParserValue *value, bool *result);
+
+/// <summary>
+///     Gets the value of a number which is a non-negative integer.
+/// </summary>
+/// <param name="value">The value</param>
+/// <param name="result">Receives the integer</param>
+/// <returns>0 on success, or -1 if the value is not a non-negative integer or is too
+/// large</returns>
+int TwinParser_GetUint(const TwinParserValue *value, uint64_t *result);
+
+/// <summary>
+///     Unescapes a string into a buffer and null terminates it.
+/// </summary>
+/// <param name="value">The value</param>
+/// <param name="buffer">Buffer which receives the string, as UTF-8</param>
+/// <param name="capacity">Size of the buffer, including room for the terminating null</param>
+/// <returns>Length of the string on success, or -1 if the value is not a string or does not
+/// fit</returns>
+int TwinParser_CopyString(const TwinParserValue *value, char *buffer, size_t capacity);
@@ -0,0 +1,142 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "twin_state.h"
+#include "nordic/crc.h"
+
+// Marks a valid saved state.
+#define TWIN_STATE_MAGIC 0x54575354u
+
+/// <summary>
+///     The state as it is saved: only the persistent entries.
+/// </summary>
+typedef struct {
+    uint32_t magic;
+    uint32_t entryCount;
+    uint64_t version;
+    uint32_t hasVersion;
+    struct {
+        char name[TWIN_STATE_MAX_NAME + 1];
+        uint32_t hash;
+    } entries[TWIN_STATE_MAX_PROPERTIES];
+    uint32_t crc;
+} SavedState;
+
+_Static_assert(sizeof(SavedState) <= TWIN_STATE_FILE_SIZE, "SavedState is too large");
+
+static TwinStateEntry *FindEntry(const TwinState *state, const char *name)
+{
+    for (size_t i = 0; i < state->entryCount; ++i) {
+        if (strcmp(state->entries[i].name, name) == 0) {
+            return (TwinStateEntry *)&state->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int TwinState_Open(TwinState *state, int fd, off_t offset)
+{
+    memset(state, 0, sizeof(*state));
+    state->fd = fd;
+    state->offset = offset;
+    if (fd < 0) {
+        return -1;
+    }
+
+    SavedState saved;
+    if (pread(fd, &saved, sizeof(saved), offset) != (ssize_t)sizeof(saved) ||
+        saved.magic != TWIN_STATE_MAGIC || saved.entryCount > TWIN_STATE_MAX_PROPERTIES ||
+        saved.crc != CalcCrc32((const uint8_t *)&saved, offsetof(SavedState, crc))) {
+        return -1;
+    }
+
+    state->hasVersion = saved.hasVersion != 0;
+    state->version = saved.version;
+    state->entryCount = saved.entryCount;
+    for (size_t i = 0; i < saved.entryCount; ++i) {
+        memcpy(state->entries[i].name, saved.entries[i].name, sizeof(state->entries[i].name));
+        state->entries[i].name[TWIN_STATE_MAX_NAME] = '\0';
+        state->entries[i].hash = saved.entries[i].hash;
+        state->entries[i].isPersistent = true;
+    }
+    return 0;
+}
+
+void TwinState_Close(TwinState *state)
+{
+    if (state->fd < 0) {
+        return;
+    }
+    TwinState_Save(state);
+    close(state->fd);
+    state->fd = -1;
+}
+
+bool TwinState_IsStale(const TwinState *state, uint64_t version)
+{
+    return state->hasVersion && version <= state->version;
+}
+
+void TwinState_SetVersion(TwinState *state, uint64_t version)
+{
+    if (!state->hasVersion || version != state->version) {
+        state->hasVersion = true;
+        state->version = version;
+        state->isDirty = true;
+    }
+}
+
+bool TwinState_IsChanged(const TwinState *state, const char *name, const char *text,
+                         size_t length)
+{
+    const TwinStateEntry *entry = FindEntry(state, name);
+    return entry == NULL || entry->hash != CalcCrc32((const uint8_t *)text, length);
+}
+
+void TwinState_Commit(TwinState *state, const char *name, const char *text, size_t length,
+                      bool isPersistent)
+{
+    TwinStateEntry *entry = FindEntry(state, name);
+    if (entry == NULL) {
+        // A property which cannot be tracked is always applied.
+        if (strlen(name) > TWIN_STATE_MAX_NAME || state->entryCount == TWIN_STATE_MAX_PROPERTIES) {
+            return;
+        }
+        entry = &state->entries[state->entryCount++];
+        strcpy(entry->name, name);
+    }
+    entry->hash = CalcCrc32((const uint8_t *)text, length);
+    entry->isPersistent = isPersistent;
+    state->isDirty |= isPersistent;
+}
+
+int TwinState_Save(TwinState *state)
+{
+    if (state->fd < 0 || !state->isDirty) {
+        return 0;
+    }
+
+    SavedState saved;
+    memset(&saved, 0, sizeof(saved));
+    saved.magic = TWIN_STATE_MAGIC;
+    saved.version = state->version;
+    saved.hasVersion = state->hasVersion;
+    for (size_t i = 0; i < state->entryCount; ++i) {
+        if (state->entries[i].isPersistent) {
+            memcpy(saved.entries[saved.entryCount].name, state->entries[i].name,
+                   sizeof(saved.entries[0].name));
+            saved.entries[saved.entryCount].hash = state->entries[i].hash;
+            ++saved.entryCount;
+        }
+    }
+    saved.crc = CalcCrc32((const uint8_t *)&saved, offsetof(SavedState, crc));
+
+    if (pwrite(state->fd, &saved, sizeof(saved), state->offset) != (ssize_t)sizeof(saved)) {
+        return -1;
+    }
+    state->isDirty = false;
+    return 0;
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// <summary>Largest number of desired properties which are tracked.</summary>
+#define TWIN_STATE_MAX_PROPERTIES 8
+
+/// <summary>Longest property name which is tracked.</summary>
+#define TWIN_STATE_MAX_NAME 23
+
+/// <summary>Number of bytes which the saved state takes in its file.</summary>
+#define TWIN_STATE_FILE_SIZE 256
+
+/// <summary>
+///     The last applied value of a desired property.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the property.</summary>
+    char name[TWIN_STATE_MAX_NAME + 1];
+    /// <summary>CRC-32 of the property's JSON text.</summary>
+    uint32_t hash;
+    /// <summary>True if the property's effect outlives the app, so its hash is saved; false if
+    /// the property must be applied again after a restart.</summary>
+    bool isPersistent;
+} TwinStateEntry;
+
+/// <summary>
+/// <para>Remembers which desired properties have been applied, so a twin which is delivered
+/// again, as the whole twin is after every reconnect, does not apply them again.</para>
+/// <para>Each property is remembered by a hash of its JSON text, so a property is applied only
+/// when its value changes. The $version of the desired properties is remembered too, so a patch
+/// which is older than the state that was applied is ignored.</para>
+/// <para>The version and the hashes of persistent properties are saved to a file, with a
+/// CRC-32, so they survive restarts; a torn save is detected, and every property is then
+/// applied once more.</para>
+/// </summary>
+typedef struct {
+    /// <summary>File which the state is saved in, which the state owns; -1 if it is only kept
+    /// in memory.</summary>
+    int fd;
+    /// <summary>Offset of the state in the file.</summary>
+    off_t offset;
+    /// <summary>True if a version has been applied.</summary>
+    bool hasVersion;
+    /// <summary>$version of the desired properties which were last applied.</summary>
+    uint64_t version;
+    /// <summary>True if the state has changed since it was saved.</summary>
+    bool isDirty;
+    /// <summary>Number of entries in entries.</summary>
+    size_t entryCount;
+    /// <summary>The properties which have been applied.</summary>
+    TwinStateEntry entries[TWIN_STATE_MAX_PROPERTIES];
+} TwinState;
+
+/// <summary>
+///     Loads the saved state from a file, or starts with an empty state.
+/// </summary>
+/// <param name="state">The state</param>
+/// <param name="fd">The file, opened for reading and writing, which the state closes; or -1
+/// to keep the state only in memory</param>
+/// <param name="offset">Offset of the TWIN_STATE_FILE_SIZE bytes which hold the state</param>
+/// <returns>0 if a saved state was loaded, or -1 if the state starts empty</returns>
+int TwinState_Open(TwinState *state, int fd, off_t offset);
+
+/// <summary>
+///     Saves the state, if it has changed, and closes the file.
+/// </summary>
+/// <param name="state">The state</param>
+void TwinState_Close(TwinState *state);
+
+/// <summary>
+///     Queries whether a patch of desired properties is no newer than the state which was
+///     applied.
+/// </summary>
+/// <param name="state">The state</param>
+/// <param name="version">$version of the patch</param>
+/// <returns>True if the patch must be ignored; false otherwise</returns>
+bool TwinState_IsStale(const TwinState *state, uint64_t version);
+
+/// <summary>
+///     Records the $version of the desired properties which were applied.
+/// </summary>
+/// <param name="state">The state</param>
+/// <param name="version">The version</param>
+void TwinState_SetVersion(TwinState *state, uint64_t version);
+
+/// <summary>
+///     Queries whether the value of a property differs from the value which was last applied.
+/// </summary>
+/// <param name="state">The state</param>
+/// <param name="name">Name of the property</param>
+/// <param name="text">JSON text of the value</param>
+/// <param name="length">Length of the text</param>
+/// <returns>True if the property must be applied; false if it is unchanged</returns>
+bool TwinState_IsChanged(const TwinState *state, const char *name, const char *text,
+                         size_t length);
+
+/// <summary>
+///     Records the value of a property which was applied successfully. A value which failed
+///     to apply is not recorded, so it is applied again when the twin is next delivered.
+/// </summary>
+/// <param name="state">The state</param>
+/// <param name="name">Name of the property</param>
+/// <param name="text">JSON text of the value</param>
+/// <param name="length">Length of the text</param>
+/// <param name="isPersistent">True if the property's effect outlives the app</param>
+void TwinState_Commit(TwinState *state, const char *name, const char *text, size_t length,
+                      bool isPersistent);
+
+/// <summary>
+///     Saves the state to its file, if it has changed.
+/// </summary>
+/// <param name="state">The state</param>
+/// <returns>0 on success or if nothing needed saving, or -1 if the state could not be
+/// written</returns>
+int TwinState_Save(TwinState *state);
@@ -0,0 +1,242 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "tx_queue.h"
+
+// Largest number of messages which are gathered into one write.
+#define TX_QUEUE_MAX_IOVECS 8
+
+// Largest number of written entries which each queue keeps for reuse.
+#define TX_QUEUE_MAX_POOLED_ENTRIES 8
+
+// Entries are allocated in multiples of this many bytes, so that a pooled entry fits most later
+// messages of a similar length.
+#define TX_QUEUE_ENTRY_GRANULE 64
+
+static uint64_t GetMonotonicUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+void TxQueue_Init(TxQueue *queue, size_t maxBytes)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->tailLink = &queue->head;
+    queue->maxBytes = maxBytes;
+    queue->lowWatermark = maxBytes;
+}
+
+void TxQueue_SetLowWatermark(TxQueue *queue, size_t lowWatermark)
+{
+    queue->lowWatermark = lowWatermark < queue->maxBytes ? lowWatermark : queue->maxBytes;
+}
+
+static void FreeEntries(TxQueueEntry *entry)
+{
+    while (entry != NULL) {
+        TxQueueEntry *next = entry->next;
+        free(entry);
+        entry = next;
+    }
+}
+
+void TxQueue_Clear(TxQueue *queue)
+{
+    FreeEntries(queue->head);
+    FreeEntries(queue->pool);
+
+    queue->head = NULL;
+    queue->tailLink = &queue->head;
+    queue->queuedBytes = 0;
+    queue->isThrottled = false;
+    queue->pool = NULL;
+    queue->poolCount = 0;
+}
+
+/// <summary>
+///     Takes the first pooled entry which can hold a message, or allocates a new one.
+/// </summary>
+static TxQueueEntry *AllocateEntry(TxQueue *queue, size_t length)
+{
+    for (TxQueueEntry **link = &queue->pool; *link != NULL; link = &(*link)->next) {
+        TxQueueEntry *entry = *link;
+        if (entry->capacity >= length) {
+            *link = entry->next;
+            --queue->poolCount;
+            ++queue->stats.poolHits;
+            return entry;
+        }
+    }
+
+    size_t capacity = (length + TX_QUEUE_ENTRY_GRANULE - 1) & ~(size_t)(TX_QUEUE_ENTRY_GRANULE - 1);
+    TxQueueEntry *entry = malloc(sizeof(TxQueueEntry) + capacity);
+    if (entry != NULL) {
+        entry->capacity = capacity;
+    }
+    return entry;
+}
+
+/// <summary>
+///     Returns a written entry to the pool, or frees it if the pool is full.
+/// </summary>
+static void ReleaseEntry(TxQueue *queue, TxQueueEntry *entry)
+{
+    if (queue->poolCount >= TX_QUEUE_MAX_POOLED_ENTRIES) {
+        free(entry);
+        return;
+    }
+
+    entry->next = queue->pool;
+    queue->pool = entry;
+    ++queue->poolCount;
+}
+
+int TxQueue_Enqueue(TxQueue *queue, const void *data, size_t length)
+{
+    struct iovec fragment = {.iov_base = (void *)data, .iov_len = length};
+    return TxQueue_EnqueueFragments(queue, &fragment, 1);
+}
+
+int TxQueue_EnqueueFragments(TxQueue *queue, const struct iovec *fragments, int fragmentCount)
+{
+    size_t length = 0;
+    for (int i = 0; i < fragmentCount; ++i) {
+        length += fragments[i].iov_len;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    // Once the high watermark has been reached, keep rejecting until the reader catches up.
+    if (queue->isThrottled && queue->queuedBytes > queue->lowWatermark) {
+        ++queue->stats.messagesRejected;
+        errno = ENOBUFS;
+        return -1;
+    }
+    queue->isThrottled = false;
+
+    if (length > queue->maxBytes - queue->queuedBytes) {
+        ++queue->stats.messagesRejected;
+        ++queue->stats.throttleCount;
+        queue->isThrottled = true;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    TxQueueEntry *entry = AllocateEntry(queue, length);
+    if (entry == NULL) {
+        ++queue->stats.messagesRejected;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    entry->next = NULL;
+    entry->queuedTimeUs = GetMonotonicUs();
+    entry->length = length;
+    entry->offset = 0;
+    uint8_t *data = entry->data;
+    for (int i = 0; i < fragmentCount; ++i) {
+        memcpy(data, fragments[i].iov_base, fragments[i].iov_len);
+        data += fragments[i].iov_len;
+    }
+
+    *queue->tailLink = entry;
+    queue->tailLink = &entry->next;
+    queue->queuedBytes += length;
+
+    ++queue->stats.messagesQueued;
+    queue->stats.bytesQueued += length;
+    if (queue->queuedBytes > queue->stats.maxQueuedBytes) {
+        queue->stats.maxQueuedBytes = queue->queuedBytes;
+    }
+
+    return 0;
+}
+
+int TxQueue_Drain(TxQueue *queue, int fd)
+{
+    while (queue->head != NULL) {
+        struct iovec iov[TX_QUEUE_MAX_IOVECS];
+        int iovCount = 0;
+        size_t bytesToWrite = 0;
+        for (TxQueueEntry *entry = queue->head; entry != NULL && iovCount < TX_QUEUE_MAX_IOVECS;
+             entry = entry->next) {
+            iov[iovCount].iov_base = entry->data + entry->offset;
+            iov[iovCount].iov_len = entry->length - entry->offset;
+            bytesToWrite += iov[iovCount].iov_len;
+            ++iovCount;
+        }
+
+        ++queue->stats.writeCalls;
+        ssize_t bytesWritten = writev(fd, iov, iovCount);
+        if (bytesWritten < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            return -1;
+        }
+
+        queue->queuedBytes -= (size_t)bytesWritten;
+        queue->stats.bytesSent += (uint64_t)bytesWritten;
+
+        // Retire every message which has been written completely.
+        uint64_t nowUs = GetMonotonicUs();
+        size_t remaining = (size_t)bytesWritten;
+        while (remaining > 0) {
+            TxQueueEntry *entry = queue->head;
+            size_t unsent = entry->length - entry->offset;
+            if (remaining < unsent) {
+                entry->offset += remaining;
+                break;
+            }
+
+            remaining -= unsent;
+            uint64_t latencyUs = nowUs - entry->queuedTimeUs;
+            ++queue->stats.messagesSent;
+            queue->stats.totalLatencyUs += latencyUs;
+            if (latencyUs > queue->stats.maxLatencyUs) {
+                queue->stats.maxLatencyUs = latencyUs;
+            }
+
+            queue->head = entry->next;
+            if (queue->head == NULL) {
+                queue->tailLink = &queue->head;
+            }
+            ReleaseEntry(queue, entry);
+        }
+        if (queue->queuedBytes <= queue->lowWatermark) {
+            queue->isThrottled = false;
+        }
+
+        // A short write means the file descriptor cannot accept more now.
+        if ((size_t)bytesWritten < bytesToWrite) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+bool TxQueue_IsEmpty(const TxQueue *queue)
+{
+    return queue->head == NULL;
+}
+
+size_t TxQueue_GetFreeBytes(const TxQueue *queue)
+{
+    return queue->maxBytes - queue->queuedBytes;
+}
+
+bool TxQueue_IsThrottled(const TxQueue *queue)
+{
+    return queue->isThrottled;
+}
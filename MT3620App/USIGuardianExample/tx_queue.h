@@ -0,0 +1,168 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/// <summary>
+///     A message waiting in a <see cref="TxQueue" />.
+/// </summary>
+typedef struct TxQueueEntry {
+    /// <summary>Next message in the queue.</summary>
+    struct TxQueueEntry *next;
+    /// <summary>CLOCK_MONOTONIC time, in microseconds, when the message was queued.</summary>
+    uint64_t queuedTimeUs;
+    /// <summary>Number of bytes which data can hold, so a pooled entry can be reused for any
+    /// message which fits.</summary>
+    size_t capacity;
+    /// <summary>Length of the message in bytes.</summary>
+    size_t length;
+    /// <summary>Number of bytes which have already been written.</summary>
+    size_t offset;
+    /// <summary>The message.</summary>
+    uint8_t data[];
+} TxQueueEntry;
+
+/// <summary>
+///     Counters for a <see cref="TxQueue" />.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages which were queued.</summary>
+    uint64_t messagesQueued;
+    /// <summary>Number of messages which were written completely.</summary>
+    uint64_t messagesSent;
+    /// <summary>Number of messages which were rejected, and so dropped by the producer, because
+    /// the queue was full or was draining to its low watermark.</summary>
+    uint64_t messagesRejected;
+    /// <summary>Number of times the queue reached its high watermark and began to reject
+    /// messages.</summary>
+    uint64_t throttleCount;
+    /// <summary>Number of messages which were stored in a pooled entry instead of newly allocated
+    /// memory.</summary>
+    uint64_t poolHits;
+    /// <summary>Number of bytes which were queued.</summary>
+    uint64_t bytesQueued;
+    /// <summary>Number of bytes which were written.</summary>
+    uint64_t bytesSent;
+    /// <summary>Number of write system calls.</summary>
+    uint64_t writeCalls;
+    /// <summary>Sum of the time, in microseconds, from queuing each sent message until its last
+    /// byte was written.</summary>
+    uint64_t totalLatencyUs;
+    /// <summary>Longest time, in microseconds, from queuing a message until its last byte was
+    /// written.</summary>
+    uint64_t maxLatencyUs;
+    /// <summary>Largest number of bytes which have been waiting at once.</summary>
+    size_t maxQueuedBytes;
+} TxQueueStats;
+
+/// <summary>
+/// <para>A FIFO of messages waiting to be written to a non-blocking file descriptor, such as a
+/// UART.</para>
+/// <para>The bytes held by the queue are bounded. A message which does not fit is rejected, so
+/// producers see backpressure instead of the queue growing without limit or the event loop
+/// blocking in write(). The bound is the high watermark; once it is reached, messages are rejected
+/// until the queue has drained to the low watermark, so a stalled reader is not fed one message
+/// for every few bytes it accepts.</para>
+/// <para>Written entries are kept in a small pool and reused for later messages, so a steady flow
+/// of messages does not allocate.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Oldest message.</summary>
+    TxQueueEntry *head;
+    /// <summary>Link to update when a message is queued.</summary>
+    TxQueueEntry **tailLink;
+    /// <summary>Number of bytes which are waiting to be written.</summary>
+    size_t queuedBytes;
+    /// <summary>Largest number of bytes which may be waiting: the high watermark.</summary>
+    size_t maxBytes;
+    /// <summary>Number of waiting bytes below which a throttled queue accepts messages
+    /// again.</summary>
+    size_t lowWatermark;
+    /// <summary>Whether messages are rejected until the queue drains to the low
+    /// watermark.</summary>
+    bool isThrottled;
+    /// <summary>Entries which have been written and may be reused.</summary>
+    TxQueueEntry *pool;
+    /// <summary>Number of entries in the pool.</summary>
+    size_t poolCount;
+    /// <summary>Counters.</summary>
+    TxQueueStats stats;
+} TxQueue;
+
+/// <summary>
+///     Initializes an empty queue. Its low watermark equals maxBytes until it is set with
+///     <see cref="TxQueue_SetLowWatermark" />.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="maxBytes">Largest number of bytes which may be waiting</param>
+void TxQueue_Init(TxQueue *queue, size_t maxBytes);
+
+/// <summary>
+///     Sets the number of waiting bytes to which a queue which reached maxBytes must drain
+///     before it accepts messages again.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="lowWatermark">The low watermark; at most maxBytes</param>
+void TxQueue_SetLowWatermark(TxQueue *queue, size_t lowWatermark);
+
+/// <summary>
+///     Frees every message in the queue and the pooled entries. The counters are kept.
+/// </summary>
+/// <param name="queue">The queue</param>
+void TxQueue_Clear(TxQueue *queue);
+
+/// <summary>
+///     Copies a message to the end of the queue.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="data">The message</param>
+/// <param name="length">Length of the message in bytes</param>
+/// <returns>0 on success, or -1 on failure with errno set to ENOBUFS if the queue is full or
+/// ENOMEM if memory could not be allocated</returns>
+int TxQueue_Enqueue(TxQueue *queue, const void *data, size_t length);
+
+/// <summary>
+///     Copies a message which is gathered from several fragments, such as a payload and its
+///     terminator, to the end of the queue.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="fragments">The fragments of the message, in order</param>
+/// <param name="fragmentCount">Number of fragments</param>
+/// <returns>0 on success, or -1 on failure with errno set to ENOBUFS if the queue is full or
+/// ENOMEM if memory could not be allocated</returns>
+int TxQueue_EnqueueFragments(TxQueue *queue, const struct iovec *fragments, int fragmentCount);
+
+/// <summary>
+///     Writes as much of the queue as the file descriptor accepts without blocking. Several
+///     messages are written by each system call.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="fd">Non-blocking file descriptor to write to</param>
+/// <returns>0 if the queue was emptied or the file descriptor would block, or -1 on a write
+/// error</returns>
+int TxQueue_Drain(TxQueue *queue, int fd);
+
+/// <summary>
+///     Queries whether a queue is empty.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <returns>True if no bytes are waiting; false otherwise</returns>
+bool TxQueue_IsEmpty(const TxQueue *queue);
+
+/// <summary>
+///     Gets the number of bytes which can be queued before messages are rejected.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <returns>The number of free bytes</returns>
+size_t TxQueue_GetFreeBytes(const TxQueue *queue);
+
+/// <summary>
+///     Queries whether a queue rejects messages until it drains to its low watermark.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <returns>True if the queue is throttled; false otherwise</returns>
+bool TxQueue_IsThrottled(const TxQueue *queue);
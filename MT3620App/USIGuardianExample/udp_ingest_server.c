@@ -0,0 +1,289 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for recvmmsg
+#include <stdbool.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "udp_ingest_server.h"
+#include "usi_azureiot.h"
+
+static const char *sendToCloudPropertyName = "sendToCloud";
+static const char *sendToBinaryPropertyName = "binary";
+
+/// <summary>
+/// Descriptors and buffers for one recvmmsg call. The descriptors always point at the same
+/// buffers, so receiving only resets their lengths.
+/// </summary>
+struct UdpIngest_Batch {
+    /// <summary>Receive descriptors.</summary>
+    struct mmsghdr messages[UDP_INGEST_BATCH_SIZE];
+    /// <summary>Scatter vectors of the receive descriptors.</summary>
+    struct iovec vectors[UDP_INGEST_BATCH_SIZE];
+    /// <summary>Source addresses of the received datagrams.</summary>
+    struct sockaddr_in addrs[UDP_INGEST_BATCH_SIZE];
+    /// <summary>Received datagrams. One byte more than the largest datagram reveals truncation
+    /// and leaves room to terminate a text payload.</summary>
+    uint8_t buffers[UDP_INGEST_BATCH_SIZE][UDP_INGEST_MAX_DATAGRAM + 1];
+};
+
+// Support functions.
+static void HandleSocketEvent(EventData *eventData);
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType);
+static void ReportError(const char *desc);
+
+UdpIngest_ServerState *UdpIngest_Start(int epollFd, in_addr_t ipAddr, in_addr_t subnetMask,
+                                       uint16_t port)
+{
+    UdpIngest_ServerState *serverState = calloc(1, sizeof(*serverState));
+    struct UdpIngest_Batch *batch = calloc(1, sizeof(*batch));
+    if (!serverState || !batch) {
+        abort();
+    }
+
+    // Set the state to unused values so it can be safely cleaned up if only a subset of the
+    // resources are successfully allocated.
+    serverState->epollFd = epollFd;
+    serverState->socketFd = -1;
+    serverState->socketEvent.eventHandler = HandleSocketEvent;
+    serverState->networkAddr = ipAddr & subnetMask;
+    serverState->subnetMask = subnetMask;
+    serverState->batch = batch;
+    for (size_t i = 0; i < UDP_INGEST_BATCH_SIZE; ++i) {
+        batch->vectors[i].iov_base = batch->buffers[i];
+        batch->vectors[i].iov_len = sizeof(batch->buffers[i]);
+        struct msghdr *header = &batch->messages[i].msg_hdr;
+        header->msg_name = &batch->addrs[i];
+        header->msg_iov = &batch->vectors[i];
+        header->msg_iovlen = 1;
+    }
+
+    int sockType = SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
+    serverState->socketFd = OpenIpV4Socket(htonl(INADDR_ANY), port, sockType);
+    if (serverState->socketFd < 0) {
+        ReportError("open socket");
+        goto fail;
+    }
+
+    // Be notified asynchronously when datagrams arrive.
+    if (RegisterEventHandlerToEpoll(epollFd, serverState->socketFd, &serverState->socketEvent,
+                                    EPOLLIN) != 0) {
+        goto fail;
+    }
+
+    Log_Debug("INFO: UDP ingest server: Listening on port %u (fd %d).\n", port,
+              serverState->socketFd);
+
+    return serverState;
+
+fail:
+    UdpIngest_ShutDown(serverState);
+    return NULL;
+}
+
+void UdpIngest_ShutDown(UdpIngest_ServerState *serverState)
+{
+    if (!serverState) {
+        return;
+    }
+
+    const UdpIngest_Stats *stats = &serverState->stats;
+    Log_Debug(
+        "INFO: UDP ingest server: %llu datagrams in %llu batches, dropped %llu duplicates and "
+        "%llu invalid.\n",
+        (unsigned long long)stats->datagramsAccepted, (unsigned long long)stats->batches,
+        (unsigned long long)stats->duplicatesDropped, (unsigned long long)stats->invalidDropped);
+
+    CloseFdAndPrintError(serverState->socketFd, "udpIngestFd");
+
+    free(serverState->batch);
+    free(serverState);
+}
+
+static uint64_t GetNowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+/// <summary>
+///     Finds the entry of a source address and port. An unknown source takes a free entry or,
+///     if the table is full, the entry of the least recently heard source.
+/// </summary>
+/// <returns>The entry, which is empty if the source is new</returns>
+static UdpIngest_Source *FindSource(UdpIngest_ServerState *serverState,
+                                    const struct sockaddr_in *addr)
+{
+    UdpIngest_Source *victim = NULL;
+    for (size_t i = 0; i < UDP_INGEST_MAX_SOURCES; ++i) {
+        UdpIngest_Source *source = &serverState->sources[i];
+        if (source->addr == addr->sin_addr.s_addr && source->port == addr->sin_port) {
+            return source;
+        }
+        if (victim == NULL ||
+            (victim->addr != 0 &&
+             (source->addr == 0 ||
+              source->sequences.lastHeardMs < victim->sequences.lastHeardMs))) {
+            victim = source;
+        }
+    }
+
+    victim->addr = addr->sin_addr.s_addr;
+    victim->port = addr->sin_port;
+    SequenceWindow_Reset(&victim->sequences);
+    return victim;
+}
+
+/// <summary>
+///     Records a sequence number received from a source.
+/// </summary>
+/// <returns>true if the sequence number is new, false if it has already been received</returns>
+static bool AcceptSequence(UdpIngest_Source *source, const struct sockaddr_in *addr,
+                           uint32_t sequence)
+{
+    SequenceWindowResult result = SequenceWindow_Accept(&source->sequences, sequence, GetNowMs());
+    if (result == SequenceWindow_Restarted) {
+        Log_Debug("INFO: UDP ingest server: %s:%u restarted at sequence number %u.\n",
+                  inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), sequence);
+    }
+    return result != SequenceWindow_Duplicate;
+}
+
+/// <summary>
+///     Sends the payload of a datagram to the cloud: as a string if it is printable text, which
+///     is terminated in place, and as base64 binary data otherwise.
+/// </summary>
+/// <param name="payload">The payload, followed by at least one free byte</param>
+/// <param name="length">Length of the payload</param>
+static void SendPayloadToCloud(uint8_t *payload, size_t length)
+{
+    size_t textLength = length;
+    if (textLength > 0 && payload[textLength - 1] == '\n') {
+        --textLength;
+    }
+    if (textLength > 0 && payload[textLength - 1] == '\r') {
+        --textLength;
+    }
+
+    bool isText = true;
+    for (size_t i = 0; i < textLength && isText; ++i) {
+        isText = isprint(payload[i]) != 0;
+    }
+
+    if (isText) {
+        // A datagram without text only advances its source's sequence number.
+        if (textLength == 0) {
+            return;
+        }
+        payload[textLength] = '\0';
+        USIAzureIoT_SendStringToCloud(sendToCloudPropertyName, (const char *)payload);
+    } else {
+        USIAzureIoT_SendBytesToCloud(sendToBinaryPropertyName, payload, length);
+    }
+}
+
+static void HandleSocketEvent(EventData *eventData)
+{
+    UdpIngest_ServerState *serverState =
+        (UdpIngest_ServerState *)((uint8_t *)eventData -
+                                  offsetof(UdpIngest_ServerState, socketEvent));
+
+    // Receive a batch of datagrams with one call. The socket stays registered for EPOLLIN, so
+    // any remainder raises another event.
+    struct UdpIngest_Batch *batch = serverState->batch;
+    for (size_t i = 0; i < UDP_INGEST_BATCH_SIZE; ++i) {
+        batch->messages[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+    }
+    int count = recvmmsg(serverState->socketFd, batch->messages, UDP_INGEST_BATCH_SIZE,
+                         MSG_DONTWAIT, /* timeout */ NULL);
+    if (count < 0) {
+        if (errno != EAGAIN) {
+            ReportError("recvmmsg");
+        }
+        return;
+    }
+    ++serverState->stats.batches;
+
+    for (int i = 0; i < count; ++i) {
+        const struct sockaddr_in *addr = &batch->addrs[i];
+        uint8_t *datagram = batch->buffers[i];
+        size_t length = batch->messages[i].msg_len;
+
+        if (length < UDP_INGEST_SEQUENCE_SIZE || length > UDP_INGEST_MAX_DATAGRAM ||
+            addr->sin_family != AF_INET ||
+            (addr->sin_addr.s_addr & serverState->subnetMask) != serverState->networkAddr) {
+            ++serverState->stats.invalidDropped;
+            continue;
+        }
+
+        uint32_t sequence = ((uint32_t)datagram[0] << 24) | ((uint32_t)datagram[1] << 16) |
+                            ((uint32_t)datagram[2] << 8) | datagram[3];
+        UdpIngest_Source *source = FindSource(serverState, addr);
+        if (!AcceptSequence(source, addr, sequence)) {
+            ++serverState->stats.duplicatesDropped;
+            continue;
+        }
+
+        ++serverState->stats.datagramsAccepted;
+        SendPayloadToCloud(datagram + UDP_INGEST_SEQUENCE_SIZE,
+                           length - UDP_INGEST_SEQUENCE_SIZE);
+    }
+}
+
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType)
+{
+    int localFd = -1;
+    int retFd = -1;
+
+    do {
+        localFd = socket(AF_INET, sockType, /* protocol */ 0);
+        if (localFd < 0) {
+            ReportError("socket");
+            break;
+        }
+
+        // Enable rebinding soon after a socket has been closed.
+        int enableReuseAddr = 1;
+        int r = setsockopt(localFd, SOL_SOCKET, SO_REUSEADDR, &enableReuseAddr,
+                           sizeof(enableReuseAddr));
+        if (r != 0) {
+            ReportError("setsockopt/SO_REUSEADDR");
+            break;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ipAddr;
+        addr.sin_port = htons(port);
+
+        r = bind(localFd, (const struct sockaddr *)&addr, sizeof(addr));
+        if (r != 0) {
+            ReportError("bind");
+            break;
+        }
+
+        retFd = localFd;
+        localFd = -1;
+    } while (0);
+
+    close(localFd);
+
+    return retFd;
+}
+
+static void ReportError(const char *desc)
+{
+    Log_Debug("ERROR: UDP ingest server: \"%s\", errno=%d (%s)\n", desc, errno, strerror(errno));
+}
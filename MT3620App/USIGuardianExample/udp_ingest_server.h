@@ -0,0 +1,106 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "netinet/in.h"
+
+#include "epoll_timerfd_utilities.h"
+#include "sequence_window.h"
+
+/// <summary>Size of the big endian sequence number which starts each datagram.</summary>
+#define UDP_INGEST_SEQUENCE_SIZE 4
+
+/// <summary>Largest datagram which is accepted: an Ethernet frame's worth of UDP payload.
+/// Longer datagrams are truncated by the kernel and dropped.</summary>
+#define UDP_INGEST_MAX_DATAGRAM 1472
+
+/// <summary>Number of datagrams which one recvmmsg call receives at most.</summary>
+#define UDP_INGEST_BATCH_SIZE 8
+
+/// <summary>Number of sources whose sequence numbers are tracked. When the table is full, the
+/// least recently heard source makes way.</summary>
+#define UDP_INGEST_MAX_SOURCES 16
+
+/// <summary>
+/// Sequence numbers received from one source address and port.
+/// </summary>
+typedef struct {
+    /// <summary>Source address; 0 if the entry is unused.</summary>
+    in_addr_t addr;
+    /// <summary>Source port.</summary>
+    in_port_t port;
+    /// <summary>Sequence numbers received, and the time of the last datagram.</summary>
+    SequenceWindow sequences;
+} UdpIngest_Source;
+
+/// <summary>
+/// Counts of the datagrams handled by the server.
+/// </summary>
+typedef struct {
+    /// <summary>Number of recvmmsg calls which returned datagrams.</summary>
+    uint64_t batches;
+    /// <summary>Number of datagrams which were passed to the cloud.</summary>
+    uint64_t datagramsAccepted;
+    /// <summary>Number of datagrams whose sequence number had already been received.</summary>
+    uint64_t duplicatesDropped;
+    /// <summary>Number of datagrams which were too short or too long, or came from outside the
+    /// private network.</summary>
+    uint64_t invalidDropped;
+} UdpIngest_Stats;
+
+struct UdpIngest_Batch;
+
+/// <summary>
+/// <para>Bundles together state about an active UDP ingest server.</para>
+/// <para>This should be allocated with <see cref="UdpIngest_Start" /> and freed with
+/// <see cref="UdpIngest_ShutDown" />. The client should not directly modify member
+/// variables.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Epoll which is used to respond asynchronously to incoming datagrams.</summary>
+    int epollFd;
+    /// <summary>Socket which receives datagrams.</summary>
+    int socketFd;
+    /// <summary>Callback which is invoked when datagrams are received.</summary>
+    EventData socketEvent;
+    /// <summary>Address of the private network; datagrams from other sources are
+    /// dropped.</summary>
+    in_addr_t networkAddr;
+    /// <summary>Subnet mask of the private network.</summary>
+    in_addr_t subnetMask;
+    /// <summary>Sources whose sequence numbers are tracked.</summary>
+    UdpIngest_Source sources[UDP_INGEST_MAX_SOURCES];
+    /// <summary>Counts of the datagrams handled.</summary>
+    UdpIngest_Stats stats;
+    /// <summary>Descriptors and buffers for one recvmmsg call.</summary>
+    struct UdpIngest_Batch *batch;
+} UdpIngest_ServerState;
+
+/// <summary>
+/// <para>Open a UDP server which passes datagrams from the private network to the cloud. Each
+/// datagram starts with a big endian 32-bit sequence number, which is incremented for every
+/// datagram a sensor sends; a datagram whose number has already been received from the same
+/// address and port is dropped, so a sensor may send each reading more than once. A sequence
+/// number far below the highest received, or one which is not above it after a sensor has been
+/// silent for SEQUENCE_WINDOW_RESTART_GAP_MS, is taken as the sensor restarting.</para>
+/// <para>The rest of the datagram is sent to the cloud like a line from the TCP server if it is
+/// printable text, optionally terminated by "\r" or "\r\n", and as a binary message
+/// otherwise.</para>
+/// <param name="epollFd">Descriptor to epoll created with CreateEpollFd.</param>
+/// <param name="ipAddr">IP address of the private network interface.</param>
+/// <param name="subnetMask">Subnet mask of the private network. The socket is bound to all
+/// addresses, so datagrams which are broadcast to the subnet are received, and datagrams from
+/// outside the subnet are dropped.</param>
+/// <param name="port">UDP port to which the socket is bound.</param>
+/// <returns>Server state which is used to manage the server's resources, NULL on failure.
+/// Should be disposed with <see cref="UdpIngest_ShutDown" />.</returns>
+/// </summary>
+UdpIngest_ServerState *UdpIngest_Start(int epollFd, in_addr_t ipAddr, in_addr_t subnetMask,
+                                       uint16_t port);
+
+/// <summary>
+/// <para>Closes the socket and frees the server.</para>
+/// <param name="serverState">Server state allocated with <see cref="UdpIngest_Start" />.</param>
+/// </summary>
+void UdpIngest_ShutDown(UdpIngest_ServerState *serverState);
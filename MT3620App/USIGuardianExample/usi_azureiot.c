@@ -1,6 +1,9 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <pthread.h>
+#include <sys/eventfd.h>
+
 #include "usi_azureiot.h"
 
 
@@ -15,7 +18,6 @@ static bool iothubAuthenticated = false;
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
 	size_t payloadSize, void *userContextCallback);
-static void TwinReportString(const char *propertyName, const char *propertyString);
 static void TwinReportBoolState(const char *propertyName, bool propertyValue);
 static void ReportStatusCallback(int result, void *context);
 static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
@@ -39,7 +41,8 @@ static int ioTStatusLedGpioFd = -1;
 static bool statusLedOn = false;
 
 // Timer / polling
-static int azureTimerFd = -1;
+static void AzureTimerEventHandler(Timer *timer);
+static Timer azureTimer = { .timerHandler = &AzureTimerEventHandler };
 
 // Azure IoT poll periods
 static const int AzureIoTDefaultPollPeriodSeconds = 5;
@@ -48,10 +51,102 @@ static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60;
 
 static int azureIoTPollPeriodSeconds = -1;
 
-static void AzureTimerEventHandler(EventData *eventData);
+// Provisioning can block for up to 10 seconds, so the client is created on a worker thread,
+// which signals the event loop through an eventfd when it is done. Only one thread runs at a
+// time, and the event loop does not use the client handle until the thread has been joined.
+static void *ProvisioningThread(void *arg);
+static void ProvisioningEventHandler(EventData *eventData);
+static EventData provisioningEventData = { .eventHandler = &ProvisioningEventHandler };
+static int provisioningEventFd = -1;
+static pthread_t provisioningThread;
+static bool provisioningInProgress = false;
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE provisionedClientHandle = NULL;
+static AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult;
+
+// DoWork runs soon after a message or reported property is queued, and again, with a growing
+// delay, while the client still has items to send or confirmations to receive. Once it is idle
+// only the Azure timer runs DoWork, which keeps the connection alive and receives twin updates.
+static void DoWorkTimerEventHandler(Timer *timer);
+static void ScheduleDoWork(void);
+static void RunDoWork(void);
+static Timer doWorkTimer = { .timerHandler = &DoWorkTimerEventHandler };
+static const uint32_t DoWorkSoonMs = 10;
+static const uint32_t DoWorkBusyMinMs = 20;
+static const uint32_t DoWorkBusyMaxMs = 1000;
+static uint32_t doWorkBusyDelayMs = 20;
+static uint64_t doWorkDueMs = 0;
+static int pendingConfirmations = 0;
+
+// Times at which items were queued since the last DoWork, for the latency histogram.
+#define MAX_QUEUED_TIMES 32
+static uint64_t queuedTimesMs[MAX_QUEUED_TIMES];
+static size_t queuedTimesCount = 0;
+static AzureDoWorkStats doWorkStats;
 
 static char *sendToCloudPropertyName = "sendToCloud";
-static char *sendToDevicePropertyName = "sendToDevice";
+
+// Lines from the serial ports and the private Ethernet servers, and the simulated temperature,
+// are packed into batches of telemetry records. A batch is sent when it reaches 4 KB, which IoT
+// Hub counts as one message, or after a time which grows as the message budget runs low; when
+// it is nearly spent, only some of the records are kept.
+static int SendTelemetryBatch(const char *message, size_t length, size_t recordCount,
+	void *context);
+static void UpdateTelemetryPolicy(void);
+static TelemetryBatcher telemetryBatcher;
+// IoT Hub counts a message's system properties, as well as its body, towards the 4 KB of a
+// message unit, so a batch is that much shorter. They are sent over MQTT as $.ct and $.ce.
+#define BATCH_CONTENT_TYPE "application/json"
+#define BATCH_CONTENT_ENCODING "utf-8"
+#define BATCH_PROPERTY_BYTES (sizeof("$.ct" BATCH_CONTENT_TYPE "$.ce" BATCH_CONTENT_ENCODING) - 1)
+#define BATCH_MAX_BYTES (TELEMETRY_BUDGET_UNIT_BYTES - BATCH_PROPERTY_BYTES)
+static const TelemetryBatcherConfig TelemetryBatchPolicies[] = {
+	[TelemetryBudget_Level_Normal] = {
+		.maxBytes = BATCH_MAX_BYTES, .maxRecords = 256, .maxAgeMs = 2000, .sampleInterval = 1 },
+	[TelemetryBudget_Level_Low] = {
+		.maxBytes = BATCH_MAX_BYTES, .maxRecords = 256, .maxAgeMs = 30000, .sampleInterval = 1 },
+	[TelemetryBudget_Level_Critical] = {
+		.maxBytes = BATCH_MAX_BYTES, .maxRecords = 256, .maxAgeMs = 300000, .sampleInterval = 4 },
+	[TelemetryBudget_Level_Exhausted] = {
+		.maxBytes = BATCH_MAX_BYTES, .maxRecords = 256, .maxAgeMs = 300000, .sampleInterval = 16 } };
+static TelemetryBudget_Level telemetryBudgetLevel = TelemetryBudget_Level_Normal;
+
+// Every message to IoT Hub is charged to this device's share of the hub's daily quota, here the
+// free tier's 8000 units; an S1 hub allows 400000 units per day for each of its units. The
+// bucket holds an hour's worth, so a burst cannot spend the day's quota.
+static TelemetryBudget telemetryBudget;
+static const uint32_t TelemetryDailyUnits = 8000;
+static const uint32_t TelemetryBurstUnits = 8000 / 24;
+
+// Every batch is appended to a log in the app's mutable storage and sent from there, in order,
+// and only removed once IoT Hub has confirmed it, so a batch which fails, or which is not
+// confirmed before a reboot, is sent again. After an outage the backlog is sent a few batches
+// at a time. The daily write budget bounds the flash wear; once it is spent, batches are sent
+// without being stored.
+static void TelemetryDrainTimerEventHandler(Timer *timer);
+static void DrainTelemetryStore(int maxBatches);
+static Timer telemetryDrainTimer = { .timerHandler = &TelemetryDrainTimerEventHandler };
+static StoreForward telemetryStore = { .fd = -1 };
+
+// Desired properties which were applied, so a twin which is delivered again after a reconnect
+// or restart does not apply them again. The state follows the telemetry log in mutable storage.
+static TwinState twinState = { .fd = -1 };
+static const uint32_t TelemetryStoreDailyWriteBytes = 512 * 1024;
+static const int TelemetryDrainPeriodMs = 1000;
+static const int TelemetryDrainBatchesPerPeriod = 2;
+static const int TelemetryDrainMaxInFlight = 4;
+static int telemetryDrainInFlight = 0;
+
+// Set while the app shuts down. The IoT Hub client is destroyed without sending what it was
+// handed, so the last batch is only stored, to be sent after the next start.
+static bool shutdownInProgress = false;
+
+// Reported properties are merged by name and sent as one patch at most every 2 seconds, since
+// IoT Hub throttles twin updates for each device. A patch which fails is sent again, with the
+// latest values, after a delay which doubles up to a minute.
+static int SendReportedPatch(const char *patch, size_t length, void *context);
+static ReportedProperties reportedProperties;
+static const ReportedPropertiesConfig ReportedPropertiesPolicy = {
+	.coalesceMs = 100, .minIntervalMs = 2000, .maxRetryMs = 60000 };
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -92,13 +187,8 @@ void USIAzureIoT_Deinit() {
 /// <summary>
 /// Azure timer event:  Check connection status and send telemetry
 /// </summary>
-static void AzureTimerEventHandler(EventData *eventData)
+static void AzureTimerEventHandler(Timer *timer)
 {
-	if (ConsumeTimerFdEvent(azureTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
 	bool isNetworkReady = false;
 	if (Networking_IsNetworkingReady(&isNetworkReady) != -1) {
 		if (!isNetworkReady) {
@@ -119,16 +209,13 @@ static void AzureTimerEventHandler(EventData *eventData)
 
 	if (iothubAuthenticated) {
 		SendSimulatedTemperature();
-		IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+		RunDoWork();
 	}
 	else {
 		GPIO_SetValue(ioTStatusLedGpioFd, GPIO_Value_High);
 	}
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData azureEventData = { .eventHandler = &AzureTimerEventHandler };
-
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
 /// </summary>
@@ -158,11 +245,49 @@ static int InitPeripheralsAndHandlers(void)
 		return -1;
 	}
 
+	TelemetryBudget_Init(&telemetryBudget, TelemetryDailyUnits, TelemetryBurstUnits);
+	telemetryBudgetLevel = TelemetryBudget_Level_Normal;
+	TelemetryBatcher_Init(&telemetryBatcher, &TelemetryBatchPolicies[telemetryBudgetLevel],
+		SendTelemetryBatch, NULL);
+	ReportedProperties_Init(&reportedProperties, &ReportedPropertiesPolicy, SendReportedPatch, NULL);
+
+	// Without the log, batches which cannot be sent are dropped, and the twin state is only kept
+	// in memory.
+	int storeFd = Storage_OpenMutableFile();
+	if (TwinState_Open(&twinState, storeFd < 0 ? -1 : dup(storeFd), STORE_FORWARD_FILE_SIZE) == 0) {
+		Log_Debug("INFO: Loaded the state of desired properties version %llu.\n",
+			(unsigned long long)twinState.version);
+	}
+	if (storeFd < 0) {
+		Log_Debug("WARNING: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+	}
+	else if (StoreForward_Open(&telemetryStore, storeFd, TelemetryStoreDailyWriteBytes) != 0) {
+		Log_Debug("WARNING: Could not recover the telemetry log: %s (%d).\n", strerror(errno), errno);
+		close(storeFd);
+		telemetryStore.fd = -1;
+	}
+	else {
+		Log_Debug("INFO: Telemetry log holds %u undelivered batches.\n",
+			telemetryStore.nextSequence - telemetryStore.readPosition.sequence);
+		struct timespec drainPeriod = { 0, TelemetryDrainPeriodMs * 1000000L };
+		if (SetTimerToPeriod(&telemetryDrainTimer, &drainPeriod) != 0) {
+			return -1;
+		}
+	}
+
+	provisioningEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (provisioningEventFd < 0) {
+		Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+	if (RegisterEventHandlerToEpoll(epollFd, provisioningEventFd, &provisioningEventData,
+		EPOLLIN) != 0) {
+		return -1;
+	}
+
 	azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
 	struct timespec azureTelemetryPeriod = { azureIoTPollPeriodSeconds, 0 };
-	azureTimerFd =
-		CreateTimerFdAndAddToEpoll(epollFd, &azureTelemetryPeriod, &azureEventData, EPOLLIN);
-	if (azureTimerFd < 0) {
+	if (SetTimerToPeriod(&azureTimer, &azureTelemetryPeriod) != 0) {
 		return -1;
 	}
 
@@ -186,7 +311,66 @@ static void ClosePeripheralsAndHandlers(void)
 		GPIO_SetValue(ioTStatusLedGpioFd, GPIO_Value_High);
 	}
 
-	CloseFdAndPrintError(azureTimerFd, "AzureTimer");
+	// Append the last batch to the telemetry log before it is closed.
+	shutdownInProgress = true;
+	TelemetryBatcher_Flush(&telemetryBatcher);
+	const TelemetryBatcherStats *stats = &telemetryBatcher.stats;
+	Log_Debug("INFO: Sent %llu telemetry records in %llu messages, %llu messages failed, %llu "
+		"records dropped, %llu sampled out.\n", (unsigned long long)stats->recordsAdded,
+		(unsigned long long)stats->messagesSent, (unsigned long long)stats->messagesFailed,
+		(unsigned long long)stats->recordsDropped, (unsigned long long)stats->recordsSampledOut);
+	const TelemetryBudgetStats *budgetStats = &telemetryBudget.stats;
+	Log_Debug("INFO: Used %llu messages, %llu bytes and %llu units of the budget; %llu messages "
+		"refused.\n", (unsigned long long)budgetStats->messages,
+		(unsigned long long)budgetStats->bytes, (unsigned long long)budgetStats->units,
+		(unsigned long long)budgetStats->messagesRefused);
+
+	DisarmTimer(&doWorkTimer);
+	Log_Debug("INFO: Called DoWork %llu times for %llu queued items, which waited up to %u ms:\n",
+		(unsigned long long)doWorkStats.doWorkCalls,
+		(unsigned long long)doWorkStats.messagesQueued, doWorkStats.maxLatencyMs);
+	for (int i = 0; i < USI_AZUREIOT_LATENCY_BUCKETS; ++i) {
+		if (doWorkStats.latencyMs[i] != 0) {
+			Log_Debug("INFO:   %s %5u ms: %llu\n", i == USI_AZUREIOT_LATENCY_BUCKETS - 1 ? ">=" : " <",
+				i == USI_AZUREIOT_LATENCY_BUCKETS - 1 ? 1u << (i - 1) : 1u << i,
+				(unsigned long long)doWorkStats.latencyMs[i]);
+		}
+	}
+
+	DisarmTimer(&telemetryDrainTimer);
+	if (telemetryStore.fd >= 0) {
+		const StoreForwardStats *storeStats = &telemetryStore.stats;
+		Log_Debug("INFO: Stored %llu telemetry batches, delivered %llu, refused %llu, lost %llu; "
+			"wrote %llu bytes and %llu checkpoints.\n",
+			(unsigned long long)storeStats->recordsAppended,
+			(unsigned long long)storeStats->recordsDelivered,
+			(unsigned long long)storeStats->recordsRefused,
+			(unsigned long long)storeStats->recordsLost,
+			(unsigned long long)storeStats->bytesWritten,
+			(unsigned long long)storeStats->checkpointsWritten);
+		StoreForward_Close(&telemetryStore);
+	}
+	TwinState_Close(&twinState);
+	ReportedProperties_Stop(&reportedProperties);
+
+	DisarmTimer(&azureTimer);
+
+	// Wait for a provisioning attempt which is still running, so its client can be destroyed.
+	if (provisioningInProgress) {
+		Log_Debug("INFO: Waiting for provisioning to finish\n");
+		pthread_join(provisioningThread, NULL);
+		provisioningInProgress = false;
+		if (provisionedClientHandle != NULL) {
+			IoTHubDeviceClient_LL_Destroy(provisionedClientHandle);
+			provisionedClientHandle = NULL;
+		}
+	}
+	if (provisioningEventFd >= 0) {
+		UnregisterEventHandlerFromEpoll(epollFd, provisioningEventFd);
+		CloseFdAndPrintError(provisioningEventFd, "ProvisioningEvent");
+		provisioningEventFd = -1;
+	}
+
 	CloseFdAndPrintError(deviceTwinStatusLedGpioFd, "StatusLed");
 	CloseFdAndPrintError(ioTStatusLedGpioFd, "IoTStatusLed");
 }
@@ -207,15 +391,67 @@ static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
 ///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
 ///     When the SAS Token for a device expires the connection needs to be recreated
 ///     which is why this is not simply a one time call.
+///     The client is created on a worker thread; ProvisioningEventHandler finishes the setup.
 /// </summary>
 static void SetupAzureClient(void)
 {
+	if (provisioningInProgress) {
+		return;
+	}
+
 	if (iothubClientHandle != NULL)
 		IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+	iothubClientHandle = NULL;
+	pendingConfirmations = 0;
+	// A patch which was in flight was lost with the client, so it is sent to the new one.
+	ReportedProperties_Complete(&reportedProperties, false);
+	queuedTimesCount = 0;
+	DisarmTimer(&doWorkTimer);
+
+	provisionedClientHandle = NULL;
+	int result = pthread_create(&provisioningThread, NULL, ProvisioningThread, NULL);
+	if (result != 0) {
+		Log_Debug("ERROR: Could not start the provisioning thread: %s (%d).\n", strerror(result),
+			result);
+		return;
+	}
+	provisioningInProgress = true;
+}
 
-	AZURE_SPHERE_PROV_RETURN_VALUE provResult =
-		IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 10000,
-			&iothubClientHandle);
+/// <summary>
+///     Provisioning thread: creates the IoT Hub client, which may block for up to 10 seconds,
+///     and signals the event loop. It touches nothing else.
+/// </summary>
+static void *ProvisioningThread(void *arg)
+{
+	provisioningResult = IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(
+		scopeId, 10000, &provisionedClientHandle);
+
+	uint64_t done = 1;
+	if (write(provisioningEventFd, &done, sizeof(done)) != sizeof(done)) {
+		// The event loop would never join this thread; there is nothing better to do.
+		abort();
+	}
+	return NULL;
+}
+
+/// <summary>
+///     Provisioning event: joins the provisioning thread and takes over the client it created,
+///     or backs off before the next attempt.
+/// </summary>
+static void ProvisioningEventHandler(EventData *eventData)
+{
+	uint64_t count;
+	if (read(provisioningEventFd, &count, sizeof(count)) != sizeof(count) ||
+		!provisioningInProgress) {
+		return;
+	}
+	pthread_join(provisioningThread, NULL);
+	provisioningInProgress = false;
+
+	AZURE_SPHERE_PROV_RETURN_VALUE provResult = provisioningResult;
+	iothubClientHandle = provisionedClientHandle;
+	provisionedClientHandle = NULL;
 	Log_Debug("IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.\n",
 		getAzureSphereProvisioningResultString(provResult));
 
@@ -235,7 +471,7 @@ static void SetupAzureClient(void)
 		}
 
 		struct timespec azureTelemetryPeriod = { azureIoTPollPeriodSeconds, 0 };
-		SetTimerFdToPeriod(azureTimerFd, &azureTelemetryPeriod);
+		SetTimerToPeriod(&azureTimer, &azureTelemetryPeriod);
 
 		Log_Debug("ERROR: failure to create IoTHub Handle - will retry in %i seconds.\n",
 			azureIoTPollPeriodSeconds);
@@ -245,7 +481,7 @@ static void SetupAzureClient(void)
 	// Successfully connected, so make sure the polling frequency is back to the default
 	azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
 	struct timespec azureTelemetryPeriod = { azureIoTPollPeriodSeconds, 0 };
-	SetTimerFdToPeriod(azureTimerFd, &azureTelemetryPeriod);
+	SetTimerToPeriod(&azureTimer, &azureTelemetryPeriod);
 
 	iothubAuthenticated = true;
 
@@ -260,66 +496,223 @@ static void SetupAzureClient(void)
 		HubConnectionStatusCallback, NULL);
 }
 
+/// <summary>
+///     Desired property StatusLED.value: turns the status LED on or off.
+/// </summary>
+/// <returns>0 on success, or -1 if the value is not a boolean or the LED could not be
+/// set</returns>
+static int HandleStatusLedValue(const TwinParserValue *value)
+{
+	bool isOn;
+	if (TwinParser_GetBool(value, &isOn) != 0) {
+		Log_Debug("WARNING: StatusLED.value is not a boolean.\n");
+		return -1;
+	}
+	if (GPIO_SetValue(deviceTwinStatusLedGpioFd,
+		(isOn == true ? GPIO_Value_Low : GPIO_Value_High)) != 0) {
+		Log_Debug("ERROR: Could not set the status LED: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+	statusLedOn = isOn;
+	TwinReportBoolState("StatusLED", statusLedOn);
+	return 0;
+}
+
+/// <summary>
+///     Members of the desired property sendToDevice.
+/// </summary>
+typedef struct {
+	bool hasValue;
+	bool hasClient;
+	uint32_t client;
+} SendToDeviceRequest;
+
+// Longest message which can be sent to the devices; the twin itself allows up to 4 KB per value.
+#define MAX_SEND_TO_DEVICE_LENGTH 1024
+static char sendToDeviceText[MAX_SEND_TO_DEVICE_LENGTH + 1];
+
+static void HandleSendToDeviceValue(const TwinParserValue *value, void *context)
+{
+	SendToDeviceRequest *request = context;
+	request->hasValue =
+		TwinParser_CopyString(value, sendToDeviceText, sizeof(sendToDeviceText)) >= 0;
+	if (!request->hasValue) {
+		Log_Debug("WARNING: sendToDevice.value is not a string of at most %d bytes.\n",
+			MAX_SEND_TO_DEVICE_LENGTH);
+	}
+}
+
+static void HandleSendToDeviceClient(const TwinParserValue *value, void *context)
+{
+	SendToDeviceRequest *request = context;
+	uint64_t client;
+	request->hasClient = TwinParser_GetUint(value, &client) == 0 && client <= UINT32_MAX;
+	request->client = (uint32_t)client;
+}
+
+// True while the desired properties of a whole twin are applied, rather than those of a patch.
+static bool isApplyingFullTwin = false;
+
+/// <summary>
+///     Desired property sendToDevice: sends its value to the serial ports and the TCP clients.
+///     The message is sent at most once: it is not sent again to the destinations which did
+///     not take it, which are reported in the reported property sendToDeviceFailed instead. A
+///     message for one TCP client is only sent from a patch, because the whole twin may carry a
+///     connection ID from before the app restarted, which may now belong to another client.
+/// </summary>
+/// <returns>0 once the message has been offered to its destinations, or -1 if the value is not
+/// valid</returns>
+static int HandleSendToDevice(const TwinParserValue *value)
+{
+	if (value->type != TwinParser_Type_Object) {
+		return -1;
+	}
+	SendToDeviceRequest request = { 0 };
+	const TwinParserPath requestPaths[] = {
+		{ .path = "value", .handler = HandleSendToDeviceValue, .context = &request },
+		{ .path = "client", .handler = HandleSendToDeviceClient, .context = &request } };
+	TwinParser_Parse(value->text, value->length, NULL, requestPaths,
+		sizeof(requestPaths) / sizeof(requestPaths[0]));
+	if (!request.hasValue) {
+		return -1;
+	}
+
+	// A comma separated list of the destinations which did not take the message, or empty.
+	char failed[REPORTED_PROPERTIES_MAX_STRING + 1] = "";
+#if (defined(BUILD_USI_SERIAL))
+	if (USISerial_SendFromCloud(sendToDeviceText) != 0) {
+		strcat(failed, "serial");
+	}
+#endif
+#if (defined(BUILD_USI_PRIVATE_ETHERNET))
+	// An optional "client" selects one TCP client by its connection ID; without it, every
+	// client receives the message.
+	if (request.hasClient) {
+		if (isApplyingFullTwin ||
+			USIPrivateEthernet_SendMsgToClient(request.client, sendToDeviceText) != 0) {
+			size_t length = strlen(failed);
+			snprintf(failed + length, sizeof(failed) - length, "%sclient %lu",
+				length > 0 ? "," : "", (unsigned long)request.client);
+		}
+	}
+	else {
+		USIPrivateEthernet_SendMsg(sendToDeviceText);
+	}
+#endif
+	if (failed[0] != '\0') {
+		Log_Debug("WARNING: sendToDevice was not delivered to %s.\n", failed);
+	}
+	ReportedProperties_SetString(&reportedProperties, "sendToDeviceFailed", failed);
+	return 0;
+}
+
+/// <summary>
+///     Function signature for functions which apply the value of a desired property.
+/// </summary>
+/// <returns>0 on success, or -1 if the value was not applied and must be applied again when
+/// the twin is next delivered</returns>
+typedef int (*DesiredPropertyHandler)(const TwinParserValue *value);
+
+/// <summary>
+///     A desired property which the app handles.
+/// </summary>
+typedef struct {
+	/// <summary>Path of the value under the desired properties.</summary>
+	const char *path;
+	/// <summary>Function which applies the value.</summary>
+	DesiredPropertyHandler apply;
+	/// <summary>True if the effect outlives the app, so the property is not applied again after
+	/// a restart unless it has changed.</summary>
+	bool isPersistent;
+} DesiredProperty;
+
+// Desired properties which the app handles. Other properties are skipped without being copied.
+// The status LED is reset when the app starts, so it is applied once after every restart; a
+// message for the devices is only sent again when it changes.
+static const DesiredProperty DesiredProperties[] = {
+	{ .path = "StatusLED.value", .apply = HandleStatusLedValue, .isPersistent = false },
+	{ .path = "sendToDevice", .apply = HandleSendToDevice, .isPersistent = true } };
+#define DESIRED_PROPERTY_COUNT (sizeof(DesiredProperties) / sizeof(DesiredProperties[0]))
+
+static void CollectValue(const TwinParserValue *value, void *context)
+{
+	*(TwinParserValue *)context = *value;
+}
+
 /// <summary>
 ///     Callback invoked when a Device Twin update is received from IoT Hub.
-///     Updates local state for 'showEvents' (bool).
+///     Applies the desired properties in DesiredProperties which have changed since they were
+///     last applied, parsing the payload in place. A patch which is no newer than the applied
+///     state is ignored.
 /// </summary>
+/// <param name="updateState">DEVICE_TWIN_UPDATE_COMPLETE for the whole twin, whose desired
+/// properties are under "desired", or DEVICE_TWIN_UPDATE_PARTIAL for a patch of desired
+/// properties</param>
 /// <param name="payload">contains the Device Twin JSON document (desired and reported)</param>
 /// <param name="payloadSize">size of the Device Twin JSON document</param>
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
 	size_t payloadSize, void *userContextCallback)
 {
-	size_t nullTerminatedJsonSize = payloadSize + 1;
-	char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-	if (nullTerminatedJsonString == NULL) {
-		Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-		abort();
+	// $version comes last, so the values are collected first and applied after it is known.
+	TwinParserValue values[DESIRED_PROPERTY_COUNT + 1];
+	TwinParserPath paths[DESIRED_PROPERTY_COUNT + 1];
+	for (size_t i = 0; i <= DESIRED_PROPERTY_COUNT; ++i) {
+		values[i].text = NULL;
+		paths[i].path = (i < DESIRED_PROPERTY_COUNT) ? DesiredProperties[i].path : "$version";
+		paths[i].handler = CollectValue;
+		paths[i].context = &values[i];
 	}
 
-	// Copy the provided buffer to a null terminated buffer.
-	memcpy(nullTerminatedJsonString, payload, payloadSize);
-	// Add the null terminator at the end.
-	nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
-
-	JSON_Value *rootProperties = NULL;
-	rootProperties = json_parse_string(nullTerminatedJsonString);
-	if (rootProperties == NULL) {
+	isApplyingFullTwin = updateState == DEVICE_TWIN_UPDATE_COMPLETE;
+	const char *prefix = isApplyingFullTwin ? "desired" : NULL;
+	if (TwinParser_Parse((const char *)payload, payloadSize, prefix, paths,
+		DESIRED_PROPERTY_COUNT + 1) != 0) {
 		Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-		goto cleanup;
+		return;
 	}
 
-	JSON_Object *rootObject = json_value_get_object(rootProperties);
-	JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
-	if (desiredProperties == NULL) {
-		desiredProperties = rootObject;
+	uint64_t version = 0;
+	bool hasVersion = values[DESIRED_PROPERTY_COUNT].text != NULL &&
+		TwinParser_GetUint(&values[DESIRED_PROPERTY_COUNT], &version) == 0;
+	if (updateState == DEVICE_TWIN_UPDATE_PARTIAL && hasVersion &&
+		TwinState_IsStale(&twinState, version)) {
+		Log_Debug("INFO: Ignored desired properties version %llu, which is not newer than %llu.\n",
+			(unsigned long long)version, (unsigned long long)twinState.version);
+		return;
 	}
 
-	// Handle the Device Twin Desired Properties here.
-	JSON_Object *LEDState = json_object_dotget_object(desiredProperties, "StatusLED");
-	if (LEDState != NULL) {
-		statusLedOn = (bool)json_object_get_boolean(LEDState, "value");
-		GPIO_SetValue(deviceTwinStatusLedGpioFd,
-			(statusLedOn == true ? GPIO_Value_Low : GPIO_Value_High));
-		TwinReportBoolState("StatusLED", statusLedOn);
+	// A value is only recorded as applied once it has been applied successfully, so one which
+	// failed is applied again when the whole twin is delivered after the next reconnect.
+	int appliedCount = 0;
+	int unchangedCount = 0;
+	int failedCount = 0;
+	for (size_t i = 0; i < DESIRED_PROPERTY_COUNT; ++i) {
+		const DesiredProperty *property = &DesiredProperties[i];
+		if (values[i].text == NULL) {
+			continue;
+		}
+		if (!TwinState_IsChanged(&twinState, property->path, values[i].text, values[i].length)) {
+			++unchangedCount;
+		}
+		else if (property->apply(&values[i]) != 0) {
+			Log_Debug("WARNING: Could not apply desired property %s.\n", property->path);
+			++failedCount;
+		}
+		else {
+			TwinState_Commit(&twinState, property->path, values[i].text, values[i].length,
+				property->isPersistent);
+			++appliedCount;
+		}
 	}
-
-	JSON_Object *SendMsgToDevice = json_object_dotget_object(desiredProperties, sendToDevicePropertyName);
-	if (SendMsgToDevice != NULL) {
-#if (defined(BUILD_USI_UART))
-		USIUart_SendUartMsg(json_object_get_string(SendMsgToDevice, "value"));
-#endif
-#if (defined(BUILD_USI_RS232_485))
-		USIRs_SendRs232Or485Msg(json_object_get_string(SendMsgToDevice, "value"));
-#endif
-#if (defined(BUILD_USI_PRIVATE_ETHERNET))
-		USIPrivateEthernet_SendMsg(json_object_get_string(SendMsgToDevice, "value"));
-#endif
+	if (hasVersion) {
+		TwinState_SetVersion(&twinState, version);
 	}
-
-cleanup:
-	// Release the allocated memory.
-	json_value_free(rootProperties);
-	free(nullTerminatedJsonString);
+	if (TwinState_Save(&twinState) != 0) {
+		Log_Debug("WARNING: Could not save the state of desired properties: %s (%d).\n",
+			strerror(errno), errno);
+	}
+	Log_Debug("INFO: Desired properties version %llu: %d applied, %d unchanged, %d failed.\n",
+		(unsigned long long)version, appliedCount, unchangedCount, failedCount);
 }
 
 /// <summary>
@@ -379,36 +772,164 @@ static const char *getAzureSphereProvisioningResultString(
 }
 
 /// <summary>
-///     Sends telemetry to IoT Hub
+///     Hands a telemetry message to the IoT Hub client, if the message budget allows it, and
+///     destroys it
 /// </summary>
-/// <param name="key">The telemetry item to update</param>
-/// <param name="value">new telemetry value</param>
-static void SendTelemetry(const unsigned char *key, const unsigned char *value)
+/// <param name="messageHandle">The message</param>
+/// <param name="length">Size of the message body and its properties, which sets its cost in
+/// message units</param>
+/// <param name="context">Passed to SendMessageCallback: the sequence number of a batch from the
+/// telemetry log, or NULL</param>
+/// <returns>0 if the client accepted the message for delivery, or -1 otherwise</returns>
+static int SendMessageHandle(IOTHUB_MESSAGE_HANDLE messageHandle, size_t length, void *context)
 {
-	static char eventBuffer[100] = { 0 };
-	static const char *EventMsgTemplate = "{ \"%s\": \"%s\" }";
-	int len = snprintf(eventBuffer, sizeof(eventBuffer), EventMsgTemplate, key, value);
-	if (len < 0)
-		return;
-
-	Log_Debug("Sending IoT Hub Message: %s\n", eventBuffer);
+	int result = 0;
+	if (!TelemetryBudget_TryConsume(&telemetryBudget, length)) {
+		Log_Debug("WARNING: message budget exhausted, dropped a message of %zu bytes\n", length);
+		result = -1;
+	}
+	else if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
+		context) != IOTHUB_CLIENT_OK) {
+		Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
+		result = -1;
+	}
+	else {
+		Log_Debug("INFO: IoTHubClient accepted the message for delivery\n");
+		++pendingConfirmations;
+		ScheduleDoWork();
+	}
 
-	IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(eventBuffer);
+	IoTHubMessage_Destroy(messageHandle);
+	return result;
+}
 
+/// <summary>
+///     Sends a JSON batch of telemetry records to IoT Hub
+/// </summary>
+/// <param name="message">The batch, which need not be null terminated</param>
+/// <param name="length">Length of the batch</param>
+/// <param name="context">Passed to SendMessageCallback</param>
+/// <returns>0 if the client accepted the message for delivery, or -1 otherwise</returns>
+static int SendBatchMessage(const char *message, size_t length, void *context)
+{
+	IOTHUB_MESSAGE_HANDLE messageHandle =
+		IoTHubMessage_CreateFromByteArray((const unsigned char *)message, length);
 	if (messageHandle == 0) {
 		Log_Debug("WARNING: unable to create a new IoTHubMessage\n");
+		return -1;
+	}
+	// Let IoT Hub message routing query the records.
+	IoTHubMessage_SetContentTypeSystemProperty(messageHandle, BATCH_CONTENT_TYPE);
+	IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, BATCH_CONTENT_ENCODING);
+
+	return SendMessageHandle(messageHandle, length + BATCH_PROPERTY_BYTES, context);
+}
+
+/// <summary>
+///     Appends a batch of telemetry records to the telemetry log and sends the oldest batch
+///     which waits in it, or sends the batch to IoT Hub as one JSON message if it cannot be
+///     stored
+/// </summary>
+/// <param name="message">The batch</param>
+/// <param name="length">Length of the batch</param>
+/// <param name="recordCount">Number of records in the batch</param>
+/// <param name="context">Not used</param>
+/// <returns>0 if the batch was stored or accepted for delivery, or -1 otherwise</returns>
+static int SendTelemetryBatch(const char *message, size_t length, size_t recordCount,
+	void *context)
+{
+	if (telemetryStore.fd >= 0) {
+		if (StoreForward_Append(&telemetryStore, message, length) == 0) {
+			if (!shutdownInProgress) {
+				DrainTelemetryStore(1);
+			}
+			return 0;
+		}
+		Log_Debug("WARNING: could not store %zu telemetry records: %s (%d)\n", recordCount,
+			strerror(errno), errno);
+	}
+
+	if (shutdownInProgress) {
+		Log_Debug("ERROR: shutting down, dropped %zu telemetry records\n", recordCount);
+		return -1;
+	}
+	if (iothubClientHandle == NULL || !iothubAuthenticated) {
+		Log_Debug("ERROR: client not connected, dropped %zu telemetry records\n", recordCount);
+		return -1;
+	}
+	Log_Debug("Sending IoT Hub Message: %zu telemetry records, %zu bytes\n", recordCount,
+		length);
+	return SendBatchMessage(message, length, NULL);
+}
+
+/// <summary>
+///     Sends the oldest batches from the telemetry log which are not waiting for IoT Hub to
+///     confirm them, keeping at most TelemetryDrainMaxInFlight of them unconfirmed
+/// </summary>
+/// <param name="maxBatches">Largest number of batches to send</param>
+static void DrainTelemetryStore(int maxBatches)
+{
+	if (telemetryStore.fd < 0 || iothubClientHandle == NULL || !iothubAuthenticated) {
 		return;
 	}
 
-	if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-		/*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
-		Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
+	static char batch[STORE_FORWARD_MAX_RECORD];
+	int sent = 0;
+	while (sent < maxBatches && telemetryDrainInFlight < TelemetryDrainMaxInFlight) {
+		size_t length;
+		uint32_t sequence;
+		if (StoreForward_ReadNext(&telemetryStore, batch, sizeof(batch), &length, &sequence) != 0) {
+			break;
+		}
+		if (SendBatchMessage(batch, length, (void *)(uintptr_t)sequence) != 0) {
+			// Try again at the next period; the budget may have refilled by then.
+			StoreForward_Rewind(&telemetryStore, sequence);
+			break;
+		}
+		++telemetryDrainInFlight;
+		++sent;
 	}
-	else {
-		Log_Debug("INFO: IoTHubClient accepted the message for delivery\n");
+
+	if (sent > 0) {
+		Log_Debug("INFO: Sent %d telemetry batches from the log\n", sent);
 	}
+}
 
-	IoTHubMessage_Destroy(messageHandle);
+/// <summary>
+///     Telemetry drain timer event: sends a few of the batches which wait in the telemetry log
+/// </summary>
+static void TelemetryDrainTimerEventHandler(Timer *timer)
+{
+	DrainTelemetryStore(TelemetryDrainBatchesPerPeriod);
+}
+
+/// <summary>
+///     Packs and samples telemetry records as hard as the message budget left requires
+/// </summary>
+static void UpdateTelemetryPolicy(void)
+{
+	TelemetryBudget_Level level = TelemetryBudget_GetLevel(&telemetryBudget);
+	if (level == telemetryBudgetLevel) {
+		return;
+	}
+
+	static const char *const LevelNames[] = { "normal", "low", "critical", "exhausted" };
+	Log_Debug("INFO: Message budget is %s: batches wait up to %u ms, 1 in %u records kept\n",
+		LevelNames[level], TelemetryBatchPolicies[level].maxAgeMs,
+		TelemetryBatchPolicies[level].sampleInterval);
+	telemetryBudgetLevel = level;
+	TelemetryBatcher_SetConfig(&telemetryBatcher, &TelemetryBatchPolicies[level]);
+}
+
+/// <summary>
+///     Adds a telemetry record to the batch which is sent to IoT Hub
+/// </summary>
+/// <param name="key">The telemetry item to update</param>
+/// <param name="value">new telemetry value</param>
+static void SendTelemetry(const unsigned char *key, const unsigned char *value)
+{
+	UpdateTelemetryPolicy();
+	TelemetryBatcher_AddString(&telemetryBatcher, (const char *)key, (const char *)value);
 }
 
 /// <summary>
@@ -419,67 +940,155 @@ static void SendTelemetry(const unsigned char *key, const unsigned char *value)
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
 	Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
-}
-
-static void TwinReportString(const char *propertyName, const char *propertyString)
-{
-	if (iothubClientHandle == NULL) {
-		Log_Debug("ERROR: client not initialized\n");
-	}
-	else {
-		static char reportedPropertiesString[512] = { 0 };
-		int len = snprintf(reportedPropertiesString, 512, "{\"%s\":\"%s\"}", propertyName, propertyString, 0);
-		if (len < 0)
-			return;
-
-		if (IoTHubDeviceClient_LL_SendReportedState(
-			iothubClientHandle, (unsigned char *)reportedPropertiesString,
-			strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-			Log_Debug("ERROR: failed to set reported string for '%s'.\n", reportedPropertiesString);
+	--pendingConfirmations;
+
+	// A batch from the telemetry log is only removed from it once IoT Hub has confirmed it,
+	// and the batches before it have been removed; otherwise it is sent again.
+	if (context != NULL) {
+		--telemetryDrainInFlight;
+		uint32_t sequence = (uint32_t)(uintptr_t)context;
+		if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+			StoreForward_Acknowledge(&telemetryStore, sequence);
 		}
 		else {
-			Log_Debug("INFO: Reported string is '%s'.\n", reportedPropertiesString);
+			StoreForward_Rewind(&telemetryStore, sequence);
 		}
 	}
 }
 
 /// <summary>
-///     Creates and enqueues a report containing the name and value pair of a Device Twin reported
-///     property. The report is not sent immediately, but it is sent on the next invocation of
-///     IoTHubDeviceClient_LL_DoWork().
+///     Sets a Device Twin reported property. Properties are merged and sent as one patch by
+///     SendReportedPatch, so only the latest value of a property which changes quickly is sent.
 /// </summary>
 /// <param name="propertyName">the IoT Hub Device Twin property name</param>
 /// <param name="propertyValue">the IoT Hub Device Twin property value</param>
 static void TwinReportBoolState(const char *propertyName, bool propertyValue)
+{
+	if (ReportedProperties_SetBool(&reportedProperties, propertyName, propertyValue) == 0) {
+		Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
+			(propertyValue == true ? "true" : "false"));
+	}
+}
+
+/// <summary>
+///     Enqueues a patch of reported properties. The patch is sent on the next invocation of
+///     IoTHubDeviceClient_LL_DoWork(), which is scheduled here.
+/// </summary>
+/// <returns>0 if the patch was enqueued, or -1 if it must be retried</returns>
+static int SendReportedPatch(const char *patch, size_t length, void *context)
+{
+	if (iothubClientHandle == NULL || !iothubAuthenticated) {
+		return -1;
+	}
+
+	if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle, (const unsigned char *)patch,
+		length, ReportStatusCallback, NULL) != IOTHUB_CLIENT_OK) {
+		Log_Debug("ERROR: failed to send reported properties %s.\n", patch);
+		return -1;
+	}
+	++pendingConfirmations;
+	ScheduleDoWork();
+	return 0;
+}
+
+/// <summary>
+///     Callback invoked when IoT Hub accepts or rejects a patch of reported properties.
+/// </summary>
+static void ReportStatusCallback(int result, void *context)
+{
+	Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
+	--pendingConfirmations;
+	ReportedProperties_Complete(&reportedProperties, result >= 200 && result < 300);
+}
+
+static uint64_t GetMonotonicMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+/// <summary>
+///     Arms the DoWork timer to expire after a delay, unless it is armed to expire sooner
+/// </summary>
+/// <param name="delayMs">The delay in milliseconds</param>
+static void ArmDoWorkTimer(uint32_t delayMs)
+{
+	uint64_t dueMs = GetMonotonicMs() + delayMs;
+	if (IsTimerArmed(&doWorkTimer) && doWorkDueMs <= dueMs) {
+		return;
+	}
+	struct timespec delay = { (time_t)(delayMs / 1000u), (long)(delayMs % 1000u) * 1000000L };
+	if (SetTimerToSingleExpiry(&doWorkTimer, &delay) == 0) {
+		doWorkDueMs = dueMs;
+	}
+}
+
+/// <summary>
+///     Runs DoWork soon, to send an item which was just queued, and records when it was queued
+/// </summary>
+static void ScheduleDoWork(void)
+{
+	++doWorkStats.messagesQueued;
+	if (queuedTimesCount < MAX_QUEUED_TIMES) {
+		queuedTimesMs[queuedTimesCount++] = GetMonotonicMs();
+	}
+	doWorkBusyDelayMs = DoWorkBusyMinMs;
+	ArmDoWorkTimer(DoWorkSoonMs);
+}
+
+/// <summary>
+///     Calls IoTHubDeviceClient_LL_DoWork and schedules the next call while the client is busy
+/// </summary>
+static void RunDoWork(void)
 {
 	if (iothubClientHandle == NULL) {
-		Log_Debug("ERROR: client not initialized\n");
+		return;
 	}
-	else {
-		static char reportedPropertiesString[30] = { 0 };
-		int len = snprintf(reportedPropertiesString, 30, "{\"%s\":%s}", propertyName,
-			(propertyValue == true ? "true" : "false"));
-		if (len < 0)
-			return;
 
-		if (IoTHubDeviceClient_LL_SendReportedState(
-			iothubClientHandle, (unsigned char *)reportedPropertiesString,
-			strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-			Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
+	// The items queued since the last call are sent now.
+	uint64_t now = GetMonotonicMs();
+	for (size_t i = 0; i < queuedTimesCount; ++i) {
+		uint64_t latencyMs = now - queuedTimesMs[i];
+		int bucket = 0;
+		while (bucket < USI_AZUREIOT_LATENCY_BUCKETS - 1 && latencyMs >= (1u << bucket)) {
+			++bucket;
 		}
-		else {
-			Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
-				(propertyValue == true ? "true" : "false"));
+		++doWorkStats.latencyMs[bucket];
+		if (latencyMs > doWorkStats.maxLatencyMs) {
+			doWorkStats.maxLatencyMs = (uint32_t)latencyMs;
+		}
+	}
+	queuedTimesCount = 0;
+	++doWorkStats.doWorkCalls;
+
+	IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+
+	// Callbacks may have queued more items, which scheduled their own call.
+	IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+	if (iothubClientHandle == NULL || queuedTimesCount > 0) {
+		return;
+	}
+	if ((IoTHubDeviceClient_LL_GetSendStatus(iothubClientHandle, &sendStatus) == IOTHUB_CLIENT_OK &&
+		sendStatus == IOTHUB_CLIENT_SEND_STATUS_BUSY) || pendingConfirmations > 0) {
+		ArmDoWorkTimer(doWorkBusyDelayMs);
+		doWorkBusyDelayMs *= 2;
+		if (doWorkBusyDelayMs > DoWorkBusyMaxMs) {
+			doWorkBusyDelayMs = DoWorkBusyMaxMs;
 		}
 	}
+	else {
+		DisarmTimer(&doWorkTimer);
+		doWorkBusyDelayMs = DoWorkBusyMinMs;
+	}
 }
 
 /// <summary>
-///     Callback invoked when the Device Twin reported properties are accepted by IoT Hub.
+///     DoWork timer event: sends queued items and receives confirmations
 /// </summary>
-static void ReportStatusCallback(int result, void *context)
+static void DoWorkTimerEventHandler(Timer *timer)
 {
-	Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
+	RunDoWork();
 }
 
 /// <summary>
@@ -503,8 +1112,48 @@ void SendSimulatedTemperature(void)
 }
 
 int USIAzureIoT_SendStringToCloud(const char *sendName, const char *sendString) {
-	TwinReportString(sendName, sendString);
-	return 0;
+	UpdateTelemetryPolicy();
+	return TelemetryBatcher_AddString(&telemetryBatcher, sendName, sendString);
+}
+
+int USIAzureIoT_SendStringNToCloud(const char *sendName, const char *sendString, size_t length) {
+	UpdateTelemetryPolicy();
+	return TelemetryBatcher_AddStringN(&telemetryBatcher, sendName, sendString, length);
+}
+
+int USIAzureIoT_SendRecordToCloud(TelemetryBatcher_RecordWriter writeRecord, const void *record) {
+	UpdateTelemetryPolicy();
+	return TelemetryBatcher_AddRecord(&telemetryBatcher, writeRecord, record);
+}
+
+/// <summary>
+///     Binary data, as a telemetry record.
+/// </summary>
+typedef struct {
+	const char *name;
+	const void *data;
+	size_t length;
+} BytesRecord;
+
+static void WriteBytesRecord(JsonWriter *writer, const void *record) {
+	const BytesRecord *bytesRecord = record;
+	JsonWriter_Key(writer, bytesRecord->name);
+	JsonWriter_Base64(writer, bytesRecord->data, bytesRecord->length);
+}
+
+int USIAzureIoT_SendBytesToCloud(const char *sendName, const void *data, size_t length) {
+	BytesRecord record = { .name = sendName, .data = data, .length = length };
+	return USIAzureIoT_SendRecordToCloud(&WriteBytesRecord, &record);
+}
+
+void USIAzureIoT_GetTelemetryStats(TelemetryBudgetStats *budgetStats,
+	TelemetryBatcherStats *batcherStats) {
+	*budgetStats = telemetryBudget.stats;
+	*batcherStats = telemetryBatcher.stats;
+}
+
+void USIAzureIoT_GetDoWorkStats(AzureDoWorkStats *stats) {
+	*stats = doWorkStats;
 }
 
 int USIAzureIoT_GetIoTStatus(void) {
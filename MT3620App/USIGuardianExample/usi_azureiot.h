@@ -13,16 +13,92 @@
 #include <iothub.h>
 #include <azure_sphere_provisioning.h>
 
-#include "parson.h" // used to parse Device Twin messages.
+#include "twin_parser.h" // used to parse Device Twin messages.
+#include "twin_state.h"
+#include "reported_properties.h"
+#include "store_forward.h"
+#include "telemetry_batcher.h"
+#include "telemetry_budget.h"
 
-#include "usi_uart.h"
-#include "usi_rs232_485.h"
+#include "usi_serial.h"
 #include "usi_private_ethernet.h"
 
+/// <summary>Number of buckets in <see cref="AzureDoWorkStats" />.latencyMs.</summary>
+#define USI_AZUREIOT_LATENCY_BUCKETS 16
+
+/// <summary>
+///     Counters for the scheduling of IoTHubDeviceClient_LL_DoWork, which puts queued messages
+///     on the wire.
+/// </summary>
+typedef struct {
+	/// <summary>Number of times DoWork was called.</summary>
+	uint64_t doWorkCalls;
+	/// <summary>Number of messages and reported-property updates which were queued.</summary>
+	uint64_t messagesQueued;
+	/// <summary>Longest time, in milliseconds, which a queued item waited for DoWork.</summary>
+	uint32_t maxLatencyMs;
+	/// <summary>Histogram of the time from queueing to the next DoWork; index 0 counts items
+	/// which waited less than 1 ms, index n items which waited from 2^(n-1) to 2^n ms, and the
+	/// last index every longer wait.</summary>
+	uint64_t latencyMs[USI_AZUREIOT_LATENCY_BUCKETS];
+} AzureDoWorkStats;
+
 extern volatile sig_atomic_t terminationRequired;
 extern int epollFd;
 
 int USIAzureIoT_Init(int usiazureiot_epollFd, sig_atomic_t usiazureiot_terminationRequired, char* scopeid_str);
 void USIAzureIoT_Deinit(void);
 int USIAzureIoT_GetIoTStatus(void);
-int USIAzureIoT_SendStringToCloud(const char *sendName, const char *sendString);
\ No newline at end of file
+
+/// <summary>
+///     Adds a string to the batch of telemetry records which is sent to IoT Hub as one
+///     message. The batch is sent when it is full or a short time after its first record.
+/// </summary>
+/// <param name="sendName">Name of the record</param>
+/// <param name="sendString">The string</param>
+/// <returns>0 on success, or -1 if the string is too long for a batch and was dropped</returns>
+int USIAzureIoT_SendStringToCloud(const char *sendName, const char *sendString);
+
+/// <summary>
+///     Adds a string of a given length, which may contain nulls, to the batch of telemetry
+///     records, like <see cref="USIAzureIoT_SendStringToCloud" />.
+/// </summary>
+/// <param name="sendName">Name of the record</param>
+/// <param name="sendString">The string</param>
+/// <param name="length">Length of the string</param>
+/// <returns>0 on success, or -1 if the string is too long for a batch and was dropped</returns>
+int USIAzureIoT_SendStringNToCloud(const char *sendName, const char *sendString, size_t length);
+
+/// <summary>
+///     Adds a record with any fields to the batch of telemetry records which is sent to IoT Hub
+///     as one message.
+/// </summary>
+/// <param name="writeRecord">Function which writes the record's keys and values</param>
+/// <param name="record">Record which is passed to writeRecord</param>
+/// <returns>0 on success, or -1 if the record is too long for a batch and was dropped</returns>
+int USIAzureIoT_SendRecordToCloud(TelemetryBatcher_RecordWriter writeRecord, const void *record);
+
+/// <summary>
+///     Adds binary data, as a base64 string, to the batch of telemetry records which is sent to
+///     IoT Hub as one message. The data is not inspected.
+/// </summary>
+/// <param name="sendName">Name of the record</param>
+/// <param name="data">The data</param>
+/// <param name="length">Length of the data</param>
+/// <returns>0 on success, or -1 if the data is too long for a batch and was dropped</returns>
+int USIAzureIoT_SendBytesToCloud(const char *sendName, const void *data, size_t length);
+
+/// <summary>
+///     Gets the counters of the messages, bytes and message units which telemetry has used, and
+///     of the records which were batched, sampled out or dropped.
+/// </summary>
+/// <param name="budgetStats">Receives the counters of the message budget</param>
+/// <param name="batcherStats">Receives the counters of the telemetry batches</param>
+void USIAzureIoT_GetTelemetryStats(TelemetryBudgetStats *budgetStats,
+	TelemetryBatcherStats *batcherStats);
+
+/// <summary>
+///     Gets the counters of DoWork calls and the latency histogram of queued messages.
+/// </summary>
+/// <param name="stats">Receives the counters</param>
+void USIAzureIoT_GetDoWorkStats(AzureDoWorkStats *stats);
\ No newline at end of file
@@ -0,0 +1,652 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "usi_modbus.h"
+
+#if (defined(BUILD_USI_MODBUS))
+
+// Polling table. Adjacent or overlapping ranges on the same slave and function are read with a
+// single request, so entries can be split by meaning rather than by bus efficiency. The table is
+// empty until it is filled in for the slaves on the bus, for example:
+//	{ .name = "meter1Voltage", .slaveId = 1, .function = ModbusFunction_ReadInputRegisters,
+//	  .address = 0, .count = 6, .periodMs = 1000 },
+//	{ .name = "plc2Status", .slaveId = 2, .function = ModbusFunction_ReadCoils,
+//	  .address = 0, .count = 16, .periodMs = 500 },
+// Every entry which is due is one telemetry record, so mind the message budget: records are
+// packed into 4 KB messages, and a fast table fills one in seconds. The entry with no name ends
+// the table and must stay last; it also keeps the table and the arrays sized by it from having
+// zero length.
+static const USIModbusPollEntry pollTable[] = {
+	{ .name = NULL }
+};
+
+// Size of the arrays which are indexed by polling table entry: the table with its terminator.
+#define POLL_TABLE_SIZE (sizeof(pollTable) / sizeof(pollTable[0]))
+#define POLL_ENTRY_COUNT (POLL_TABLE_SIZE - 1)
+
+// Serial port which the slaves are connected to. Slaves end a frame with a silence of 3.5
+// characters, so the port is switched to idle-gap framing.
+#define MODBUS_PORT_NAME "RS232&485"
+static const SerialFramerConfig ModbusFraming = { .mode = SerialFramingMode_IdleGap };
+
+// Time to wait for a response, measured from when the request is queued.
+#define RESPONSE_TIMEOUT_MS 500
+
+// Consecutive timeouts after which a slave is considered offline and backed off.
+#define OFFLINE_FAILURE_COUNT 3
+
+// Polling interval of an offline slave: doubled on each further timeout, up to the maximum.
+#define OFFLINE_BACKOFF_MS 1000
+#define MAX_OFFLINE_BACKOFF_MS 60000
+
+/// <summary>
+///     One request on the bus: the coalesced range of one or more polling table entries.
+/// </summary>
+typedef struct {
+	uint8_t slaveId;
+	uint8_t function;
+	uint16_t address;
+	uint16_t count;
+	/// <summary>Shortest period of the block's entries.</summary>
+	uint32_t periodMs;
+	/// <summary>Time at which the block is next read.</summary>
+	uint64_t nextDueMs;
+	/// <summary>The block's entries, as a range of entryOrder.</summary>
+	size_t firstEntry;
+	size_t entryCount;
+	/// <summary>Consecutive timeouts of the block's slave.</summary>
+	uint32_t failures;
+} PollBlock;
+
+// Polling table indices, sorted by slave, function and address.
+static size_t entryOrder[POLL_TABLE_SIZE];
+// Time at which each polling table entry is next published.
+static uint64_t entryNextDueMs[POLL_TABLE_SIZE];
+
+static PollBlock blocks[POLL_TABLE_SIZE];
+static size_t blockCount = 0;
+
+/// <summary>
+///     A request submitted by another module.
+/// </summary>
+typedef struct ModbusTransaction {
+	uint8_t unitId;
+	uint8_t pdu[MODBUS_MAX_PDU_SIZE];
+	size_t pduLength;
+	/// <summary>Completion handler, or NULL once the request has been cancelled.</summary>
+	USIModbusResponseHandler handler;
+	void *context;
+	struct ModbusTransaction *next;
+} ModbusTransaction;
+
+static ModbusTransaction transactionPool[USI_MODBUS_MAX_TRANSACTIONS];
+static ModbusTransaction *freeTransactions = NULL;
+// Submitted requests which wait for the bus, oldest first.
+static ModbusTransaction *waitingTransactions = NULL;
+// Slave of the last submitted request which was sent, so that slaves take turns.
+static uint8_t lastTransactionUnitId = 0;
+// Whether the last request on the bus was a submitted request rather than a poll.
+static bool lastRequestWasTransaction = false;
+
+// Request whose response is awaited: a poll block or a submitted request. Both are NULL if the
+// bus is idle.
+static PollBlock *inFlightBlock = NULL;
+static ModbusTransaction *inFlightTransaction = NULL;
+static int portIndex = -1;
+
+static void ModbusTimerEventHandler(Timer *timer);
+// While a request is in flight the timer is its response timeout; otherwise it fires when the
+// next block is due.
+static Timer modbusTimer = { .timerHandler = &ModbusTimerEventHandler };
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+	// Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+	terminationRequired = true;
+}
+
+static uint64_t GetNowMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static void ArmModbusTimer(uint64_t delayMs)
+{
+	// A zero expiry would disarm the timer.
+	if (delayMs == 0) {
+		delayMs = 1;
+	}
+
+	struct timespec delay = { .tv_sec = (time_t)(delayMs / 1000u),
+							  .tv_nsec = (long)(delayMs % 1000u) * 1000000 };
+	SetTimerToSingleExpiry(&modbusTimer, &delay);
+}
+
+/// <summary>
+///     Returns the next time something with the given period is due. A deadline which has
+///     already been missed is not caught up on; the schedule restarts from now.
+/// </summary>
+static uint64_t GetNextDueMs(uint64_t dueMs, uint32_t periodMs, uint64_t nowMs)
+{
+	uint64_t nextDueMs = dueMs + periodMs;
+	return (nextDueMs > nowMs) ? nextDueMs : nowMs + periodMs;
+}
+
+static uint16_t GetMaxReadCount(uint8_t function)
+{
+	return ModbusRtu_IsBitFunction(function) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+}
+
+/// <summary>
+///     Sort the polling table and merge entries whose ranges touch or overlap into blocks which
+///     each take a single request.
+/// </summary>
+/// <returns>0 on success, or -1 if the polling table is invalid</returns>
+static int BuildPollBlocks(void)
+{
+	for (size_t i = 0; pollTable[i].name != NULL; ++i) {
+		const USIModbusPollEntry *entry = &pollTable[i];
+		if (entry->slaveId < 1 || entry->slaveId > 247 || entry->count == 0 ||
+			entry->count > GetMaxReadCount(entry->function) || entry->periodMs == 0 ||
+			(uint32_t)entry->address + entry->count > 0x10000) {
+			Log_Debug("ERROR: Invalid Modbus poll entry '%s'.\n", entry->name);
+			return -1;
+		}
+
+		// Insertion sort; the table is small and built once.
+		size_t j = i;
+		while (j > 0) {
+			const USIModbusPollEntry *previous = &pollTable[entryOrder[j - 1]];
+			if (previous->slaveId < entry->slaveId ||
+				(previous->slaveId == entry->slaveId && (previous->function < entry->function ||
+				(previous->function == entry->function && previous->address <= entry->address)))) {
+				break;
+			}
+			entryOrder[j] = entryOrder[j - 1];
+			--j;
+		}
+		entryOrder[j] = i;
+	}
+
+	blockCount = 0;
+	for (size_t i = 0; pollTable[i].name != NULL; ++i) {
+		const USIModbusPollEntry *entry = &pollTable[entryOrder[i]];
+		uint32_t entryEnd = (uint32_t)entry->address + entry->count;
+		PollBlock *block = (blockCount > 0) ? &blocks[blockCount - 1] : NULL;
+
+		if (block != NULL && block->slaveId == entry->slaveId &&
+			block->function == entry->function &&
+			entry->address <= (uint32_t)block->address + block->count &&
+			entryEnd - block->address <= GetMaxReadCount(entry->function)) {
+			if (entryEnd > (uint32_t)block->address + block->count) {
+				block->count = (uint16_t)(entryEnd - block->address);
+			}
+			if (entry->periodMs < block->periodMs) {
+				block->periodMs = entry->periodMs;
+			}
+			++block->entryCount;
+			continue;
+		}
+
+		block = &blocks[blockCount++];
+		block->slaveId = entry->slaveId;
+		block->function = (uint8_t)entry->function;
+		block->address = entry->address;
+		block->count = entry->count;
+		block->periodMs = entry->periodMs;
+		block->nextDueMs = 0;
+		block->firstEntry = i;
+		block->entryCount = 1;
+		block->failures = 0;
+	}
+
+	Log_Debug("INFO: %zu Modbus poll entries coalesced into %zu requests.\n", POLL_ENTRY_COUNT,
+		blockCount);
+	return 0;
+}
+
+/// <summary>
+///     The values of one polling table entry, from its block's response data.
+/// </summary>
+typedef struct {
+	const USIModbusPollEntry *entry;
+	const PollBlock *block;
+	const uint8_t *data;
+} PollRecord;
+
+/// <summary>
+///     Write the fields of a telemetry record for a polling table entry:
+///     "modbus":{"name":...,"slave":...,"function":...,"address":...,"values":[...]}
+/// </summary>
+static void WritePollRecord(JsonWriter *writer, const void *record)
+{
+	const PollRecord *pollRecord = record;
+	const USIModbusPollEntry *entry = pollRecord->entry;
+	bool isBitFunction = ModbusRtu_IsBitFunction(pollRecord->block->function);
+
+	JsonWriter_Key(writer, "modbus");
+	JsonWriter_BeginObject(writer);
+	JsonWriter_Key(writer, "name");
+	JsonWriter_String(writer, entry->name);
+	JsonWriter_Key(writer, "slave");
+	JsonWriter_Uint(writer, entry->slaveId);
+	JsonWriter_Key(writer, "function");
+	JsonWriter_Uint(writer, (unsigned)entry->function);
+	JsonWriter_Key(writer, "address");
+	JsonWriter_Uint(writer, entry->address);
+	JsonWriter_Key(writer, "values");
+	JsonWriter_BeginArray(writer);
+	size_t offset = (size_t)(entry->address - pollRecord->block->address);
+	for (size_t k = 0; k < entry->count; ++k) {
+		unsigned value;
+		if (isBitFunction) {
+			size_t bit = offset + k;
+			value = (pollRecord->data[bit / 8] >> (bit % 8)) & 1u;
+		}
+		else {
+			const uint8_t *reg = pollRecord->data + (offset + k) * 2;
+			value = ((unsigned)reg[0] << 8) | reg[1];
+		}
+		JsonWriter_Uint(writer, value);
+	}
+	JsonWriter_EndArray(writer);
+	JsonWriter_EndObject(writer);
+}
+
+/// <summary>
+///     Publish the entries of a block which are due, from the block's response data, as records
+///     in the telemetry batch.
+/// </summary>
+static void PublishBlock(const PollBlock *block, const uint8_t *data, uint64_t nowMs)
+{
+	for (size_t i = block->firstEntry; i < block->firstEntry + block->entryCount; ++i) {
+		size_t entryIndex = entryOrder[i];
+		if (entryNextDueMs[entryIndex] > nowMs) {
+			continue;
+		}
+		const USIModbusPollEntry *entry = &pollTable[entryIndex];
+		entryNextDueMs[entryIndex] = GetNextDueMs(entryNextDueMs[entryIndex], entry->periodMs, nowMs);
+
+		PollRecord record = { .entry = entry, .block = block, .data = data };
+		if (USIAzureIoT_SendRecordToCloud(&WritePollRecord, &record) != 0) {
+			Log_Debug("ERROR: Modbus values for '%s' do not fit in a message.\n", entry->name);
+		}
+	}
+}
+
+/// <summary>
+///     Record a completed transaction with a block's slave, bringing it back online.
+/// </summary>
+static void RecordSuccess(const PollBlock *block)
+{
+	if (block->failures >= OFFLINE_FAILURE_COUNT) {
+		Log_Debug("INFO: Modbus slave %u is back online.\n", block->slaveId);
+	}
+	for (size_t i = 0; i < blockCount; ++i) {
+		if (blocks[i].slaveId == block->slaveId) {
+			blocks[i].failures = 0;
+		}
+	}
+}
+
+/// <summary>
+///     Record a timeout of a block's slave. A slave which keeps timing out is polled less and
+///     less often, so it does not take bus time from the slaves which are answering.
+/// </summary>
+static void RecordFailure(const PollBlock *block, uint64_t nowMs)
+{
+	uint8_t slaveId = block->slaveId;
+	uint32_t failures = block->failures + 1;
+
+	uint64_t backoffMs = 0;
+	if (failures >= OFFLINE_FAILURE_COUNT) {
+		uint32_t doublings = failures - OFFLINE_FAILURE_COUNT;
+		backoffMs = (doublings < 6) ? ((uint64_t)OFFLINE_BACKOFF_MS << doublings) : MAX_OFFLINE_BACKOFF_MS;
+		if (backoffMs > MAX_OFFLINE_BACKOFF_MS) {
+			backoffMs = MAX_OFFLINE_BACKOFF_MS;
+		}
+		if (failures == OFFLINE_FAILURE_COUNT) {
+			Log_Debug("WARNING: Modbus slave %u is not responding.\n", slaveId);
+		}
+	}
+
+	for (size_t i = 0; i < blockCount; ++i) {
+		if (blocks[i].slaveId == slaveId) {
+			blocks[i].failures = failures;
+			if (blocks[i].nextDueMs < nowMs + backoffMs) {
+				blocks[i].nextDueMs = nowMs + backoffMs;
+			}
+		}
+	}
+}
+
+/// <summary>
+///     Take the next submitted request off the queue: the oldest one for the first slave after
+///     the one which was served last.
+/// </summary>
+static ModbusTransaction *TakeNextTransaction(void)
+{
+	ModbusTransaction **link = NULL;
+	ModbusTransaction **firstLink = NULL;
+	for (ModbusTransaction **l = &waitingTransactions; *l != NULL; l = &(*l)->next) {
+		uint8_t unitId = (*l)->unitId;
+		if (firstLink == NULL || unitId < (*firstLink)->unitId) {
+			firstLink = l;
+		}
+		if (unitId > lastTransactionUnitId && (link == NULL || unitId < (*link)->unitId)) {
+			link = l;
+		}
+	}
+
+	if (link == NULL) {
+		link = firstLink;
+	}
+	if (link == NULL) {
+		return NULL;
+	}
+
+	ModbusTransaction *transaction = *link;
+	*link = transaction->next;
+	lastTransactionUnitId = transaction->unitId;
+	return transaction;
+}
+
+static void ReleaseTransaction(ModbusTransaction *transaction)
+{
+	transaction->next = freeTransactions;
+	freeTransactions = transaction;
+}
+
+/// <summary>
+///     Complete the submitted request in flight, with its response or NULL on failure.
+/// </summary>
+static void CompleteTransaction(const uint8_t *pdu, size_t pduLength)
+{
+	ModbusTransaction *transaction = inFlightTransaction;
+	USIModbusResponseHandler handler = transaction->handler;
+	void *context = transaction->context;
+
+	// Release first, so the handler can submit another request straight away.
+	inFlightTransaction = NULL;
+	ReleaseTransaction(transaction);
+	if (handler != NULL) {
+		handler(pdu, pduLength, context);
+	}
+}
+
+/// <summary>
+///     Start the next request, or wait until the next block is due. Called whenever the bus
+///     becomes idle, so the next slave is asked as soon as the previous one has answered rather
+///     than on a fixed cycle. Submitted requests and due polls take turns, so a busy client
+///     cannot stop the polling table, nor the other way around.
+/// </summary>
+static void IssueNextRequest(void)
+{
+	while (inFlightBlock == NULL && inFlightTransaction == NULL) {
+		uint64_t nowMs = GetNowMs();
+		PollBlock *next = NULL;
+		for (size_t i = 0; i < blockCount; ++i) {
+			if (next == NULL || blocks[i].nextDueMs < next->nextDueMs) {
+				next = &blocks[i];
+			}
+		}
+		bool isBlockDue = next != NULL && next->nextDueMs <= nowMs;
+
+		if (waitingTransactions != NULL && (!isBlockDue || !lastRequestWasTransaction)) {
+			ModbusTransaction *transaction = TakeNextTransaction();
+			lastRequestWasTransaction = true;
+
+			uint8_t request[MODBUS_RTU_MAX_FRAME_SIZE];
+			request[0] = transaction->unitId;
+			memcpy(request + 1, transaction->pdu, transaction->pduLength);
+			size_t requestLength = ModbusRtu_AppendCrc(request, 1 + transaction->pduLength);
+
+			inFlightTransaction = transaction;
+			if (USISerial_Send(portIndex, request, requestLength) != 0) {
+				CompleteTransaction(NULL, 0);
+				continue;
+			}
+			ArmModbusTimer(RESPONSE_TIMEOUT_MS);
+			return;
+		}
+
+		if (!isBlockDue) {
+			if (next != NULL) {
+				ArmModbusTimer(next->nextDueMs - nowMs);
+			}
+			return;
+		}
+
+		lastRequestWasTransaction = false;
+		next->nextDueMs = GetNextDueMs(next->nextDueMs, next->periodMs, nowMs);
+
+		uint8_t request[MODBUS_RTU_READ_REQUEST_SIZE];
+		size_t requestLength = ModbusRtu_BuildReadRequest(request, next->slaveId, next->function,
+			next->address, next->count);
+		if (USISerial_Send(portIndex, request, requestLength) != 0) {
+			// The block is not due again until its next period, so the loop moves on.
+			RecordFailure(next, nowMs);
+			continue;
+		}
+
+		inFlightBlock = next;
+		ArmModbusTimer(RESPONSE_TIMEOUT_MS);
+	}
+}
+
+/// <summary>
+///     Handle Modbus timer event: either the response timed out, or the next block is due.
+/// </summary>
+static void ModbusTimerEventHandler(Timer *timer)
+{
+	if (inFlightBlock != NULL) {
+		Log_Debug("WARNING: Modbus slave %u did not respond to function %u at %u.\n",
+			inFlightBlock->slaveId, inFlightBlock->function, inFlightBlock->address);
+		RecordFailure(inFlightBlock, GetNowMs());
+		inFlightBlock = NULL;
+	}
+	else if (inFlightTransaction != NULL) {
+		Log_Debug("WARNING: Modbus slave %u did not respond to function %u.\n",
+			inFlightTransaction->unitId, inFlightTransaction->pdu[0]);
+		CompleteTransaction(NULL, 0);
+	}
+
+	IssueNextRequest();
+}
+
+/// <summary>
+///     Handle a frame from the RS485 port: validate it as the response to the request in flight.
+/// </summary>
+static void ModbusFrameHandler(const struct iovec *spans, int spanCount, void *context)
+{
+	// Frames longer than any valid response are truncated and then fail the CRC check.
+	char frame[MODBUS_RTU_MAX_FRAME_SIZE + 1];
+	size_t length = SerialFramer_CopyFrame(spans, spanCount, frame, sizeof(frame));
+
+	if (inFlightTransaction != NULL) {
+		// Exception responses are passed on to the submitter as they are.
+		ModbusRtuResult result = ModbusRtu_CheckResponse((const uint8_t *)frame, length,
+			inFlightTransaction->unitId, inFlightTransaction->pdu[0]);
+		if (result == ModbusRtuResult_Mismatch) {
+			Log_Debug("WARNING: Modbus frame does not match the request to slave %u.\n",
+				inFlightTransaction->unitId);
+			return;
+		}
+
+		DisarmTimer(&modbusTimer);
+		if (result == ModbusRtuResult_Ok) {
+			CompleteTransaction((const uint8_t *)frame + 1, length - 3);
+		}
+		else {
+			Log_Debug("WARNING: Modbus frame from slave %u failed the CRC check.\n",
+				inFlightTransaction->unitId);
+			CompleteTransaction(NULL, 0);
+		}
+		IssueNextRequest();
+		return;
+	}
+
+	PollBlock *block = inFlightBlock;
+	if (block == NULL) {
+		Log_Debug("WARNING: Unexpected %zu byte Modbus frame.\n", length);
+		return;
+	}
+
+	const uint8_t *data = NULL;
+	uint8_t exceptionCode = 0;
+	ModbusRtuResult result = ModbusRtu_ParseReadResponse((const uint8_t *)frame, length,
+		block->slaveId, block->function, block->count, &data, &exceptionCode);
+	switch (result) {
+	case ModbusRtuResult_Ok:
+		RecordSuccess(block);
+		PublishBlock(block, data, GetNowMs());
+		break;
+	case ModbusRtuResult_Exception:
+		RecordSuccess(block);
+		Log_Debug("ERROR: Modbus slave %u returned exception %u for function %u at %u.\n",
+			block->slaveId, exceptionCode, block->function, block->address);
+		break;
+	case ModbusRtuResult_BadCrc:
+		// Corrupted on the wire; the slave gets another chance at its next period.
+		Log_Debug("WARNING: Modbus frame from slave %u failed the CRC check.\n", block->slaveId);
+		break;
+	default:
+		// Perhaps a late answer to a request which already timed out; keep waiting.
+		Log_Debug("WARNING: Modbus frame does not match the request to slave %u.\n",
+			block->slaveId);
+		return;
+	}
+
+	inFlightBlock = NULL;
+	DisarmTimer(&modbusTimer);
+	IssueNextRequest();
+}
+
+/// <summary>
+///     Set up SIGTERM termination handler, take over the RS485 port and start polling.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitPeripheralsAndHandlers(void)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(struct sigaction));
+	action.sa_handler = TerminationHandler;
+	sigaction(SIGTERM, &action, NULL);
+
+	if (BuildPollBlocks() != 0) {
+		return -1;
+	}
+
+	portIndex = USISerial_AttachFrameHandler(MODBUS_PORT_NAME, &ModbusFraming, &ModbusFrameHandler,
+		NULL);
+	if (portIndex < 0) {
+		return -1;
+	}
+
+	uint64_t nowMs = GetNowMs();
+	for (size_t i = 0; pollTable[i].name != NULL; ++i) {
+		entryNextDueMs[i] = nowMs;
+	}
+	for (size_t i = 0; i < blockCount; ++i) {
+		blocks[i].nextDueMs = nowMs;
+	}
+
+	freeTransactions = NULL;
+	waitingTransactions = NULL;
+	for (size_t i = 0; i < USI_MODBUS_MAX_TRANSACTIONS; ++i) {
+		ReleaseTransaction(&transactionPool[i]);
+	}
+
+	inFlightBlock = NULL;
+	inFlightTransaction = NULL;
+	IssueNextRequest();
+	return 0;
+}
+
+/// <summary>
+///     Stop polling and return the port to its own framing and routes.
+/// </summary>
+static void ClosePeripheralsAndHandlers(void)
+{
+	DisarmTimer(&modbusTimer);
+	USISerial_DetachFrameHandler(portIndex);
+	inFlightBlock = NULL;
+	inFlightTransaction = NULL;
+	waitingTransactions = NULL;
+	freeTransactions = NULL;
+	portIndex = -1;
+}
+
+int USIModbus_Init(int usimodbus_epollFd, sig_atomic_t usimodbus_terminationRequired) {
+	Log_Debug("INFO: USI Modbus RTU master starting.\n");
+
+	terminationRequired = usimodbus_terminationRequired;
+	epollFd = usimodbus_epollFd;
+
+	if (InitPeripheralsAndHandlers() != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+void USIModbus_Deinit(void) {
+	ClosePeripheralsAndHandlers();
+}
+
+int USIModbus_Submit(uint8_t unitId, const uint8_t *pdu, size_t pduLength,
+	USIModbusResponseHandler handler, void *context) {
+	if (portIndex < 0 || unitId < 1 || unitId > 247 || pduLength < 1 ||
+		pduLength > MODBUS_MAX_PDU_SIZE) {
+		return -1;
+	}
+
+	ModbusTransaction *transaction = freeTransactions;
+	if (transaction == NULL) {
+		Log_Debug("WARNING: Modbus request queue is full.\n");
+		return -1;
+	}
+	freeTransactions = transaction->next;
+
+	transaction->unitId = unitId;
+	memcpy(transaction->pdu, pdu, pduLength);
+	transaction->pduLength = pduLength;
+	transaction->handler = handler;
+	transaction->context = context;
+	transaction->next = NULL;
+
+	ModbusTransaction **link = &waitingTransactions;
+	while (*link != NULL) {
+		link = &(*link)->next;
+	}
+	*link = transaction;
+
+	IssueNextRequest();
+	return 0;
+}
+
+void USIModbus_Cancel(void *context) {
+	ModbusTransaction **link = &waitingTransactions;
+	while (*link != NULL) {
+		ModbusTransaction *transaction = *link;
+		if (transaction->context == context) {
+			*link = transaction->next;
+			ReleaseTransaction(transaction);
+		}
+		else {
+			link = &transaction->next;
+		}
+	}
+
+	// The request on the bus still runs to completion, so the next one cannot collide with its
+	// response; only its handler is dropped.
+	if (inFlightTransaction != NULL && inFlightTransaction->context == context) {
+		inFlightTransaction->handler = NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,72 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "common.h"
+#include "usi_azureiot.h"
+#include "usi_serial.h"
+#include "json_writer.h"
+#include "modbus_rtu.h"
+
+extern volatile sig_atomic_t terminationRequired;
+extern int epollFd;
+
+/// <summary>
+///     One entry of the Modbus polling table: a range of registers or bits on one slave, read at
+///     a fixed rate and published as telemetry.
+/// </summary>
+typedef struct {
+	/// <summary>Name which the values are published under.</summary>
+	const char *name;
+	/// <summary>Slave address, 1 to 247.</summary>
+	uint8_t slaveId;
+	/// <summary>Read function: coils, discrete inputs, holding or input registers.</summary>
+	ModbusFunction function;
+	/// <summary>Address of the first register or bit.</summary>
+	uint16_t address;
+	/// <summary>Number of registers or bits.</summary>
+	uint16_t count;
+	/// <summary>Polling period in milliseconds.</summary>
+	uint32_t periodMs;
+} USIModbusPollEntry;
+
+/// <summary>Largest number of requests from other modules which may wait for the bus.</summary>
+#define USI_MODBUS_MAX_TRANSACTIONS 16
+
+/// <summary>
+///     Function signature for the completion of a request submitted with
+///     <see cref="USIModbus_Submit" />.
+/// </summary>
+/// <param name="pdu">The response PDU, which may be an exception response, or NULL if the slave
+/// did not respond</param>
+/// <param name="pduLength">Length of the response PDU</param>
+/// <param name="context">The context which was supplied to USIModbus_Submit</param>
+typedef void (*USIModbusResponseHandler)(const uint8_t *pdu, size_t pduLength, void *context);
+
+int USIModbus_Init(int usimodbus_epollFd, sig_atomic_t usimodbus_terminationRequired);
+void USIModbus_Deinit(void);
+
+/// <summary>
+///     Queues a request for a slave. Requests for the same slave are sent in order; slaves with
+///     waiting requests take turns, and alternate with the polling table when it is due.
+///     If the bus is idle the request is sent at once; if it cannot be written to the port, the
+///     handler is called with a NULL PDU before USIModbus_Submit returns, which still returns 0.
+///     The caller must therefore be ready for the handler before it submits the request.
+/// </summary>
+/// <param name="unitId">Slave address</param>
+/// <param name="pdu">Request PDU: function code and data</param>
+/// <param name="pduLength">Length of the PDU, at most MODBUS_MAX_PDU_SIZE</param>
+/// <param name="handler">Function which is called with the response</param>
+/// <param name="context">Context which is passed to the handler and identifies the request to
+/// <see cref="USIModbus_Cancel" /></param>
+/// <returns>0 if the request was queued, even if its handler has already been called, or -1 if
+/// the request is invalid or the queue is full, in which case the handler is not called</returns>
+int USIModbus_Submit(uint8_t unitId, const uint8_t *pdu, size_t pduLength,
+	USIModbusResponseHandler handler, void *context);
+
+/// <summary>
+///     Cancels every request submitted with a context. Their handlers are not called.
+/// </summary>
+/// <param name="context">The context</param>
+void USIModbus_Cancel(void *context);
@@ -3,9 +3,9 @@
 
 #include "usi_private_ethernet.h"
 
-
-   // File descriptors - initialized to invalid value
-static int timerFd = -1;
+// Timer which checks the network interface status until it is ready.
+static void TimerEventHandler(Timer *timer);
+static Timer networkCheckTimer = { .timerHandler = &TimerEventHandler };
 
 static bool isNetworkStackReady = false;
 EchoServer_ServerState *serverState = NULL;
@@ -16,8 +16,45 @@ static struct in_addr subnetMask;
 static struct in_addr gatewayIpAddress;
 static const uint16_t LocalTcpServerPort = 11000;
 static int serverBacklogSize = 3;
+// Clients of the TCP server which may be connected at once, and how long one may stay silent
+// before its connection is closed.
+static const size_t MaxTcpClients = 4;
+static const struct timespec TcpClientIdleTimeout = {300, 0};
+// UDP ingest for sensors which only send datagrams, on the same port number as the TCP server.
+static UdpIngest_ServerState *udpIngestState = NULL;
+static const uint16_t LocalUdpIngestPort = 11000;
 static const char NetworkInterface[] = "eth0";
 
+#if (defined(BUILD_USI_MODBUS))
+// Modbus TCP gateway to the slaves on the RS485 bus. Read responses are shared between clients
+// for ModbusCacheTtlMs, so fast pollers do not multiply the traffic on the serial link.
+static ModbusTcpServer_ServerState *modbusServerState = NULL;
+static const uint16_t LocalModbusTcpServerPort = 502;
+static const uint32_t ModbusCacheTtlMs = 1000;
+#endif
+
+#if (defined(BUILD_USI_SERIAL_BRIDGE))
+// Serial ports which an engineering laptop can reach directly over TCP, for example with
+// pyserial's rfc2217:// URLs or a Telnet client in binary mode.
+typedef struct {
+	const char *portName;
+	uint16_t tcpPort;
+} SerialBridgeConfig;
+
+static const SerialBridgeConfig serialBridgeConfigs[] = {
+#if (defined(BUILD_USI_UART))
+	{ "UART", 11001 },
+#endif
+#if (defined(BUILD_USI_RS232_485))
+	{ "RS232&485", 11002 },
+#endif
+};
+
+#define SERIAL_BRIDGE_COUNT (sizeof(serialBridgeConfigs) / sizeof(serialBridgeConfigs[0]))
+
+static SerialBridge_ServerState *serialBridgeStates[SERIAL_BRIDGE_COUNT];
+#endif
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -57,7 +94,19 @@ static void ServerStoppedHandler(EchoServer_StopReason reason)
 static void ShutDownServerAndCleanup(void)
 {
 	EchoServer_ShutDown(serverState);
-	CloseFdAndPrintError(timerFd, "Timer");
+	UdpIngest_ShutDown(udpIngestState);
+	udpIngestState = NULL;
+#if (defined(BUILD_USI_MODBUS))
+	ModbusTcpServer_ShutDown(modbusServerState);
+	modbusServerState = NULL;
+#endif
+#if (defined(BUILD_USI_SERIAL_BRIDGE))
+	for (size_t i = 0; i < SERIAL_BRIDGE_COUNT; ++i) {
+		SerialBridge_ShutDown(serialBridgeStates[i]);
+		serialBridgeStates[i] = NULL;
+	}
+#endif
+	DisarmTimer(&networkCheckTimer);
 }
 
 /// <summary>
@@ -256,9 +305,9 @@ static int CheckNetworkStackStatusAndLaunchServers(void)
 		return -1;
 	}
 
-	// The network stack is ready, so unregister the timer event handler and launch servers.
+	// The network stack is ready, so disarm the timer and launch servers.
 	if (isNetworkStackReady) {
-		UnregisterEventHandlerFromEpoll(epollFd, timerFd);
+		DisarmTimer(&networkCheckTimer);
 
 		// Use static IP addressing to configure network interface.
 		int result = ConfigureNetworkInterfaceWithStaticIp(NetworkInterface);
@@ -280,10 +329,37 @@ static int CheckNetworkStackStatusAndLaunchServers(void)
 
 		// Start the TCP server.
 		serverState = EchoServer_Start(epollFd, localServerIpAddress.s_addr, LocalTcpServerPort,
-			serverBacklogSize, ServerStoppedHandler);
+			serverBacklogSize, MaxTcpClients, &TcpClientIdleTimeout, ServerStoppedHandler);
 		if (serverState == NULL) {
 			return -1;
 		}
+
+		// Start the UDP ingest server.
+		udpIngestState = UdpIngest_Start(epollFd, localServerIpAddress.s_addr, subnetMask.s_addr,
+			LocalUdpIngestPort);
+		if (udpIngestState == NULL) {
+			return -1;
+		}
+
+#if (defined(BUILD_USI_MODBUS))
+		// Start the Modbus TCP gateway.
+		modbusServerState = ModbusTcpServer_Start(epollFd, localServerIpAddress.s_addr,
+			LocalModbusTcpServerPort, serverBacklogSize, ModbusCacheTtlMs);
+		if (modbusServerState == NULL) {
+			return -1;
+		}
+#endif
+
+#if (defined(BUILD_USI_SERIAL_BRIDGE))
+		// Start the serial bridges.
+		for (size_t i = 0; i < SERIAL_BRIDGE_COUNT; ++i) {
+			serialBridgeStates[i] = SerialBridge_Start(epollFd, localServerIpAddress.s_addr,
+				serialBridgeConfigs[i].tcpPort, 1, serialBridgeConfigs[i].portName);
+			if (serialBridgeStates[i] == NULL) {
+				return -1;
+			}
+		}
+#endif
 	}
 
 	return 0;
@@ -292,13 +368,8 @@ static int CheckNetworkStackStatusAndLaunchServers(void)
 /// <summary>
 ///     The timer event handler.
 /// </summary>
-static void TimerEventHandler(EventData *eventData)
+static void TimerEventHandler(Timer *timer)
 {
-	if (ConsumeTimerFdEvent(timerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
 	// Check whether the network stack is ready.
 	if (!isNetworkStackReady) {
 		if (CheckNetworkStackStatusAndLaunchServers() != 0) {
@@ -307,8 +378,6 @@ static void TimerEventHandler(EventData *eventData)
 	}
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData timerEventData = { .eventHandler = &TimerEventHandler };
 
 /// <summary>
 ///     Set up SIGTERM termination handler, set up epoll event handling, configure network
@@ -324,8 +393,7 @@ static int InitializeAndLaunchServers(void)
 
 	// Check network interface status at the specified period until it is ready.
 	struct timespec checkInterval = { 1, 0 };
-	timerFd = CreateTimerFdAndAddToEpoll(epollFd, &checkInterval, &timerEventData, EPOLLIN);
-	if (timerFd < 0) {
+	if (SetTimerToPeriod(&networkCheckTimer, &checkInterval) != 0) {
 		return -1;
 	}
 
@@ -7,6 +7,9 @@
 #include <arpa/inet.h>
 #include <applibs/networking.h>
 #include "echo_tcp_server.h"
+#include "udp_ingest_server.h"
+#include "modbus_tcp_server.h"
+#include "serial_bridge.h"
 
 extern volatile sig_atomic_t terminationRequired;
 extern int epollFd;
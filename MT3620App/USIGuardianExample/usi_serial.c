@@ -0,0 +1,587 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "usi_serial.h"
+
+#if (defined(BUILD_USI_SERIAL))
+
+// Port table. Every port shares the same code; only this configuration differs.
+static const USISerialPortConfig portConfigs[] = {
+#if (defined(BUILD_USI_UART))
+	// ISU2 UART, exposed on USB: lines ending with 0x0d('\r').
+	{ .name = "UART",
+	  .uartId = USI_MT3620_BT_GB_ISU2_UART,
+	  .baudRate = 115200,
+	  .parity = UART_Parity_None,
+	  .flowControl = UART_FlowControl_None,
+	  .framing = { .mode = SerialFramingMode_Delimiter,.delimiter = '\r' },
+	  .rs485DirectionGpio = USI_SERIAL_NO_GPIO,
+	  .routes = USISerialRoute_ToCloud | USISerialRoute_FromCloud,
+	  .cloudPropertyName = "sendToCloud",
+	  .txQueueLimit = 4096 },
+#endif
+#if (defined(BUILD_USI_RS232_485))
+	// ISU3 UART, exposed on the RS232/RS485 connector: lines ending with 0x0d('\r'). A module
+	// which takes the port over, such as the Modbus RTU master, may switch it to its own framing.
+	{ .name = "RS232&485",
+	  .uartId = USI_MT3620_BT_GB_ISU3_UART,
+	  .baudRate = 115200,
+	  .parity = UART_Parity_None,
+	  .flowControl = UART_FlowControl_None,
+	  .framing = { .mode = SerialFramingMode_Delimiter,.delimiter = '\r' },
+	  .rs485DirectionGpio = USI_RS485_CONTROL,
+	  .rs485TransmitIsHigh = true,
+	  .routes = USISerialRoute_ToCloud | USISerialRoute_FromCloud,
+	  .cloudPropertyName = "sendToCloud",
+	  .txQueueLimit = 4096 },
+#endif
+};
+
+#define PORT_COUNT (sizeof(portConfigs) / sizeof(portConfigs[0]))
+
+/// <summary>
+///     Run-time state of one serial port.
+/// </summary>
+typedef struct {
+	/// <summary>The port's configuration.</summary>
+	const USISerialPortConfig *config;
+	/// <summary>UART file descriptor.</summary>
+	int uartFd;
+	/// <summary>RS485 direction GPIO; its fd is -1 if the port has none.</summary>
+	Rs485DirectionGpio directionGpio;
+	/// <summary>Drives the RS485 direction GPIO around transmissions.</summary>
+	Rs485Direction direction;
+	/// <summary>Epoll registration of the UART; the handler finds the port from it.</summary>
+	EventData uartEventData;
+	/// <summary>Splits received data into frames.</summary>
+	SerialFramer framer;
+	/// <summary>Data waiting to be transmitted.</summary>
+	TxQueue txQueue;
+	/// <summary>Whether the UART is registered for EPOLLOUT.</summary>
+	bool isWaitingForWritable;
+	/// <summary>Handler which has taken over the port's frames, or NULL if they follow the
+	/// port's routes.</summary>
+	SerialFrameHandler frameHandler;
+	/// <summary>Context which is passed to frameHandler.</summary>
+	void *frameHandlerContext;
+	/// <summary>Current line settings of the UART.</summary>
+	USISerialLineSettings lineSettings;
+	/// <summary>Handler of the raw bytes received while the port is bridged, or NULL if it is
+	/// not.</summary>
+	USISerialDataHandler bridgeDataHandler;
+	/// <summary>Handler which is told that a bridged port accepts data again.</summary>
+	USISerialTxReadyHandler bridgeTxReadyHandler;
+	/// <summary>Context which is passed to the bridge handlers.</summary>
+	void *bridgeContext;
+} SerialPort;
+
+static SerialPort ports[PORT_COUNT];
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+	// Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+	terminationRequired = true;
+}
+
+/// <summary>
+///     Write as much of a port's transmit queue as the UART accepts, and wait for EPOLLOUT only
+///     while data remains.
+/// </summary>
+/// <param name="port">The port to write to</param>
+/// <returns>0 on success, or -1 on failure</returns>
+static int DrainTxQueue(SerialPort *port)
+{
+	// On an RS485 port, the driver must be enabled before the first byte, and is released once the
+	// last byte has left the UART.
+	bool hasDirection = port->directionGpio.gpioFd >= 0;
+	if (hasDirection && !TxQueue_IsEmpty(&port->txQueue) &&
+		Rs485Direction_BeginTransmit(&port->direction) != 0) {
+		return -1;
+	}
+
+	uint64_t bytesSentBefore = port->txQueue.stats.bytesSent;
+	if (TxQueue_Drain(&port->txQueue, port->uartFd) != 0) {
+		Log_Debug("ERROR: Could not write to %s: %s (%d).\n", port->config->name, strerror(errno),
+			errno);
+		return -1;
+	}
+
+	if (hasDirection) {
+		Rs485Direction_BytesWritten(&port->direction,
+			(size_t)(port->txQueue.stats.bytesSent - bytesSentBefore));
+		if (TxQueue_IsEmpty(&port->txQueue) && Rs485Direction_EndTransmit(&port->direction) != 0) {
+			return -1;
+		}
+	}
+
+	bool isWaitingForWritable = !TxQueue_IsEmpty(&port->txQueue);
+	if (isWaitingForWritable != port->isWaitingForWritable) {
+		uint32_t events = EPOLLIN | (isWaitingForWritable ? EPOLLOUT : 0);
+		if (RegisterEventHandlerToEpoll(epollFd, port->uartFd, &port->uartEventData, events) != 0) {
+			return -1;
+		}
+		port->isWaitingForWritable = isWaitingForWritable;
+	}
+
+	return 0;
+}
+
+/// <summary>
+///     Helper function to queue a message for the given port. The message is written without
+///     blocking; whatever the UART does not accept immediately is written on EPOLLOUT.
+/// </summary>
+/// <param name="port">The port to write to</param>
+/// <param name="dataToSend">The data to send over the UART</param>
+/// <param name="totalBytesToSend">Length of the data</param>
+/// <returns>0 on success, or -1 if the message was rejected or could not be written</returns>
+static int SendSerialMessage(SerialPort *port, const void *dataToSend, size_t totalBytesToSend)
+{
+	if (TxQueue_Enqueue(&port->txQueue, dataToSend, totalBytesToSend) != 0) {
+		Log_Debug("ERROR: Could not queue %zu bytes for %s (%zu bytes free): %s (%d).\n",
+			totalBytesToSend, port->config->name, TxQueue_GetFreeBytes(&port->txQueue),
+			strerror(errno), errno);
+		return -1;
+	}
+
+	if (DrainTxQueue(port) != 0) {
+		terminationRequired = true;
+		return -1;
+	}
+
+	return 0;
+}
+
+/// <summary>
+///     Handle a complete frame from a port's framer: route it.
+/// </summary>
+static void PortFrameHandler(const struct iovec *spans, int spanCount, void *context)
+{
+	SerialPort *port = context;
+	if (port->frameHandler != NULL) {
+		port->frameHandler(spans, spanCount, port->frameHandlerContext);
+	} else if ((port->config->routes & USISerialRoute_ToCloud) != 0) {
+		// The frame is sent with its length, so a NUL byte in it does not cut it short.
+		char frame[SERIAL_FRAMER_BUFFER_SIZE + 1];
+		size_t length = SerialFramer_CopyFrame(spans, spanCount, frame, sizeof(frame));
+		USIAzureIoT_SendStringNToCloud(port->config->cloudPropertyName, frame, length);
+	}
+}
+
+/// <summary>
+///     Handle UART event for any port: continue transmitting if the UART has become writable,
+///     and if there is incoming data, pass it to the port's framer.
+/// </summary>
+static int OpenUart(SerialPort *port, const USISerialLineSettings *settings);
+
+static void PortEventHandler(EventData *eventData)
+{
+	SerialPort *port = (SerialPort *)((uint8_t *)eventData - offsetof(SerialPort, uartEventData));
+
+	// An error or hangup stays signalled until the UART is closed, so it is reopened; if that
+	// fails the port is left closed rather than waking the loop forever.
+	if ((eventData->events & (EPOLLERR | EPOLLHUP)) != 0) {
+		Log_Debug("ERROR: %s reported an error (events 0x%x); reopening it.\n", port->config->name,
+			eventData->events);
+		USISerialLineSettings settings = port->lineSettings;
+		if (OpenUart(port, &settings) != 0 && port->uartFd >= 0) {
+			UnregisterEventHandlerFromEpoll(epollFd, port->uartFd);
+			CloseFdAndPrintError(port->uartFd, port->config->name);
+			port->uartFd = -1;
+		}
+		return;
+	}
+
+	if ((eventData->events & EPOLLOUT) != 0) {
+		if (DrainTxQueue(port) != 0) {
+			terminationRequired = true;
+			return;
+		}
+		if (port->bridgeTxReadyHandler != NULL && !TxQueue_IsThrottled(&port->txQueue)) {
+			port->bridgeTxReadyHandler(port->bridgeContext);
+		}
+	}
+	if ((eventData->events & EPOLLIN) == 0) {
+		return;
+	}
+
+	// A bridged port passes bytes straight on, without framing or logging each read.
+	if (port->bridgeDataHandler != NULL) {
+		uint8_t data[SERIAL_FRAMER_BUFFER_SIZE];
+		ssize_t bytesRead = read(port->uartFd, data, sizeof(data));
+		if (bytesRead < 0) {
+			Log_Debug("ERROR: Could not read %s: %s (%d).\n", port->config->name, strerror(errno),
+				errno);
+			terminationRequired = true;
+			return;
+		}
+		if (bytesRead > 0) {
+			port->bridgeDataHandler(data, (size_t)bytesRead, port->bridgeContext);
+		}
+		return;
+	}
+
+	// Read incoming UART data straight into the framer. It is expected behavior that messages
+	// may be received in multiple partial chunks; the framer reassembles them into frames.
+	size_t receiveSpace;
+	uint8_t *receiveBuffer = SerialFramer_GetWriteSpace(&port->framer, &receiveSpace);
+	ssize_t bytesRead = read(port->uartFd, receiveBuffer, receiveSpace);
+	if (bytesRead < 0) {
+		Log_Debug("ERROR: Could not read %s: %s (%d).\n", port->config->name, strerror(errno),
+			errno);
+		terminationRequired = true;
+		return;
+	}
+
+	if (bytesRead > 0) {
+		SerialFramer_Commit(&port->framer, (size_t)bytesRead);
+	}
+}
+
+/// <summary>
+///     Get the line settings with which a port opens.
+/// </summary>
+static void GetConfiguredLineSettings(const USISerialPortConfig *config,
+	USISerialLineSettings *settings)
+{
+	settings->baudRate = config->baudRate;
+	settings->dataBits = UART_DataBits_Eight;
+	settings->parity = config->parity;
+	settings->stopBits = UART_StopBits_One;
+	settings->flowControl = config->flowControl;
+}
+
+/// <summary>
+///     Open a port's UART with the given line settings, or reopen it if it is open, and set up
+///     its event handler and RS485 direction control.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenUart(SerialPort *port, const USISerialLineSettings *settings)
+{
+	const USISerialPortConfig *config = port->config;
+
+	if (port->uartFd >= 0) {
+		UnregisterEventHandlerFromEpoll(epollFd, port->uartFd);
+		CloseFdAndPrintError(port->uartFd, config->name);
+		port->uartFd = -1;
+	}
+
+	// Create a UART_Config object, open the UART and set up UART event handler
+	UART_Config uartConfig;
+	UART_InitConfig(&uartConfig);
+	uartConfig.baudRate = settings->baudRate;
+	uartConfig.dataBits = settings->dataBits;
+	uartConfig.parity = settings->parity;
+	uartConfig.stopBits = settings->stopBits;
+	uartConfig.flowControl = settings->flowControl;
+	port->uartFd = UART_Open(config->uartId, &uartConfig);
+	if (port->uartFd < 0) {
+		Log_Debug("ERROR: Could not open %s: %s (%d).\n", config->name, strerror(errno), errno);
+		return -1;
+	}
+	port->lineSettings = *settings;
+
+	uint32_t events = EPOLLIN | (port->isWaitingForWritable ? EPOLLOUT : 0);
+	if (RegisterEventHandlerToEpoll(epollFd, port->uartFd, &port->uartEventData, events) != 0) {
+		return -1;
+	}
+
+	if (port->directionGpio.gpioFd >= 0) {
+		// Start bit, data bits, optional parity bit and stop bits.
+		uint32_t bitsPerCharacter = 1u + settings->dataBits +
+			(settings->parity == UART_Parity_None ? 0u : 1u) + settings->stopBits;
+		Rs485Direction_Close(&port->direction);
+		if (Rs485Direction_Init(&port->direction, epollFd, port->uartFd, settings->baudRate,
+			bitsPerCharacter, &Rs485Direction_SetGpio, &port->directionGpio) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/// <summary>
+///     Set up a port's framer. An idle gap of zero is derived from the baud rate.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitFramer(SerialPort *port, const SerialFramerConfig *config, uint32_t baudRate)
+{
+	SerialFramerConfig framing = *config;
+	if (framing.mode == SerialFramingMode_IdleGap && framing.idleGapMicroseconds == 0) {
+		framing.idleGapMicroseconds = SerialFramer_GetIdleGapForBaudRate(baudRate);
+	}
+	return SerialFramer_Init(&port->framer, &framing, &PortFrameHandler, port, epollFd);
+}
+
+/// <summary>
+///     Open a port's peripherals and set up its event handler.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenPort(SerialPort *port)
+{
+	const USISerialPortConfig *config = port->config;
+
+	if (InitFramer(port, &config->framing, config->baudRate) != 0) {
+		return -1;
+	}
+
+	TxQueue_Init(&port->txQueue, config->txQueueLimit);
+	port->isWaitingForWritable = false;
+	port->frameHandler = NULL;
+	port->bridgeDataHandler = NULL;
+	port->bridgeTxReadyHandler = NULL;
+	port->uartEventData.eventHandler = &PortEventHandler;
+
+	// Open RS485 direction GPIO as output, with the receiver enabled.
+	if (config->rs485DirectionGpio != USI_SERIAL_NO_GPIO) {
+		port->directionGpio.transmitIsHigh = config->rs485TransmitIsHigh;
+		port->directionGpio.gpioFd = GPIO_OpenAsOutput(config->rs485DirectionGpio,
+			GPIO_OutputMode_PushPull, config->rs485TransmitIsHigh ? GPIO_Value_Low : GPIO_Value_High);
+		if (port->directionGpio.gpioFd < 0) {
+			Log_Debug("ERROR: Could not open %s RS485 direction GPIO: %s (%d).\n", config->name,
+				strerror(errno), errno);
+			return -1;
+		}
+	}
+
+	USISerialLineSettings settings;
+	GetConfiguredLineSettings(config, &settings);
+	return OpenUart(port, &settings);
+}
+
+/// <summary>
+///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitPeripheralsAndHandlers(void)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(struct sigaction));
+	action.sa_handler = TerminationHandler;
+	sigaction(SIGTERM, &action, NULL);
+
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		ports[i].config = &portConfigs[i];
+		ports[i].uartFd = -1;
+		ports[i].directionGpio.gpioFd = -1;
+		ports[i].direction.releaseTimerEventData.fd = -1;
+		ports[i].framer.idleTimerEventData.fd = -1;
+	}
+
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		if (OpenPort(&ports[i]) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/// <summary>
+///     Close peripherals and handlers.
+/// </summary>
+static void ClosePeripheralsAndHandlers(void)
+{
+	Log_Debug("Closing file descriptors.\n");
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		CloseFdAndPrintError(ports[i].uartFd, ports[i].config->name);
+		Rs485Direction_Close(&ports[i].direction);
+		CloseFdAndPrintError(ports[i].directionGpio.gpioFd, "RS485Direction");
+		SerialFramer_Close(&ports[i].framer);
+		TxQueue_Clear(&ports[i].txQueue);
+		ports[i].uartFd = -1;
+		ports[i].directionGpio.gpioFd = -1;
+	}
+}
+
+int USISerial_Init(int usiserial_epollFd, sig_atomic_t usiserial_terminationRequired) {
+	Log_Debug("INFO: USI serial ports starting.\n");
+
+	terminationRequired = usiserial_terminationRequired;
+	epollFd = usiserial_epollFd;
+
+	if (InitPeripheralsAndHandlers() != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+void USISerial_Deinit(void) {
+	ClosePeripheralsAndHandlers();
+}
+
+int USISerial_SendFromCloud(const char *dataToSend) {
+	if (dataToSend == NULL) {
+		return -1;
+	}
+
+	int result = 0;
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		if (ports[i].uartFd >= 0 && ports[i].frameHandler == NULL &&
+			ports[i].bridgeDataHandler == NULL &&
+			(ports[i].config->routes & USISerialRoute_FromCloud) != 0) {
+			if (SendSerialMessage(&ports[i], dataToSend, strlen(dataToSend)) != 0) {
+				result = -1;
+			}
+		}
+	}
+	return result;
+}
+
+int USISerial_AttachFrameHandler(const char *portName, const SerialFramerConfig *framing,
+	SerialFrameHandler handler, void *context) {
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		if (ports[i].uartFd >= 0 && strcmp(ports[i].config->name, portName) == 0) {
+			if (framing != NULL) {
+				SerialFramer_Close(&ports[i].framer);
+				if (InitFramer(&ports[i], framing, ports[i].lineSettings.baudRate) != 0) {
+					return -1;
+				}
+			}
+			ports[i].frameHandler = handler;
+			ports[i].frameHandlerContext = context;
+			return (int)i;
+		}
+	}
+
+	Log_Debug("ERROR: Serial port %s is not open.\n", portName);
+	return -1;
+}
+
+void USISerial_DetachFrameHandler(int portIndex) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT) {
+		return;
+	}
+
+	SerialPort *port = &ports[portIndex];
+	port->frameHandler = NULL;
+	port->frameHandlerContext = NULL;
+	if (port->uartFd >= 0) {
+		SerialFramer_Close(&port->framer);
+		if (InitFramer(port, &port->config->framing, port->lineSettings.baudRate) != 0) {
+			terminationRequired = true;
+		}
+	}
+}
+
+int USISerial_Send(int portIndex, const void *data, size_t length) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT || ports[portIndex].uartFd < 0) {
+		return -1;
+	}
+	if (ports[portIndex].bridgeDataHandler != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	return SendSerialMessage(&ports[portIndex], data, length);
+}
+
+int USISerial_GetTxStats(const char *portName, TxQueueStats *stats) {
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		if (strcmp(ports[i].config->name, portName) == 0) {
+			*stats = ports[i].txQueue.stats;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int USISerial_OpenBridge(const char *portName, USISerialDataHandler dataHandler,
+	USISerialTxReadyHandler txReadyHandler, void *context) {
+	for (size_t i = 0; i < PORT_COUNT; ++i) {
+		if (ports[i].uartFd >= 0 && strcmp(ports[i].config->name, portName) == 0) {
+			if (ports[i].bridgeDataHandler != NULL) {
+				Log_Debug("ERROR: Serial port %s is already bridged.\n", portName);
+				return -1;
+			}
+			ports[i].bridgeDataHandler = dataHandler;
+			ports[i].bridgeTxReadyHandler = txReadyHandler;
+			ports[i].bridgeContext = context;
+			Log_Debug("INFO: Serial port %s is bridged.\n", portName);
+			return (int)i;
+		}
+	}
+
+	Log_Debug("ERROR: Serial port %s is not open.\n", portName);
+	return -1;
+}
+
+void USISerial_CloseBridge(int portIndex) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT) {
+		return;
+	}
+
+	SerialPort *port = &ports[portIndex];
+	port->bridgeDataHandler = NULL;
+	port->bridgeTxReadyHandler = NULL;
+	port->bridgeContext = NULL;
+
+	const USISerialPortConfig *config = port->config;
+	USISerialLineSettings settings;
+	GetConfiguredLineSettings(config, &settings);
+	const USISerialLineSettings *current = &port->lineSettings;
+	bool isChanged = settings.baudRate != current->baudRate ||
+		settings.dataBits != current->dataBits || settings.parity != current->parity ||
+		settings.stopBits != current->stopBits || settings.flowControl != current->flowControl;
+	if (isChanged && port->uartFd >= 0 &&
+		USISerial_SetLineSettings(portIndex, &settings) != 0) {
+		terminationRequired = true;
+	}
+	Log_Debug("INFO: Serial port %s is no longer bridged.\n", config->name);
+}
+
+int USISerial_BridgeSend(int portIndex, const void *data, size_t length) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT || ports[portIndex].uartFd < 0) {
+		return -1;
+	}
+
+	SerialPort *port = &ports[portIndex];
+	if (TxQueue_Enqueue(&port->txQueue, data, length) != 0) {
+		return -1;
+	}
+	if (DrainTxQueue(port) != 0) {
+		terminationRequired = true;
+		return -1;
+	}
+	return 0;
+}
+
+size_t USISerial_GetTxFreeBytes(int portIndex) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT || ports[portIndex].uartFd < 0 ||
+		TxQueue_IsThrottled(&ports[portIndex].txQueue)) {
+		return 0;
+	}
+	return TxQueue_GetFreeBytes(&ports[portIndex].txQueue);
+}
+
+int USISerial_SetLineSettings(int portIndex, const USISerialLineSettings *settings) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT) {
+		return -1;
+	}
+
+	SerialPort *port = &ports[portIndex];
+	USISerialLineSettings previous = port->lineSettings;
+	if (OpenUart(port, settings) == 0) {
+		Log_Debug("INFO: Serial port %s set to %u baud, %u data bits, parity %u, %u stop bits, "
+			"flow control %u.\n", port->config->name, (unsigned)settings->baudRate,
+			(unsigned)settings->dataBits, (unsigned)settings->parity, (unsigned)settings->stopBits,
+			(unsigned)settings->flowControl);
+		return 0;
+	}
+
+	if (OpenUart(port, &previous) != 0) {
+		Log_Debug("ERROR: Could not restore the settings of %s.\n", port->config->name);
+	}
+	return -1;
+}
+
+int USISerial_GetLineSettings(int portIndex, USISerialLineSettings *settings) {
+	if (portIndex < 0 || (size_t)portIndex >= PORT_COUNT) {
+		return -1;
+	}
+	*settings = ports[portIndex].lineSettings;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "common.h"
+#include "usi_azureiot.h"
+#include "serial_framer.h"
+#include "tx_queue.h"
+#include "rs485_direction.h"
+
+extern volatile sig_atomic_t terminationRequired;
+extern int epollFd;
+
+/// <summary>
+///     Value of <see cref="USISerialPortConfig.rs485DirectionGpio" /> for a port which has no
+///     RS485 direction control.
+/// </summary>
+#define USI_SERIAL_NO_GPIO (-1)
+
+/// <summary>
+///     Where data to and from a serial port is routed.
+/// </summary>
+typedef enum {
+	/// <summary>Frames received from the port are reported to Azure IoT.</summary>
+	USISerialRoute_ToCloud = 1 << 0,
+	/// <summary>Messages from the Azure IoT device twin are sent to the port.</summary>
+	USISerialRoute_FromCloud = 1 << 1
+} USISerialRoute;
+
+/// <summary>
+///     Configuration of one serial port. Adding a port is a matter of adding an entry to the port
+///     table in usi_serial.c and its UART (and GPIO) to app_manifest.json.
+/// </summary>
+typedef struct {
+	/// <summary>Name of the port, used in log messages.</summary>
+	const char *name;
+	/// <summary>The UART.</summary>
+	UART_Id uartId;
+	/// <summary>Baud rate.</summary>
+	UART_BaudRate_Type baudRate;
+	/// <summary>Parity.</summary>
+	UART_Parity_Type parity;
+	/// <summary>Flow control.</summary>
+	UART_FlowControl_Type flowControl;
+	/// <summary>How received data is split into frames. An idle gap of zero is replaced by the
+	/// Modbus RTU gap for the baud rate.</summary>
+	SerialFramerConfig framing;
+	/// <summary>GPIO which drives the RS485 transceiver's direction, or
+	/// USI_SERIAL_NO_GPIO.</summary>
+	GPIO_Id rs485DirectionGpio;
+	/// <summary>Whether the RS485 direction GPIO is high to transmit.</summary>
+	bool rs485TransmitIsHigh;
+	/// <summary>Bitwise OR of <see cref="USISerialRoute" /> values.</summary>
+	uint32_t routes;
+	/// <summary>Device twin property which received frames are reported as.</summary>
+	const char *cloudPropertyName;
+	/// <summary>Largest number of bytes which may wait to be transmitted.</summary>
+	size_t txQueueLimit;
+} USISerialPortConfig;
+
+/// <summary>
+///     Line settings of a serial port. A port opens with those of its configuration, 8 data bits
+///     and 1 stop bit; a bridge client may change them while it owns the port.
+/// </summary>
+typedef struct {
+	/// <summary>Baud rate.</summary>
+	UART_BaudRate_Type baudRate;
+	/// <summary>Data bits.</summary>
+	UART_DataBits_Type dataBits;
+	/// <summary>Parity.</summary>
+	UART_Parity_Type parity;
+	/// <summary>Stop bits.</summary>
+	UART_StopBits_Type stopBits;
+	/// <summary>Flow control.</summary>
+	UART_FlowControl_Type flowControl;
+} USISerialLineSettings;
+
+/// <summary>
+///     Function signature for handlers of the raw bytes received by a bridged port.
+/// </summary>
+typedef void (*USISerialDataHandler)(const uint8_t *data, size_t length, void *context);
+
+/// <summary>
+///     Function signature for handlers which are told that a bridged port's transmit queue has
+///     been written and accepts data again.
+/// </summary>
+typedef void (*USISerialTxReadyHandler)(void *context);
+
+int USISerial_Init(int usiserial_epollFd, sig_atomic_t usiserial_terminationRequired);
+void USISerial_Deinit(void);
+int USISerial_SendFromCloud(const char *dataToSend);
+int USISerial_GetTxStats(const char *portName, TxQueueStats *stats);
+
+/// <summary>
+///     Hands every frame received from a port to a handler instead of the port's routes. The port
+///     then no longer receives messages from the cloud; only the handler's owner writes to it.
+/// </summary>
+/// <param name="portName">Name of the port</param>
+/// <param name="framing">How the handler's frames are found, replacing the port's framing; an
+/// idle gap of zero is derived from the baud rate. NULL keeps the port's framing.</param>
+/// <param name="handler">Function which is called with each received frame</param>
+/// <param name="context">Context which is passed to the handler</param>
+/// <returns>Index of the port, for <see cref="USISerial_Send" />, or -1 if it is not open</returns>
+int USISerial_AttachFrameHandler(const char *portName, const SerialFramerConfig *framing,
+	SerialFrameHandler handler, void *context);
+
+/// <summary>
+///     Returns a port's frames to its routes and restores its own framing, undoing
+///     <see cref="USISerial_AttachFrameHandler" />.
+/// </summary>
+/// <param name="portIndex">Index returned by USISerial_AttachFrameHandler</param>
+void USISerial_DetachFrameHandler(int portIndex);
+
+/// <summary>
+///     Queues binary data for transmission on a port.
+/// </summary>
+/// <param name="portIndex">Index returned by <see cref="USISerial_AttachFrameHandler" /></param>
+/// <param name="data">The data</param>
+/// <param name="length">Length of the data</param>
+/// <returns>0 on success, or -1 if the data was rejected or could not be written</returns>
+int USISerial_Send(int portIndex, const void *data, size_t length);
+
+/// <summary>
+///     Gives a port to a bridge. Received bytes are handed to the data handler as they arrive,
+///     without framing or logging, and only <see cref="USISerial_BridgeSend" /> writes to the
+///     port; its routes and frame handler are suspended until <see cref="USISerial_CloseBridge" />.
+/// </summary>
+/// <param name="portName">Name of the port</param>
+/// <param name="dataHandler">Function which is called with the bytes received from the port</param>
+/// <param name="txReadyHandler">Function which is called when queued data has been written and
+/// the port accepts data again</param>
+/// <param name="context">Context which is passed to the handlers</param>
+/// <returns>Index of the port, or -1 if it is not open or is already bridged</returns>
+int USISerial_OpenBridge(const char *portName, USISerialDataHandler dataHandler,
+	USISerialTxReadyHandler txReadyHandler, void *context);
+
+/// <summary>
+///     Returns a bridged port to its routes and frame handler, and restores the line settings of
+///     its configuration.
+/// </summary>
+/// <param name="portIndex">Index returned by <see cref="USISerial_OpenBridge" /></param>
+void USISerial_CloseBridge(int portIndex);
+
+/// <summary>
+///     Queues bytes for transmission on a bridged port.
+/// </summary>
+/// <param name="portIndex">Index returned by <see cref="USISerial_OpenBridge" /></param>
+/// <param name="data">The data</param>
+/// <param name="length">Length of the data; at most <see cref="USISerial_GetTxFreeBytes" /></param>
+/// <returns>0 on success, or -1 if the data was rejected or could not be written</returns>
+int USISerial_BridgeSend(int portIndex, const void *data, size_t length);
+
+/// <summary>
+///     Gets the number of bytes which a port's transmit queue accepts now.
+/// </summary>
+/// <param name="portIndex">Index of the port</param>
+/// <returns>The number of free bytes; 0 if the queue is throttled or the port is not open</returns>
+size_t USISerial_GetTxFreeBytes(int portIndex);
+
+/// <summary>
+///     Reopens a port's UART with new line settings. If the UART does not accept them, the
+///     previous settings are restored.
+/// </summary>
+/// <param name="portIndex">Index of the port</param>
+/// <param name="settings">The new line settings</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int USISerial_SetLineSettings(int portIndex, const USISerialLineSettings *settings);
+
+/// <summary>
+///     Gets a port's current line settings.
+/// </summary>
+/// <param name="portIndex">Index of the port</param>
+/// <param name="settings">Receives the line settings</param>
+/// <returns>0 on success, or -1 if the index is not valid</returns>
+int USISerial_GetLineSettings(int portIndex, USISerialLineSettings *settings);
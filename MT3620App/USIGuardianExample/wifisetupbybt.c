@@ -25,7 +25,6 @@
 // - wificonfig (configure Wi-Fi settings)
 
 // File descriptors - initialized to invalid value
-static int buttonTimerFd = -1;
 static int bleAdvertiseToBondedDevicesLedGpioFd = -1;
 static int bleAdvertiseToAllDevicesLedGpioFd = -1;
 static int bleConnectedLedGpioFd = -1;
@@ -35,42 +34,11 @@ static int bleDeviceResetPinGpioFd = -1;
 static struct timespec bleAdvertiseToAllTimeoutPeriod = { 60u, 0 };
 static GPIO_Value_Type deviceControlLedState = GPIO_Value_High;
 
-/// <summary>
-///     Button events.
-/// </summary>
-typedef enum {
-	/// <summary>The event when failing to get button state.</summary>
-	ButtonEvent_Error = -1,
-	/// <summary>No button event has occurred.</summary>
-	ButtonEvent_None = 0,
-	/// <summary>The event when button is pressed.</summary>
-	ButtonEvent_Pressed,
-	/// <summary>The event when button is released.</summary>
-	ButtonEvent_Released,
-	/// <summary>The event when button is being held.</summary>
-	ButtonEvent_Held,
-	/// <summary>The event when button is released after being held.</summary>
-	ButtonEvent_ReleasedAfterHeld
-} ButtonEvent;
-
-/// <summary>
-///     Data structure for the button state.
-/// </summary>
-typedef struct {
-	/// <summary>File descriptor for the button.</summary>
-	int fd;
-	/// <summary>Whether the button is currently pressed.</summary>
-	bool isPressed;
-	/// <summary>Whether the button is currently held.</summary>
-	bool isHeld;
-	/// <summary>The time stamp when the button-press happened.</summary>
-	struct timespec pressedTime;
-} ButtonState;
-
-// Button-related variables
-static const time_t buttonHeldThresholdTimeInSeconds = 3L;
-static ButtonState button1State = { .fd = -1,.isPressed = false,.isHeld = false };
-static ButtonState button2State = { .fd = -1,.isPressed = false,.isHeld = false };
+// Buttons, reported by the button engine.
+static void Button1EventHandler(Button *button, ButtonEvent event);
+static void Button2EventHandler(Button *button, ButtonEvent event);
+static Button button1 = { .fd = -1,.eventHandler = &Button1EventHandler };
+static Button button2 = { .fd = -1,.eventHandler = &Button2EventHandler };
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -81,47 +49,6 @@ static void TerminationHandler(int signalNumber)
 	terminationRequired = true;
 }
 
-ButtonEvent GetButtonEvent(ButtonState *state)
-{
-	ButtonEvent event = ButtonEvent_None;
-	GPIO_Value_Type newInputValue;
-	int result = GPIO_GetValue(state->fd, &newInputValue);
-	if (result != 0) {
-		Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-		return ButtonEvent_Error;
-	}
-	if (state->isPressed) {
-		if (newInputValue == GPIO_Value_High) {
-			// Button has just been released, so set event based on whether button has been held and
-			// then reset flags.
-			event = state->isHeld ? ButtonEvent_ReleasedAfterHeld : ButtonEvent_Released;
-			state->isHeld = false;
-			state->isPressed = false;
-		}
-		if (newInputValue == GPIO_Value_Low && !state->isHeld) {
-			// Button has been pressed and hasn't been released yet. As it hasn't been classified as
-			// held, compare the elapsed time to determine whether the button has been held long
-			// enough to be regarded as 'Held'.
-			struct timespec currentTime;
-			clock_gettime(CLOCK_REALTIME, &currentTime);
-			long elapsedSeconds = currentTime.tv_sec - state->pressedTime.tv_sec;
-			state->isHeld = (elapsedSeconds > buttonHeldThresholdTimeInSeconds ||
-				(elapsedSeconds == buttonHeldThresholdTimeInSeconds &&
-					currentTime.tv_nsec >= state->pressedTime.tv_nsec));
-			if (state->isHeld) {
-				event = ButtonEvent_Held;
-			}
-		}
-	}
-	else if (newInputValue == GPIO_Value_Low) {
-		// Button has just been pressed, set isPressed flag and mark current time.
-		state->isPressed = true;
-		clock_gettime(CLOCK_REALTIME, &state->pressedTime);
-		event = ButtonEvent_Pressed;
-	}
-	return event;
-}
-
 static void UpdateBleLedStatus(BleControlMessageProtocolState state)
 {
 	GPIO_SetValue(bleAdvertiseToBondedDevicesLedGpioFd,
@@ -198,23 +125,17 @@ static bool GetDeviceControlLedStatusHandler(void)
 }
 
 /// <summary>
-///     Handle button timer event and take defined actions as printed when the application started.
+///     Handle USI_BUTTON_1 events: a brief press allows new BLE bonds, and holding the button
+///     deletes all BLE bonds.
 /// </summary>
-/// <param name="eventData">Context data for handled event.</param>
-static void ButtonTimerEventHandler(EventData *eventData)
+/// <param name="button">The button which generated the event.</param>
+/// <param name="event">The debounced button event.</param>
+static void Button1EventHandler(Button *button, ButtonEvent event)
 {
-	if (ConsumeTimerFdEvent(buttonTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
-	// Take actions based on button events.
-	ButtonEvent button1Event = GetButtonEvent(&button1State);
-	if (button1Event == ButtonEvent_Error) {
+	if (event == ButtonEvent_Error) {
 		terminationRequired = true;
-		return;
 	}
-	else if (button1Event == ButtonEvent_Released) {
+	else if (event == ButtonEvent_Released) {
 		// SAMPLE_BUTTON_1 has just been released without being held, start BLE advertising to all
 		// devices.
 		Log_Debug("INFO: SAMPLE_BUTTON_1 was pressed briefly, allowing new BLE bonds...\n");
@@ -222,7 +143,7 @@ static void ButtonTimerEventHandler(EventData *eventData)
 			Log_Debug("ERROR: Unable to allow new BLE bonds, check nRF52 is connected.\n");
 		}
 	}
-	else if (button1Event == ButtonEvent_Held) {
+	else if (event == ButtonEvent_Held) {
 		// When SAMPLE_BUTTON_1 is held, delete all bonded BLE devices.
 		Log_Debug("INFO: SAMPLE_BUTTON_1 is held; deleting all BLE bonds...\n");
 		if (BleControlMessageProtocol_DeleteAllBondedDevices() != 0) {
@@ -233,21 +154,27 @@ static void ButtonTimerEventHandler(EventData *eventData)
 		}
 	}
 	// No actions are defined for other events.
+}
 
-	// Take actions based on SAMPLE_BUTTON_2 events.
-	ButtonEvent button2Event = GetButtonEvent(&button2State);
-	if (button2Event == ButtonEvent_Error) {
+/// <summary>
+///     Handle USI_BUTTON_2 events: a brief press toggles the device control LED, and holding the
+///     button forgets all stored Wi-Fi networks.
+/// </summary>
+/// <param name="button">The button which generated the event.</param>
+/// <param name="event">The debounced button event.</param>
+static void Button2EventHandler(Button *button, ButtonEvent event)
+{
+	if (event == ButtonEvent_Error) {
 		terminationRequired = true;
-		return;
 	}
-	else if (button2Event == ButtonEvent_Released) {
+	else if (event == ButtonEvent_Released) {
 		Log_Debug("INFO: SAMPLE_BUTTON_2 was pressed briefly; toggling SAMPLE_LED.\n");
 		deviceControlLedState =
 			(deviceControlLedState == GPIO_Value_Low ? GPIO_Value_High : GPIO_Value_Low);
 		GPIO_SetValue(deviceControlLedGpioFd, deviceControlLedState);
 		DeviceControlMessageProtocol_NotifyLedStatusChange();
 	}
-	else if (button2Event == ButtonEvent_Held) {
+	else if (event == ButtonEvent_Held) {
 		// Forget all stored Wi-Fi networks
 		Log_Debug("INFO: SAMPLE_BUTTON_2 is held; forgetting all stored Wi-Fi networks...\n");
 		if (WifiConfig_ForgetAllNetworks() != 0) {
@@ -261,9 +188,6 @@ static void ButtonTimerEventHandler(EventData *eventData)
 	// No actions are defined for other events.
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonsEventData = { .eventHandler = &ButtonTimerEventHandler };
-
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
 /// </summary>
@@ -302,23 +226,20 @@ static int InitPeripheralsAndHandlers(void) {
 		GetDeviceControlLedStatusHandler);
 
 	Log_Debug("Opening SAMPLE_BUTTON_1 as input\n");
-	button1State.fd = GPIO_OpenAsInput(USI_BUTTON_1);
-	if (button1State.fd < 0) {
+	button1.fd = GPIO_OpenAsInput(USI_BUTTON_1);
+	if (button1.fd < 0) {
 		Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1 GPIO: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
 
 	Log_Debug("Opening SAMPLE_BUTTON_2 as input.\n");
-	button2State.fd = GPIO_OpenAsInput(USI_BUTTON_2);
-	if (button2State.fd < 0) {
+	button2.fd = GPIO_OpenAsInput(USI_BUTTON_2);
+	if (button2.fd < 0) {
 		Log_Debug("ERROR: Could not open SAMPLE_BUTTON_2 GPIO: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
 
-	struct timespec buttonStatusCheckPeriod = { 0, 1000000 };
-	buttonTimerFd =
-		CreateTimerFdAndAddToEpoll(epollFd, &buttonStatusCheckPeriod, &buttonsEventData, EPOLLIN);
-	if (buttonTimerFd < 0) {
+	if (ButtonEngine_Register(&button1) != 0 || ButtonEngine_Register(&button2) != 0) {
 		return -1;
 	}
 
@@ -387,9 +308,10 @@ static void ClosePeripheralsAndHandlers(void)
 	}
 
 	Log_Debug("Closing file descriptors\n");
-	CloseFdAndPrintError(buttonTimerFd, "ButtonTimer");
-	CloseFdAndPrintError(button1State.fd, "Button1");
-	CloseFdAndPrintError(button2State.fd, "Button2");
+	ButtonEngine_Unregister(&button1);
+	ButtonEngine_Unregister(&button2);
+	CloseFdAndPrintError(button1.fd, "Button1");
+	CloseFdAndPrintError(button2.fd, "Button2");
 	CloseFdAndPrintError(bleDeviceResetPinGpioFd, "BleDeviceResetPin");
 	CloseFdAndPrintError(bleAdvertiseToBondedDevicesLedGpioFd, "BleAdvertiseToBondedDevicesLed");
 	CloseFdAndPrintError(bleAdvertiseToAllDevicesLedGpioFd, "BleAdvertiseToAllDevicesLed");
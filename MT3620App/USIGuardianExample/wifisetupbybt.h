@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "button_engine.h"
 #include "message_protocol.h"
 #include "blecontrol_message_protocol.h"
 #include "wificonfig_message_protocol.h"